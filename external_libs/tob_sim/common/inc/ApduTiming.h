@@ -0,0 +1,85 @@
+/*
+ *
+ * Twilio Breakout Trust Onboard SDK
+ *
+ * Copyright (c) 2019 Twilio, Inc.
+ *
+ * SPDX-License-Identifier:  Apache-2.0
+ */
+
+#ifndef __APDU_TIMING_H__
+#define __APDU_TIMING_H__
+
+#include <stdint.h>
+#include <time.h>
+
+// Where the time of one exchange with the transport went. Times are in microseconds from the moment the exchange
+// started, 0 for the marks the transport does not record.
+typedef struct {
+  // Command handed over to the link; with LSerial, the UART finished sending it
+  uint32_t write_us;
+  // First and last byte of the answer received, whatever the modem sent in between (echo, URCs) included
+  uint32_t first_byte_us;
+  uint32_t last_byte_us;
+  // Whole exchange as seen by the caller, always recorded
+  uint32_t total_us;
+  // Bytes on the link in each direction, AT command and response framing included
+  uint32_t bytes_out;
+  uint32_t bytes_in;
+} se_apdu_timing_t;
+
+#ifdef __cplusplus
+
+// Collects an se_apdu_timing_t while an exchange runs. The marks do nothing unless a record is being collected, so
+// transports may call them unconditionally.
+class ApduTimer {
+ public:
+  void begin(se_apdu_timing_t* record) {
+    *record = se_apdu_timing_t();
+    clock_gettime(CLOCK_MONOTONIC, &_start);
+    _record = record;
+  }
+
+  void end(void) {
+    if (_record != nullptr) {
+      _record->total_us = elapsed();
+      _record           = nullptr;
+    }
+  }
+
+  bool active(void) const {
+    return _record != nullptr;
+  }
+
+  void sent(unsigned long int bytes) {
+    if (_record != nullptr) {
+      _record->write_us = elapsed();
+      _record->bytes_out += bytes;
+    }
+  }
+
+  void received(unsigned long int bytes) {
+    if ((_record != nullptr) && (bytes > 0)) {
+      _record->last_byte_us = elapsed();
+      if (_record->bytes_in == 0) {
+        _record->first_byte_us = _record->last_byte_us;
+      }
+      _record->bytes_in += bytes;
+    }
+  }
+
+ private:
+  uint32_t elapsed(void) const {
+    struct timespec now;
+
+    clock_gettime(CLOCK_MONOTONIC, &now);
+    return (uint32_t)((now.tv_sec - _start.tv_sec) * 1000000L + (now.tv_nsec - _start.tv_nsec) / 1000L);
+  }
+
+  se_apdu_timing_t* _record = nullptr;
+  struct timespec _start    = {0, 0};
+};
+
+#endif /* __cplusplus */
+
+#endif /* __APDU_TIMING_H__ */
@@ -30,7 +30,8 @@ class Applet {
   // Returns true in case applet is selected, false otherwise.
   bool isSelected(void);
 
-  // Select the applet using basic or logical channel.
+  // Select the applet using basic or logical channel. A logical channel is opened by the SE interface when it
+  // manages channels itself, with MANAGE CHANNEL otherwise.
   // Returns true in case select was successful, false otherwise.
   bool select(bool isBasic = true);
 
@@ -64,6 +65,11 @@ class Applet {
   // Returns true in case transmit was successful, false otherwise.
   bool transmit(uint8_t cla, SCIns ins, SCP1 p1, SCP2 p2, const uint8_t* data, uint16_t dataLen, uint8_t le);
 
+  // Read size bytes of the EF selected through the corresponding channel
+  // from offset, chunk bytes per READ BINARY.
+  // Returns true in case every byte was read, false otherwise.
+  bool readBinary(uint16_t offset, uint16_t size, uint8_t chunk, uint8_t* data);
+
   // Returns the status word received after the last successful transmit,
   // 0 otherwise.
   uint16_t getStatusWord(void);
@@ -81,6 +87,7 @@ class Applet {
   uint8_t _channel;       // channel value
   bool _isSelected;       // flag to indicate if the applet is currently selected.
   bool _isBasic;          // flag to indicate if the applet has been selected through basic channel.
+  bool _isManaged;        // flag to indicate if the logical channel is managed by the SE interface.
   uint8_t* _aid;          // Applet's AID
   uint16_t _aidLen;       // Applet's AID length
 };
@@ -0,0 +1,33 @@
+/*
+ *
+ * Twilio Breakout Trust Onboard SDK
+ *
+ * Copyright (c) 2019 Twilio, Inc.
+ *
+ * SPDX-License-Identifier:  Apache-2.0
+ */
+
+#ifndef __ATR_H__
+#define __ATR_H__
+
+#include <stdbool.h>
+#include <stddef.h>
+#include <stdint.h>
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+// Locate the historical bytes of an ATR (ISO/IEC 7816-3), past TS, T0 and the interface bytes.
+// Returns false in case atr is not an ATR or is cut short.
+bool tob_atr_historical_bytes(const uint8_t* atr, size_t len, const uint8_t** historical, size_t* historicalLen);
+
+// Whether the card capabilities among the historical bytes (ISO/IEC 7816-4 compact-TLV tag 7, third software
+// function table) announce extended Lc and Le fields
+bool tob_atr_extended_length(const uint8_t* atr, size_t len);
+
+#ifdef __cplusplus
+}
+#endif
+
+#endif /* __ATR_H__ */
@@ -0,0 +1,38 @@
+/*
+ *
+ * Twilio Breakout Trust Onboard SDK
+ *
+ * Copyright (c) 2019 Twilio, Inc.
+ *
+ * SPDX-License-Identifier:  Apache-2.0
+ */
+
+#ifndef __HEX_CODEC_H__
+#define __HEX_CODEC_H__
+
+#include <stdbool.h>
+#include <stddef.h>
+#include <stdint.h>
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+// Encode len bytes as 2 * len upper case hex characters. No terminating zero is written.
+// Uses SSE2 or NEON when the target has them.
+void tob_hex_encode(const uint8_t* bytes, size_t len, char* hex);
+
+// Decode hexLen hex characters of either case into hexLen / 2 bytes.
+// Returns false if hexLen is odd or any character is not a hex digit, the content of bytes is unspecified then.
+// Uses SSE2 or NEON when the target has them.
+bool tob_hex_decode(const char* hex, size_t hexLen, uint8_t* bytes);
+
+// Portable implementations, also used for the tails shorter than a vector.
+void tob_hex_encode_scalar(const uint8_t* bytes, size_t len, char* hex);
+bool tob_hex_decode_scalar(const char* hex, size_t hexLen, uint8_t* bytes);
+
+#ifdef __cplusplus
+}
+#endif
+
+#endif /* __HEX_CODEC_H__ */
@@ -100,6 +100,17 @@ enum class SCSW1 : uint16_t {
 
 enum class SCSW2 : uint8_t { OKNoQualification = 0x00 };
 
+/* Logical channel coded into CLA as per ISO/IEC 7816-4: 0 to 3 in the two low bits of the first interindustry
+ * classes, 4 to 19 as 4 plus the four low bits of the further ones, which have bit 6 set. Command chaining (bit 4) and
+ * proprietary classes (bit 7) are kept, secure messaging is not. */
+static inline uint8_t claWithChannel(uint8_t cla, uint8_t channel) {
+  return (channel < 4) ? (cla | channel) : ((cla & 0x90) | 0x40 | (channel - 4));
+}
+
+static inline uint8_t claChannel(uint8_t cla) {
+  return (cla & 0x40) ? 4 + (cla & 0x0F) : (cla & 0x03);
+}
+
 /* Common operators to keep casting directive proliferation under control */
 static inline SCIns operator|(SCIns ins, uint8_t channel) {
   return static_cast<SCIns>(static_cast<uint8_t>(ins) | channel);
@@ -55,6 +55,9 @@
 
 #define ALGO_RSA_PKCS1_PADDING 0x1A
 
+// Longest signature or plain text, that of an RSA-4096 key
+#define MIAS_RSA_MAX_LEN 512
+
 /*** KEY PAIR INFO ***********************************************************/
 
 #define RSA_KEY_PAIR_FLAG (1 << 0)
@@ -133,7 +136,7 @@ class MIAS : public Applet {
 
   // Compute signature
   // Hash parameter is a buffer which contain data to encrypt using key to compute signature.
-  // Signature parameter is a buffer which will contain the resulted signature.
+  // Signature parameter is a buffer of MIAS_RSA_MAX_LEN bytes which will contain the resulted signature.
   // Returns true in case signing was successful, false otherwise.
   bool signFinal(const uint8_t* hash, uint16_t hashLen, uint8_t* signature, uint16_t* signatureLen);
 
@@ -143,7 +146,7 @@ class MIAS : public Applet {
   // Returns true in case preparing context was successful, false otherwise.
   bool decryptInit(uint8_t algorithm, uint8_t key);
 
-  // Decrypt provided data and returns the corresponding plain data.
+  // Decrypt provided data and returns the corresponding plain data, plain having room for MIAS_RSA_MAX_LEN bytes.
   // Returns true in case decrypting was successful, false otherwise.
   bool decryptFinal(const uint8_t* data, uint16_t dataLen, uint8_t* plain, uint16_t* plainLen);
 
@@ -168,6 +171,9 @@ class MIAS : public Applet {
   uint8_t _decryptKey;
 
 
+  // READ BINARY size for objects, as tuned for the transport
+  uint8_t readChunk(void);
+
   bool mseSetBeforeHash(uint8_t algorithm);
   bool psoHashInternally(uint8_t algorithm, const uint8_t* data, uint16_t dataLen);
   bool psoHashInternallyFinal(uint8_t* hash, uint16_t* hashLen);
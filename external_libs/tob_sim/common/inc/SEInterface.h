@@ -14,6 +14,7 @@
 #include <stdint.h>
 #include <string.h>
 
+#include "ApduTiming.h"
 #include "ISO7816.h"
 
 #define APDU_CLA_OFFSET 0
@@ -24,10 +25,61 @@
 #define APDU_LC_OFFSET 4
 #define APDU_DATA_OFFSET 5
 
+// Asynchronous exchanges which may be pending on an interface at once
+#ifndef SE_ASYNC_QUEUE_LEN
+#define SE_ASYNC_QUEUE_LEN 4
+#endif
+
+// Longest command data and response data of one APDU. Transports taking extended Lc and Le carry up to this much,
+// the others keep to 256.
+#ifndef SE_MAX_DATA_LEN
+#ifdef NO_OS
+#define SE_MAX_DATA_LEN 256
+#else
+#define SE_MAX_DATA_LEN 4096
+#endif
+#endif
+
+#if (SE_MAX_DATA_LEN < 256) || (SE_MAX_DATA_LEN > 65526)
+#error "SE_MAX_DATA_LEN must be between 256 and 65526, APDU lengths being 16 bits"
+#endif
+
+// Header, extended Lc, data and extended Le
+#define SE_APDU_MAX_LEN (4 + 3 + SE_MAX_DATA_LEN + 2)
+#define SE_RESPONSE_MAX_LEN (SE_MAX_DATA_LEN + 2)
+
+// Header, short Lc, data and short Le
+#define SE_SHORT_APDU_MAX_LEN (4 + 1 + 255 + 1)
+
+// Most commands one transmit sends, GET RESPONSE and resends after 6Cxx included, for a card which never stops asking
+// for more not to hold the caller forever
+#ifndef SE_CHAIN_MAX_COMMANDS
+#define SE_CHAIN_MAX_COMMANDS 32
+#endif
+
 //#define APDU_DEBUG
 
+// Bytes per command for the operations spanning several APDUs, tuned to the transport by TobCalibration. 0 leaves
+// the size each caller was written with.
+typedef struct {
+  // Le of READ BINARY
+  uint8_t read_chunk;
+  // Data of PSO HASH, rounded down to a multiple of the hash block
+  uint8_t hash_chunk;
+} se_chunking_t;
+
 #ifdef __cplusplus
 
+class SEInterface;
+
+// Completion of an APDU submitted with transmitAsync. ok tells whether the exchange went through, response holds the
+// response data followed by the status word and is only valid during the call.
+typedef void (*SECompletion)(SEInterface* seiface, bool ok, const uint8_t* response, uint16_t responseLen, void* arg);
+
+// Called after every exchange with the transport while timing is on, apdu being the command just answered
+typedef void (*SETimingHandler)(SEInterface* seiface, const uint8_t* apdu, uint16_t apduLen,
+                                const se_apdu_timing_t* timing, void* arg);
+
 class SEInterface {
  public:
   SEInterface(void);
@@ -65,6 +117,106 @@ class SEInterface {
                     le);
   }
 
+  // Transmit an APDU with extended Lc and Le (ISO/IEC 7816-4), Lc being left out for dataLen 0 and Le for le 0.
+  // Cases 3 and 4 above go through here for more than 255 bytes of data.
+  // Returns false in case the transport does not take extended lengths or dataLen or le is over SE_MAX_DATA_LEN, true
+  // in case transmit was successful.
+  bool transmitExtended(uint8_t cla, uint8_t ins, uint8_t p1, uint8_t p2, const uint8_t* data, uint16_t dataLen,
+                        uint16_t le);
+
+  // Transmit an APDU, header and body as for transmitApdu, and gather the data of every part of its response into
+  // response, the card telling with 61xx after each part but the last how long the next one is. A part following data
+  // is asked for with continuation as INS, some applets taking ENVELOPE rather than GET RESPONSE there, a lone 61xx
+  // with GET RESPONSE as transmit does. getStatusWord() holds the status word of the last part.
+  // Returns true in case the response is complete, responseLen holding its length, false in case transmit failed,
+  // the parts would not fit in size bytes or SE_CHAIN_MAX_COMMANDS did not get to the last one.
+  bool transmitChained(const uint8_t* apdu, uint16_t apduLen, uint8_t* response, uint16_t size, uint16_t* responseLen,
+                       uint8_t continuation = static_cast<uint8_t>(SCIns::GetResponse));
+
+  // Whether both the transport and the card take extended Lc and Le, for callers to size their commands
+  virtual bool supportsExtendedLength(void) {
+    return false;
+  }
+
+  // Open a logical channel with the applet identified by aid selected on it, for transports which keep track of
+  // channels themselves. The channel number to code into CLA is stored in channel.
+  // Returns true in case the channel is open, false in case opening failed or the transport leaves channels to
+  // MANAGE CHANNEL.
+  virtual bool openLogicalChannel(const uint8_t* aid, uint16_t aidLen, uint8_t* channel) {
+    return false;
+  }
+
+  // Close a channel opened by openLogicalChannel
+  // Returns true in case close was successful, false otherwise.
+  virtual bool closeLogicalChannel(uint8_t channel) {
+    return false;
+  }
+
+  // Read size bytes of the transparent EF currently selected on the channel of cla from offset into data, with one
+  // READ BINARY per chunk bytes, or per SE_MAX_DATA_LEN bytes with extended Le where supportsExtendedLength(). Cards
+  // turning the extended command down are read chunk by chunk. Transports which can send the next command before the
+  // previous response is in override it, the status word of the last READ BINARY being kept as for transmit either
+  // way.
+  // Returns true in case every chunk was read, false otherwise, readLen holding the number of bytes read.
+  virtual bool readBinary(uint8_t cla, uint16_t offset, uint16_t size, uint8_t chunk, uint8_t* data,
+                          uint16_t* readLen);
+
+  // Submit an APDU, header and body as for transmitApdu, and return right away. completion is called from
+  // processEvents() once the response arrived, 61xx and 6Cxx being handled as by transmit. Exchanges run one after
+  // the other in submission order; transmit fails while any of them is pending.
+  // Returns false in case SE_ASYNC_QUEUE_LEN exchanges are pending already, the APDU is longer than
+  // SE_SHORT_APDU_MAX_LEN or completion is nullptr.
+  bool transmitAsync(const uint8_t* apdu, uint16_t apduLen, SECompletion completion, void* arg);
+
+  // Descriptor to watch for input (poll, select or epoll) while exchanges are pending, -1 in case the transport has
+  // none: exchanges then run to completion inside transmitAsync and processEvents() can be called right away.
+  virtual int getPollFd(void) {
+    return -1;
+  }
+
+  // Milliseconds until the exchange in flight times out, to bound the wait on the descriptor, -1 if none is in flight
+  virtual int getPollTimeout(void) {
+    return -1;
+  }
+
+  // Consume whatever the transport received without blocking and run the completions of the exchanges which are
+  // done, the next queued exchange being started right away.
+  // Returns the number of completions run.
+  int processEvents(void);
+
+  // Number of exchanges submitted with transmitAsync whose completion has not run yet
+  unsigned int getPendingCount(void) {
+    return _asyncCount;
+  }
+
+  // Time every exchange transmit runs through the transport, GET RESPONSE and resends after 61xx and 6Cxx being
+  // exchanges of their own. handler, if any, gets each record as it is complete. Off by default.
+  void setTiming(bool enable, SETimingHandler handler = nullptr, void* arg = nullptr);
+
+  // Copy the record of the last timed exchange into timing
+  // Returns false in case timing is off or nothing was timed yet.
+  bool getLastTiming(se_apdu_timing_t* timing);
+
+  // Chunk sizes tuned for this transport, all 0 until set
+  void setChunking(const se_chunking_t* chunking);
+  void getChunking(se_chunking_t* chunking);
+
+  // READ BINARY and PSO HASH sizes for a caller written for fallback
+  uint8_t getReadChunk(uint8_t fallback) {
+    return (_chunking.read_chunk != 0) ? _chunking.read_chunk : fallback;
+  }
+
+  uint8_t getHashChunk(uint8_t fallback) {
+    return (_chunking.hash_chunk != 0) ? _chunking.hash_chunk : fallback;
+  }
+
+  // Hold the card for the commands that follow, up to the matching endTransaction(), so that no other client of the
+  // reader gets in between and the transport is not handed back and forth at every APDU. Calls nest, only the
+  // outermost pair reaching the transport.
+  // Returns true in case the card is held, false otherwise, endTransaction() being called either way.
+  bool beginTransaction(void);
+  void endTransaction(void);
+
   // Returns the status word received after the last successful transmit, 0 otherwise.
   uint16_t getStatusWord(void);
 
@@ -75,30 +227,134 @@ class SEInterface {
   uint16_t getResponseLength(void);
 
   // Internal buffers
-  uint8_t _apdu[5 + 256 + 1];
+  uint8_t _apdu[SE_APDU_MAX_LEN];
   uint16_t _apduLen;
-  uint8_t _apduResponse[2 + 256];
+  uint8_t _apduResponse[SE_RESPONSE_MAX_LEN];
   uint16_t _apduResponseLen;
 
  protected:
-  // Low layer implementation to transmit an APDU and retrieve the corresponding APDU Response
+  // Low layer implementation to transmit an APDU and retrieve the corresponding APDU Response, response having room
+  // for SE_RESPONSE_MAX_LEN bytes
   // Returns true in case transmit was successful, false otherwise
   virtual bool transmitApdu(uint8_t* apdu, uint16_t apduLen, uint8_t* response, uint16_t* responseLen) = 0;
 
+  // Exchange being timed, for the transport to mark
+  ApduTimer _timer;
+
+  // Transport side of beginTransaction() and endTransaction(), for transports shared with other clients
+  // Returns true in case the card is held, false otherwise.
+  virtual bool lockTransport(void) {
+    return true;
+  }
+
+  virtual void unlockTransport(void) {
+  }
+
+  // Non-blocking counterpart of transmitApdu for transports with a poll descriptor: send apdu and return, the
+  // response going to response as pollApdu collects it.
+  // Returns true in case the APDU was sent, false otherwise.
+  virtual bool startApdu(uint8_t* apdu, uint16_t apduLen, uint8_t* response) {
+    return false;
+  }
+
+  // Consume what was received for the APDU sent by startApdu without blocking, done being set once it is complete
+  // Returns false in case the exchange failed, true otherwise.
+  virtual bool pollApdu(uint16_t* responseLen, bool* done) {
+    return false;
+  }
+
  private:
+  struct AsyncRequest {
+    uint8_t apdu[SE_SHORT_APDU_MAX_LEN];
+    uint16_t apduLen;
+    SECompletion completion;
+    void* arg;
+  };
+
+  // Send the APDU of the oldest pending exchange, through transmitApdu for transports without poll descriptor
+  void startAsync(void);
+  // Rewrite the APDU in flight into the GET RESPONSE or the resend asked for by a 61xx or 6Cxx response
+  // Returns true in case the exchange goes on, false in case the response is final.
+  bool continueAsync(void);
+
+  AsyncRequest _async[SE_ASYNC_QUEUE_LEN];
+  unsigned int _asyncHead;
+  unsigned int _asyncCount;
+  // The response of the oldest exchange is complete, _asyncOk telling whether it went through
+  bool _asyncDone;
+  bool _asyncOk;
+  // A completion is running, submissions wait for it to return
+  bool _asyncCompleting;
+  uint8_t _asyncResponse[SE_RESPONSE_MAX_LEN];
+  uint16_t _asyncResponseLen;
+
+  bool _timing;
+  bool _timed;
+  se_apdu_timing_t _lastTiming;
+  SETimingHandler _timingHandler;
+  void* _timingArg;
+
+  se_chunking_t _chunking;
+
+  // The APDU in _apdu has extended Lc or Le, _apduExtendedLe telling whether it ends with a two byte Le
+  bool _apduExtended;
+  bool _apduExtendedLe;
+
+  // Nesting of beginTransaction(), _locked telling whether the outermost one got the card
+  unsigned int _transactionDepth;
+  bool _locked;
+
   // 'In between' layer implementation which auto handle 6Cxx and 61xx response
   // Stack:
   //  - transmitApdu
+  //  - exchange
+  //  - chain
   //  - transmit
   //  - transmit (case 1 ... 4)
   // Returns true in case transmit was successful, false otherwise
   bool transmit(void);
+
+  // Loop behind transmit and transmitChained, response nullptr keeping only the last part as transmit does
+  bool chain(uint8_t* response, uint16_t size, uint16_t* responseLen, uint8_t continuation);
+
+  // One command through transmitApdu, timed and traced
+  bool exchange(void);
+};
+
+// Transaction held for the lifetime of the object, with the applet selection and everything else of one operation
+// inside of it
+class SETransaction {
+ public:
+  explicit SETransaction(SEInterface* seiface) : _seiface(seiface) {
+    _locked = (_seiface != nullptr) && _seiface->beginTransaction();
+  }
+
+  ~SETransaction() {
+    if (_seiface != nullptr) {
+      _seiface->endTransaction();
+    }
+  }
+
+  bool locked() {
+    return _locked;
+  }
+
+ private:
+  SETransaction(const SETransaction&) = delete;
+  SETransaction& operator=(const SETransaction&) = delete;
+
+  SEInterface* _seiface;
+  bool _locked;
 };
 
 #else
 
 typedef struct SEInterface SEInterface;
 
+typedef void (*SECompletion)(SEInterface* seiface, bool ok, const uint8_t* response, uint16_t responseLen, void* arg);
+typedef void (*SETimingHandler)(SEInterface* seiface, const uint8_t* apdu, uint16_t apduLen,
+                                const se_apdu_timing_t* timing, void* arg);
+
 bool SEInterface_lock(SEInterface* seiface);
 bool SEInterface_unlock(SEInterface* seiface);
 
@@ -109,6 +365,28 @@ bool SEInterface_transmit_case3(SEInterface* seiface, uint8_t cla, uint8_t ins,
 bool SEInterface_transmit_case4(SEInterface* seiface, uint8_t cla, uint8_t ins, uint8_t p1, uint8_t p2,
                                 const uint8_t* data, uint16_t data_len, uint8_t le);
 
+bool SEInterface_transmit_extended(SEInterface* seiface, uint8_t cla, uint8_t ins, uint8_t p1, uint8_t p2,
+                                   const uint8_t* data, uint16_t data_len, uint16_t le);
+bool SEInterface_supports_extended_length(SEInterface* seiface);
+
+bool SEInterface_transmit_chained(SEInterface* seiface, const uint8_t* apdu, uint16_t apdu_len, uint8_t* response,
+                                  uint16_t size, uint16_t* response_len, uint8_t continuation);
+
+bool SEInterface_read_binary(SEInterface* seiface, uint8_t cla, uint16_t offset, uint16_t size, uint8_t chunk,
+                             uint8_t* data, uint16_t* read_len);
+
+bool SEInterface_transmit_async(SEInterface* seiface, const uint8_t* apdu, uint16_t apdu_len, SECompletion completion,
+                                void* arg);
+int SEInterface_get_poll_fd(SEInterface* seiface);
+int SEInterface_get_poll_timeout(SEInterface* seiface);
+int SEInterface_process_events(SEInterface* seiface);
+
+void SEInterface_set_timing(SEInterface* seiface, bool enable, SETimingHandler handler, void* arg);
+bool SEInterface_get_last_timing(SEInterface* seiface, se_apdu_timing_t* timing);
+
+void SEInterface_set_chunking(SEInterface* seiface, const se_chunking_t* chunking);
+void SEInterface_get_chunking(SEInterface* seiface, se_chunking_t* chunking);
+
 uint16_t SEInterface_get_status_word(SEInterface* seiface);
 uint16_t SEInterface_get_response(SEInterface* seiface, uint8_t* data);
 uint16_t SEInterface_get_response_length(SEInterface* seiface);
@@ -16,6 +16,7 @@ Applet::Applet(uint8_t* aid, uint16_t aidLen) {
   _aidLen     = aidLen;
   _seiface    = NULL;
   _isBasic    = false;
+  _isManaged  = false;
   _isSelected = false;
   _channel    = 0;
 }
@@ -58,18 +59,24 @@ bool Applet::select(bool isBasic) {
           return true;
         }
       }
+    } else if (_seiface->openLogicalChannel(_aid, _aidLen, &_channel)) {
+      _isSelected = true;
+      _isBasic    = false;
+      _isManaged  = true;
+      return true;
     } else {
       if (_seiface->transmit(0x00, SCIns::ManageChannel, SCP1::MANAGECHANNELOpen, SCP2::MANAGECHANNELAllocateChannel,
                              0x01)) {
         if (_seiface->getStatusWord() == (SCSW1::OKNoQualification | SCSW2::OKNoQualification)) {
           _seiface->getResponse(&_channel);
 
-          if (_seiface->transmit(0x00 | _channel, SCIns::Select, SCP1::SELECTByDFName,
+          if (_seiface->transmit(claWithChannel(0x00, _channel), SCIns::Select, SCP1::SELECTByDFName,
                                  SCP2::SELECTFCITemplate | SCP2::SELECTFirstOrOnly, _aid, _aidLen)) {
             if ((_seiface->getStatusWord() == (SCSW1::OKNoQualification | SCSW2::OKNoQualification)) ||
                 ((_seiface->getStatusWord() & 0xFF00) == SCSW1::OKLengthInSW2)) {
               _isSelected = true;
               _isBasic    = false;
+              _isManaged  = false;
               return true;
             }
           }
@@ -85,7 +92,11 @@ bool Applet::select(bool isBasic) {
 
 bool Applet::deselect(void) {
   if (_seiface != NULL) {
-    if (_isSelected && !_isBasic) {
+    if (_isSelected && _isManaged) {
+      if (_seiface->closeLogicalChannel(_channel)) {
+        _isSelected = false;
+      }
+    } else if (_isSelected && !_isBasic) {
       if (_seiface->transmit(0x00, SCIns::ManageChannel, SCP1::MANAGECHANNELClose, static_cast<SCP2>(_channel), 0x01)) {
         if (_seiface->getStatusWord() == (SCSW1::OKNoQualification | SCSW2::OKNoQualification)) {
           _isSelected = false;
@@ -100,28 +111,37 @@ bool Applet::deselect(void) {
 
 bool Applet::transmit(uint8_t cla, SCIns ins, SCP1 p1, SCP2 p2) {
   if (_isSelected) {
-    return _seiface->transmit(cla | _channel, ins, p1, p2);
+    return _seiface->transmit(claWithChannel(cla, _channel), ins, p1, p2);
   }
   return false;
 }
 
 bool Applet::transmit(uint8_t cla, SCIns ins, SCP1 p1, SCP2 p2, uint8_t le) {
   if (_isSelected) {
-    return _seiface->transmit(cla | _channel, ins, p1, p2, le);
+    return _seiface->transmit(claWithChannel(cla, _channel), ins, p1, p2, le);
   }
   return false;
 }
 
 bool Applet::transmit(uint8_t cla, SCIns ins, SCP1 p1, SCP2 p2, const uint8_t* data, uint16_t dataLen) {
   if (_isSelected) {
-    return _seiface->transmit(cla | _channel, ins, p1, p2, data, dataLen);
+    return _seiface->transmit(claWithChannel(cla, _channel), ins, p1, p2, data, dataLen);
   }
   return false;
 }
 
 bool Applet::transmit(uint8_t cla, SCIns ins, SCP1 p1, SCP2 p2, const uint8_t* data, uint16_t dataLen, uint8_t le) {
   if (_isSelected) {
-    return _seiface->transmit(cla | _channel, ins, p1, p2, data, dataLen, le);
+    return _seiface->transmit(claWithChannel(cla, _channel), ins, p1, p2, data, dataLen, le);
+  }
+  return false;
+}
+
+bool Applet::readBinary(uint16_t offset, uint16_t size, uint8_t chunk, uint8_t* data) {
+  uint16_t len;
+
+  if (_isSelected) {
+    return _seiface->readBinary(claWithChannel(0x00, _channel), offset, size, chunk, data, &len);
   }
   return false;
 }
@@ -0,0 +1,82 @@
+/*
+ *
+ * Twilio Breakout Trust Onboard SDK
+ *
+ * Copyright (c) 2019 Twilio, Inc.
+ *
+ * SPDX-License-Identifier:  Apache-2.0
+ */
+
+#include "Atr.h"
+
+// Compact-TLV tag of the card capabilities
+#define ATR_CARD_CAPABILITIES 0x7
+// Third software function table, extended Lc and Le fields
+#define ATR_EXTENDED_LENGTH 0x40
+
+extern "C" bool tob_atr_historical_bytes(const uint8_t* atr, size_t len, const uint8_t** historical,
+                                         size_t* historicalLen) {
+  size_t off = 2;
+  uint8_t indicator;
+  size_t count;
+
+  if ((len < 2) || ((atr[0] != 0x3B) && (atr[0] != 0x3F))) {
+    return false;
+  }
+
+  count     = atr[1] & 0x0F;
+  indicator = atr[1] >> 4;
+
+  // Each group of interface bytes is announced by T0 or the TD closing the previous group
+  for (;;) {
+    off += ((indicator & 0x01) ? 1 : 0) + ((indicator & 0x02) ? 1 : 0) + ((indicator & 0x04) ? 1 : 0);
+    if ((indicator & 0x08) == 0) {
+      break;
+    }
+    if (off >= len) {
+      return false;
+    }
+    indicator = atr[off++] >> 4;
+  }
+
+  if (off + count > len) {
+    return false;
+  }
+
+  *historical    = &atr[off];
+  *historicalLen = count;
+  return true;
+}
+
+extern "C" bool tob_atr_extended_length(const uint8_t* atr, size_t len) {
+  const uint8_t* historical;
+  size_t historicalLen;
+  size_t objectLen;
+  size_t end;
+  size_t off;
+
+  // Only category indicators 00 and 80 are followed by compact-TLV objects, 00 keeping three status bytes at the end
+  if (!tob_atr_historical_bytes(atr, len, &historical, &historicalLen) || (historicalLen == 0)) {
+    return false;
+  }
+  if (historical[0] == 0x80) {
+    end = historicalLen;
+  } else if ((historical[0] == 0x00) && (historicalLen >= 4)) {
+    end = historicalLen - 3;
+  } else {
+    return false;
+  }
+
+  for (off = 1; off < end; off += 1 + objectLen) {
+    objectLen = historical[off] & 0x0F;
+    if (off + objectLen >= end) {
+      break;
+    }
+    if (((historical[off] >> 4) == ATR_CARD_CAPABILITIES) && (objectLen >= 3) &&
+        (historical[off + 3] & ATR_EXTENDED_LENGTH)) {
+      return true;
+    }
+  }
+
+  return false;
+}
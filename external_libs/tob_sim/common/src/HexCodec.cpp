@@ -0,0 +1,213 @@
+/*
+ *
+ * Twilio Breakout Trust Onboard SDK
+ *
+ * Copyright (c) 2019 Twilio, Inc.
+ *
+ * SPDX-License-Identifier:  Apache-2.0
+ */
+
+#include "HexCodec.h"
+
+#if defined(__SSE2__)
+#include <emmintrin.h>
+#define HEX_USE_SSE2
+#elif defined(__ARM_NEON) || defined(__ARM_NEON__)
+#include <arm_neon.h>
+#define HEX_USE_NEON
+#endif
+
+static const char HEX_DIGITS[] = "0123456789ABCDEF";
+
+// Nibble value of every character, 0xFF for the ones which are not hex digits
+static const uint8_t HEX_VALUES[256] = {
+    0xFF, 0xFF, 0xFF, 0xFF, 0xFF, 0xFF, 0xFF, 0xFF, 0xFF, 0xFF, 0xFF, 0xFF, 0xFF, 0xFF, 0xFF, 0xFF,
+    0xFF, 0xFF, 0xFF, 0xFF, 0xFF, 0xFF, 0xFF, 0xFF, 0xFF, 0xFF, 0xFF, 0xFF, 0xFF, 0xFF, 0xFF, 0xFF,
+    0xFF, 0xFF, 0xFF, 0xFF, 0xFF, 0xFF, 0xFF, 0xFF, 0xFF, 0xFF, 0xFF, 0xFF, 0xFF, 0xFF, 0xFF, 0xFF,
+    0x00, 0x01, 0x02, 0x03, 0x04, 0x05, 0x06, 0x07, 0x08, 0x09, 0xFF, 0xFF, 0xFF, 0xFF, 0xFF, 0xFF,
+    0xFF, 0x0A, 0x0B, 0x0C, 0x0D, 0x0E, 0x0F, 0xFF, 0xFF, 0xFF, 0xFF, 0xFF, 0xFF, 0xFF, 0xFF, 0xFF,
+    0xFF, 0xFF, 0xFF, 0xFF, 0xFF, 0xFF, 0xFF, 0xFF, 0xFF, 0xFF, 0xFF, 0xFF, 0xFF, 0xFF, 0xFF, 0xFF,
+    0xFF, 0x0A, 0x0B, 0x0C, 0x0D, 0x0E, 0x0F, 0xFF, 0xFF, 0xFF, 0xFF, 0xFF, 0xFF, 0xFF, 0xFF, 0xFF,
+    0xFF, 0xFF, 0xFF, 0xFF, 0xFF, 0xFF, 0xFF, 0xFF, 0xFF, 0xFF, 0xFF, 0xFF, 0xFF, 0xFF, 0xFF, 0xFF,
+    0xFF, 0xFF, 0xFF, 0xFF, 0xFF, 0xFF, 0xFF, 0xFF, 0xFF, 0xFF, 0xFF, 0xFF, 0xFF, 0xFF, 0xFF, 0xFF,
+    0xFF, 0xFF, 0xFF, 0xFF, 0xFF, 0xFF, 0xFF, 0xFF, 0xFF, 0xFF, 0xFF, 0xFF, 0xFF, 0xFF, 0xFF, 0xFF,
+    0xFF, 0xFF, 0xFF, 0xFF, 0xFF, 0xFF, 0xFF, 0xFF, 0xFF, 0xFF, 0xFF, 0xFF, 0xFF, 0xFF, 0xFF, 0xFF,
+    0xFF, 0xFF, 0xFF, 0xFF, 0xFF, 0xFF, 0xFF, 0xFF, 0xFF, 0xFF, 0xFF, 0xFF, 0xFF, 0xFF, 0xFF, 0xFF,
+    0xFF, 0xFF, 0xFF, 0xFF, 0xFF, 0xFF, 0xFF, 0xFF, 0xFF, 0xFF, 0xFF, 0xFF, 0xFF, 0xFF, 0xFF, 0xFF,
+    0xFF, 0xFF, 0xFF, 0xFF, 0xFF, 0xFF, 0xFF, 0xFF, 0xFF, 0xFF, 0xFF, 0xFF, 0xFF, 0xFF, 0xFF, 0xFF,
+    0xFF, 0xFF, 0xFF, 0xFF, 0xFF, 0xFF, 0xFF, 0xFF, 0xFF, 0xFF, 0xFF, 0xFF, 0xFF, 0xFF, 0xFF, 0xFF,
+    0xFF, 0xFF, 0xFF, 0xFF, 0xFF, 0xFF, 0xFF, 0xFF, 0xFF, 0xFF, 0xFF, 0xFF, 0xFF, 0xFF, 0xFF, 0xFF,};
+
+extern "C" void tob_hex_encode_scalar(const uint8_t* bytes, size_t len, char* hex) {
+  size_t i;
+
+  for (i = 0; i < len; i++) {
+    hex[2 * i]     = HEX_DIGITS[bytes[i] >> 4];
+    hex[2 * i + 1] = HEX_DIGITS[bytes[i] & 0x0F];
+  }
+}
+
+extern "C" bool tob_hex_decode_scalar(const char* hex, size_t hexLen, uint8_t* bytes) {
+  size_t i;
+  uint8_t hi, lo;
+
+  if (hexLen & 1) {
+    return false;
+  }
+
+  for (i = 0; i < hexLen; i += 2) {
+    hi = HEX_VALUES[(uint8_t)hex[i]];
+    lo = HEX_VALUES[(uint8_t)hex[i + 1]];
+    if ((hi | lo) & 0xF0) {
+      return false;
+    }
+    bytes[i / 2] = (hi << 4) | lo;
+  }
+
+  return true;
+}
+
+#if defined(HEX_USE_SSE2)
+
+// 16 bytes into 32 characters
+static inline void encode_block(const uint8_t* bytes, char* hex) {
+  const __m128i mask  = _mm_set1_epi8(0x0F);
+  const __m128i nine  = _mm_set1_epi8(9);
+  const __m128i zero  = _mm_set1_epi8('0');
+  const __m128i alpha = _mm_set1_epi8('A' - '0' - 10);
+  __m128i v, hi, lo;
+
+  v  = _mm_loadu_si128((const __m128i*)bytes);
+  hi = _mm_and_si128(_mm_srli_epi16(v, 4), mask);
+  lo = _mm_and_si128(v, mask);
+  hi = _mm_add_epi8(_mm_add_epi8(hi, zero), _mm_and_si128(_mm_cmpgt_epi8(hi, nine), alpha));
+  lo = _mm_add_epi8(_mm_add_epi8(lo, zero), _mm_and_si128(_mm_cmpgt_epi8(lo, nine), alpha));
+
+  _mm_storeu_si128((__m128i*)hex, _mm_unpacklo_epi8(hi, lo));
+  _mm_storeu_si128((__m128i*)(hex + 16), _mm_unpackhi_epi8(hi, lo));
+}
+
+// Nibble values of 16 characters, valid gets a movemask with a bit set for every hex digit
+static inline __m128i decode_nibbles(__m128i c, int* valid) {
+  __m128i isDigit, isAlpha, folded;
+
+  // Signed compares: characters above 0x7F are negative and fail both ranges
+  isDigit = _mm_and_si128(_mm_cmpgt_epi8(c, _mm_set1_epi8('0' - 1)), _mm_cmplt_epi8(c, _mm_set1_epi8('9' + 1)));
+  folded  = _mm_or_si128(c, _mm_set1_epi8(0x20));
+  isAlpha =
+      _mm_and_si128(_mm_cmpgt_epi8(folded, _mm_set1_epi8('a' - 1)), _mm_cmplt_epi8(folded, _mm_set1_epi8('f' + 1)));
+
+  *valid = _mm_movemask_epi8(_mm_or_si128(isDigit, isAlpha));
+  return _mm_or_si128(_mm_and_si128(isDigit, _mm_sub_epi8(c, _mm_set1_epi8('0'))),
+                      _mm_and_si128(isAlpha, _mm_sub_epi8(folded, _mm_set1_epi8('a' - 10))));
+}
+
+// 32 characters into 16 bytes
+static inline bool decode_block(const char* hex, uint8_t* bytes) {
+  const __m128i low = _mm_set1_epi16(0x00FF);
+  __m128i a, b;
+  int validA, validB;
+
+  a = decode_nibbles(_mm_loadu_si128((const __m128i*)hex), &validA);
+  b = decode_nibbles(_mm_loadu_si128((const __m128i*)(hex + 16)), &validB);
+  if ((validA & validB) != 0xFFFF) {
+    return false;
+  }
+
+  // Every 16-bit lane holds the high nibble in its low byte and the low nibble in its high byte
+  a = _mm_or_si128(_mm_slli_epi16(_mm_and_si128(a, low), 4), _mm_srli_epi16(a, 8));
+  b = _mm_or_si128(_mm_slli_epi16(_mm_and_si128(b, low), 4), _mm_srli_epi16(b, 8));
+  _mm_storeu_si128((__m128i*)bytes, _mm_packus_epi16(a, b));
+  return true;
+}
+
+#elif defined(HEX_USE_NEON)
+
+// 16 bytes into 32 characters
+static inline void encode_block(const uint8_t* bytes, char* hex) {
+  const uint8x16_t nine  = vdupq_n_u8(9);
+  const uint8x16_t zero  = vdupq_n_u8('0');
+  const uint8x16_t alpha = vdupq_n_u8('A' - '0' - 10);
+  uint8x16_t v, hi, lo;
+  uint8x16x2_t out;
+
+  v  = vld1q_u8(bytes);
+  hi = vshrq_n_u8(v, 4);
+  lo = vandq_u8(v, vdupq_n_u8(0x0F));
+
+  out.val[0] = vaddq_u8(vaddq_u8(hi, zero), vandq_u8(vcgtq_u8(hi, nine), alpha));
+  out.val[1] = vaddq_u8(vaddq_u8(lo, zero), vandq_u8(vcgtq_u8(lo, nine), alpha));
+  vst2q_u8((uint8_t*)hex, out);
+}
+
+// Nibble values of 16 characters, valid gets 0xFF in every lane holding a hex digit
+static inline uint8x16_t decode_nibbles(uint8x16_t c, uint8x16_t* valid) {
+  uint8x16_t digit, alpha, isDigit, isAlpha;
+
+  // Unsigned wrap-around turns both range checks into a single compare
+  digit   = vsubq_u8(c, vdupq_n_u8('0'));
+  alpha   = vsubq_u8(vorrq_u8(c, vdupq_n_u8(0x20)), vdupq_n_u8('a'));
+  isDigit = vcltq_u8(digit, vdupq_n_u8(10));
+  isAlpha = vcltq_u8(alpha, vdupq_n_u8(6));
+
+  *valid = vorrq_u8(isDigit, isAlpha);
+  return vorrq_u8(vandq_u8(isDigit, digit), vandq_u8(isAlpha, vaddq_u8(alpha, vdupq_n_u8(10))));
+}
+
+static inline bool all_lanes_set(uint8x16_t m) {
+  uint8x8_t r = vand_u8(vget_low_u8(m), vget_high_u8(m));
+
+  r = vpmin_u8(r, r);
+  r = vpmin_u8(r, r);
+  r = vpmin_u8(r, r);
+  return vget_lane_u8(r, 0) == 0xFF;
+}
+
+// 32 characters into 16 bytes
+static inline bool decode_block(const char* hex, uint8_t* bytes) {
+  uint8x16x2_t c;
+  uint8x16_t hi, lo, validHi, validLo;
+
+  // De-interleaving load: even characters are the high nibbles, odd ones the low nibbles
+  c  = vld2q_u8((const uint8_t*)hex);
+  hi = decode_nibbles(c.val[0], &validHi);
+  lo = decode_nibbles(c.val[1], &validLo);
+  if (!all_lanes_set(vandq_u8(validHi, validLo))) {
+    return false;
+  }
+
+  vst1q_u8(bytes, vorrq_u8(vshlq_n_u8(hi, 4), lo));
+  return true;
+}
+
+#endif
+
+extern "C" void tob_hex_encode(const uint8_t* bytes, size_t len, char* hex) {
+  size_t i = 0;
+
+#if defined(HEX_USE_SSE2) || defined(HEX_USE_NEON)
+  for (; i + 16 <= len; i += 16) {
+    encode_block(&bytes[i], &hex[2 * i]);
+  }
+#endif
+
+  tob_hex_encode_scalar(&bytes[i], len - i, &hex[2 * i]);
+}
+
+extern "C" bool tob_hex_decode(const char* hex, size_t hexLen, uint8_t* bytes) {
+  size_t i = 0;
+
+  if (hexLen & 1) {
+    return false;
+  }
+
+#if defined(HEX_USE_SSE2) || defined(HEX_USE_NEON)
+  for (; i + 32 <= hexLen; i += 32) {
+    if (!decode_block(&hex[i], &bytes[i / 2])) {
+      return false;
+    }
+  }
+#endif
+
+  return tob_hex_decode_scalar(&hex[i], hexLen - i, &bytes[i / 2]);
+}
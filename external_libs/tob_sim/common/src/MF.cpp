@@ -97,33 +97,12 @@ bool MF::readEF(uint8_t* path, uint16_t pathLen, uint8_t* data, uint16_t* dataLe
                pathLen, 0x00)) {
     if (getStatusWord() == (SCSW1::OKNoQualification | SCSW2::OKNoQualification)) {
       if (getEFSize(_seiface->_apduResponse, _seiface->getResponseLength(), dataLen)) {
-        uint16_t i;
-        uint8_t toread;
-
         // data is NULL, only return length
         if (data == NULL) {
           return true;
         }
 
-        for (i = 0; i < *dataLen;) {
-          if ((*dataLen - i) >= 255) {
-            toread = 255;
-          } else {
-            toread = *dataLen - i;
-          }
-
-          if (transmit(0x00, SCIns::ReadBinary, i >> 8, i, toread)) {
-            if (getStatusWord() == (SCSW1::OKNoQualification | SCSW2::OKNoQualification)) {
-              i += getResponse(&(data[i]));
-            } else {
-              return false;
-            }
-          } else {
-            return false;
-          }
-        }
-
-        return true;
+        return readBinary(0, *dataLen, _seiface->getReadChunk(255), data);
       }
     }
   }
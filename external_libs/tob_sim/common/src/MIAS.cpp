@@ -35,6 +35,9 @@ static uint8_t CONTAINERS_INFO_EF[] = {0x00, 0x02};
 
 static uint8_t FILE_DIR_EF[] = {0x01, 0x01};
 
+// Largest READ BINARY the applet is known to answer, tuned chunk sizes only ever go below it
+#define MIAS_READ_CHUNK 0xEE
+
 MIAS::MIAS(void) : Applet(AID, sizeof(AID)) {
   _keypairs_num = -1;
 
@@ -52,6 +55,12 @@ MIAS::~MIAS(void) {
 
 /** PRIVATE *******************************************************************/
 
+uint8_t MIAS::readChunk(void) {
+  uint8_t chunk = _seiface->getReadChunk(MIAS_READ_CHUNK);
+
+  return (chunk < MIAS_READ_CHUNK) ? chunk : MIAS_READ_CHUNK;
+}
+
 bool MIAS::mseSetBeforeHash(uint8_t algorithm) {
   uint8_t data[3];
 
@@ -71,7 +80,7 @@ bool MIAS::mseSetBeforeHash(uint8_t algorithm) {
 
 bool MIAS::psoHashInternally(uint8_t algorithm, const uint8_t* data, uint16_t dataLen) {
   uint8_t block_size;
-  uint16_t i, l;
+  uint16_t i, l, chunk;
 
   if ((algorithm == ALGO_SHA1) || (algorithm == ALGO_SHA224) || (algorithm == ALGO_SHA256)) {
     block_size = 64;
@@ -81,9 +90,15 @@ bool MIAS::psoHashInternally(uint8_t algorithm, const uint8_t* data, uint16_t da
     return false;
   }
 
+  // Whole blocks only, one at least
+  chunk = _seiface->getHashChunk(block_size) / block_size * block_size;
+  if (chunk == 0) {
+    chunk = block_size;
+  }
+
   for (i = 0; i < dataLen; i += l) {
-    if ((l = dataLen - i) > block_size) {
-      l = block_size;
+    if ((l = dataLen - i) > chunk) {
+      l = chunk;
     }
 
     if (!transmit(0x00, SCIns::PerformSecurityOperation, SCP1::PSOHashCode, SCP2::PSOPlain, &data[i], l)) {
@@ -178,56 +193,57 @@ bool MIAS::mseSetBeforeSignature(uint8_t algorithm, uint8_t key) {
 }
 
 bool MIAS::psoComputeDigitalSignature(uint8_t* signature, uint16_t* signatureLen) {
+  uint8_t apdu[5];
+#ifdef USE_GAT_RESPONSE
   uint16_t len;
+#endif
 
   *signatureLen = 0;
 
-  if (transmit(0x00, SCIns::PerformSecurityOperation, SCP1::PSOSignature, SCP2::PSOSignatureInput, 0x00)) {
-#ifdef USE_GAT_RESPONSE
-    if (_isBasic) {
-#endif
-      while (getResponseLength()) {
-        len = getResponse(signature);
-        signature += len;
-        *signatureLen += len;
-        if ((getStatusWord() & 0xFF00) == SCSW1::OKLengthInSW2) {
-          // Transmit GET Response
-          if (transmit(0x00, SCIns::Envelope, SCP1::ENVELOPEReserved, SCP2::ENVELOPEReserved,
-                       getStatusWord() & 0x00FF)) {
-            continue;
-          }
-        } else if (getStatusWord() == (SCSW1::OKNoQualification | SCSW2::OKNoQualification)) {
-          return true;
-        }
-        return false;
-      }
+  if (!_isSelected) {
+    return false;
+  }
+
 #ifdef USE_GAT_RESPONSE
-    } else {
-      // GAT format: [DATA1 DATA2 ... ][GAT SW1 SW2][90 00]
-      while ((getStatusWord() == (SCSW1::OKNoQualification | SCSW2::OKNoQualification)) &&
-             (_seiface->_apduResponseLen >= 4)) {
-        // Convert ApduResponse in order to have GAT status word as regular status word
-        _seiface->_apduResponseLen -= 2;
-
-        len = getResponse(signature);
-        signature += len;
-        *signatureLen += len;
-        if ((getStatusWord() & 0xFF00) == SCSW1::OKLengthinSW2) {
-          // Transmit GAT Response
-          if (transmit(0x00, SCIns::Envelope, SCP1::ENVELOPEReserved, SCP2::ENVELOPEReserved,
-                       getStatusWord() & 0x00FF)) {
-            continue;
-          }
-        } else if (getStatusWord() == (SCSW1::OKNoQualification | SCSW2::OKNoQualification)) {
-          return true;
+  if (!_isBasic) {
+    if (!transmit(0x00, SCIns::PerformSecurityOperation, SCP1::PSOSignature, SCP2::PSOSignatureInput, 0x00)) {
+      return false;
+    }
+
+    // GAT format: [DATA1 DATA2 ... ][GAT SW1 SW2][90 00]
+    while ((getStatusWord() == (SCSW1::OKNoQualification | SCSW2::OKNoQualification)) &&
+           (_seiface->_apduResponseLen >= 4)) {
+      // Convert ApduResponse in order to have GAT status word as regular status word
+      _seiface->_apduResponseLen -= 2;
+
+      len = getResponse(signature);
+      signature += len;
+      *signatureLen += len;
+      if ((getStatusWord() & 0xFF00) == SCSW1::OKLengthInSW2) {
+        // Transmit GAT Response
+        if (transmit(0x00, SCIns::Envelope, SCP1::ENVELOPEReserved, SCP2::ENVELOPEReserved,
+                     getStatusWord() & 0x00FF)) {
+          continue;
         }
-        return false;
+      } else if (getStatusWord() == (SCSW1::OKNoQualification | SCSW2::OKNoQualification)) {
+        return true;
       }
+      return false;
     }
-#endif
+    return false;
   }
+#endif
 
-  return false;
+  apdu[APDU_CLA_OFFSET] = claWithChannel(0x00, _channel);
+  apdu[APDU_INS_OFFSET] = static_cast<uint8_t>(SCIns::PerformSecurityOperation);
+  apdu[APDU_P1_OFFSET]  = static_cast<uint8_t>(SCP1::PSOSignature);
+  apdu[APDU_P2_OFFSET]  = static_cast<uint8_t>(SCP2::PSOSignatureInput);
+  apdu[APDU_LE_OFFSET]  = 0x00;
+
+  // Signatures of keys over 2048 bits come in parts, the applet giving those after the first to ENVELOPE
+  return _seiface->transmitChained(apdu, sizeof(apdu), signature, MIAS_RSA_MAX_LEN, signatureLen,
+                                   static_cast<uint8_t>(SCIns::Envelope)) &&
+         (*signatureLen > 0) && (getStatusWord() == (SCSW1::OKNoQualification | SCSW2::OKNoQualification));
 }
 
 bool MIAS::mseSetBeforeDecrypt(uint8_t algorithm, uint8_t key) {
@@ -251,37 +267,51 @@ bool MIAS::mseSetBeforeDecrypt(uint8_t algorithm, uint8_t key) {
 }
 
 bool MIAS::psoDecipher(const uint8_t* data, uint16_t dataLen, uint8_t* plain, uint16_t* plainLen) {
-  uint8_t buf[255];
+  uint8_t apdu[5 + 255];
+  uint16_t len;
 
-  if (dataLen < 255) {
-    buf[0] = static_cast<uint8_t>(SCTag::PSOPaddingProprietary1);
-    memcpy(&buf[1], data, dataLen);
+  *plainLen = 0;
 
-    if (!transmit(0x00, SCIns::PerformSecurityOperation, SCP1::PSOPlain, SCP2::PSOPadding, buf, dataLen + 1)) {
-      return false;
+  if (!_isSelected) {
+    return false;
+  }
+
+  // Padding indicator and cryptogram go 255 bytes per command, each but the last chained with CLA 0x10
+  apdu[APDU_DATA_OFFSET] = static_cast<uint8_t>(SCTag::PSOPaddingProprietary1);
+  len                    = 1;
+  while (true) {
+    uint16_t part = (dataLen < 255 - len) ? dataLen : 255 - len;
+
+    memcpy(&apdu[APDU_DATA_OFFSET + len], data, part);
+    data += part;
+    dataLen -= part;
+    len += part;
+    if (dataLen == 0) {
+      break;
     }
-  } else {
-    buf[0] = static_cast<uint8_t>(SCTag::PSOPaddingProprietary1);
-    memcpy(&buf[1], data, 254);
-    data += 254;
-    dataLen -= 254;
 
-    if (!transmit(0x10, SCIns::PerformSecurityOperation, SCP1::PSOPlain, SCP2::PSOPadding, buf, 255)) {
+    if (!transmit(0x10, SCIns::PerformSecurityOperation, SCP1::PSOPlain, SCP2::PSOPadding, &apdu[APDU_DATA_OFFSET],
+                  len)) {
       return false;
     }
-
     if (getStatusWord() != (SCSW1::OKNoQualification | SCSW2::OKNoQualification)) {
       return false;
     }
+    len = 0;
+  }
 
-    if (!transmit(0x00, SCIns::PerformSecurityOperation, SCP1::PSOPlain, SCP2::PSOPadding, data, dataLen)) {
-      return false;
-    }
+  apdu[APDU_CLA_OFFSET] = claWithChannel(0x00, _channel);
+  apdu[APDU_INS_OFFSET] = static_cast<uint8_t>(SCIns::PerformSecurityOperation);
+  apdu[APDU_P1_OFFSET]  = static_cast<uint8_t>(SCP1::PSOPlain);
+  apdu[APDU_P2_OFFSET]  = static_cast<uint8_t>(SCP2::PSOPadding);
+  apdu[APDU_LC_OFFSET]  = len;
+
+  // Plain text of keys over 2048 bits comes in parts
+  if (!_seiface->transmitChained(apdu, APDU_DATA_OFFSET + len, plain, MIAS_RSA_MAX_LEN, plainLen)) {
+    return false;
   }
 
   if (getStatusWord() == (SCSW1::OKNoQualification | SCSW2::OKNoQualification)) {
-    *plainLen = getResponse(plain);
-
     // No data returned -> let's try to retrieve it explicitly
     if (*plainLen == 0) {
       if (!transmit(0x00, SCIns::GetResponse, SCP1::ENVELOPEReserved, SCP2::ENVELOPEReserved)) {
@@ -472,7 +502,6 @@ bool MIAS::getCertificateByContainerId(uint8_t container_id, uint8_t* cert, uint
   uint8_t len;
   SCTag t;
   uint8_t l;
-  uint16_t offset;
   uint16_t ef_size;
   mias_key_pair_t* kp;
 
@@ -504,19 +533,8 @@ bool MIAS::getCertificateByContainerId(uint8_t container_id, uint8_t* cert, uint
               return true;
             }
 
-            for (offset = 0; offset < ef_size;) {
-              len = 0xEE;
-              if ((offset + len) > ef_size) {
-                len = ef_size - offset;
-              }
-
-              if (transmit(0x00, SCIns::ReadBinary, (offset >> 8) & 0xFF, offset & 0xFF, len)) {
-                if (getStatusWord() == (SCSW1::OKNoQualification | SCSW2::OKNoQualification)) {
-                  len = getResponse(&(cert[offset]));
-                }
-              }
-
-              offset += len;
+            if (!readBinary(0, ef_size, readChunk(), cert)) {
+              return false;
             }
 
             if ((cert[0] == 0x01) && (cert[1] == 0x00)) {
@@ -572,7 +590,7 @@ bool MIAS::changePin(uint8_t* oldPin, uint16_t oldPinLen, uint8_t* newPin, uint1
 
 bool MIAS::p11GetObjectByLabel(uint8_t* label, uint16_t labelLen, uint8_t* object, uint16_t* objectLen) {
   uint8_t record[0x15];
-  uint16_t i, offset, len, size, trimPos, trimLen;
+  uint16_t i, offset, size, trimPos, trimLen;
   mias_file_t* nfile = NULL;
 
   *objectLen = 0;
@@ -671,24 +689,8 @@ bool MIAS::p11GetObjectByLabel(uint8_t* label, uint16_t labelLen, uint8_t* objec
                                                       return true;
                                                     }
 
-                                                    for (i = 0; i < size;) {
-                                                      len = 0xEE;
-                                                      if ((i + len) > size) {
-                                                        len = size - i;
-                                                      }
-
-                                                      if (transmit(0x00, SCIns::ReadBinary, offset >> 8, offset, len)) {
-                                                        if (getStatusWord() ==
-                                                            (SCSW1::OKNoQualification | SCSW2::OKNoQualification)) {
-                                                          len = getResponse(&(object[i]));
-                                                        }
-                                                      }
-
-                                                      offset += len;
-                                                      i += len;
-                                                    }
-
-                                                    return true;
+                                                    // In one go where extended lengths are supported
+                                                    return readBinary(offset, size, readChunk(), object);
                                                   }
                                                 }
                                               }
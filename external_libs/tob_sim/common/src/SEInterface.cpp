@@ -14,8 +14,23 @@
 #endif
 
 SEInterface::SEInterface(void) {
-  _apduLen         = 0;
-  _apduResponseLen = 0;
+  _apduLen          = 0;
+  _apduResponseLen  = 0;
+  _asyncHead        = 0;
+  _asyncCount       = 0;
+  _asyncDone        = false;
+  _asyncOk          = false;
+  _asyncCompleting  = false;
+  _asyncResponseLen = 0;
+  _timing           = false;
+  _timed            = false;
+  _timingHandler    = nullptr;
+  _timingArg        = nullptr;
+  _chunking         = se_chunking_t();
+  _apduExtended     = false;
+  _apduExtendedLe   = false;
+  _transactionDepth = 0;
+  _locked           = false;
 }
 
 SEInterface::~SEInterface(void) {
@@ -41,6 +56,10 @@ bool SEInterface::transmit(uint8_t cla, uint8_t ins, uint8_t p1, uint8_t p2, uin
 }
 
 bool SEInterface::transmit(uint8_t cla, uint8_t ins, uint8_t p1, uint8_t p2, const uint8_t* data, uint16_t dataLen) {
+  if (dataLen > 255) {
+    return transmitExtended(cla, ins, p1, p2, data, dataLen, 0);
+  }
+
   _apdu[APDU_CLA_OFFSET] = cla;
   _apdu[APDU_INS_OFFSET] = ins;
   _apdu[APDU_P1_OFFSET]  = p1;
@@ -53,6 +72,10 @@ bool SEInterface::transmit(uint8_t cla, uint8_t ins, uint8_t p1, uint8_t p2, con
 
 bool SEInterface::transmit(uint8_t cla, uint8_t ins, uint8_t p1, uint8_t p2, const uint8_t* data, uint16_t dataLen,
                            uint8_t le) {
+  if (dataLen > 255) {
+    return transmitExtended(cla, ins, p1, p2, data, dataLen, (le != 0) ? le : 256);
+  }
+
   _apdu[APDU_CLA_OFFSET] = cla;
   _apdu[APDU_INS_OFFSET] = ins;
   _apdu[APDU_P1_OFFSET]  = p1;
@@ -64,7 +87,127 @@ bool SEInterface::transmit(uint8_t cla, uint8_t ins, uint8_t p1, uint8_t p2, con
   return transmit();
 }
 
+bool SEInterface::transmitExtended(uint8_t cla, uint8_t ins, uint8_t p1, uint8_t p2, const uint8_t* data,
+                                   uint16_t dataLen, uint16_t le) {
+  bool ret;
+
+  if (!supportsExtendedLength() || (dataLen > SE_MAX_DATA_LEN) || (le > SE_MAX_DATA_LEN)) {
+    return false;
+  }
+
+  _apdu[APDU_CLA_OFFSET] = cla;
+  _apdu[APDU_INS_OFFSET] = ins;
+  _apdu[APDU_P1_OFFSET]  = p1;
+  _apdu[APDU_P2_OFFSET]  = p2;
+  _apduLen               = 4;
+
+  // Lc and Le both take three bytes when alone, a case 4 command leaving the leading zero out of Le
+  if (dataLen > 0) {
+    _apdu[_apduLen++] = 0x00;
+    _apdu[_apduLen++] = dataLen >> 8;
+    _apdu[_apduLen++] = dataLen & 0xFF;
+    memcpy(&_apdu[_apduLen], data, dataLen);
+    _apduLen += dataLen;
+  } else if (le > 0) {
+    _apdu[_apduLen++] = 0x00;
+  }
+  if (le > 0) {
+    _apdu[_apduLen++] = le >> 8;
+    _apdu[_apduLen++] = le & 0xFF;
+  }
+
+  _apduExtended   = true;
+  _apduExtendedLe = (le > 0);
+  ret             = transmit();
+  _apduExtended   = false;
+  return ret;
+}
+
+bool SEInterface::transmitChained(const uint8_t* apdu, uint16_t apduLen, uint8_t* response, uint16_t size,
+                                  uint16_t* responseLen, uint8_t continuation) {
+  bool ret;
+
+  *responseLen = 0;
+
+  if ((apduLen < 4) || (apduLen > SE_APDU_MAX_LEN)) {
+    return false;
+  }
+
+  memcpy(_apdu, apdu, apduLen);
+  _apduLen = apduLen;
+
+  // A zero where a short Lc or Le would be starts extended lengths, Le being last unless the body is just Lc and data
+  _apduExtended   = (apduLen > 5) && (apdu[APDU_LC_OFFSET] == 0x00);
+  _apduExtendedLe = _apduExtended && ((apduLen == 7) || (apduLen == 9 + ((apdu[5] << 8) | apdu[6])));
+  ret             = chain(response, size, responseLen, continuation);
+  _apduExtended   = false;
+  return ret;
+}
+
 bool SEInterface::transmit(void) {
+  return chain(nullptr, 0, nullptr, static_cast<uint8_t>(SCIns::GetResponse));
+}
+
+bool SEInterface::chain(uint8_t* response, uint16_t size, uint16_t* responseLen, uint8_t continuation) {
+  uint16_t len;
+
+  // The transport is busy with asynchronous exchanges
+  if (_asyncCount > 0) {
+    return false;
+  }
+
+  for (int commands = 0; commands < SE_CHAIN_MAX_COMMANDS; commands++) {
+    if (!exchange()) {
+      return false;
+    }
+
+    if ((_apduResponseLen == 2) && (_apduResponse[0] == 0x6C) && _apduExtended) {
+      if (!_apduExtendedLe) {
+        return true;
+      }
+      _apdu[_apduLen - 2] = 0x00;
+      _apdu[_apduLen - 1] = _apduResponse[1];
+      continue;
+    }
+
+    if ((_apduResponseLen == 2) && (_apduResponse[0] == 0x6C)) {
+      _apdu[4] = _apduResponse[1];
+      if (_apduLen < 5) {
+        _apduLen = 5;
+      }
+      continue;
+    }
+
+    len = (_apduResponseLen > 2) ? _apduResponseLen - 2 : 0;
+    if (response != nullptr) {
+      if (*responseLen + len > size) {
+        return false;
+      }
+      memcpy(&response[*responseLen], _apduResponse, len);
+      *responseLen += len;
+    }
+
+    // Data followed by 61xx is left to the caller unless parts are being gathered
+    if ((_apduResponseLen < 2) || (_apduResponse[_apduResponseLen - 2] != 0x61) ||
+        ((len > 0) && (response == nullptr))) {
+      return true;
+    }
+
+    _apduExtended = false;
+    _apdu[0]      = claWithChannel(0x00, claChannel(_apdu[0]));
+    _apdu[1]      = (len > 0) ? continuation : static_cast<uint8_t>(SCIns::GetResponse);
+    _apdu[2]      = 0x00;
+    _apdu[3]      = 0x00;
+    _apdu[4]      = _apduResponse[_apduResponseLen - 1];
+    _apduLen      = 5;
+  }
+
+  return false;
+}
+
+bool SEInterface::exchange(void) {
+  bool ret;
+
 #ifdef APDU_DEBUG
   {
     uint16_t i;
@@ -76,7 +219,19 @@ bool SEInterface::transmit(void) {
   }
 #endif
 
-  if (transmitApdu(_apdu, _apduLen, _apduResponse, &_apduResponseLen) == false) {
+  if (_timing) {
+    _timer.begin(&_lastTiming);
+    ret = transmitApdu(_apdu, _apduLen, _apduResponse, &_apduResponseLen);
+    _timer.end();
+    _timed = true;
+    if (_timingHandler != nullptr) {
+      _timingHandler(this, _apdu, _apduLen, &_lastTiming, _timingArg);
+    }
+  } else {
+    ret = transmitApdu(_apdu, _apduLen, _apduResponse, &_apduResponseLen);
+  }
+
+  if (ret == false) {
     return false;
   }
 
@@ -91,27 +246,195 @@ bool SEInterface::transmit(void) {
   }
 #endif
 
-  if ((_apduResponseLen == 2) && (_apduResponse[0] == 0x6C)) {
-    _apdu[4] = _apduResponse[1];
-    if (_apduLen < 5) {
-      _apduLen = 5;
+  return true;
+}
+
+bool SEInterface::readBinary(uint8_t cla, uint16_t offset, uint16_t size, uint8_t chunk, uint8_t* data,
+                             uint16_t* readLen) {
+  uint16_t len;
+  uint16_t done = 0;
+  bool extended = supportsExtendedLength() && (size > chunk);
+
+  *readLen = 0;
+  if (chunk == 0) {
+    return false;
+  }
+
+  while (done < size) {
+    if (extended) {
+      len = ((size - done) < SE_MAX_DATA_LEN) ? (size - done) : SE_MAX_DATA_LEN;
+      if (!transmitExtended(cla, static_cast<uint8_t>(SCIns::ReadBinary), (offset + done) >> 8,
+                            (offset + done) & 0xFF, nullptr, 0, len)) {
+        return false;
+      }
+      // Some cards only take extended lengths for some commands
+      if (getStatusWord() != (SCSW1::OKNoQualification | SCSW2::OKNoQualification)) {
+        extended = false;
+        continue;
+      }
+    } else {
+      len = ((size - done) < chunk) ? (size - done) : chunk;
+      if (!transmit(cla, SCIns::ReadBinary, static_cast<SCP1>((offset + done) >> 8),
+                    static_cast<SCP2>((offset + done) & 0xFF), (uint8_t)len) ||
+          (getStatusWord() != (SCSW1::OKNoQualification | SCSW2::OKNoQualification))) {
+        return false;
+      }
+    }
+
+    // A short chunk means the end of the file was reached
+    len = getResponseLength();
+    if (len > size - done) {
+      len = size - done;
+    }
+    memcpy(&data[done], _apduResponse, len);
+    done += len;
+    *readLen = done;
+    if (len == 0) {
+      return false;
+    }
+  }
+
+  return true;
+}
+
+bool SEInterface::transmitAsync(const uint8_t* apdu, uint16_t apduLen, SECompletion completion, void* arg) {
+  AsyncRequest* request;
+
+  if ((completion == nullptr) || (_asyncCount >= SE_ASYNC_QUEUE_LEN) || (apduLen < 4) ||
+      (apduLen > SE_SHORT_APDU_MAX_LEN)) {
+    return false;
+  }
+
+  request = &_async[(_asyncHead + _asyncCount) % SE_ASYNC_QUEUE_LEN];
+  memcpy(request->apdu, apdu, apduLen);
+  request->apduLen    = apduLen;
+  request->completion = completion;
+  request->arg        = arg;
+
+  if ((_asyncCount++ == 0) && !_asyncCompleting) {
+    startAsync();
+  }
+  return true;
+}
+
+void SEInterface::startAsync(void) {
+  AsyncRequest* request = &_async[_asyncHead];
+
+  _asyncResponseLen = 0;
+  if (getPollFd() >= 0) {
+    _asyncOk   = startApdu(request->apdu, request->apduLen, _asyncResponse);
+    _asyncDone = !_asyncOk;
+  } else {
+    _asyncOk   = transmitApdu(request->apdu, request->apduLen, _asyncResponse, &_asyncResponseLen);
+    _asyncDone = true;
+  }
+}
+
+bool SEInterface::continueAsync(void) {
+  AsyncRequest* request = &_async[_asyncHead];
+
+  if ((_asyncResponseLen != 2) || ((_asyncResponse[0] != 0x6C) && (_asyncResponse[0] != 0x61))) {
+    return false;
+  }
+
+  if (_asyncResponse[0] == 0x6C) {
+    request->apdu[4] = _asyncResponse[1];
+    if (request->apduLen < 5) {
+      request->apduLen = 5;
+    }
+  } else {
+    request->apdu[0] = claWithChannel(0x00, claChannel(request->apdu[0]));
+    request->apdu[1] = static_cast<uint8_t>(SCIns::GetResponse);
+    request->apdu[2] = 0x00;
+    request->apdu[3] = 0x00;
+    request->apdu[4] = _asyncResponse[1];
+    request->apduLen = 5;
+  }
+  return true;
+}
+
+int SEInterface::processEvents(void) {
+  AsyncRequest request;
+  bool done;
+  int completed = 0;
+
+  while (_asyncCount > 0) {
+    if (!_asyncDone) {
+      if (!pollApdu(&_asyncResponseLen, &done)) {
+        _asyncOk = false;
+      } else if (!done) {
+        break;
+      }
+      _asyncDone = true;
+    }
+
+    if (_asyncOk && continueAsync()) {
+      startAsync();
+      continue;
+    }
+
+    // The slot is freed before the completion runs, which may submit more. The next exchange only starts once it
+    // returned, the response buffer being handed to it.
+    request    = _async[_asyncHead];
+    _asyncHead = (_asyncHead + 1) % SE_ASYNC_QUEUE_LEN;
+    _asyncCount--;
+    _asyncDone       = false;
+    _asyncCompleting = true;
+    request.completion(this, _asyncOk, _asyncResponse, _asyncOk ? _asyncResponseLen : 0, request.arg);
+    _asyncCompleting = false;
+    completed++;
+
+    if (_asyncCount > 0) {
+      startAsync();
     }
-    return transmit();
   }
 
-  if ((_apduResponseLen == 2) && (_apduResponse[0] == 0x61)) {
-    _apdu[0] = 0x00 | (_apdu[0] & 0x03);
-    _apdu[1] = 0xC0;
-    _apdu[2] = 0x00;
-    _apdu[3] = 0x00;
-    _apdu[4] = _apduResponse[1];
-    _apduLen = 5;
-    return transmit();
+  return completed;
+}
+
+void SEInterface::setTiming(bool enable, SETimingHandler handler, void* arg) {
+  _timing        = enable;
+  _timed         = false;
+  _timingHandler = enable ? handler : nullptr;
+  _timingArg     = arg;
+}
+
+bool SEInterface::getLastTiming(se_apdu_timing_t* timing) {
+  if (!_timing || !_timed) {
+    return false;
   }
 
+  *timing = _lastTiming;
   return true;
 }
 
+void SEInterface::setChunking(const se_chunking_t* chunking) {
+  _chunking = *chunking;
+}
+
+void SEInterface::getChunking(se_chunking_t* chunking) {
+  *chunking = _chunking;
+}
+
+bool SEInterface::beginTransaction(void) {
+  if (_transactionDepth++ == 0) {
+    _locked = lockTransport();
+  }
+
+  return _locked;
+}
+
+void SEInterface::endTransaction(void) {
+  if (_transactionDepth == 0) {
+    return;
+  }
+
+  if ((--_transactionDepth == 0) && _locked) {
+    unlockTransport();
+    _locked = false;
+  }
+}
+
 uint16_t SEInterface::getStatusWord(void) {
   uint16_t sw = 0;
 
@@ -147,6 +470,15 @@ uint16_t SEInterface::getResponseLength(void) {
 
 /** C Accessors	***************************************************************/
 
+extern "C" bool SEInterface_lock(SEInterface* seiface) {
+  return seiface->beginTransaction();
+}
+
+extern "C" bool SEInterface_unlock(SEInterface* seiface) {
+  seiface->endTransaction();
+  return true;
+}
+
 extern "C" bool SEInterface_transmit_case1(SEInterface* seiface, uint8_t cla, uint8_t ins, uint8_t p1, uint8_t p2) {
   return seiface->transmit(cla, ins, p1, p2);
 }
@@ -166,6 +498,42 @@ extern "C" bool SEInterface_transmit_case4(SEInterface* seiface, uint8_t cla, ui
   return seiface->transmit(cla, ins, p1, p2, data, data_len, le);
 }
 
+extern "C" bool SEInterface_transmit_extended(SEInterface* seiface, uint8_t cla, uint8_t ins, uint8_t p1, uint8_t p2,
+                                              const uint8_t* data, uint16_t data_len, uint16_t le) {
+  return seiface->transmitExtended(cla, ins, p1, p2, data, data_len, le);
+}
+
+extern "C" bool SEInterface_supports_extended_length(SEInterface* seiface) {
+  return seiface->supportsExtendedLength();
+}
+
+extern "C" bool SEInterface_transmit_chained(SEInterface* seiface, const uint8_t* apdu, uint16_t apdu_len,
+                                             uint8_t* response, uint16_t size, uint16_t* response_len,
+                                             uint8_t continuation) {
+  return seiface->transmitChained(apdu, apdu_len, response, size, response_len, continuation);
+}
+
+extern "C" bool SEInterface_read_binary(SEInterface* seiface, uint8_t cla, uint16_t offset, uint16_t size,
+                                        uint8_t chunk, uint8_t* data, uint16_t* read_len) {
+  return seiface->readBinary(cla, offset, size, chunk, data, read_len);
+}
+
+extern "C" void SEInterface_set_timing(SEInterface* seiface, bool enable, SETimingHandler handler, void* arg) {
+  seiface->setTiming(enable, handler, arg);
+}
+
+extern "C" bool SEInterface_get_last_timing(SEInterface* seiface, se_apdu_timing_t* timing) {
+  return seiface->getLastTiming(timing);
+}
+
+extern "C" void SEInterface_set_chunking(SEInterface* seiface, const se_chunking_t* chunking) {
+  seiface->setChunking(chunking);
+}
+
+extern "C" void SEInterface_get_chunking(SEInterface* seiface, se_chunking_t* chunking) {
+  seiface->getChunking(chunking);
+}
+
 extern "C" uint16_t SEInterface_get_status_word(SEInterface* seiface) {
   return seiface->getStatusWord();
 }
@@ -177,3 +545,20 @@ extern "C" uint16_t SEInterface_get_response(SEInterface* seiface, uint8_t* data
 extern "C" uint16_t SEInterface_get_response_length(SEInterface* seiface) {
   return seiface->getResponseLength();
 }
+
+extern "C" bool SEInterface_transmit_async(SEInterface* seiface, const uint8_t* apdu, uint16_t apdu_len,
+                                           SECompletion completion, void* arg) {
+  return seiface->transmitAsync(apdu, apdu_len, completion, arg);
+}
+
+extern "C" int SEInterface_get_poll_fd(SEInterface* seiface) {
+  return seiface->getPollFd();
+}
+
+extern "C" int SEInterface_get_poll_timeout(SEInterface* seiface) {
+  return seiface->getPollTimeout();
+}
+
+extern "C" int SEInterface_process_events(SEInterface* seiface) {
+  return seiface->processEvents();
+}
@@ -0,0 +1,180 @@
+/*
+ *
+ * Twilio Breakout Trust Onboard SDK
+ *
+ * Copyright (c) 2019 Twilio, Inc.
+ *
+ * SPDX-License-Identifier:  Apache-2.0
+ */
+
+#ifndef __CCID_SEINTERFACE_H__
+#define __CCID_SEINTERFACE_H__
+
+#include "SEInterface.h"
+
+// CCID message header: type, length, slot, sequence and three message specific bytes
+#define CCID_HEADER_LEN 10
+// Longest message exchanged with the reader, a short APDU or a T=1 block with room to spare
+#define CCID_MAX_MESSAGE_LEN (CCID_HEADER_LEN + 5 + 256 + 2 + 8)
+
+// Deadline in milliseconds for the reader to answer a command, extended by time extension requests
+#define CCID_TIMEOUT 5000
+
+// Longest USB serial number told apart when several readers of the same model are plugged in
+#define CCID_MAX_SERIAL_LEN 64
+
+// Bulk-OUT messages
+#define CCID_PC_TO_RDR_SET_PARAMETERS 0x61
+#define CCID_PC_TO_RDR_ICC_POWER_ON 0x62
+#define CCID_PC_TO_RDR_ICC_POWER_OFF 0x63
+#define CCID_PC_TO_RDR_XFR_BLOCK 0x6F
+
+// Bulk-IN messages
+#define CCID_RDR_TO_PC_DATA_BLOCK 0x80
+#define CCID_RDR_TO_PC_SLOT_STATUS 0x81
+#define CCID_RDR_TO_PC_PARAMETERS 0x82
+
+// Command status in bits 6 and 7 of bStatus
+#define CCID_STATUS_MASK 0xC0
+#define CCID_STATUS_FAILED 0x40
+#define CCID_STATUS_TIME_EXTENSION 0x80
+
+// Exchange level in dwFeatures of the CCID class descriptor
+#define CCID_FEATURE_LEVEL_MASK 0x00070000
+#define CCID_FEATURE_LEVEL_TPDU 0x00010000
+#define CCID_FEATURE_LEVEL_SHORT_APDU 0x00020000
+#define CCID_FEATURE_LEVEL_EXTENDED_APDU 0x00040000
+// The reader picks the protocol parameters from the ATR itself
+#define CCID_FEATURE_AUTO_PARAMETERS 0x00000002
+
+// T=1 block: NAD, PCB, LEN, up to 254 bytes of information and the LRC
+#define T1_PROLOGUE_LEN 3
+#define T1_MAX_IFS 254
+#define T1_DEFAULT_IFS 32
+#define T1_RETRIES 3
+
+#define T1_PCB_I_NS 0x40
+#define T1_PCB_I_MORE 0x20
+#define T1_PCB_R 0x80
+#define T1_PCB_R_NR 0x10
+#define T1_PCB_S 0xC0
+#define T1_PCB_S_RESPONSE 0x20
+#define T1_S_RESYNCH 0x00
+#define T1_S_IFS 0x01
+#define T1_S_ABORT 0x02
+#define T1_S_WTX 0x03
+
+#ifdef __cplusplus
+
+// Bulk pipe pair to a CCID reader, one message per transfer
+class CcidTransport {
+ public:
+  virtual ~CcidTransport(void) {
+  }
+
+  virtual bool open(void)  = 0;
+  virtual void close(void) = 0;
+
+  virtual bool write(const uint8_t* data, unsigned long int len) = 0;
+  // Receive one message of at most size bytes, waiting at most timeout milliseconds
+  virtual bool read(uint8_t* data, unsigned long int size, unsigned long int* len, int timeout) = 0;
+
+  // dwFeatures of the reader's CCID class descriptor, valid once open
+  virtual uint32_t getFeatures(void) = 0;
+};
+
+// Reader on the USB bus, driven through usbfs without pcscd
+class UsbCcidTransport : public CcidTransport {
+ public:
+  // serial selects among several readers of the same model, nullptr takes the first one found
+  UsbCcidTransport(uint16_t vendor, uint16_t product, const char* serial = nullptr);
+  ~UsbCcidTransport(void);
+
+  bool open(void) override;
+  void close(void) override;
+  bool write(const uint8_t* data, unsigned long int len) override;
+  bool read(uint8_t* data, unsigned long int size, unsigned long int* len, int timeout) override;
+  uint32_t getFeatures(void) override {
+    return _features;
+  }
+
+ private:
+  // Pick the CCID interface and its bulk endpoints out of the descriptors usbfs returns
+  bool parseDescriptors(const uint8_t* data, unsigned long int len);
+
+  uint16_t _vendor;
+  uint16_t _product;
+  char _serial[CCID_MAX_SERIAL_LEN];
+  int _fd;
+  int _interface;
+  uint8_t _bulkIn;
+  uint8_t _bulkOut;
+  uint32_t _features;
+};
+
+// Smart card in the first slot of a CCID reader, talking T=0 or T=1 as announced by its ATR
+class CcidSEInterface : public SEInterface {
+ public:
+  CcidSEInterface(uint16_t vendor, uint16_t product, const char* serial = nullptr);
+  // Create an instance on top of an already created transport, which is then owned by the interface
+  CcidSEInterface(CcidTransport* transport);
+  ~CcidSEInterface(void);
+
+  // Power the card up and set the reader up for the protocol of its ATR
+  bool open(void) override;
+  void close(void) override;
+
+  // Protocol in use, 0 or 1, -1 before open
+  int getProtocol(void) {
+    return _protocol;
+  }
+
+  // Parse device strings of the form VID:PID[:serial], the ids in hex. serial points into device or is nullptr.
+  // Returns false in case device is malformed.
+  static bool parseDevice(const char* device, uint16_t* vendor, uint16_t* product, const char** serial);
+
+ protected:
+  bool transmitApdu(uint8_t* apdu, uint16_t apduLen, uint8_t* response, uint16_t* responseLen) override;
+
+  // Send a bulk-OUT message and wait for the answer with the same sequence number, honouring time extensions.
+  // The answer is left in _rx. Returns true in case the reader reported success, false otherwise.
+  bool command(uint8_t type, const uint8_t* params, const uint8_t* data, unsigned long int len);
+
+  // Pick protocol, IFSC and parameters out of the ATR
+  bool parseAtr(const uint8_t* atr, unsigned long int len);
+
+  bool transmitT0(const uint8_t* apdu, uint16_t apduLen, uint8_t* response, uint16_t* responseLen);
+  bool transmitT1(const uint8_t* apdu, uint16_t apduLen, uint8_t* response, uint16_t* responseLen);
+  // Exchange one T=1 block with the card, the answer lands in block
+  bool exchangeBlock(uint8_t pcb, const uint8_t* inf, uint8_t len, uint8_t* block, uint8_t* blockLen);
+
+ private:
+  CcidTransport* _transport;
+  uint32_t _features;
+  uint8_t _sequence;
+  int _protocol;
+
+  // From the ATR: TA1 and the T=1 characters
+  uint8_t _ta1;
+  uint8_t _ifsc;
+  uint8_t _bwi;
+  uint8_t _cwi;
+
+  // T=1 send and receive sequence numbers
+  uint8_t _ns;
+  uint8_t _nr;
+
+  uint8_t _tx[CCID_MAX_MESSAGE_LEN];
+  uint8_t _rx[CCID_MAX_MESSAGE_LEN];
+  unsigned long int _rxLen;
+};
+
+#else /* __cplusplus */
+
+SEInterface* CcidSEInterface_create(uint16_t vendor, uint16_t product, const char* serial);
+void CcidSEInterface_destroy(SEInterface* iface);
+int CcidSEInterface_open(SEInterface* iface);
+
+#endif /* __cplusplus */
+
+#endif /* __CCID_SEINTERFACE_H__ */
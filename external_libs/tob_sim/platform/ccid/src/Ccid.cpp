@@ -0,0 +1,790 @@
+/*
+ *
+ * Twilio Breakout Trust Onboard SDK
+ *
+ * Copyright (c) 2019 Twilio, Inc.
+ *
+ * SPDX-License-Identifier:  Apache-2.0
+ */
+
+#include "Ccid.h"
+#include "Deadline.h"
+#include <cerrno>
+#include <cstdio>
+#include <cstdlib>
+#include <cstring>
+
+#include <dirent.h>
+#include <fcntl.h>
+#include <sys/ioctl.h>
+#include <unistd.h>
+
+#include <linux/usbdevice_fs.h>
+
+//#define CCID_DEBUG
+
+#define CCID_SYSFS_USB_DEVICES "/sys/bus/usb/devices"
+
+// USB descriptor types and the smart card device class
+#define USB_DT_INTERFACE 0x04
+#define USB_DT_ENDPOINT 0x05
+#define USB_DT_CCID 0x21
+#define USB_CLASS_CCID 0x0B
+#define USB_ENDPOINT_BULK 0x02
+#define USB_ENDPOINT_IN 0x80
+
+// Offsets into the CCID class descriptor
+#define CCID_DESCRIPTOR_FEATURES 40
+#define CCID_DESCRIPTOR_LEN 54
+
+// Parameters announced by an ATR which leaves them out
+#define ATR_DEFAULT_TA1 0x11
+#define ATR_DEFAULT_BWI 4
+#define ATR_DEFAULT_CWI 13
+
+// T=1 R-block error indications
+#define T1_R_EDC_ERROR 0x01
+
+static inline void put32(uint8_t* out, uint32_t value) {
+  out[0] = (uint8_t)(value & 0xFF);
+  out[1] = (uint8_t)((value >> 8) & 0xFF);
+  out[2] = (uint8_t)((value >> 16) & 0xFF);
+  out[3] = (uint8_t)(value >> 24);
+}
+
+static inline uint32_t get32(const uint8_t* data) {
+  return (uint32_t)data[0] | ((uint32_t)data[1] << 8) | ((uint32_t)data[2] << 16) | ((uint32_t)data[3] << 24);
+}
+
+/** USB transport *************************************************************/
+
+// Read a sysfs attribute of a USB device, without the trailing newline
+static bool readAttribute(const char* device, const char* name, char* value, size_t size) {
+  char path[256];
+  FILE* file;
+  size_t len;
+
+  snprintf(path, sizeof(path), "%s/%s/%s", CCID_SYSFS_USB_DEVICES, device, name);
+  if ((file = fopen(path, "r")) == nullptr) {
+    return false;
+  }
+  if (fgets(value, size, file) == nullptr) {
+    fclose(file);
+    return false;
+  }
+  fclose(file);
+
+  len = strlen(value);
+  while ((len > 0) && ((value[len - 1] == '\n') || (value[len - 1] == '\r'))) {
+    value[--len] = '\0';
+  }
+  return true;
+}
+
+UsbCcidTransport::UsbCcidTransport(uint16_t vendor, uint16_t product, const char* serial) {
+  _vendor    = vendor;
+  _product   = product;
+  _fd        = -1;
+  _interface = -1;
+  _bulkIn    = 0;
+  _bulkOut   = 0;
+  _features  = 0;
+  _serial[0] = '\0';
+  if (serial != nullptr) {
+    strncpy(_serial, serial, sizeof(_serial) - 1);
+    _serial[sizeof(_serial) - 1] = '\0';
+  }
+}
+
+UsbCcidTransport::~UsbCcidTransport(void) {
+  close();
+}
+
+bool UsbCcidTransport::parseDescriptors(const uint8_t* data, unsigned long int len) {
+  unsigned long int off;
+  uint8_t descLen;
+  bool inCcid = false;
+  bool found  = false;
+
+  _bulkIn   = 0;
+  _bulkOut  = 0;
+  _features = 0;
+
+  // Device descriptor followed by the configuration descriptors, each one introduced by its length and type
+  for (off = 0; (off + 2 <= len) && (data[off] >= 2) && (off + data[off] <= len); off += descLen) {
+    descLen = data[off];
+    switch (data[off + 1]) {
+      case USB_DT_INTERFACE:
+        // The first smart card interface is the one used, alternate settings and other functions are skipped
+        inCcid = !found && (descLen >= 9) && (data[off + 5] == USB_CLASS_CCID);
+        if (inCcid) {
+          _interface = data[off + 2];
+          found      = true;
+        }
+        break;
+      case USB_DT_CCID:
+        if (inCcid && (descLen >= CCID_DESCRIPTOR_LEN)) {
+          _features = get32(&data[off + CCID_DESCRIPTOR_FEATURES]);
+        }
+        break;
+      case USB_DT_ENDPOINT:
+        if (inCcid && (descLen >= 7) && ((data[off + 3] & 0x03) == USB_ENDPOINT_BULK)) {
+          if (data[off + 2] & USB_ENDPOINT_IN) {
+            _bulkIn = data[off + 2];
+          } else {
+            _bulkOut = data[off + 2];
+          }
+        }
+        break;
+      default:
+        break;
+    }
+  }
+
+  return found && (_bulkIn != 0) && (_bulkOut != 0);
+}
+
+bool UsbCcidTransport::open(void) {
+  uint8_t descriptors[4096];
+  char value[CCID_MAX_SERIAL_LEN];
+  char path[64];
+  struct dirent* entry;
+  DIR* dir;
+  unsigned long int bus = 0;
+  unsigned long int dev = 0;
+  bool found            = false;
+  ssize_t len;
+
+  if (_fd >= 0) {
+    return true;
+  }
+
+  if ((dir = opendir(CCID_SYSFS_USB_DEVICES)) == nullptr) {
+    fprintf(stderr, "CCID: could not list USB devices\n");
+    return false;
+  }
+
+  while ((entry = readdir(dir)) != nullptr) {
+    // Interfaces are listed next to devices as bus-port:config.interface
+    if ((entry->d_name[0] == '.') || (strchr(entry->d_name, ':') != nullptr)) {
+      continue;
+    }
+    if (!readAttribute(entry->d_name, "idVendor", value, sizeof(value)) || (strtoul(value, nullptr, 16) != _vendor) ||
+        !readAttribute(entry->d_name, "idProduct", value, sizeof(value)) ||
+        (strtoul(value, nullptr, 16) != _product)) {
+      continue;
+    }
+    if ((_serial[0] != '\0') &&
+        (!readAttribute(entry->d_name, "serial", value, sizeof(value)) || (strcmp(value, _serial) != 0))) {
+      continue;
+    }
+    if (readAttribute(entry->d_name, "busnum", value, sizeof(value))) {
+      bus = strtoul(value, nullptr, 10);
+      if (readAttribute(entry->d_name, "devnum", value, sizeof(value))) {
+        dev   = strtoul(value, nullptr, 10);
+        found = true;
+        break;
+      }
+    }
+  }
+  closedir(dir);
+
+  if (!found) {
+    fprintf(stderr, "CCID: no reader %04X:%04X%s%s found\n", _vendor, _product,
+            (_serial[0] != '\0') ? " with serial " : "", _serial);
+    return false;
+  }
+
+  snprintf(path, sizeof(path), "/dev/bus/usb/%03lu/%03lu", bus, dev);
+  if ((_fd = ::open(path, O_RDWR)) < 0) {
+    fprintf(stderr, "CCID: could not open %s: %s\n", path, strerror(errno));
+    return false;
+  }
+
+  // usbfs hands out the cached descriptors on read
+  len = ::read(_fd, descriptors, sizeof(descriptors));
+  if ((len <= 0) || !parseDescriptors(descriptors, (unsigned long int)len)) {
+    fprintf(stderr, "CCID: %s has no smart card interface\n", path);
+    ::close(_fd);
+    _fd = -1;
+    return false;
+  }
+
+  if (ioctl(_fd, USBDEVFS_CLAIMINTERFACE, &_interface) < 0) {
+    fprintf(stderr, "CCID: could not claim interface %d of %s: %s, is pcscd running?\n", _interface, path,
+            strerror(errno));
+    ::close(_fd);
+    _fd = -1;
+    return false;
+  }
+
+  return true;
+}
+
+void UsbCcidTransport::close(void) {
+  if (_fd < 0) {
+    return;
+  }
+
+  ioctl(_fd, USBDEVFS_RELEASEINTERFACE, &_interface);
+  ::close(_fd);
+  _fd = -1;
+}
+
+bool UsbCcidTransport::write(const uint8_t* data, unsigned long int len) {
+  struct usbdevfs_bulktransfer bulk;
+
+  bulk.ep      = _bulkOut;
+  bulk.len     = len;
+  bulk.timeout = CCID_TIMEOUT;
+  bulk.data    = (void*)data;
+  return (_fd >= 0) && (ioctl(_fd, USBDEVFS_BULK, &bulk) == (int)len);
+}
+
+bool UsbCcidTransport::read(uint8_t* data, unsigned long int size, unsigned long int* len, int timeout) {
+  struct usbdevfs_bulktransfer bulk;
+  int r;
+
+  // A zero timeout would wait forever
+  if ((_fd < 0) || (timeout <= 0)) {
+    return false;
+  }
+
+  bulk.ep      = _bulkIn;
+  bulk.len     = size;
+  bulk.timeout = timeout;
+  bulk.data    = data;
+  if ((r = ioctl(_fd, USBDEVFS_BULK, &bulk)) < 0) {
+    return false;
+  }
+
+  *len = (unsigned long int)r;
+  return true;
+}
+
+/** CCID **********************************************************************/
+
+CcidSEInterface::CcidSEInterface(uint16_t vendor, uint16_t product, const char* serial)
+    : CcidSEInterface(new UsbCcidTransport(vendor, product, serial)) {
+}
+
+CcidSEInterface::CcidSEInterface(CcidTransport* transport) {
+  _transport = transport;
+  _features  = 0;
+  _sequence  = 0;
+  _protocol  = -1;
+  _ta1       = ATR_DEFAULT_TA1;
+  _ifsc      = T1_DEFAULT_IFS;
+  _bwi       = ATR_DEFAULT_BWI;
+  _cwi       = ATR_DEFAULT_CWI;
+  _ns        = 0;
+  _nr        = 0;
+  _rxLen     = 0;
+}
+
+CcidSEInterface::~CcidSEInterface(void) {
+  close();
+  delete _transport;
+}
+
+bool CcidSEInterface::parseDevice(const char* device, uint16_t* vendor, uint16_t* product, const char** serial) {
+  unsigned long int value;
+  char* end;
+
+  value = strtoul(device, &end, 16);
+  if ((end == device) || (*end != ':') || (value > 0xFFFF)) {
+    return false;
+  }
+  *vendor = (uint16_t)value;
+
+  device = end + 1;
+  value  = strtoul(device, &end, 16);
+  if ((end == device) || ((*end != ':') && (*end != '\0')) || (value > 0xFFFF)) {
+    return false;
+  }
+  *product = (uint16_t)value;
+
+  *serial = ((*end == ':') && (end[1] != '\0')) ? end + 1 : nullptr;
+  return true;
+}
+
+bool CcidSEInterface::command(uint8_t type, const uint8_t* params, const uint8_t* data, unsigned long int len) {
+  struct timespec deadline;
+  uint8_t sequence = _sequence++;
+  uint8_t expected;
+  int remaining;
+
+  if (CCID_HEADER_LEN + len > sizeof(_tx)) {
+    return false;
+  }
+
+  _tx[0] = type;
+  put32(&_tx[1], (uint32_t)len);
+  _tx[5] = 0;
+  _tx[6] = sequence;
+  _tx[7] = params[0];
+  _tx[8] = params[1];
+  _tx[9] = params[2];
+  if (len > 0) {
+    memcpy(&_tx[CCID_HEADER_LEN], data, len);
+  }
+
+#ifdef CCID_DEBUG
+  {
+    unsigned long int i;
+    printf("CCID: > ");
+    for (i = 0; i < CCID_HEADER_LEN + len; i++) {
+      printf("%02X", _tx[i]);
+    }
+    printf("\r\n");
+  }
+#endif
+
+  if (!_transport->write(_tx, CCID_HEADER_LEN + len)) {
+    fprintf(stderr, "CCID: could not send message 0x%02X\n", type);
+    return false;
+  }
+
+  // Time extensions push the deadline back, answers to commands given up on earlier are dropped
+  deadline_after(CCID_TIMEOUT, &deadline);
+  for (;;) {
+    remaining = deadline_remaining(&deadline);
+    if ((remaining == 0) || !_transport->read(_rx, sizeof(_rx), &_rxLen, remaining)) {
+      fprintf(stderr, "CCID: no response to message 0x%02X\n", type);
+      return false;
+    }
+
+#ifdef CCID_DEBUG
+    {
+      unsigned long int i;
+      printf("CCID: < ");
+      for (i = 0; i < _rxLen; i++) {
+        printf("%02X", _rx[i]);
+      }
+      printf("\r\n");
+    }
+#endif
+
+    if ((_rxLen < CCID_HEADER_LEN) || (_rx[5] != 0) || (_rx[6] != sequence)) {
+      continue;
+    }
+    if ((_rx[7] & CCID_STATUS_MASK) == CCID_STATUS_TIME_EXTENSION) {
+      deadline_after(CCID_TIMEOUT, &deadline);
+      continue;
+    }
+    break;
+  }
+
+  switch (type) {
+    case CCID_PC_TO_RDR_ICC_POWER_ON:
+    case CCID_PC_TO_RDR_XFR_BLOCK:
+      expected = CCID_RDR_TO_PC_DATA_BLOCK;
+      break;
+    case CCID_PC_TO_RDR_SET_PARAMETERS:
+      expected = CCID_RDR_TO_PC_PARAMETERS;
+      break;
+    default:
+      expected = CCID_RDR_TO_PC_SLOT_STATUS;
+      break;
+  }
+
+  if ((_rx[0] != expected) || (get32(&_rx[1]) != _rxLen - CCID_HEADER_LEN)) {
+    fprintf(stderr, "CCID: malformed response to message 0x%02X\n", type);
+    return false;
+  }
+
+  if ((_rx[7] & CCID_STATUS_MASK) != 0) {
+    fprintf(stderr, "CCID: reader reported error 0x%02X on message 0x%02X\n", _rx[8], type);
+    return false;
+  }
+
+  return true;
+}
+
+bool CcidSEInterface::parseAtr(const uint8_t* atr, unsigned long int len) {
+  unsigned long int off = 2;
+  unsigned int level    = 1;
+  uint8_t indicator;
+  int protocol = 0;
+  int first    = -1;
+  bool ifsc    = false;
+  bool bwi     = false;
+
+  if ((len < 2) || ((atr[0] != 0x3B) && (atr[0] != 0x3F))) {
+    return false;
+  }
+
+  _ta1      = ATR_DEFAULT_TA1;
+  _ifsc     = T1_DEFAULT_IFS;
+  _bwi      = ATR_DEFAULT_BWI;
+  _cwi      = ATR_DEFAULT_CWI;
+  indicator = atr[1] >> 4;
+
+  // Interface bytes come in groups announced by the previous T0 or TD byte. From the third group on, TA and TB carry
+  // the parameters of the protocol the preceding TD named.
+  for (;;) {
+    if (indicator & 0x01) {
+      if (off >= len) {
+        return false;
+      }
+      if (level == 1) {
+        _ta1 = atr[off];
+      } else if ((level >= 3) && (protocol == 1) && !ifsc) {
+        if ((atr[off] != 0x00) && (atr[off] != 0xFF)) {
+          _ifsc = atr[off];
+        }
+        ifsc = true;
+      }
+      off++;
+    }
+    if (indicator & 0x02) {
+      if (off >= len) {
+        return false;
+      }
+      if ((level >= 3) && (protocol == 1) && !bwi) {
+        _bwi = atr[off] >> 4;
+        _cwi = atr[off] & 0x0F;
+        bwi  = true;
+      }
+      off++;
+    }
+    if (indicator & 0x04) {
+      off++;
+    }
+    if ((indicator & 0x08) == 0) {
+      break;
+    }
+    if (off >= len) {
+      return false;
+    }
+    protocol  = atr[off] & 0x0F;
+    indicator = atr[off] >> 4;
+    if (first < 0) {
+      first = protocol;
+    }
+    off++;
+    level++;
+  }
+
+  // The first protocol offered is the one in use unless a PPS moved to another one
+  _protocol = (first < 0) ? 0 : first;
+  if (_protocol > 1) {
+    fprintf(stderr, "CCID: unsupported protocol T=%d\n", _protocol);
+    _protocol = -1;
+    return false;
+  }
+
+  return true;
+}
+
+bool CcidSEInterface::open(void) {
+  uint8_t params[3] = {0, 0, 0};
+  uint8_t data[7];
+  uint8_t block[T1_PROLOGUE_LEN + T1_MAX_IFS + 1];
+  uint8_t blockLen;
+  uint8_t ifsd = T1_MAX_IFS;
+
+  if (_protocol >= 0) {
+    return true;
+  }
+
+  if (!_transport->open()) {
+    return false;
+  }
+
+  _features = _transport->getFeatures();
+  if ((_features & CCID_FEATURE_LEVEL_MASK) == 0) {
+    fprintf(stderr, "CCID: character level readers are not supported\n");
+    _transport->close();
+    return false;
+  }
+
+  // Automatic voltage selection
+  if (!command(CCID_PC_TO_RDR_ICC_POWER_ON, params, nullptr, 0) ||
+      !parseAtr(&_rx[CCID_HEADER_LEN], _rxLen - CCID_HEADER_LEN)) {
+    fprintf(stderr, "CCID: could not power the card up\n");
+    _transport->close();
+    return false;
+  }
+
+  // Readers exchanging TPDUs need the protocol parameters, unless they take them from the ATR themselves
+  if (((_features & CCID_FEATURE_LEVEL_MASK) == CCID_FEATURE_LEVEL_TPDU) &&
+      ((_features & CCID_FEATURE_AUTO_PARAMETERS) == 0)) {
+    params[0] = (uint8_t)_protocol;
+    data[0]   = _ta1;
+    if (_protocol == 0) {
+      data[1] = 0x00;  // Direct convention
+      data[2] = 0x00;  // Extra guard time
+      data[3] = 0x0A;  // Waiting integer
+      data[4] = 0x00;  // Clock stop not allowed
+    } else {
+      data[1] = 0x10;  // LRC, direct convention
+      data[2] = 0x00;
+      data[3] = (uint8_t)((_bwi << 4) | _cwi);
+      data[4] = 0x00;
+      data[5] = _ifsc;
+      data[6] = 0x00;  // NAD
+    }
+    if (!command(CCID_PC_TO_RDR_SET_PARAMETERS, params, data, (_protocol == 0) ? 5 : 7)) {
+      close();
+      return false;
+    }
+  }
+
+  _ns = 0;
+  _nr = 0;
+
+  // Let the card send blocks as long as ours, a card refusing keeps answering in blocks of the default size
+  if ((_protocol == 1) && ((_features & CCID_FEATURE_LEVEL_MASK) == CCID_FEATURE_LEVEL_TPDU)) {
+    if (!exchangeBlock(T1_PCB_S | T1_S_IFS, &ifsd, 1, block, &blockLen) ||
+        (block[1] != (T1_PCB_S | T1_PCB_S_RESPONSE | T1_S_IFS))) {
+      fprintf(stderr, "CCID: card did not accept IFSD %u\n", ifsd);
+    }
+  }
+
+  return true;
+}
+
+void CcidSEInterface::close(void) {
+  uint8_t params[3] = {0, 0, 0};
+
+  if (_protocol < 0) {
+    return;
+  }
+
+  command(CCID_PC_TO_RDR_ICC_POWER_OFF, params, nullptr, 0);
+  _transport->close();
+  _protocol = -1;
+}
+
+bool CcidSEInterface::transmitApdu(uint8_t* apdu, uint16_t apduLen, uint8_t* response, uint16_t* responseLen) {
+  uint8_t params[3] = {0, 0, 0};
+
+  if ((_protocol < 0) || (apduLen < 4) || (apduLen > 5 + 256 + 1)) {
+    return false;
+  }
+
+  if ((_features & CCID_FEATURE_LEVEL_MASK) == CCID_FEATURE_LEVEL_TPDU) {
+    return (_protocol == 0) ? transmitT0(apdu, apduLen, response, responseLen)
+                            : transmitT1(apdu, apduLen, response, responseLen);
+  }
+
+  // APDU level readers take care of the protocol themselves
+  if (!command(CCID_PC_TO_RDR_XFR_BLOCK, params, apdu, apduLen) || (_rxLen - CCID_HEADER_LEN < 2) ||
+      (_rxLen - CCID_HEADER_LEN > 256 + 2)) {
+    return false;
+  }
+
+  *responseLen = (uint16_t)(_rxLen - CCID_HEADER_LEN);
+  memcpy(response, &_rx[CCID_HEADER_LEN], *responseLen);
+  return true;
+}
+
+/** T=0 ***********************************************************************/
+
+bool CcidSEInterface::transmitT0(const uint8_t* apdu, uint16_t apduLen, uint8_t* response, uint16_t* responseLen) {
+  uint8_t params[3] = {0, 0, 0};
+  uint8_t tpdu[5 + 255];
+  uint16_t tpduLen = apduLen;
+
+  // A TPDU always has P3: case 1 gets a zero one, case 4 goes without Le and SEInterface fetches the data on 61xx
+  memcpy(tpdu, apdu, (apduLen > sizeof(tpdu)) ? sizeof(tpdu) : apduLen);
+  if (apduLen == 4) {
+    tpdu[4] = 0x00;
+    tpduLen = 5;
+  } else if ((apduLen > 5) && (apduLen == 5 + apdu[APDU_LC_OFFSET] + 1)) {
+    tpduLen = apduLen - 1;
+  } else if (apduLen > sizeof(tpdu)) {
+    return false;
+  }
+
+  // The reader runs the procedure bytes and hands back data and status word
+  if (!command(CCID_PC_TO_RDR_XFR_BLOCK, params, tpdu, tpduLen) || (_rxLen - CCID_HEADER_LEN < 2) ||
+      (_rxLen - CCID_HEADER_LEN > 256 + 2)) {
+    return false;
+  }
+
+  *responseLen = (uint16_t)(_rxLen - CCID_HEADER_LEN);
+  memcpy(response, &_rx[CCID_HEADER_LEN], *responseLen);
+  return true;
+}
+
+/** T=1 ***********************************************************************/
+
+// Encode a block with NAD 0 and its LRC, returns its length
+static unsigned long int t1Block(uint8_t pcb, const uint8_t* inf, uint8_t len, uint8_t* out) {
+  unsigned long int i;
+  uint8_t lrc;
+
+  out[0] = 0x00;
+  out[1] = pcb;
+  out[2] = len;
+  if (len > 0) {
+    memcpy(&out[T1_PROLOGUE_LEN], inf, len);
+  }
+
+  lrc = 0;
+  for (i = 0; i < T1_PROLOGUE_LEN + len; i++) {
+    lrc ^= out[i];
+  }
+  out[T1_PROLOGUE_LEN + len] = lrc;
+  return T1_PROLOGUE_LEN + len + 1;
+}
+
+static bool t1Check(const uint8_t* block, unsigned long int len) {
+  unsigned long int i;
+  uint8_t lrc = 0;
+
+  if ((len < T1_PROLOGUE_LEN + 1) || (block[2] == 0xFF) || (len != T1_PROLOGUE_LEN + block[2] + 1U)) {
+    return false;
+  }
+
+  for (i = 0; i < len; i++) {
+    lrc ^= block[i];
+  }
+  return lrc == 0;
+}
+
+bool CcidSEInterface::exchangeBlock(uint8_t pcb, const uint8_t* inf, uint8_t len, uint8_t* block,
+                                    uint8_t* blockLen) {
+  uint8_t out[T1_PROLOGUE_LEN + T1_MAX_IFS + 1];
+  uint8_t params[3] = {0, 0, 0};
+  const uint8_t* in;
+  unsigned long int outLen;
+  uint8_t value;
+  int errors = 0;
+
+  outLen = t1Block(pcb, inf, len, out);
+  for (;;) {
+    if (!command(CCID_PC_TO_RDR_XFR_BLOCK, params, out, outLen)) {
+      return false;
+    }
+    params[0] = 0;
+    in        = &_rx[CCID_HEADER_LEN];
+
+    // A corrupted block is asked for again
+    if (!t1Check(in, _rxLen - CCID_HEADER_LEN)) {
+      if (++errors > T1_RETRIES) {
+        fprintf(stderr, "CCID: too many transmission errors\n");
+        return false;
+      }
+      outLen = t1Block(T1_PCB_R | (_nr ? T1_PCB_R_NR : 0) | T1_R_EDC_ERROR, nullptr, 0, out);
+      continue;
+    }
+
+    // S-block requests of the card are answered here, the block it sends next answers ours
+    if ((in[1] & (T1_PCB_S | T1_PCB_S_RESPONSE)) == T1_PCB_S) {
+      switch (in[1] & 0x1F) {
+        case T1_S_WTX:
+          if (in[2] != 1) {
+            return false;
+          }
+          // The reader waits that many block waiting times for the next block
+          value     = in[T1_PROLOGUE_LEN];
+          params[0] = value;
+          outLen    = t1Block(T1_PCB_S | T1_PCB_S_RESPONSE | T1_S_WTX, &value, 1, out);
+          continue;
+        case T1_S_IFS:
+          if ((in[2] != 1) || (in[T1_PROLOGUE_LEN] == 0x00) || (in[T1_PROLOGUE_LEN] == 0xFF)) {
+            return false;
+          }
+          value  = in[T1_PROLOGUE_LEN];
+          _ifsc  = value;
+          outLen = t1Block(T1_PCB_S | T1_PCB_S_RESPONSE | T1_S_IFS, &value, 1, out);
+          continue;
+        default:
+          fprintf(stderr, "CCID: card aborted the exchange (S-block 0x%02X)\n", in[1]);
+          return false;
+      }
+    }
+
+    *blockLen = (uint8_t)(_rxLen - CCID_HEADER_LEN);
+    memcpy(block, in, *blockLen);
+    return true;
+  }
+}
+
+bool CcidSEInterface::transmitT1(const uint8_t* apdu, uint16_t apduLen, uint8_t* response, uint16_t* responseLen) {
+  uint8_t block[T1_PROLOGUE_LEN + T1_MAX_IFS + 1];
+  uint8_t blockLen;
+  uint16_t off = 0;
+  uint8_t chunk;
+  uint8_t pcb;
+  int retries = 0;
+
+  // The APDU goes in I-blocks of at most IFSC bytes, the card acknowledges each chained one with an R-block asking
+  // for the next and answers the last one with an I-block of its own
+  for (;;) {
+    chunk = (uint8_t)((apduLen - off > _ifsc) ? _ifsc : apduLen - off);
+    pcb   = (_ns ? T1_PCB_I_NS : 0) | ((off + chunk < apduLen) ? T1_PCB_I_MORE : 0);
+    if (!exchangeBlock(pcb, &apdu[off], chunk, block, &blockLen)) {
+      return false;
+    }
+
+    if ((block[1] & T1_PCB_R) == 0) {
+      if ((pcb & T1_PCB_I_MORE) == 0) {
+        break;
+      }
+    } else if (((block[1] & T1_PCB_S) == T1_PCB_R) && (pcb & T1_PCB_I_MORE) && ((block[1] & 0x0F) == 0) &&
+               (((block[1] & T1_PCB_R_NR) != 0) != (_ns != 0))) {
+      _ns ^= 1;
+      off += chunk;
+      retries = 0;
+      continue;
+    }
+
+    // Anything else asks for the block again
+    if (++retries > T1_RETRIES) {
+      fprintf(stderr, "CCID: card keeps rejecting block 0x%02X\n", pcb);
+      return false;
+    }
+  }
+
+  _ns ^= 1;
+  *responseLen = 0;
+
+  // The response may come chained as well, each I-block is acknowledged with an R-block asking for the next
+  for (;;) {
+    if (((block[1] & T1_PCB_I_NS) != 0) != (_nr != 0)) {
+      fprintf(stderr, "CCID: unexpected block sequence number\n");
+      return false;
+    }
+    if (*responseLen + block[2] > 256 + 2) {
+      return false;
+    }
+    memcpy(&response[*responseLen], &block[T1_PROLOGUE_LEN], block[2]);
+    *responseLen += block[2];
+    _nr ^= 1;
+
+    if ((block[1] & T1_PCB_I_MORE) == 0) {
+      break;
+    }
+
+    retries = 0;
+    do {
+      if (!exchangeBlock(T1_PCB_R | (_nr ? T1_PCB_R_NR : 0), nullptr, 0, block, &blockLen)) {
+        return false;
+      }
+    } while (((block[1] & T1_PCB_R) != 0) && (++retries <= T1_RETRIES));
+
+    if ((block[1] & T1_PCB_R) != 0) {
+      return false;
+    }
+  }
+
+  return *responseLen >= 2;
+}
+
+/** C Accessors	***************************************************************/
+
+extern "C" SEInterface* CcidSEInterface_create(uint16_t vendor, uint16_t product, const char* serial) {
+  return new CcidSEInterface(vendor, product, serial);
+}
+
+extern "C" void CcidSEInterface_destroy(SEInterface* iface) {
+  delete static_cast<CcidSEInterface*>(iface);
+}
+
+extern "C" int CcidSEInterface_open(SEInterface* iface) {
+  return static_cast<CcidSEInterface*>(iface)->open();
+}
@@ -10,8 +10,44 @@
 #ifndef __AT_INTERFACE_H__
 #define __AT_INTERFACE_H__
 
+#include "ApduTiming.h"
 #include "Serial.h"
 
+#include <time.h>
+
+// Size of the receive ring buffer, must be a power of two
+#define AT_RX_BUFFER_SIZE 1024
+
+// Longest command APDU accepted by sendATCSIM: header, Lc, 256 bytes of data and Le
+#define AT_MAX_APDU_LEN (5 + 256 + 1)
+// Longest response APDU: 256 bytes of data and the status word
+#define AT_MAX_RESPONSE_LEN (256 + 2)
+
+// AT+CGLA=<sessionid>,<length>,"<command>"<CR><LF>, AT+CSIM is the same without the session
+#define AT_CMD_BUFFER_SIZE (8 + 11 + 4 + 2 + (2 * AT_MAX_APDU_LEN) + 3)
+
+// Longest AID accepted by sendATCCHO, as per ISO/IEC 7816-4
+#define AT_MAX_AID_LEN 16
+
+// Longest information response prefix the response parser can match, e.g. "+CSIM: "
+#define AT_MAX_PREFIX_LEN 15
+
+// URC handler table, queue of URCs received during a command and the longest URC line kept, longer ones are truncated
+#define AT_MAX_URC_HANDLERS 8
+#define AT_URC_QUEUE_LEN 8
+#define AT_URC_LINE_LEN 128
+
+enum ATResult {
+  AT_RESULT_OK,         // OK
+  AT_RESULT_ERROR,      // ERROR, NO CARRIER, BUSY, NO ANSWER, NO DIALTONE
+  AT_RESULT_CME_ERROR,  // +CME ERROR: <n>
+  AT_RESULT_CMS_ERROR,  // +CMS ERROR: <n>
+  AT_RESULT_TIMEOUT     // No final result code before the deadline
+};
+
+// Called with the URC line, without its terminating <CR><LF>
+typedef void (*ATUrcHandler)(const char* line, void* arg);
+
 class ATInterface {
  public:
   ATInterface(Serial* serial);
@@ -22,13 +58,213 @@ class ATInterface {
 
   bool sendATCSIM(uint8_t* apdu, uint16_t apduLen, uint8_t* response, uint16_t* responseLen);
 
+  // Open a logical channel with the applet identified by aid selected on it (AT+CCHO), the modem keeps track of it.
+  // Returns true in case the channel was opened, its session id being stored in session, false otherwise.
+  bool sendATCCHO(const uint8_t* aid, uint16_t aidLen, unsigned long int* session);
+
+  // Exchange an APDU on a logical channel opened by sendATCCHO (AT+CGLA)
+  bool sendATCGLA(unsigned long int session, uint8_t* apdu, uint16_t apduLen, uint8_t* response,
+                  uint16_t* responseLen);
+
+  // Close a logical channel opened by sendATCCHO (AT+CCHC)
+  bool sendATCCHC(unsigned long int session);
+
+  // Send an APDU with AT+CSIM, or with AT+CGLA on session when it is not negative, without waiting for the response.
+  // pollApdu collects it into response, which must stay valid until then.
+  // Returns true in case the command was sent, false otherwise.
+  bool beginApdu(long int session, uint8_t* apdu, uint16_t apduLen, uint8_t* response);
+
+  // Consume what the port received so far for the APDU sent by beginApdu, without blocking. done is set once the
+  // final result code arrived or the deadline passed.
+  // Returns false in case the command failed, true otherwise.
+  bool pollApdu(uint16_t* responseLen, bool* done);
+
+  // Milliseconds left until the APDU sent by beginApdu times out, -1 if none is outstanding
+  int getPendingTimeout(void);
+
+  // Check whether the modem queues a command received while it is still busy with the previous one: two commands go
+  // out in a single write and both must be answered OK within timeout milliseconds.
+  bool probePipelining(int timeout);
+
+  // Read size bytes of the selected EF from offset with one READ BINARY of chunk bytes per AT+CSIM, or AT+CGLA on
+  // session when it is not negative, keeping the next command queued in the modem while the response to the previous
+  // one arrives. Only probePipelining() modems should be given this. Reading stops at the first response which is
+  // not a full chunk with 9000, once the command queued behind it was answered too. Each response is decoded into
+  // response, of AT_MAX_RESPONSE_LEN bytes, which keeps the last one.
+  // Returns false in case a command failed at the AT level, true otherwise, readLen holding the number of bytes read.
+  bool readBinaryPipelined(long int session, uint8_t cla, uint16_t offset, uint16_t size, uint8_t chunk,
+                           uint8_t* data, uint16_t* readLen, uint8_t* response, uint16_t* responseLen);
+
+  // Send a command without information response, e.g. "ATE0", and wait at most timeout milliseconds for it to
+  // complete. Returns true in case the modem answered OK, false otherwise.
+  bool sendCommand(const char* command, int timeout);
+
+  // Send a command with a text information response, e.g. "AT+IPR=?" answered by "+IPR: (...)". What follows prefix
+  // on that line is stored zero terminated in response, truncated to size - 1 characters. An empty prefix takes the
+  // first line which is not a final result code, the echo of a command or a URC with a handler, for responses without
+  // prefix such as ATI.
+  // Returns true in case the modem answered OK after the information response, false otherwise.
+  bool sendCommand(const char* command, const char* prefix, char* response, unsigned long int size, int timeout);
+
+  // Mark APDU commands sent and bytes received on timer, nullptr for none
+  void setTimer(ApduTimer* timer) {
+    _timer = timer;
+  }
+
+  // Minimum time in milliseconds between the end of a response and the next command, for modules which lose commands
+  // sent too early. 0, the default, sends right away.
+  void setCommandDelay(int delay) {
+    _commandDelay = delay;
+  }
+
+  // Final result code of the last command
+  ATResult getLastResult(void) {
+    return _parser.result;
+  }
+
+  // Error code of the last +CME ERROR: <n> or +CMS ERROR: <n> final result code, -1 if it was not numeric or the
+  // command ended otherwise
+  int getLastErrorCode(void) {
+    return _parser.errorCode;
+  }
+
+  // Deliver URCs whose line starts with prefix, e.g. "+CREG: " or "RING", to handler. URCs received while a command
+  // is outstanding are queued and handed over once it completes, handlers may therefore send commands themselves.
+  // Returns false in case the handler table is full.
+  bool addUrcHandler(const char* prefix, ATUrcHandler handler, void* arg);
+  void removeUrcHandler(const char* prefix);
+
+  // Wait at most timeout milliseconds for URCs while no command is outstanding and dispatch every complete one
+  // received. Returns the number of URCs dispatched.
+  int pollUrcs(int timeout);
+
+  // Number of URCs lost because the queue was full
+  unsigned long int getDroppedUrcs(void) {
+    return _urcDropped;
+  }
+
  protected:
-  bool bytesArray2HexString(uint8_t* bytes, uint16_t bytesLen, uint8_t* hexstr, uint16_t* hexstrLen);
-  bool hexString2BytesArray(uint8_t* hexstr, uint16_t hexstrLen, uint8_t* bytes, uint16_t* bytesLen);
-  bool readLine(char* data, unsigned long int* len);
+  // Wait for the final result code of the command just sent. The hex payload of an information response
+  // '<prefix><length>,"<hex>"' is decoded into data while it is being received, or with text set the rest of the
+  // line is copied as is. prefix may be NULL for commands without information response.
+  // Returns true in case the command ended with OK and, if a prefix was given, a well formed response of at most
+  // size bytes was received; false on ERROR, +CME ERROR or timeout.
+  bool readResponse(const char* prefix, uint8_t* data, unsigned long int size, unsigned long int* len, int timeout,
+                    bool text = false);
+
+  // Send command terminated by <CR><LF>
+  bool sendLine(const char* command);
+
+  // Send <command>[<session>,]<length>,"<apdu>", session being left out when negative
+  bool writeApdu(const char* command, long int session, uint8_t* apdu, uint16_t apduLen);
+
+  // Send <command>[<session>,]<length>,"<apdu>" and decode the <prefix><length>,"<response>" answer, session being
+  // left out when negative
+  bool sendApdu(const char* command, const char* prefix, long int session, uint8_t* apdu, uint16_t apduLen,
+                uint8_t* response, uint16_t* responseLen);
 
  private:
+  enum ParserState {
+    PARSER_LINE_START,  // Matching the start of a line against the prefix and the final result codes
+    PARSER_SKIP_LINE,   // Discarding the rest of a line
+    PARSER_LENGTH,      // Reading the decimal length after the prefix
+    PARSER_QUOTE,       // Skipping the optional opening quote
+    PARSER_HEX,         // Decoding the payload
+    PARSER_TEXT,        // Copying the rest of a text information response
+    PARSER_ERROR_CODE,  // Reading the code of a +CME ERROR or +CMS ERROR
+    PARSER_URC,         // Collecting a line which might be a URC
+    PARSER_DONE         // Final result code seen
+  };
+
+  struct Parser {
+    ParserState state;
+    const char* prefix;
+    unsigned long int prefixLen;
+    bool text;
+    // No command outstanding, final result codes are just stray lines
+    bool idle;
+
+    char head[AT_MAX_PREFIX_LEN + 1];
+    unsigned long int headLen;
+
+    uint8_t* out;
+    unsigned long int outSize;
+    unsigned long int outLen;
+    unsigned long int hexLen;
+    unsigned long int hexDone;
+    char pendingHex;
+
+    bool received;
+    bool malformed;
+    ATResult result;
+    int errorCode;
+  };
+
+  struct UrcHandler {
+    const char* prefix;
+    ATUrcHandler handler;
+    void* arg;
+  };
+
+  struct Urc {
+    unsigned int handler;
+    char line[AT_URC_LINE_LEN];
+  };
+
+  void parseBegin(const char* prefix, uint8_t* out, unsigned long int size, bool text = false);
+  // Consume everything in the receive ring buffer up to the final result code, bytes following it are left for the
+  // next command. Returns true once the final result code was seen.
+  bool parseStep(void);
+  // Outcome of the command parsed, the response length being stored in len
+  bool parseEnd(unsigned long int* len);
+  unsigned long int parseChar(const char* data, unsigned long int avail);
+  void parseLineStart(char c);
+  // Whether the line started in the parser head is an echo or a URC with a handler, candidate being set in case it
+  // could still become one
+  bool otherLine(bool* candidate);
+  void parseUrc(void);
+
+  // Sleep until the command delay after the last response has passed
+  void waitCommandDelay(void);
+
+  // Hand queued URCs over to their handlers, returns how many
+  int dispatchUrcs(void);
+
+  // Pull whatever the serial port has into the receive ring buffer with a single read.
+  // Returns true in case some data was received before the timeout expired, false otherwise.
+  bool fill(int timeout);
+
   Serial* _serial;
+  ApduTimer* _timer;
+
+  // Preallocated command buffer, nothing is allocated per APDU
+  char _cmd[AT_CMD_BUFFER_SIZE];
+
+  Parser _parser;
+
+  int _commandDelay;
+  struct timespec _nextCommand;
+
+  // APDU sent by beginApdu waiting for its response
+  bool _pending;
+  struct timespec _pendingDeadline;
+
+  UrcHandler _urcHandlers[AT_MAX_URC_HANDLERS];
+  unsigned int _urcHandlerCount;
+  // Line being collected in PARSER_URC
+  char _urcLine[AT_URC_LINE_LEN];
+  unsigned long int _urcLineLen;
+  Urc _urcQueue[AT_URC_QUEUE_LEN];
+  unsigned int _urcQueueHead;
+  unsigned int _urcQueueCount;
+  unsigned long int _urcDropped;
+  bool _urcDispatching;
+
+  // Receive ring buffer. Indices are free running, bytes received past the end of a response are kept for the next
+  // one.
+  char _rx[AT_RX_BUFFER_SIZE];
+  unsigned long int _rxHead;
+  unsigned long int _rxTail;
 };
 
 #endif /* __AT_INTERFACE_H__ */
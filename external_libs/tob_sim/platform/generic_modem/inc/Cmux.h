@@ -0,0 +1,204 @@
+/*
+ *
+ * Twilio Breakout Trust Onboard SDK
+ *
+ * Copyright (c) 2019 Twilio, Inc.
+ *
+ * SPDX-License-Identifier:  Apache-2.0
+ */
+
+#ifndef __CMUX_H__
+#define __CMUX_H__
+
+#include "Serial.h"
+
+#include <condition_variable>
+#include <mutex>
+#include <thread>
+
+// 3GPP TS 27.010 multiplexer, basic option. The modem is switched into multiplexer mode with AT+CMUX and every
+// DLC (data link connection) then behaves as a serial port of its own: one carries the AT+CSIM traffic, others can
+// be exposed as pseudo-terminals for pppd and friends.
+
+#define CMUX_FLAG 0xF9
+
+// DLCs 1 to CMUX_MAX_CHANNELS - 1 can be opened, DLC 0 is the control channel
+#define CMUX_MAX_CHANNELS 8
+
+// Default and largest supported information field length (N1)
+#define CMUX_DEFAULT_FRAME_SIZE 127
+#define CMUX_MAX_FRAME_SIZE 1024
+
+// Receive buffer of each DLC, flow control asks the modem to pause above 3/4 and to resume below 1/4 of it
+#define CMUX_CHANNEL_BUFFER_SIZE 4096
+
+// Deadline in milliseconds for the modem to acknowledge opening or closing a DLC (T1 is usually much shorter)
+#define CMUX_CONTROL_TIMEOUT 1000
+// Idle time in milliseconds after which the link is probed with a Test message, and how long the answer may take
+#define CMUX_KEEPALIVE_INTERVAL 10000
+#define CMUX_KEEPALIVE_TIMEOUT 3000
+
+// Frame types, control field without the P/F bit
+#define CMUX_SABM 0x2F
+#define CMUX_UA 0x63
+#define CMUX_DM 0x0F
+#define CMUX_DISC 0x43
+#define CMUX_UIH 0xEF
+#define CMUX_PF 0x10
+
+// Control channel message types with EA set, CMUX_MSG_CR marks a command
+#define CMUX_MSG_PN 0x81
+#define CMUX_MSG_CLD 0xC1
+#define CMUX_MSG_TEST 0x21
+#define CMUX_MSG_FCON 0xA1
+#define CMUX_MSG_FCOFF 0x61
+#define CMUX_MSG_MSC 0xE1
+#define CMUX_MSG_NSC 0x11
+#define CMUX_MSG_CR 0x02
+
+// V.24 signals carried by MSC
+#define CMUX_V24_FC 0x02
+#define CMUX_V24_RTC 0x04
+#define CMUX_V24_RTR 0x08
+#define CMUX_V24_DV 0x80
+
+// Largest encoded frame: flags, address, control, two length octets, information field and FCS
+#define CMUX_FRAME_OVERHEAD 7
+
+struct CmuxFrame {
+  uint8_t dlci;
+  uint8_t control;  // Including the P/F bit
+  bool cr;
+  const uint8_t* data;
+  unsigned long int len;
+};
+
+// Byte by byte frame decoder, resynchronises on the next flag after a corrupted frame
+class CmuxDecoder {
+ public:
+  CmuxDecoder(void);
+
+  // Returns true in case byte completed a valid frame, which stays available in frame until the next call.
+  bool feed(uint8_t byte, CmuxFrame* frame);
+
+  void reset(void);
+
+ private:
+  enum State { WAIT_FLAG, ADDRESS, CONTROL, LENGTH, LENGTH2, INFO, FCS, CLOSE };
+
+  State _state;
+  uint8_t _header[4];
+  unsigned long int _headerLen;
+  unsigned long int _len;
+  unsigned long int _got;
+  uint8_t _fcs;
+  uint8_t _info[CMUX_MAX_FRAME_SIZE];
+};
+
+class Cmux {
+ public:
+  // Create a multiplexer on top of serial, which is then owned by the multiplexer
+  Cmux(Serial* serial, unsigned int frameSize = CMUX_DEFAULT_FRAME_SIZE);
+  ~Cmux(void);
+
+  // Switch the modem into multiplexer mode with AT+CMUX, open the control channel and start the background thread
+  // handling framing, flow control and keep-alive.
+  // Returns true in case the multiplexer is up, false otherwise.
+  bool start(void);
+
+  // Close every DLC and the multiplexer, the modem goes back to AT command mode
+  void stop(void);
+
+  // Returns false once the modem closed the multiplexer or stopped answering keep-alives
+  bool isRunning(void);
+
+  // Open DLC dlci and expose it as a pseudo-terminal, whose slave path is copied into name
+  // Returns true in case the channel is open, false otherwise.
+  bool exposeChannel(uint8_t dlci, char* name, unsigned long int size);
+
+  // Encode a frame into out, which must have room for len + CMUX_FRAME_OVERHEAD bytes. Returns the frame length.
+  static unsigned long int encodeFrame(uint8_t dlci, uint8_t control, bool cr, const uint8_t* data,
+                                       unsigned long int len, uint8_t* out);
+
+  // Frame check sequence over the given address, control and length octets
+  static uint8_t fcs(const uint8_t* data, unsigned long int len);
+
+ private:
+  friend class CmuxChannel;
+
+  struct Dlc {
+    bool open;
+    bool waiting;         // SABM or DISC sent, acknowledgement pending
+    uint8_t ack;          // UA or DM received for it
+    bool remoteFlowOff;   // Modem asked us to stop sending on this DLC
+    bool localFlowOff;    // We asked the modem to stop sending on this DLC
+    char rx[CMUX_CHANNEL_BUFFER_SIZE];
+    unsigned long int rxHead;
+    unsigned long int rxTail;
+    unsigned long int dropped;
+    int ptyMaster;
+    int ptySlave;
+  };
+
+  bool openChannel(uint8_t dlci, int timeout);
+  bool closeChannel(uint8_t dlci, int timeout);
+
+  // Send data on dlci in frames of at most the negotiated size, waiting while flow control holds it back
+  bool write(uint8_t dlci, const char* data, unsigned long int len, int timeout);
+  // Take received data of dlci, waiting at most timeout milliseconds for toRead bytes (all set) or for any byte
+  bool read(uint8_t dlci, char* data, unsigned long int toRead, unsigned long int* read, int timeout, bool all);
+
+  bool sendFrame(uint8_t dlci, uint8_t control, bool cr, const uint8_t* data, unsigned long int len);
+  bool sendControl(uint8_t type, const uint8_t* value, unsigned long int len);
+  bool sendFlowControl(uint8_t dlci, bool off);
+
+  void receiveLoop(void);
+  void ptyLoop(void);
+  void handleFrame(const CmuxFrame* frame);
+  void handleControl(const uint8_t* data, unsigned long int len);
+  void wakePtyLoop(void);
+  void fail(void);
+
+  Serial* _serial;
+  unsigned int _frameSize;
+  CmuxDecoder _decoder;
+
+  // Protects everything below, _cond is signalled on any change
+  std::mutex _lock;
+  std::condition_variable _cond;
+  // Serialises frames written to the port
+  std::mutex _writeLock;
+
+  bool _running;
+  bool _flowOff;  // FCoff received, nothing may be sent on any DLC
+  bool _testPending;
+  uint8_t _testSequence;
+  Dlc _dlc[CMUX_MAX_CHANNELS];
+
+  std::thread _rxThread;
+  std::thread _ptyThread;
+  int _wakePipe[2];
+
+  // Encoding buffer of the writer holding _writeLock
+  uint8_t _txFrame[CMUX_MAX_FRAME_SIZE + CMUX_FRAME_OVERHEAD];
+};
+
+// Serial port carried by one DLC of a multiplexer, which must outlive it
+class CmuxChannel : public Serial {
+ public:
+  CmuxChannel(Cmux* mux, uint8_t dlci);
+  ~CmuxChannel(void);
+
+  bool start(void);
+  bool send(char* data, unsigned long int toWrite, unsigned long int* written);
+  bool recv(char* data, unsigned long int toRead, unsigned long int* read);
+  bool recv(char* data, unsigned long int toRead, unsigned long int* read, int timeout);
+  bool recvAvailable(char* data, unsigned long int toRead, unsigned long int* read, int timeout);
+  bool stop(void);
+
+ private:
+  Cmux* _mux;
+  uint8_t _dlci;
+};
+
+#endif /* __CMUX_H__ */
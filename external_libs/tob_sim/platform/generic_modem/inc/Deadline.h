@@ -0,0 +1,40 @@
+/*
+ *
+ * Twilio Breakout Trust Onboard SDK
+ *
+ * Copyright (c) 2019 Twilio, Inc.
+ *
+ * SPDX-License-Identifier:  Apache-2.0
+ */
+
+#ifndef __DEADLINE_H__
+#define __DEADLINE_H__
+
+#include <time.h>
+
+// Compute an absolute deadline timeout milliseconds from now.
+static inline void deadline_after(int timeout, struct timespec* deadline) {
+  clock_gettime(CLOCK_MONOTONIC, deadline);
+  deadline->tv_sec += timeout / 1000;
+  deadline->tv_nsec += (long)(timeout % 1000) * 1000000L;
+  if (deadline->tv_nsec >= 1000000000L) {
+    deadline->tv_sec += 1;
+    deadline->tv_nsec -= 1000000000L;
+  }
+}
+
+// Milliseconds left until the deadline, 0 if it has passed, -1 if there is no deadline.
+static inline int deadline_remaining(const struct timespec* deadline) {
+  struct timespec now;
+  long ms;
+
+  if (deadline == nullptr) {
+    return -1;
+  }
+
+  clock_gettime(CLOCK_MONOTONIC, &now);
+  ms = (deadline->tv_sec - now.tv_sec) * 1000L + (deadline->tv_nsec - now.tv_nsec + 999999L) / 1000000L;
+  return (ms > 0) ? (int)ms : 0;
+}
+
+#endif /* __DEADLINE_H__ */
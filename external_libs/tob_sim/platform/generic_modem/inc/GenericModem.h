@@ -13,27 +13,182 @@
 #include "ATInterface.h"
 #include "SEInterface.h"
 
+// Deadline in milliseconds for each command of the session bootstrap
+#define MODEM_BOOTSTRAP_TIMEOUT 1000
+
+// Baud rate asking GenericModem to negotiate the fastest line speed the modem and the host support
+#define MODEM_BAUDRATE_AUTO 0
+// Line speed an automatically negotiated link starts from, the usual factory setting
+#define MODEM_BAUDRATE_DEFAULT 115200
+// Number of AT probes, and the deadline in milliseconds for each of them, checking a link after a speed change
+#define MODEM_BAUDRATE_CHECKS 3
+#define MODEM_BAUDRATE_CHECK_TIMEOUT 200
+
+// Logical channels 1 to MODEM_MAX_LOGICAL_CHANNEL can be coded into CLA, as per ISO/IEC 7816-4
+#define MODEM_MAX_LOGICAL_CHANNEL 19
+
+// Milliseconds between two attempts at opening a port which came back while the module is still booting
+#define MODEM_RECONNECT_RETRY 500
+
+// Recoveries from a port which went away, see ModemProfile::reconnectTimeout
+typedef struct {
+  // The port came back and the channel state was restored
+  unsigned int recoveries;
+  // Gave up waiting, the exchange in flight failed
+  unsigned int failures;
+  // Microseconds from the failed exchange to the restored state, last recovery and all of them
+  uint32_t last_us;
+  uint64_t total_us;
+} modem_recovery_stats_t;
+
 #ifdef __cplusplus
 
+// AT session settings applied by GenericModem::open() before the first APDU. The defaults keep every byte that is
+// not part of an AT+CSIM response off the wire.
+struct ModemProfile {
+  // Leave command echo on (ATE1) instead of turning it off (ATE0)
+  bool echo = false;
+  // AT+CMEE=<n>: 0 plain ERROR, 1 numeric +CME ERROR, 2 verbose +CME ERROR, -1 keeps the modem setting
+  int cmee = 1;
+  // Leave network registration URCs (+CREG, +CGREG, +CEREG) enabled on this port
+  bool urcs = false;
+  // Additional commands sent last, e.g. vendor URC routing. nullptr terminated, nullptr for none.
+  const char* const* commands = nullptr;
+  // Switch the link to the fastest rate both ends support (AT+IPR), falling back to the current one if the faster
+  // link does not work. Ignored on ports without a line speed, like USB CDC ACM.
+  bool autoBaudrate = false;
+  // Let the modem manage logical channels (AT+CCHO, AT+CGLA, AT+CCHC) when it supports them, opening a channel and
+  // selecting the applet in one command instead of MANAGE CHANNEL and SELECT through AT+CSIM
+  bool logicalChannels = true;
+  // Check with AT+CCHO=? and AT+CGLA=? that the modem supports logical channels. Drivers of modules known to support
+  // them skip it, a failing AT+CCHO still falls back to MANAGE CHANNEL.
+  bool probeLogicalChannels = true;
+  // Guard time in milliseconds between a response and the next command, for modules which need one
+  int commandDelay = 0;
+  // Send the next READ BINARY of a file read before the response to the previous one is in, if the modem passes the
+  // check that it queues commands received while busy. Never used together with a command delay.
+  bool pipelining = false;
+  // Milliseconds to wait for the port to come back when the modem drops off the bus, e.g. a USB module
+  // re-enumerating after a reset. The session and the channel state are then restored and the exchange in flight
+  // retried once. 0 gives up right away.
+  int reconnectTimeout = 30000;
+};
+
 class GenericModem : public SEInterface {
  public:
-  // Create an instance of Generic Modem.
+  // Create an instance of Generic Modem. MODEM_BAUDRATE_AUTO as baudrate enables ModemProfile::autoBaudrate.
   GenericModem(const char* device, int baudrate = 115200);
+  // Create an instance of Generic Modem on top of an already created serial port, which is then owned by the modem.
+  GenericModem(Serial* serial);
   ~GenericModem(void);
 
-  bool open(void) override {
-    return _at.open();
+  bool open(void) override;
+  void close(void) override;
+
+  // AT channel to the modem, e.g. to register URC handlers on it
+  ATInterface& getATInterface(void) {
+    return _at;
+  }
+
+  // Line speed the link runs at, 0 in case the port has none
+  int getBaudrate(void) {
+    return _serial->getBaudrate();
+  }
+
+  // Replace the session settings, takes effect on the next open()
+  void setProfile(const ModemProfile& profile) {
+    _profile = profile;
+  }
+
+  const ModemProfile& getProfile(void) {
+    return _profile;
+  }
+
+  // Returns true in case logical channels are opened with AT+CCHO for this session
+  bool hasLogicalChannels(void) {
+    return _logicalChannels;
   }
 
-  void close(void) override {
-    _at.close();
+  // Returns true in case file reads are pipelined for this session
+  bool hasPipelining(void) {
+    return _pipelining;
+  }
+
+  bool openLogicalChannel(const uint8_t* aid, uint16_t aidLen, uint8_t* channel) override;
+  bool closeLogicalChannel(uint8_t channel) override;
+
+  // The serial port itself, for ports with a descriptor (LSerial)
+  int getPollFd(void) override {
+    return _serial->getFd();
+  }
+
+  int getPollTimeout(void) override {
+    return _at.getPendingTimeout();
+  }
+
+  // Pipelined when the session allows it, the rest of the file being read in lock-step after any error
+  bool readBinary(uint8_t cla, uint16_t offset, uint16_t size, uint8_t chunk, uint8_t* data,
+                  uint16_t* readLen) override;
+
+  const modem_recovery_stats_t& getRecoveryStats(void) {
+    return _recoveryStats;
   }
 
  protected:
   bool transmitApdu(uint8_t* apdu, uint16_t apduLen, uint8_t* response, uint16_t* responseLen) override;
+  bool startApdu(uint8_t* apdu, uint16_t apduLen, uint8_t* response) override;
+  bool pollApdu(uint16_t* responseLen, bool* done) override;
 
- private:
+  // Session of the channel coded into the CLA of apdu when the modem opened it with AT+CCHO, -1 otherwise
+  long int getSession(const uint8_t* apdu);
+
+  // AT+CSIM or AT+CGLA depending on the channel, nothing else
+  bool exchange(uint8_t* apdu, uint16_t apduLen, uint8_t* response, uint16_t* responseLen);
+
+  // Keep the commands which brought a channel to its current state: applet and file selection
+  void recordState(const uint8_t* apdu, uint16_t apduLen, const uint8_t* response, uint16_t responseLen);
+  void clearState(uint8_t channel);
+
+  // Wait for a lost port to come back, open the session again and restore the channels with their state
+  // Returns true in case the session is back, false in case the port did not come back in time.
+  bool recover(void);
+  void restoreChannels(uint32_t logicalChannels, uint32_t managedChannels);
+
+  // Apply the session profile, returns false in case the modem does not answer AT commands
+  bool bootstrap(void);
+
+  // Move the link to the fastest rate advertised by AT+IPR=? which works, returns false in case the modem was lost
+  bool negotiateBaudrate(void);
+  // Ask the modem to switch to baudrate, follow it and check the link. With force the host follows even if the
+  // modem did not acknowledge, to recover from a link that stopped working.
+  bool switchBaudrate(int baudrate, bool force);
+  // Find the rate a modem left at a negotiated speed by an earlier session is running at
+  bool findBaudrate(void);
+
+  Serial* _serial;
   ATInterface _at;
+  ModemProfile _profile;
+  // Rate the first open() found the link at, every session starts from it and close() leaves the modem there
+  int _initialBaudrate = 0;
+  bool _logicalChannels = false;
+  bool _pipelining      = false;
+  // Channels opened with AT+CCHO, bit n set for channel n
+  uint32_t _openChannels = 0;
+  // Channels opened with MANAGE CHANNEL through AT+CSIM
+  uint32_t _managedChannels = 0;
+
+  struct ChannelState {
+    // AID given to AT+CCHO
+    uint8_t aid[AT_MAX_AID_LEN];
+    uint16_t aidLen;
+    // Last SELECT by AID and of a file which went through
+    uint8_t select[AT_MAX_APDU_LEN];
+    uint16_t selectLen;
+    uint8_t file[AT_MAX_APDU_LEN];
+    uint16_t fileLen;
+  };
+  ChannelState _channelState[MODEM_MAX_LOGICAL_CHANNEL + 1];
+  modem_recovery_stats_t _recoveryStats;
 };
 
 #else /* __cplusplus */
@@ -41,6 +196,7 @@ class GenericModem : public SEInterface {
 SEInterface* GenericModem_create(const char* device, int baudrate);
 void GenericModem_destroy(SEInterface* iface);
 int GenericModem_open(SEInterface* iface);
+void GenericModem_get_recovery_stats(SEInterface* iface, modem_recovery_stats_t* stats);
 
 #endif /* __cplusplus */
 
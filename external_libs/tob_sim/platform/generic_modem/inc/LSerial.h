@@ -12,6 +12,8 @@
 
 #include "Serial.h"
 
+#include <time.h>
+
 class LSerial : public Serial {
  public:
   // Create an instance of WSerial.
@@ -21,12 +23,40 @@ class LSerial : public Serial {
   bool start(void);
   bool send(char* data, unsigned long int toWrite, unsigned long int* written);
   bool recv(char* data, unsigned long int toRead, unsigned long int* read);
+  bool recv(char* data, unsigned long int toRead, unsigned long int* read, int timeout);
+  bool recvAvailable(char* data, unsigned long int toRead, unsigned long int* read, int timeout);
   bool stop(void);
+  bool drain(void);
+
+  bool setBaudrate(int baudrate);
+  bool supportsBaudrate(int baudrate);
+  int getBaudrate(void) {
+    return _baudrate;
+  }
+  int getFd(void) {
+    return m_uart;
+  }
+
+  bool isLost(void) {
+    return _lost;
+  }
+
+  // Watches the directory of the device with inotify, udev creating the node and then fixing its permissions
+  bool waitForDevice(int timeout);
 
  private:
+  // Block in poll() until the port is ready for the requested events or the deadline expires.
+  // Returns true in case the port is ready, false on timeout or error.
+  bool waitFor(short events, const struct timespec* deadline);
+  // Note whether errno, after a failed read or write, means the device is gone
+  void checkLost(void);
+
   char* _device = nullptr;
   int _baudrate = 0;
   int32_t m_uart;
+  bool _usbCdc = false;
+  // Hung up or failing with EIO since started
+  bool _lost = false;
 };
 
 #endif /* __LSERIAL_H__ */
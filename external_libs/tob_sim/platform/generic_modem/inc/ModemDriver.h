@@ -0,0 +1,67 @@
+/*
+ *
+ * Twilio Breakout Trust Onboard SDK
+ *
+ * Copyright (c) 2019 Twilio, Inc.
+ *
+ * SPDX-License-Identifier:  Apache-2.0
+ */
+
+#ifndef __MODEM_DRIVER_H__
+#define __MODEM_DRIVER_H__
+
+#include "GenericModem.h"
+
+// Drivers which can be added on top of the built-in ones
+#define MODEM_MAX_DRIVERS 8
+
+// Longest manufacturer or model identification kept by the probe, terminating zero included
+#define MODEM_IDENTITY_LEN 48
+
+// Guard time u-blox asks for between a response and the next command, in milliseconds
+#define UBLOX_COMMAND_DELAY 20
+
+// A module family, recognised by its AT+CGMI manufacturer and AT+CGMM model identification
+struct ModemDriver {
+  const char* name;
+  // Case insensitive prefix of the manufacturer identification, nullptr matches any
+  const char* manufacturer;
+  // Case insensitive prefix of the model identification, nullptr matches any
+  const char* model;
+  // Create the SE interface of a modem on serial, which it then owns
+  GenericModem* (*create)(Serial* serial);
+};
+
+class ModemRegistry {
+ public:
+  // Add a driver, which takes precedence over the built-in ones and over those added before.
+  // Returns false in case the registry is full.
+  static bool add(const ModemDriver* driver);
+
+  // Identify the modem on serial and return the first driver matching it, the GenericModem one in case none does or
+  // the modem does not answer. manufacturer and model receive the identification, MODEM_IDENTITY_LEN bytes each.
+  static const ModemDriver* probe(Serial* serial, char* manufacturer, char* model);
+
+  // Probe the modem on serial and create it with its driver. serial is then owned by the returned modem.
+  static GenericModem* create(Serial* serial);
+};
+
+// Quectel modules know AT+CCHO/AT+CGLA/AT+CCHC, the capability probe is skipped
+class QuectelModem : public GenericModem {
+ public:
+  QuectelModem(Serial* serial);
+};
+
+// u-blox modules want a guard time between commands and know AT+CCHO/AT+CGLA/AT+CCHC
+class UbloxModem : public GenericModem {
+ public:
+  UbloxModem(Serial* serial);
+};
+
+// SIMCom modules know AT+CCHO/AT+CGLA/AT+CCHC, the capability probe is skipped
+class SimcomModem : public GenericModem {
+ public:
+  SimcomModem(Serial* serial);
+};
+
+#endif /* __MODEM_DRIVER_H__ */
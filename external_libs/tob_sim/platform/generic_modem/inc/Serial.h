@@ -12,6 +12,9 @@
 
 #include <stdint.h>
 
+// Default deadline in milliseconds applied to blocking serial operations.
+#define SERIAL_DEFAULT_TIMEOUT 5000
+
 class Serial {
  public:
   Serial(void);
@@ -21,6 +24,66 @@ class Serial {
   virtual bool send(char* data, unsigned long int toWrite, unsigned long int* written) = 0;
   virtual bool recv(char* data, unsigned long int toRead, unsigned long int* read)     = 0;
   virtual bool stop(void)                                                              = 0;
+
+  // Receive exactly toRead bytes, waiting at most timeout milliseconds for all of them (negative means forever).
+  // read is set to the number of bytes actually received, which is less than toRead on timeout.
+  // Returns true in case all the bytes were received, false otherwise.
+  virtual bool recv(char* data, unsigned long int toRead, unsigned long int* read, int timeout) = 0;
+
+  // Receive whatever is pending on the port, up to toRead bytes, in a single read, waiting at most timeout
+  // milliseconds for the first byte to arrive.
+  // Returns true in case at least one byte was received, false otherwise.
+  virtual bool recvAvailable(char* data, unsigned long int toRead, unsigned long int* read, int timeout) = 0;
+
+  // Change the line speed of the started port. Returns true in case the port now runs at baudrate, false otherwise.
+  virtual bool setBaudrate(int baudrate) {
+    return false;
+  }
+
+  // Returns true in case the port has a line speed and the host can run it at baudrate. USB CDC ACM ports have none.
+  virtual bool supportsBaudrate(int baudrate) {
+    return false;
+  }
+
+  // Configured line speed, 0 in case the port has no notion of one.
+  virtual int getBaudrate(void) {
+    return 0;
+  }
+
+  // Wait until everything sent left the port, for ports which buffer writes.
+  // Returns false in case the port failed, true otherwise.
+  virtual bool drain(void) {
+    return true;
+  }
+
+  // Returns true in case the device behind the started port went away, e.g. a USB modem re-enumerating after a reset.
+  // The port then has to be stopped and started again once waitForDevice() saw it come back.
+  virtual bool isLost(void) {
+    return false;
+  }
+
+  // Wait at most timeout milliseconds for the device of a lost port to be back and ready to be opened.
+  // Returns true in case start() can be called, false otherwise.
+  virtual bool waitForDevice(int timeout) {
+    return false;
+  }
+
+  // Descriptor to poll for input when waiting in an event loop, -1 in case the port has none.
+  virtual int getFd(void) {
+    return -1;
+  }
+
+  // Deadline in milliseconds used by the calls which don't take one explicitly.
+  void setTimeout(int timeout) {
+    _timeout = timeout;
+  }
+
+  int getTimeout(void) {
+    return _timeout;
+  }
+
+ protected:
+  int _timeout;
 };
 
 #endif /* __SERIAL_H__ */
@@ -8,20 +8,75 @@
  */
 
 #include "ATInterface.h"
+#include "Deadline.h"
+#include "HexCodec.h"
 #include <cstdio>
 #include <cstdlib>
 #include <cstring>
 
+#include <unistd.h>
+
 //#define AT_DEBUG
 
+// Write value in decimal into out without a terminating zero, returns the number of characters written.
+static unsigned long int formatDecimal(unsigned int value, char* out) {
+  char digits[10];
+  unsigned long int n = 0;
+  unsigned long int i;
+
+  do {
+    digits[n++] = '0' + (value % 10);
+    value /= 10;
+  } while (value);
+
+  for (i = 0; i < n; i++) {
+    out[i] = digits[n - 1 - i];
+  }
+
+  return n;
+}
+
+// Final result codes, the ones ending in a space are followed by an error code
+static const struct {
+  const char* text;
+  ATResult result;
+} finalResultCodes[] = {
+    {"OK\r\n", AT_RESULT_OK},
+    {"ERROR\r\n", AT_RESULT_ERROR},
+    {"+CME ERROR: ", AT_RESULT_CME_ERROR},
+    {"+CMS ERROR: ", AT_RESULT_CMS_ERROR},
+    {"NO CARRIER\r\n", AT_RESULT_ERROR},
+    {"BUSY\r\n", AT_RESULT_ERROR},
+    {"NO ANSWER\r\n", AT_RESULT_ERROR},
+    {"NO DIALTONE\r\n", AT_RESULT_ERROR},
+};
+
 ATInterface::ATInterface(Serial* serial) {
-  _serial = serial;
+  _serial          = serial;
+  _timer           = NULL;
+  _rxHead          = 0;
+  _rxTail          = 0;
+  _urcHandlerCount = 0;
+  _urcLineLen      = 0;
+  _urcQueueHead    = 0;
+  _urcQueueCount   = 0;
+  _urcDropped      = 0;
+  _urcDispatching  = false;
+  _commandDelay    = 0;
+  _pending         = false;
+  _parser.state    = PARSER_DONE;
+  deadline_after(0, &_nextCommand);
+  parseBegin(NULL, NULL, 0);
 }
 
 ATInterface::~ATInterface(void) {
 }
 
 bool ATInterface::open(void) {
+  _rxHead        = 0;
+  _rxTail        = 0;
+  _urcQueueCount = 0;
+  _parser.state  = PARSER_DONE;
   return _serial->start();
 }
 
@@ -29,74 +84,594 @@ void ATInterface::close(void) {
   _serial->stop();
 }
 
-bool ATInterface::bytesArray2HexString(uint8_t* bytes, uint16_t bytesLen, uint8_t* hexstr, uint16_t* hexstrLen) {
-  const uint8_t* hex = (const uint8_t*)"0123456789ABCDEF";
-  uint16_t i;
+bool ATInterface::fill(int timeout) {
+  unsigned long int start;
+  unsigned long int room;
+  unsigned long int read;
+
+  // Only the contiguous free area after the tail is filled, the next call picks up the wrapped part
+  start = _rxTail & (AT_RX_BUFFER_SIZE - 1);
+  room  = AT_RX_BUFFER_SIZE - (_rxTail - _rxHead);
+  if (room > AT_RX_BUFFER_SIZE - start) {
+    room = AT_RX_BUFFER_SIZE - start;
+  }
+
+  if (room == 0) {
+    return false;
+  }
 
-  *hexstrLen = 0;
-  for (i = 0; i < bytesLen; i++, *hexstrLen += 2) {
-    *hexstr = hex[(bytes[i] >> 4) & 0xF];
-    hexstr++;
-    *hexstr = hex[bytes[i] & 0xF];
-    hexstr++;
+  if (!_serial->recvAvailable(&_rx[start], room, &read, timeout)) {
+    return false;
   }
 
+  _rxTail += read;
+  if (_timer != NULL) {
+    _timer->received(read);
+  }
   return true;
 }
 
-bool ATInterface::hexString2BytesArray(uint8_t* hexstr, uint16_t hexstrLen, uint8_t* bytes, uint16_t* bytesLen) {
-  uint8_t d;
-  uint16_t i, j;
+bool ATInterface::readResponse(const char* prefix, uint8_t* data, unsigned long int size, unsigned long int* len,
+                               int timeout, bool text) {
+  struct timespec deadline;
 
-  *bytesLen = 0;
-  for (i = 0; i < hexstrLen; *bytesLen += 1) {
-    d = 0;
-    for (j = i + 2; i < j; i++) {
-      d <<= 4;
-      if ((hexstr[i] >= '0') && (hexstr[i] <= '9')) {
-        d |= hexstr[i] - '0';
-      } else if ((hexstr[i] >= 'a') && (hexstr[i] <= 'f')) {
-        d |= hexstr[i] - 'a' + 10;
-      } else if ((hexstr[i] >= 'A') && (hexstr[i] <= 'F')) {
-        d |= hexstr[i] - 'A' + 10;
-      }
+  deadline_after(timeout, &deadline);
+  parseBegin(prefix, data, size, text);
+
+  // Every byte is consumed as soon as it is read, so decoding overlaps with the rest of the response arriving
+  while (!parseStep()) {
+    if (!fill((timeout < 0) ? -1 : deadline_remaining(&deadline))) {
+      break;
     }
-    *bytes = d;
-    bytes++;
   }
 
-  return true;
+  return parseEnd(len);
 }
 
-bool ATInterface::readLine(char* data, unsigned long int* len) {
-  unsigned long int off;
-  unsigned long int read;
+bool ATInterface::parseEnd(unsigned long int* len) {
+  deadline_after(_commandDelay, &_nextCommand);
+  *len = 0;
 
-  off  = 0;
-  read = 0;
-  do {
-    if (!_serial->recv(&data[off], 1, &read)) {
+  // Still AT_RESULT_TIMEOUT without a final result code
+  if (_parser.result != AT_RESULT_OK) {
+    return false;
+  }
+
+  if (_parser.prefix != NULL) {
+    if (!_parser.received || _parser.malformed) {
       return false;
     }
-    if (read) {
-      off += read;
-      if (data[off - 1] == '\n') {
-        break;
+    *len = _parser.outLen;
+  }
+
+  return true;
+}
+
+void ATInterface::parseBegin(const char* prefix, uint8_t* out, unsigned long int size, bool text) {
+  // A line started before, e.g. a URC only partly received by pollUrcs(), is finished first
+  if ((_parser.state != PARSER_LINE_START) && (_parser.state != PARSER_SKIP_LINE) && (_parser.state != PARSER_URC)) {
+    _parser.state   = PARSER_LINE_START;
+    _parser.headLen = 0;
+  }
+
+  _parser.prefix    = prefix;
+  _parser.prefixLen = (prefix != NULL) ? strlen(prefix) : 0;
+  _parser.text      = text;
+  _parser.idle      = false;
+  _parser.out       = out;
+  _parser.outSize   = size;
+  _parser.outLen    = 0;
+  _parser.hexLen    = 0;
+  _parser.hexDone   = 0;
+  _parser.received  = false;
+  _parser.malformed = false;
+  _parser.result    = AT_RESULT_TIMEOUT;
+  _parser.errorCode = -1;
+}
+
+bool ATInterface::parseStep(void) {
+  unsigned long int start;
+  unsigned long int avail;
+
+  while ((_rxHead != _rxTail) && (_parser.state != PARSER_DONE)) {
+    start = _rxHead & (AT_RX_BUFFER_SIZE - 1);
+    avail = _rxTail - _rxHead;
+    if (avail > AT_RX_BUFFER_SIZE - start) {
+      avail = AT_RX_BUFFER_SIZE - start;
+    }
+
+    _rxHead += parseChar(&_rx[start], avail);
+  }
+
+  return _parser.state == PARSER_DONE;
+}
+
+// True in case head could still grow into candidate
+static bool startsLike(const char* candidate, const char* head, unsigned long int headLen) {
+  return (strlen(candidate) >= headLen) && (memcmp(candidate, head, headLen) == 0);
+}
+
+bool ATInterface::otherLine(bool* candidate) {
+  static const char* const echoes[] = {"AT", "at"};
+  unsigned long int len;
+  unsigned int i;
+
+  for (i = 0; i < sizeof(echoes) / sizeof(echoes[0]); i++) {
+    if ((_parser.headLen >= 2) && (memcmp(_parser.head, echoes[i], 2) == 0)) {
+      return true;
+    }
+    *candidate = *candidate || startsLike(echoes[i], _parser.head, _parser.headLen);
+  }
+
+  for (i = 0; i < _urcHandlerCount; i++) {
+    len = strlen(_urcHandlers[i].prefix);
+    if ((_parser.headLen >= len) && (memcmp(_parser.head, _urcHandlers[i].prefix, len) == 0)) {
+      return true;
+    }
+    *candidate = *candidate || startsLike(_urcHandlers[i].prefix, _parser.head, _parser.headLen);
+  }
+
+  return false;
+}
+
+void ATInterface::parseLineStart(char c) {
+  unsigned long int len;
+  unsigned int i;
+  bool candidate;
+
+  if (_parser.headLen < sizeof(_parser.head)) {
+    _parser.head[_parser.headLen++] = c;
+  }
+
+  if ((_parser.prefix != NULL) && (_parser.headLen == _parser.prefixLen) &&
+      (memcmp(_parser.head, _parser.prefix, _parser.prefixLen) == 0)) {
+    _parser.state  = _parser.text ? PARSER_TEXT : PARSER_LENGTH;
+    _parser.hexLen = 0;
+    _parser.outLen = 0;
+    return;
+  }
+
+  candidate = (_parser.prefix != NULL) && startsLike(_parser.prefix, _parser.head, _parser.headLen);
+
+  for (i = 0; !_parser.idle && (i < sizeof(finalResultCodes) / sizeof(finalResultCodes[0])); i++) {
+    len = strlen(finalResultCodes[i].text);
+    if ((_parser.headLen == len) && (memcmp(_parser.head, finalResultCodes[i].text, len) == 0)) {
+      _parser.result = finalResultCodes[i].result;
+      if (finalResultCodes[i].text[len - 1] == ' ') {
+        _parser.state     = PARSER_ERROR_CODE;
+        _parser.errorCode = 0;
+      } else {
+        _parser.state = PARSER_DONE;
       }
+      return;
     }
-  } while (1);
+    candidate = candidate || startsLike(finalResultCodes[i].text, _parser.head, _parser.headLen);
+  }
+
+  // The response of an empty prefix is the first line which cannot be a final result code, the command's echo or a URC
+  if ((_parser.prefix != NULL) && (_parser.prefixLen == 0) && !_parser.received && !otherLine(&candidate) &&
+      !candidate && (c != '\r') && (c != '\n')) {
+    _parser.outLen = (_parser.headLen < _parser.outSize) ? _parser.headLen : _parser.outSize;
+    memcpy(_parser.out, _parser.head, _parser.outLen);
+    _parser.state = PARSER_TEXT;
+    return;
+  }
 
-  *len = off;
+  if (c == '\n') {
+    // Empty line, or a short one matching nothing
+    if ((_parser.headLen > 2) && (_urcHandlerCount > 0)) {
+      memcpy(_urcLine, _parser.head, _parser.headLen);
+      _urcLineLen = _parser.headLen - 1;
+      parseUrc();
+    }
+    _parser.headLen = 0;
+    return;
+  }
+
+  // Echo, URCs and anything else nobody waits for. The start of the line was already consumed, it is kept for the
+  // URC handlers in case there are some.
+  if (!candidate) {
+    if (_urcHandlerCount > 0) {
+      memcpy(_urcLine, _parser.head, _parser.headLen);
+      _urcLineLen   = _parser.headLen;
+      _parser.state = PARSER_URC;
+    } else {
+      _parser.state = PARSER_SKIP_LINE;
+    }
+  }
+}
+
+void ATInterface::parseUrc(void) {
+  unsigned long int len;
+  unsigned int i;
+  Urc* urc;
+
+  if ((_urcLineLen > 0) && (_urcLine[_urcLineLen - 1] == '\r')) {
+    _urcLineLen--;
+  }
+  _urcLine[_urcLineLen] = '\0';
+
+  // Command echo
+  if ((_urcLineLen >= 2) && ((strncmp(_urcLine, "AT", 2) == 0) || (strncmp(_urcLine, "at", 2) == 0))) {
+    return;
+  }
+
+  for (i = 0; i < _urcHandlerCount; i++) {
+    len = strlen(_urcHandlers[i].prefix);
+    if ((_urcLineLen >= len) && (memcmp(_urcLine, _urcHandlers[i].prefix, len) == 0)) {
+      break;
+    }
+  }
+
+  if (i == _urcHandlerCount) {
+    return;
+  }
+
+  if (_urcQueueCount == AT_URC_QUEUE_LEN) {
+    _urcDropped++;
+    return;
+  }
+
+  urc          = &_urcQueue[(_urcQueueHead + _urcQueueCount) % AT_URC_QUEUE_LEN];
+  urc->handler = i;
+  memcpy(urc->line, _urcLine, _urcLineLen + 1);
+  _urcQueueCount++;
+}
+
+bool ATInterface::addUrcHandler(const char* prefix, ATUrcHandler handler, void* arg) {
+  if (_urcHandlerCount == AT_MAX_URC_HANDLERS) {
+    return false;
+  }
+
+  _urcHandlers[_urcHandlerCount].prefix  = prefix;
+  _urcHandlers[_urcHandlerCount].handler = handler;
+  _urcHandlers[_urcHandlerCount].arg     = arg;
+  _urcHandlerCount++;
   return true;
 }
 
+void ATInterface::removeUrcHandler(const char* prefix) {
+  unsigned int i, j;
+
+  for (i = 0; i < _urcHandlerCount;) {
+    if (strcmp(_urcHandlers[i].prefix, prefix) != 0) {
+      i++;
+      continue;
+    }
+
+    // Queued URCs of this handler are dropped, the others follow their handler down the table
+    for (j = 0; j < _urcQueueCount; j++) {
+      Urc* urc = &_urcQueue[(_urcQueueHead + j) % AT_URC_QUEUE_LEN];
+      if (urc->handler == i) {
+        urc->handler = AT_MAX_URC_HANDLERS;
+      } else if ((urc->handler > i) && (urc->handler != AT_MAX_URC_HANDLERS)) {
+        urc->handler--;
+      }
+    }
+
+    memmove(&_urcHandlers[i], &_urcHandlers[i + 1], (_urcHandlerCount - i - 1) * sizeof(_urcHandlers[0]));
+    _urcHandlerCount--;
+  }
+}
+
+int ATInterface::dispatchUrcs(void) {
+  ATResult result;
+  int errorCode;
+  int n;
+  Urc urc;
+
+  // Handlers sending commands end up here again, the outer call keeps going through the queue
+  if (_urcDispatching) {
+    return 0;
+  }
+
+  _urcDispatching = true;
+  result          = _parser.result;
+  errorCode       = _parser.errorCode;
+
+  for (n = 0; _urcQueueCount > 0;) {
+    urc           = _urcQueue[_urcQueueHead];
+    _urcQueueHead = (_urcQueueHead + 1) % AT_URC_QUEUE_LEN;
+    _urcQueueCount--;
+
+    if (urc.handler < _urcHandlerCount) {
+      _urcHandlers[urc.handler].handler(urc.line, _urcHandlers[urc.handler].arg);
+      n++;
+    }
+  }
+
+  // What the caller sees is the outcome of its own command
+  _parser.result    = result;
+  _parser.errorCode = errorCode;
+  _urcDispatching   = false;
+  return n;
+}
+
+int ATInterface::pollUrcs(int timeout) {
+  ATResult result;
+  int errorCode;
+
+  if (_urcQueueCount == 0) {
+    result            = _parser.result;
+    errorCode         = _parser.errorCode;
+    parseBegin(NULL, NULL, 0);
+    _parser.idle      = true;
+    _parser.result    = result;
+    _parser.errorCode = errorCode;
+
+    // Whatever arrived since the last command first, then wait for more
+    parseStep();
+    if (_urcQueueCount == 0 && fill(timeout)) {
+      parseStep();
+    }
+  }
+
+  return dispatchUrcs();
+}
+
+// Consume bytes from data, returns how many. Runs of payload and of skipped lines are consumed in bulk, everything
+// else one character at a time.
+unsigned long int ATInterface::parseChar(const char* data, unsigned long int avail) {
+  const char* nl;
+  char pair[2];
+  unsigned long int n;
+  unsigned long int run;
+
+  switch (_parser.state) {
+    case PARSER_LINE_START:
+      parseLineStart(data[0]);
+      return 1;
+
+    case PARSER_SKIP_LINE:
+      nl = (const char*)memchr(data, '\n', avail);
+      if (nl == NULL) {
+        return avail;
+      }
+      _parser.state   = PARSER_LINE_START;
+      _parser.headLen = 0;
+      return (unsigned long int)(nl - data) + 1;
+
+    case PARSER_LENGTH:
+      if ((data[0] >= '0') && (data[0] <= '9')) {
+        _parser.hexLen = _parser.hexLen * 10 + (data[0] - '0');
+        if (_parser.hexLen > 2 * _parser.outSize) {
+          _parser.malformed = true;
+          _parser.state     = PARSER_SKIP_LINE;
+        }
+        return 1;
+      }
+      if ((data[0] == ',') && ((_parser.hexLen & 1) == 0)) {
+        _parser.state = PARSER_QUOTE;
+        return 1;
+      }
+      // Let the rest of the line, including this character, be skipped
+      _parser.malformed = true;
+      _parser.state     = PARSER_SKIP_LINE;
+      return 0;
+
+    case PARSER_QUOTE:
+      _parser.hexDone = 0;
+      _parser.outLen  = 0;
+      if (_parser.hexLen == 0) {
+        _parser.received = true;
+        _parser.state    = PARSER_SKIP_LINE;
+        return 0;
+      }
+      _parser.state = PARSER_HEX;
+      return (data[0] == '"') ? 1 : 0;
+
+    case PARSER_HEX:
+      n = 0;
+
+      // Complete a byte whose first digit came with the previous read
+      if (_parser.hexDone & 1) {
+        pair[0] = _parser.pendingHex;
+        pair[1] = data[0];
+        if (!tob_hex_decode(pair, 2, &_parser.out[_parser.hexDone / 2])) {
+          _parser.malformed = true;
+          _parser.state     = PARSER_SKIP_LINE;
+          return 0;
+        }
+        _parser.hexDone++;
+        n = 1;
+      }
+
+      run = avail - n;
+      if (run > _parser.hexLen - _parser.hexDone) {
+        run = _parser.hexLen - _parser.hexDone;
+      }
+      run &= ~1UL;
+
+      if ((run > 0) && !tob_hex_decode(&data[n], run, &_parser.out[_parser.hexDone / 2])) {
+        _parser.malformed = true;
+        _parser.state     = PARSER_SKIP_LINE;
+        return n;
+      }
+      _parser.hexDone += run;
+      n += run;
+
+      if ((_parser.hexDone < _parser.hexLen) && (n < avail)) {
+        _parser.pendingHex = data[n];
+        _parser.hexDone++;
+        n++;
+      }
+
+      if (_parser.hexDone == _parser.hexLen) {
+        _parser.outLen   = _parser.hexLen / 2;
+        _parser.received = true;
+        _parser.state    = PARSER_SKIP_LINE;
+      }
+      return n;
+
+    case PARSER_TEXT:
+      nl  = (const char*)memchr(data, '\n', avail);
+      run = (nl != NULL) ? (unsigned long int)(nl - data) : avail;
+      n   = run;
+      if (run > _parser.outSize - _parser.outLen) {
+        run = _parser.outSize - _parser.outLen;
+      }
+      memcpy(&_parser.out[_parser.outLen], data, run);
+      _parser.outLen += run;
+
+      if (nl != NULL) {
+        // The <CR> terminating the line is not part of the response
+        if ((_parser.outLen > 0) && (_parser.out[_parser.outLen - 1] == '\r')) {
+          _parser.outLen--;
+        }
+        _parser.received = true;
+        _parser.state    = PARSER_LINE_START;
+        _parser.headLen  = 0;
+        n++;
+      }
+      return n;
+
+    case PARSER_ERROR_CODE:
+      if (data[0] == '\n') {
+        _parser.state = PARSER_DONE;
+      } else if ((data[0] >= '0') && (data[0] <= '9') && (_parser.errorCode >= 0) && (_parser.errorCode < 100000)) {
+        _parser.errorCode = _parser.errorCode * 10 + (data[0] - '0');
+      } else if (data[0] != '\r') {
+        // Verbose error text, AT+CMEE=2
+        _parser.errorCode = -1;
+      }
+      return 1;
+
+    case PARSER_URC:
+      nl  = (const char*)memchr(data, '\n', avail);
+      run = (nl != NULL) ? (unsigned long int)(nl - data) : avail;
+      n   = run;
+      if (run > sizeof(_urcLine) - 1 - _urcLineLen) {
+        run = sizeof(_urcLine) - 1 - _urcLineLen;
+      }
+      memcpy(&_urcLine[_urcLineLen], data, run);
+      _urcLineLen += run;
+
+      if (nl != NULL) {
+        parseUrc();
+        _parser.state   = PARSER_LINE_START;
+        _parser.headLen = 0;
+        n++;
+      }
+      return n;
+
+    case PARSER_DONE:
+      break;
+  }
+
+  return 0;
+}
+
+void ATInterface::waitCommandDelay(void) {
+  int remaining;
+
+  if ((_commandDelay > 0) && ((remaining = deadline_remaining(&_nextCommand)) > 0)) {
+    usleep(remaining * 1000);
+  }
+}
+
+bool ATInterface::sendLine(const char* command) {
+  unsigned long int off, len;
+
+  off = strlen(command);
+  if (off > sizeof(_cmd) - 2) {
+    return false;
+  }
+
+  memcpy(_cmd, command, off);
+  _cmd[off++] = '\r';
+  _cmd[off++] = '\n';
+
+  waitCommandDelay();
+  return _serial->send(_cmd, off, &len);
+}
+
+bool ATInterface::sendCommand(const char* command, int timeout) {
+  unsigned long int len;
+
+  bool ret;
+
+  if (!sendLine(command)) {
+    return false;
+  }
+
+  ret = readResponse(NULL, NULL, 0, &len, timeout);
+  dispatchUrcs();
+  return ret;
+}
+
+bool ATInterface::sendCommand(const char* command, const char* prefix, char* response, unsigned long int size,
+                              int timeout) {
+  unsigned long int len;
+  bool ret;
+
+  if ((size == 0) || !sendLine(command)) {
+    return false;
+  }
+
+  ret           = readResponse(prefix, (uint8_t*)response, size - 1, &len, timeout, true);
+  response[len] = '\0';
+  dispatchUrcs();
+  return ret;
+}
+
 bool ATInterface::sendATCSIM(uint8_t* apdu, uint16_t apduLen, uint8_t* response, uint16_t* responseLen) {
-  static unsigned long bufSize = 537 * sizeof(char);
-  char* buf;
-  uint16_t i;
+  return sendApdu("AT+CSIM=", "+CSIM: ", -1, apdu, apduLen, response, responseLen);
+}
+
+bool ATInterface::sendATCGLA(unsigned long int session, uint8_t* apdu, uint16_t apduLen, uint8_t* response,
+                             uint16_t* responseLen) {
+  return sendApdu("AT+CGLA=", "+CGLA: ", (long int)session, apdu, apduLen, response, responseLen);
+}
+
+bool ATInterface::sendATCCHO(const uint8_t* aid, uint16_t aidLen, unsigned long int* session) {
+  char cmd[8 + 2 + (2 * AT_MAX_AID_LEN) + 1];
+  char response[32];
+  const char* value;
+  char* end;
+  unsigned long int off;
+
+  if (aidLen > AT_MAX_AID_LEN) {
+    return false;
+  }
+
+  // AT+CCHO="<dfname>"
+  memcpy(cmd, "AT+CCHO=\"", 9);
+  off = 9;
+  tob_hex_encode(aid, aidLen, &cmd[off]);
+  off += 2 * aidLen;
+  cmd[off++] = '"';
+  cmd[off]   = '\0';
+
+  // TS 27.007 answers a bare <sessionid>, some modems prefix it with +CCHO:
+  if (!sendCommand(cmd, "", response, sizeof(response), _serial->getTimeout())) {
+    return false;
+  }
+
+  value = response;
+  if (strncmp(value, "+CCHO:", 6) == 0) {
+    value += 6;
+  }
+  while (*value == ' ') {
+    value++;
+  }
+
+  *session = strtoul(value, &end, 10);
+  return (end != value) && (*end == '\0');
+}
+
+bool ATInterface::sendATCCHC(unsigned long int session) {
+  char cmd[8 + 11];
+
+  memcpy(cmd, "AT+CCHC=", 8);
+  cmd[8 + formatDecimal((unsigned int)session, &cmd[8])] = '\0';
+  return sendCommand(cmd, _serial->getTimeout());
+}
+
+bool ATInterface::writeApdu(const char* command, long int session, uint8_t* apdu, uint16_t apduLen) {
   unsigned long int off, len;
 
 #ifdef AT_DEBUG
+  uint16_t i;
   printf("SND: ");
   for (i = 0; i < apduLen; i++) {
     printf("%02X", apdu[i]);
@@ -104,45 +679,56 @@ bool ATInterface::sendATCSIM(uint8_t* apdu, uint16_t apduLen, uint8_t* response,
   printf("\n");
 #endif
 
-  off = 0;
-  buf = (char*)malloc(bufSize);
-
-  off += sprintf(&buf[off], "AT+CSIM=%d,\"", apduLen * 2);
-  for (i = 0; i < apduLen; i++) {
-    off += sprintf(&buf[off], "%02X", apdu[i]);
+  if (apduLen > AT_MAX_APDU_LEN) {
+    return false;
   }
-  off += sprintf(&buf[off], "\"\r\n");
-
-  _serial->send(buf, off, &len);
-  memset(buf, 0, bufSize);
 
-  do {
-    readLine(buf, &len);
-    if (memcmp(buf, "ERROR\r\n", 7) == 0) {
-      return false;
-    }
-  } while ((memcmp(buf, "+CSIM: ", 7) != 0));
+  off = strlen(command);
+  memcpy(_cmd, command, off);
+  if (session >= 0) {
+    off += formatDecimal((unsigned int)session, &_cmd[off]);
+    _cmd[off++] = ',';
+  }
+  off += formatDecimal(apduLen * 2, &_cmd[off]);
+  _cmd[off++] = ',';
+  _cmd[off++] = '"';
+  tob_hex_encode(apdu, apduLen, &_cmd[off]);
+  off += 2 * apduLen;
+  _cmd[off++] = '"';
+  _cmd[off++] = '\r';
+  _cmd[off++] = '\n';
 
-  off          = 7;
-  *responseLen = 0;
-  while (buf[off] != ',') {
-    *responseLen *= 10;
-    *responseLen += buf[off] - '0';
-    off++;
+  waitCommandDelay();
+  if (!_serial->send(_cmd, off, &len)) {
+    return false;
   }
 
-  while (!(((buf[off] >= '0') && (buf[off] <= '9')) || ((buf[off] >= 'A') && (buf[off] <= 'F')) ||
-           ((buf[off] >= 'a') && (buf[off] <= 'f')))) {
-    off++;
+  // A timed command is only sent once it left the port, which tells the link apart from the modem
+  if ((_timer != NULL) && _timer->active()) {
+    _serial->drain();
+    _timer->sent(off);
   }
+  return true;
+}
 
-  hexString2BytesArray((uint8_t*)&buf[off], *responseLen, response, responseLen);
+bool ATInterface::sendApdu(const char* command, const char* prefix, long int session, uint8_t* apdu,
+                           uint16_t apduLen, uint8_t* response, uint16_t* responseLen) {
+  unsigned long int len;
 
-  do {
-    readLine(buf, &len);
-  } while (memcmp(buf, "OK\r\n", 4) != 0);
+  if (!writeApdu(command, session, apdu, apduLen)) {
+    return false;
+  }
+
+  // <prefix><length>,"<response>", decoded as it arrives
+  if (!readResponse(prefix, response, AT_MAX_RESPONSE_LEN, &len, _serial->getTimeout())) {
+    dispatchUrcs();
+    return false;
+  }
+  *responseLen = len;
+  dispatchUrcs();
 
 #ifdef AT_DEBUG
+  uint16_t i;
   printf("RCV: ");
   for (i = 0; i < *responseLen; i++) {
     printf("%02X", response[i]);
@@ -150,6 +736,134 @@ bool ATInterface::sendATCSIM(uint8_t* apdu, uint16_t apduLen, uint8_t* response,
   printf("\n");
 #endif
 
-  free(buf);
   return true;
 }
+
+bool ATInterface::beginApdu(long int session, uint8_t* apdu, uint16_t apduLen, uint8_t* response) {
+  if (_pending || !writeApdu((session >= 0) ? "AT+CGLA=" : "AT+CSIM=", session, apdu, apduLen)) {
+    return false;
+  }
+
+  parseBegin((session >= 0) ? "+CGLA: " : "+CSIM: ", response, AT_MAX_RESPONSE_LEN);
+  deadline_after(_serial->getTimeout(), &_pendingDeadline);
+  _pending = true;
+  return true;
+}
+
+bool ATInterface::pollApdu(uint16_t* responseLen, bool* done) {
+  unsigned long int len;
+  bool ret;
+
+  *done = false;
+  if (!_pending) {
+    return false;
+  }
+
+  // Only what the port already holds is consumed, the caller comes back once its descriptor is readable again
+  while (!parseStep()) {
+    if (!fill(0)) {
+      if (deadline_remaining(&_pendingDeadline) > 0) {
+        return true;
+      }
+      break;
+    }
+  }
+
+  _pending = false;
+  *done    = true;
+  ret      = parseEnd(&len);
+  if (ret) {
+    *responseLen = len;
+  }
+  dispatchUrcs();
+  return ret;
+}
+
+int ATInterface::getPendingTimeout(void) {
+  return _pending ? deadline_remaining(&_pendingDeadline) : -1;
+}
+
+bool ATInterface::probePipelining(int timeout) {
+  static const char burst[] = "AT\r\nAT\r\n";
+  unsigned long int len;
+  bool ret;
+
+  memcpy(_cmd, burst, sizeof(burst) - 1);
+  waitCommandDelay();
+  if (!_serial->send(_cmd, sizeof(burst) - 1, &len)) {
+    return false;
+  }
+
+  // Both answers are collected even if the first one failed, nothing is left to confuse the next command
+  ret = readResponse(NULL, NULL, 0, &len, timeout);
+  ret = readResponse(NULL, NULL, 0, &len, timeout) && ret;
+  dispatchUrcs();
+  return ret;
+}
+
+bool ATInterface::readBinaryPipelined(long int session, uint8_t cla, uint16_t offset, uint16_t size, uint8_t chunk,
+                                      uint8_t* data, uint16_t* readLen, uint8_t* response, uint16_t* responseLen) {
+  const char* command = (session >= 0) ? "AT+CGLA=" : "AT+CSIM=";
+  const char* prefix  = (session >= 0) ? "+CGLA: " : "+CSIM: ";
+  uint8_t apdu[5];
+  unsigned long int len;
+  uint16_t expected;
+  uint16_t sent     = 0;
+  uint16_t done     = 0;
+  unsigned int busy = 0;
+  bool stopped      = false;
+  bool ret          = true;
+
+  *readLen     = 0;
+  *responseLen = 0;
+  if ((chunk == 0) || _pending) {
+    return false;
+  }
+
+  apdu[0] = cla;
+  apdu[1] = 0xB0;
+
+  // Two commands in flight: the modem starts on the next READ BINARY as soon as it answered the previous one, while
+  // that answer is still on its way to the host
+  while ((busy > 0) || (!stopped && (sent < size))) {
+    while (!stopped && (busy < 2) && (sent < size)) {
+      expected = ((size - sent) < chunk) ? (size - sent) : chunk;
+      apdu[2]  = (uint8_t)((offset + sent) >> 8);
+      apdu[3]  = (uint8_t)(offset + sent);
+      apdu[4]  = (uint8_t)expected;
+      if (!writeApdu(command, session, apdu, sizeof(apdu))) {
+        stopped = true;
+        ret     = false;
+        break;
+      }
+      sent += expected;
+      busy++;
+    }
+
+    if (busy == 0) {
+      break;
+    }
+
+    // Responses come back in the order the commands were sent
+    expected = ((size - done) < chunk) ? (size - done) : chunk;
+    busy--;
+    if (!readResponse(prefix, response, AT_MAX_RESPONSE_LEN, &len, _serial->getTimeout())) {
+      stopped = true;
+      ret     = false;
+      continue;
+    }
+    *responseLen = (uint16_t)len;
+
+    if (stopped || (len != (unsigned long int)expected + 2) || (response[expected] != 0x90) ||
+        (response[expected + 1] != 0x00)) {
+      stopped = true;
+      continue;
+    }
+    memcpy(&data[done], response, expected);
+    done += expected;
+  }
+
+  *readLen = done;
+  dispatchUrcs();
+  return ret;
+}
@@ -0,0 +1,949 @@
+/*
+ *
+ * Twilio Breakout Trust Onboard SDK
+ *
+ * Copyright (c) 2019 Twilio, Inc.
+ *
+ * SPDX-License-Identifier:  Apache-2.0
+ */
+
+#include "Cmux.h"
+#include "ATInterface.h"
+#include <cstdio>
+#include <cstdlib>
+#include <cstring>
+
+#include <chrono>
+
+#include <fcntl.h>
+#include <poll.h>
+#include <termios.h>
+#include <unistd.h>
+
+//#define CMUX_DEBUG
+
+// How long the receive thread waits for data before looking at the keep-alive timers, in milliseconds
+#define CMUX_POLL_INTERVAL 100
+
+typedef std::chrono::steady_clock Clock;
+
+static Clock::time_point deadlineAfter(int timeout) {
+  return Clock::now() + std::chrono::milliseconds(timeout);
+}
+
+/** Frame codec ***************************************************************/
+
+uint8_t Cmux::fcs(const uint8_t* data, unsigned long int len) {
+  uint8_t crc = 0xFF;
+  unsigned long int i;
+  int bit;
+
+  // CRC-8, polynomial x^8 + x^2 + x + 1 processed LSB first as specified in TS 27.010 annex B
+  for (i = 0; i < len; i++) {
+    crc ^= data[i];
+    for (bit = 0; bit < 8; bit++) {
+      crc = (crc & 1) ? (crc >> 1) ^ 0xE0 : (crc >> 1);
+    }
+  }
+
+  return 0xFF - crc;
+}
+
+unsigned long int Cmux::encodeFrame(uint8_t dlci, uint8_t control, bool cr, const uint8_t* data,
+                                    unsigned long int len, uint8_t* out) {
+  unsigned long int header;
+  unsigned long int off;
+
+  out[0] = CMUX_FLAG;
+  out[1] = (uint8_t)((dlci << 2) | (cr ? 0x02 : 0x00) | 0x01);
+  out[2] = control;
+  if (len < 128) {
+    out[3] = (uint8_t)((len << 1) | 0x01);
+    header = 3;
+  } else {
+    out[3] = (uint8_t)((len & 0x7F) << 1);
+    out[4] = (uint8_t)(len >> 7);
+    header = 4;
+  }
+
+  off = 1 + header;
+  if (len > 0) {
+    memcpy(&out[off], data, len);
+  }
+  off += len;
+
+  // UIH frames only protect the header, every other frame type its information field as well
+  if ((control & ~CMUX_PF) == CMUX_UIH) {
+    out[off++] = fcs(&out[1], header);
+  } else {
+    out[off++] = fcs(&out[1], header + len);
+  }
+  out[off++] = CMUX_FLAG;
+
+  return off;
+}
+
+CmuxDecoder::CmuxDecoder(void) {
+  reset();
+}
+
+void CmuxDecoder::reset(void) {
+  _state     = WAIT_FLAG;
+  _headerLen = 0;
+  _len       = 0;
+  _got       = 0;
+  _fcs       = 0;
+}
+
+bool CmuxDecoder::feed(uint8_t byte, CmuxFrame* frame) {
+  uint8_t expected;
+  uint8_t check[4 + CMUX_MAX_FRAME_SIZE];
+
+  switch (_state) {
+    case WAIT_FLAG:
+      if (byte == CMUX_FLAG) {
+        _state = ADDRESS;
+      }
+      return false;
+
+    case ADDRESS:
+      // Consecutive flags, the closing flag of a frame may also open the next one
+      if (byte == CMUX_FLAG) {
+        return false;
+      }
+      if ((byte & 0x01) == 0) {
+        _state = WAIT_FLAG;
+        return false;
+      }
+      _header[0] = byte;
+      _headerLen = 1;
+      _state     = CONTROL;
+      return false;
+
+    case CONTROL:
+      _header[_headerLen++] = byte;
+      _state                = LENGTH;
+      return false;
+
+    case LENGTH:
+      _header[_headerLen++] = byte;
+      _len                  = byte >> 1;
+      if ((byte & 0x01) == 0) {
+        _state = LENGTH2;
+        return false;
+      }
+      break;
+
+    case LENGTH2:
+      _header[_headerLen++] = byte;
+      _len |= (unsigned long int)byte << 7;
+      break;
+
+    case INFO:
+      _info[_got++] = byte;
+      if (_got == _len) {
+        _state = FCS;
+      }
+      return false;
+
+    case FCS:
+      _fcs   = byte;
+      _state = CLOSE;
+      return false;
+
+    case CLOSE:
+      if (byte != CMUX_FLAG) {
+        _state = WAIT_FLAG;
+        return false;
+      }
+
+      _state = ADDRESS;
+      if ((_header[1] & ~CMUX_PF) == CMUX_UIH) {
+        expected = Cmux::fcs(_header, _headerLen);
+      } else {
+        memcpy(check, _header, _headerLen);
+        memcpy(&check[_headerLen], _info, _len);
+        expected = Cmux::fcs(check, _headerLen + _len);
+      }
+
+      if (_fcs != expected) {
+#ifdef CMUX_DEBUG
+        printf("CMUX: bad FCS %02X, expected %02X\r\n", _fcs, expected);
+#endif
+        return false;
+      }
+
+      frame->dlci    = _header[0] >> 2;
+      frame->cr      = (_header[0] & 0x02) != 0;
+      frame->control = _header[1];
+      frame->data    = _info;
+      frame->len     = _len;
+      return true;
+  }
+
+  // Length complete
+  if (_len > CMUX_MAX_FRAME_SIZE) {
+    _state = WAIT_FLAG;
+    return false;
+  }
+
+  _got   = 0;
+  _state = (_len > 0) ? INFO : FCS;
+  return false;
+}
+
+/** Multiplexer ***************************************************************/
+
+Cmux::Cmux(Serial* serial, unsigned int frameSize) {
+  unsigned int i;
+
+  _serial       = serial;
+  _frameSize    = (frameSize > CMUX_MAX_FRAME_SIZE) ? CMUX_MAX_FRAME_SIZE : frameSize;
+  _running      = false;
+  _flowOff      = false;
+  _testPending  = false;
+  _testSequence = 0;
+  _wakePipe[0]  = -1;
+  _wakePipe[1]  = -1;
+
+  for (i = 0; i < CMUX_MAX_CHANNELS; i++) {
+    _dlc[i].open          = false;
+    _dlc[i].waiting       = false;
+    _dlc[i].ack           = 0;
+    _dlc[i].remoteFlowOff = false;
+    _dlc[i].localFlowOff  = false;
+    _dlc[i].rxHead        = 0;
+    _dlc[i].rxTail        = 0;
+    _dlc[i].dropped       = 0;
+    _dlc[i].ptyMaster     = -1;
+    _dlc[i].ptySlave      = -1;
+  }
+}
+
+Cmux::~Cmux(void) {
+  stop();
+  delete _serial;
+}
+
+bool Cmux::start(void) {
+  char cmd[32];
+
+  if (_rxThread.joinable()) {
+    return false;
+  }
+
+  if (!_serial->start()) {
+    return false;
+  }
+
+  // The modem acknowledges in AT command mode, frames follow from then on
+  {
+    ATInterface at(_serial);
+
+    snprintf(cmd, sizeof(cmd), "AT+CMUX=0,0,,%u", _frameSize);
+    if (!at.sendCommand(cmd, CMUX_CONTROL_TIMEOUT)) {
+      fprintf(stderr, "Modem refused %s\n", cmd);
+      _serial->stop();
+      return false;
+    }
+  }
+
+  if ((pipe(_wakePipe) != 0) || (fcntl(_wakePipe[0], F_SETFL, O_NONBLOCK) != 0) ||
+      (fcntl(_wakePipe[1], F_SETFL, O_NONBLOCK) != 0)) {
+    _serial->stop();
+    return false;
+  }
+
+  _decoder.reset();
+  _running     = true;
+  _flowOff     = false;
+  _testPending = false;
+  _rxThread    = std::thread(&Cmux::receiveLoop, this);
+
+  if (!openChannel(0, CMUX_CONTROL_TIMEOUT)) {
+    fprintf(stderr, "Modem did not open the CMUX control channel\n");
+    stop();
+    return false;
+  }
+
+  return true;
+}
+
+void Cmux::stop(void) {
+  unsigned int i;
+
+  if (!_rxThread.joinable()) {
+    return;
+  }
+
+  for (i = 1; i < CMUX_MAX_CHANNELS; i++) {
+    if (_dlc[i].open) {
+      closeChannel(i, CMUX_CONTROL_TIMEOUT);
+    }
+  }
+
+  // The modem answers CLD and goes back to AT command mode
+  if (isRunning() && sendControl(CMUX_MSG_CLD | CMUX_MSG_CR, nullptr, 0)) {
+    std::unique_lock<std::mutex> lock(_lock);
+    _cond.wait_for(lock, std::chrono::milliseconds(CMUX_CONTROL_TIMEOUT), [this] { return !_running; });
+  }
+
+  fail();
+  _rxThread.join();
+  if (_ptyThread.joinable()) {
+    _ptyThread.join();
+  }
+
+  for (i = 0; i < CMUX_MAX_CHANNELS; i++) {
+    if (_dlc[i].ptyMaster >= 0) {
+      close(_dlc[i].ptyMaster);
+      close(_dlc[i].ptySlave);
+      _dlc[i].ptyMaster = -1;
+      _dlc[i].ptySlave  = -1;
+    }
+  }
+
+  close(_wakePipe[0]);
+  close(_wakePipe[1]);
+  _wakePipe[0] = -1;
+  _wakePipe[1] = -1;
+
+  _serial->stop();
+}
+
+bool Cmux::isRunning(void) {
+  std::lock_guard<std::mutex> lock(_lock);
+  return _running;
+}
+
+void Cmux::fail(void) {
+  unsigned int i;
+
+  {
+    std::lock_guard<std::mutex> lock(_lock);
+    _running = false;
+    for (i = 0; i < CMUX_MAX_CHANNELS; i++) {
+      _dlc[i].open    = false;
+      _dlc[i].waiting = false;
+    }
+    _cond.notify_all();
+  }
+
+  wakePtyLoop();
+}
+
+bool Cmux::openChannel(uint8_t dlci, int timeout) {
+  Dlc* dlc;
+  bool open;
+
+  if (dlci >= CMUX_MAX_CHANNELS) {
+    return false;
+  }
+  dlc = &_dlc[dlci];
+
+  {
+    std::lock_guard<std::mutex> lock(_lock);
+    if (!_running) {
+      return false;
+    }
+    if (dlc->open) {
+      return true;
+    }
+    dlc->waiting       = true;
+    dlc->ack           = 0;
+    dlc->rxHead        = 0;
+    dlc->rxTail        = 0;
+    dlc->remoteFlowOff = false;
+    dlc->localFlowOff  = false;
+  }
+
+  if (!sendFrame(dlci, CMUX_SABM | CMUX_PF, true, nullptr, 0)) {
+    return false;
+  }
+
+  {
+    std::unique_lock<std::mutex> lock(_lock);
+    _cond.wait_until(lock, deadlineAfter(timeout), [dlc] { return !dlc->waiting; });
+    dlc->waiting = false;
+    dlc->open    = _running && (dlc->ack == CMUX_UA);
+    open         = dlc->open;
+  }
+
+  // Data DLCs want the V.24 signals raised before they pass anything
+  if (open && (dlci != 0)) {
+    sendFlowControl(dlci, false);
+  }
+
+  return open;
+}
+
+bool Cmux::closeChannel(uint8_t dlci, int timeout) {
+  Dlc* dlc;
+
+  if (dlci >= CMUX_MAX_CHANNELS) {
+    return false;
+  }
+  dlc = &_dlc[dlci];
+
+  {
+    std::lock_guard<std::mutex> lock(_lock);
+    if (!dlc->open) {
+      return true;
+    }
+    dlc->waiting = true;
+    dlc->ack     = 0;
+  }
+
+  if (sendFrame(dlci, CMUX_DISC | CMUX_PF, true, nullptr, 0)) {
+    std::unique_lock<std::mutex> lock(_lock);
+    _cond.wait_until(lock, deadlineAfter(timeout), [dlc] { return !dlc->waiting; });
+  }
+
+  std::lock_guard<std::mutex> lock(_lock);
+  dlc->waiting = false;
+  dlc->open    = false;
+  _cond.notify_all();
+  return true;
+}
+
+bool Cmux::sendFrame(uint8_t dlci, uint8_t control, bool cr, const uint8_t* data, unsigned long int len) {
+  std::lock_guard<std::mutex> lock(_writeLock);
+  unsigned long int frameLen;
+  unsigned long int written;
+
+  frameLen = encodeFrame(dlci, control, cr, data, len, _txFrame);
+  return _serial->send((char*)_txFrame, frameLen, &written);
+}
+
+bool Cmux::sendControl(uint8_t type, const uint8_t* value, unsigned long int len) {
+  uint8_t msg[2 + 16];
+
+  if (len > sizeof(msg) - 2) {
+    return false;
+  }
+
+  msg[0] = type;
+  msg[1] = (uint8_t)((len << 1) | 0x01);
+  if (len > 0) {
+    memcpy(&msg[2], value, len);
+  }
+
+  return sendFrame(0, CMUX_UIH, true, msg, 2 + len);
+}
+
+bool Cmux::sendFlowControl(uint8_t dlci, bool off) {
+  uint8_t value[2];
+
+  value[0] = (uint8_t)((dlci << 2) | 0x02 | 0x01);
+  value[1] = 0x01 | CMUX_V24_RTC | CMUX_V24_RTR | CMUX_V24_DV | (off ? CMUX_V24_FC : 0);
+  return sendControl(CMUX_MSG_MSC | CMUX_MSG_CR, value, sizeof(value));
+}
+
+bool Cmux::write(uint8_t dlci, const char* data, unsigned long int len, int timeout) {
+  Clock::time_point deadline = deadlineAfter(timeout);
+  Dlc* dlc                   = &_dlc[dlci];
+  unsigned long int off;
+  unsigned long int n;
+
+  for (off = 0; off < len; off += n) {
+    {
+      std::unique_lock<std::mutex> lock(_lock);
+      auto ready = [this, dlc] { return !_running || !dlc->open || (!_flowOff && !dlc->remoteFlowOff); };
+
+      if (timeout < 0) {
+        _cond.wait(lock, ready);
+      } else if (!_cond.wait_until(lock, deadline, ready)) {
+        return false;
+      }
+
+      if (!_running || !dlc->open) {
+        return false;
+      }
+    }
+
+    n = len - off;
+    if (n > _frameSize) {
+      n = _frameSize;
+    }
+
+    if (!sendFrame(dlci, CMUX_UIH, true, (const uint8_t*)&data[off], n)) {
+      return false;
+    }
+  }
+
+  return true;
+}
+
+bool Cmux::read(uint8_t dlci, char* data, unsigned long int toRead, unsigned long int* read, int timeout, bool all) {
+  Clock::time_point deadline = deadlineAfter(timeout);
+  Dlc* dlc                   = &_dlc[dlci];
+  unsigned long int start;
+  unsigned long int n;
+  bool resume = false;
+
+  *read = 0;
+
+  {
+    std::unique_lock<std::mutex> lock(_lock);
+    auto ready = [this, dlc] { return (dlc->rxHead != dlc->rxTail) || !_running || !dlc->open; };
+
+    for (;;) {
+      while ((*read < toRead) && (dlc->rxHead != dlc->rxTail)) {
+        start = dlc->rxHead % CMUX_CHANNEL_BUFFER_SIZE;
+        n     = dlc->rxTail - dlc->rxHead;
+        if (n > CMUX_CHANNEL_BUFFER_SIZE - start) {
+          n = CMUX_CHANNEL_BUFFER_SIZE - start;
+        }
+        if (n > toRead - *read) {
+          n = toRead - *read;
+        }
+        memcpy(&data[*read], &dlc->rx[start], n);
+        dlc->rxHead += n;
+        *read += n;
+      }
+
+      if ((*read == toRead) || (!all && (*read > 0)) || !_running || !dlc->open) {
+        break;
+      }
+
+      if (timeout < 0) {
+        _cond.wait(lock, ready);
+      } else if (!_cond.wait_until(lock, deadline, ready)) {
+        break;
+      }
+    }
+
+    if (dlc->localFlowOff && (dlc->rxTail - dlc->rxHead < CMUX_CHANNEL_BUFFER_SIZE / 4)) {
+      dlc->localFlowOff = false;
+      resume            = true;
+    }
+  }
+
+  if (resume) {
+    sendFlowControl(dlci, false);
+  }
+
+  return all ? (*read == toRead) : (*read > 0);
+}
+
+bool Cmux::exposeChannel(uint8_t dlci, char* name, unsigned long int size) {
+  struct termios tio;
+  int master;
+  int slave;
+
+  if ((dlci == 0) || (dlci >= CMUX_MAX_CHANNELS) || (_dlc[dlci].ptyMaster >= 0)) {
+    return false;
+  }
+
+  if (!openChannel(dlci, CMUX_CONTROL_TIMEOUT)) {
+    return false;
+  }
+
+  if ((master = posix_openpt(O_RDWR | O_NOCTTY | O_NONBLOCK)) < 0) {
+    closeChannel(dlci, CMUX_CONTROL_TIMEOUT);
+    return false;
+  }
+
+  if ((grantpt(master) != 0) || (unlockpt(master) != 0) || (ptsname_r(master, name, size) != 0)) {
+    close(master);
+    closeChannel(dlci, CMUX_CONTROL_TIMEOUT);
+    return false;
+  }
+
+  // Holding the slave open keeps the master from reporting a hangup whenever its user closes it
+  if ((slave = open(name, O_RDWR | O_NOCTTY | O_NONBLOCK)) < 0) {
+    close(master);
+    closeChannel(dlci, CMUX_CONTROL_TIMEOUT);
+    return false;
+  }
+  if (tcgetattr(slave, &tio) == 0) {
+    cfmakeraw(&tio);
+    tcsetattr(slave, TCSANOW, &tio);
+  }
+
+  {
+    std::lock_guard<std::mutex> lock(_lock);
+    _dlc[dlci].ptyMaster = master;
+    _dlc[dlci].ptySlave  = slave;
+  }
+
+  if (!_ptyThread.joinable()) {
+    _ptyThread = std::thread(&Cmux::ptyLoop, this);
+  }
+  wakePtyLoop();
+
+  return true;
+}
+
+void Cmux::wakePtyLoop(void) {
+  char c = 0;
+
+  if (_wakePipe[1] >= 0) {
+    (void)::write(_wakePipe[1], &c, 1);
+  }
+}
+
+void Cmux::handleFrame(const CmuxFrame* frame) {
+  uint8_t control = frame->control & ~CMUX_PF;
+  unsigned long int start;
+  unsigned long int room;
+  unsigned long int n;
+  Dlc* dlc;
+  bool pause  = false;
+  bool closed = false;
+  bool pty    = false;
+
+#ifdef CMUX_DEBUG
+  printf("CMUX: < DLC %u control %02X length %lu\r\n", frame->dlci, frame->control, frame->len);
+#endif
+
+  if (frame->dlci >= CMUX_MAX_CHANNELS) {
+    if (control == CMUX_SABM) {
+      sendFrame(frame->dlci, CMUX_DM | CMUX_PF, false, nullptr, 0);
+    }
+    return;
+  }
+  dlc = &_dlc[frame->dlci];
+
+  switch (control) {
+    case CMUX_UA:
+    case CMUX_DM: {
+      std::lock_guard<std::mutex> lock(_lock);
+      if (dlc->waiting) {
+        dlc->ack     = control;
+        dlc->waiting = false;
+      } else if (control == CMUX_DM) {
+        dlc->open = false;
+      }
+      _cond.notify_all();
+      break;
+    }
+
+    case CMUX_SABM:
+      // DLCs are only opened from this side
+      sendFrame(frame->dlci, CMUX_DM | CMUX_PF, false, nullptr, 0);
+      break;
+
+    case CMUX_DISC: {
+      {
+        std::lock_guard<std::mutex> lock(_lock);
+        dlc->open = false;
+        _cond.notify_all();
+      }
+      sendFrame(frame->dlci, CMUX_UA | CMUX_PF, false, nullptr, 0);
+      closed = (frame->dlci == 0);
+      break;
+    }
+
+    case CMUX_UIH:
+      if (frame->dlci == 0) {
+        handleControl(frame->data, frame->len);
+        break;
+      }
+
+      {
+        std::lock_guard<std::mutex> lock(_lock);
+        if (!dlc->open) {
+          break;
+        }
+
+        for (n = 0; n < frame->len;) {
+          start = dlc->rxTail % CMUX_CHANNEL_BUFFER_SIZE;
+          room  = CMUX_CHANNEL_BUFFER_SIZE - (dlc->rxTail - dlc->rxHead);
+          if (room > CMUX_CHANNEL_BUFFER_SIZE - start) {
+            room = CMUX_CHANNEL_BUFFER_SIZE - start;
+          }
+          if (room == 0) {
+            dlc->dropped += frame->len - n;
+            break;
+          }
+          if (room > frame->len - n) {
+            room = frame->len - n;
+          }
+          memcpy(&dlc->rx[start], &frame->data[n], room);
+          dlc->rxTail += room;
+          n += room;
+        }
+
+        if (!dlc->localFlowOff && (dlc->rxTail - dlc->rxHead > 3 * CMUX_CHANNEL_BUFFER_SIZE / 4)) {
+          dlc->localFlowOff = true;
+          pause             = true;
+        }
+        pty = (dlc->ptyMaster >= 0);
+        _cond.notify_all();
+      }
+
+      if (pause) {
+        sendFlowControl(frame->dlci, true);
+      }
+      if (pty) {
+        wakePtyLoop();
+      }
+      break;
+
+    default:
+      break;
+  }
+
+  if (closed) {
+    fail();
+  }
+}
+
+void Cmux::handleControl(const uint8_t* data, unsigned long int len) {
+  unsigned long int valueLen;
+  unsigned long int off;
+  const uint8_t* value;
+  uint8_t type;
+  uint8_t dlci;
+
+  if (len < 2) {
+    return;
+  }
+
+  type     = data[0];
+  valueLen = data[1] >> 1;
+  off      = 2;
+  if ((data[1] & 0x01) == 0) {
+    if (len < 3) {
+      return;
+    }
+    valueLen |= (unsigned long int)data[2] << 7;
+    off = 3;
+  }
+
+  if (off + valueLen > len) {
+    return;
+  }
+  value = &data[off];
+
+#ifdef CMUX_DEBUG
+  printf("CMUX: < control %02X length %lu\r\n", type, valueLen);
+#endif
+
+  // Responses to our own commands, only the keep-alive and close down ones matter
+  if ((type & CMUX_MSG_CR) == 0) {
+    if (type == CMUX_MSG_TEST) {
+      std::lock_guard<std::mutex> lock(_lock);
+      _testPending = false;
+    } else if (type == CMUX_MSG_CLD) {
+      fail();
+    }
+    return;
+  }
+
+  switch (type & ~CMUX_MSG_CR) {
+    case CMUX_MSG_MSC:
+      if (valueLen >= 2) {
+        dlci = value[0] >> 2;
+        if (dlci < CMUX_MAX_CHANNELS) {
+          std::lock_guard<std::mutex> lock(_lock);
+          _dlc[dlci].remoteFlowOff = (value[1] & CMUX_V24_FC) != 0;
+          _cond.notify_all();
+        }
+      }
+      sendControl(CMUX_MSG_MSC, value, valueLen);
+      break;
+
+    case CMUX_MSG_FCON:
+    case CMUX_MSG_FCOFF:
+      {
+        std::lock_guard<std::mutex> lock(_lock);
+        _flowOff = ((type & ~CMUX_MSG_CR) == CMUX_MSG_FCOFF);
+        _cond.notify_all();
+      }
+      sendControl(type & ~CMUX_MSG_CR, nullptr, 0);
+      break;
+
+    case CMUX_MSG_TEST:
+    case CMUX_MSG_PN:
+      // Echo the pattern, accept the parameters as proposed
+      sendControl(type & ~CMUX_MSG_CR, value, valueLen);
+      break;
+
+    case CMUX_MSG_CLD:
+      sendControl(CMUX_MSG_CLD, nullptr, 0);
+      fail();
+      break;
+
+    default:
+      sendControl(CMUX_MSG_NSC, &type, 1);
+      break;
+  }
+}
+
+void Cmux::receiveLoop(void) {
+  Clock::time_point lastRx = Clock::now();
+  Clock::time_point testSent;
+  Clock::time_point before;
+  uint8_t buf[256];
+  uint8_t pattern[4];
+  unsigned long int n;
+  unsigned long int i;
+  CmuxFrame frame;
+  bool probe;
+
+  while (isRunning()) {
+    before = Clock::now();
+    if (_serial->recvAvailable((char*)buf, sizeof(buf), &n, CMUX_POLL_INTERVAL)) {
+      lastRx = Clock::now();
+      for (i = 0; i < n; i++) {
+        if (_decoder.feed(buf[i], &frame)) {
+          handleFrame(&frame);
+        }
+      }
+    } else if (Clock::now() - before < std::chrono::milliseconds(CMUX_POLL_INTERVAL / 2)) {
+      // The port reports an error rather than a timeout, don't spin on it until the keep-alive gives up
+      std::this_thread::sleep_for(std::chrono::milliseconds(CMUX_POLL_INTERVAL));
+    }
+
+    probe = false;
+    {
+      std::lock_guard<std::mutex> lock(_lock);
+      if (_testPending) {
+        if (Clock::now() - testSent > std::chrono::milliseconds(CMUX_KEEPALIVE_TIMEOUT)) {
+          _running = false;
+        }
+      } else if (Clock::now() - lastRx > std::chrono::milliseconds(CMUX_KEEPALIVE_INTERVAL)) {
+        _testPending = true;
+        testSent     = Clock::now();
+        probe        = true;
+      }
+    }
+
+    if (probe) {
+      memcpy(pattern, "TOB", 3);
+      pattern[3] = _testSequence++;
+      sendControl(CMUX_MSG_TEST | CMUX_MSG_CR, pattern, sizeof(pattern));
+    }
+  }
+
+  fail();
+}
+
+void Cmux::ptyLoop(void) {
+  struct pollfd fds[1 + CMUX_MAX_CHANNELS];
+  uint8_t dlcis[1 + CMUX_MAX_CHANNELS];
+  char buf[CMUX_MAX_FRAME_SIZE];
+  unsigned long int start;
+  unsigned long int n;
+  unsigned int count;
+  unsigned int i;
+  ssize_t r;
+  Dlc* dlc;
+  bool resume;
+
+  while (isRunning()) {
+    fds[0].fd     = _wakePipe[0];
+    fds[0].events = POLLIN;
+    count         = 1;
+
+    {
+      std::lock_guard<std::mutex> lock(_lock);
+      for (i = 1; i < CMUX_MAX_CHANNELS; i++) {
+        dlc = &_dlc[i];
+        if ((dlc->ptyMaster < 0) || !dlc->open) {
+          continue;
+        }
+        fds[count].fd     = dlc->ptyMaster;
+        fds[count].events = 0;
+        if (!_flowOff && !dlc->remoteFlowOff) {
+          fds[count].events |= POLLIN;
+        }
+        if (dlc->rxHead != dlc->rxTail) {
+          fds[count].events |= POLLOUT;
+        }
+        dlcis[count++] = i;
+      }
+    }
+
+    if (poll(fds, count, 1000) <= 0) {
+      continue;
+    }
+
+    if (fds[0].revents & POLLIN) {
+      while (::read(_wakePipe[0], buf, sizeof(buf)) > 0) {
+      }
+    }
+
+    for (i = 1; i < count; i++) {
+      dlc = &_dlc[dlcis[i]];
+
+      // Modem to pty
+      if (fds[i].revents & POLLOUT) {
+        resume = false;
+        {
+          std::lock_guard<std::mutex> lock(_lock);
+          start = dlc->rxHead % CMUX_CHANNEL_BUFFER_SIZE;
+          n     = dlc->rxTail - dlc->rxHead;
+          if (n > CMUX_CHANNEL_BUFFER_SIZE - start) {
+            n = CMUX_CHANNEL_BUFFER_SIZE - start;
+          }
+          r = ::write(dlc->ptyMaster, &dlc->rx[start], n);
+          if (r > 0) {
+            dlc->rxHead += r;
+          }
+          if (dlc->localFlowOff && (dlc->rxTail - dlc->rxHead < CMUX_CHANNEL_BUFFER_SIZE / 4)) {
+            dlc->localFlowOff = false;
+            resume            = true;
+          }
+        }
+        if (resume) {
+          sendFlowControl(dlcis[i], false);
+        }
+      }
+
+      // Pty to modem
+      if (fds[i].revents & POLLIN) {
+        r = ::read(dlc->ptyMaster, buf, _frameSize);
+        if (r > 0) {
+          write(dlcis[i], buf, r, -1);
+        }
+      }
+    }
+  }
+}
+
+/** Channel *******************************************************************/
+
+CmuxChannel::CmuxChannel(Cmux* mux, uint8_t dlci) {
+  _mux  = mux;
+  _dlci = dlci;
+}
+
+CmuxChannel::~CmuxChannel(void) {
+}
+
+bool CmuxChannel::start(void) {
+  if ((_dlci == 0) || (_dlci >= CMUX_MAX_CHANNELS)) {
+    return false;
+  }
+
+  return _mux->openChannel(_dlci, CMUX_CONTROL_TIMEOUT);
+}
+
+bool CmuxChannel::stop(void) {
+  return _mux->closeChannel(_dlci, CMUX_CONTROL_TIMEOUT);
+}
+
+bool CmuxChannel::send(char* data, unsigned long int toWrite, unsigned long int* written) {
+  *written = 0;
+  if (!_mux->write(_dlci, data, toWrite, _timeout)) {
+    return false;
+  }
+
+  *written = toWrite;
+  return true;
+}
+
+bool CmuxChannel::recv(char* data, unsigned long int toRead, unsigned long int* read) {
+  return recv(data, toRead, read, _timeout);
+}
+
+bool CmuxChannel::recv(char* data, unsigned long int toRead, unsigned long int* read, int timeout) {
+  return _mux->read(_dlci, data, toRead, read, timeout, true);
+}
+
+bool CmuxChannel::recvAvailable(char* data, unsigned long int toRead, unsigned long int* read, int timeout) {
+  return _mux->read(_dlci, data, toRead, read, timeout, false);
+}
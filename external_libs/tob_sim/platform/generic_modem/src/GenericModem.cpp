@@ -8,15 +8,447 @@
  */
 
 #include "GenericModem.h"
+#include "Deadline.h"
 #include "LSerial.h"
 #include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
 
 //#define MODEM_DEBUG
 
-GenericModem::GenericModem(const char* const device, int baudrate) : _at(new LSerial(device, baudrate)) {
+// Rates tried by the negotiation, fastest first
+static const int negotiatedBaudrates[] = {4000000, 3000000, 2000000, 1500000, 1000000, 921600, 460800, 230400, 115200};
+
+// Returns true in case the AT+IPR=? list, e.g. "(0,300,...,115200),(...)" or "(300-921600)", contains baudrate.
+// Only the first parameter list is looked at, the second one is the rates the modem can autodetect.
+static bool iprListContains(const char* list, int baudrate) {
+  const char* p;
+  char* end;
+  long lo, hi;
+
+  p = strchr(list, '(');
+  p = (p != nullptr) ? p + 1 : list;
+
+  while ((*p != '\0') && (*p != ')')) {
+    lo = strtol(p, &end, 10);
+    if (end == p) {
+      p++;
+      continue;
+    }
+
+    hi = lo;
+    p  = end;
+    if (*p == '-') {
+      hi = strtol(p + 1, &end, 10);
+      p  = end;
+    }
+
+    if ((baudrate >= lo) && (baudrate <= hi)) {
+      return true;
+    }
+  }
+
+  return false;
+}
+
+GenericModem::GenericModem(const char* const device, int baudrate)
+    : _serial(new LSerial(device, (baudrate == MODEM_BAUDRATE_AUTO) ? MODEM_BAUDRATE_DEFAULT : baudrate)),
+      _at(_serial) {
+  _profile.autoBaudrate = (baudrate == MODEM_BAUDRATE_AUTO);
+  _at.setTimer(&_timer);
+  memset(_channelState, 0, sizeof(_channelState));
+  _recoveryStats = modem_recovery_stats_t();
+}
+
+GenericModem::GenericModem(Serial* serial) : _serial(serial), _at(_serial) {
+  _at.setTimer(&_timer);
+  memset(_channelState, 0, sizeof(_channelState));
+  _recoveryStats = modem_recovery_stats_t();
 }
 
 GenericModem::~GenericModem(void) {
+  delete _serial;
+}
+
+bool GenericModem::open(void) {
+  _at.setCommandDelay(_profile.commandDelay);
+  if (!_at.open()) {
+    return false;
+  }
+
+  // Every session starts from the rate of the first one, the host side may still be at a rate negotiated since
+  if (_initialBaudrate == 0) {
+    _initialBaudrate = _serial->getBaudrate();
+  } else if (_serial->getBaudrate() != _initialBaudrate) {
+    _serial->setBaudrate(_initialBaudrate);
+  }
+
+  // A modem which was not reset since the last session may still run at the negotiated rate
+  if (_profile.autoBaudrate && _serial->supportsBaudrate(_initialBaudrate) &&
+      !_at.sendCommand("AT", MODEM_BAUDRATE_CHECK_TIMEOUT) && !findBaudrate()) {
+    _at.close();
+    return false;
+  }
+
+  if (!bootstrap()) {
+    _at.close();
+    return false;
+  }
+
+  if (_profile.autoBaudrate && !negotiateBaudrate()) {
+    _at.close();
+    return false;
+  }
+
+  // Modems which don't know the commands answer ERROR to the test form
+  _openChannels    = 0;
+  _managedChannels = 0;
+  _logicalChannels = _profile.logicalChannels &&
+                     (!_profile.probeLogicalChannels || (_at.sendCommand("AT+CCHO=?", MODEM_BOOTSTRAP_TIMEOUT) &&
+                                                         _at.sendCommand("AT+CGLA=?", MODEM_BOOTSTRAP_TIMEOUT)));
+
+  // A guard time between commands is exactly what pipelining would not respect
+  _pipelining = _profile.pipelining && (_profile.commandDelay == 0) && _at.probePipelining(MODEM_BOOTSTRAP_TIMEOUT);
+
+  return true;
+}
+
+void GenericModem::close(void) {
+  char cmd[24];
+  uint8_t channel;
+
+  for (channel = 1; channel <= MODEM_MAX_LOGICAL_CHANNEL; channel++) {
+    if (_openChannels & (1UL << channel)) {
+      closeLogicalChannel(channel);
+    }
+  }
+
+  // Leave the modem at the rate the next session starts from
+  if (_profile.autoBaudrate && (_initialBaudrate != 0) && (_serial->getBaudrate() != _initialBaudrate)) {
+    snprintf(cmd, sizeof(cmd), "AT+IPR=%d", _initialBaudrate);
+    _at.sendCommand(cmd, MODEM_BAUDRATE_CHECK_TIMEOUT);
+  }
+
+  memset(_channelState, 0, sizeof(_channelState));
+  _at.close();
+}
+
+bool GenericModem::negotiateBaudrate(void) {
+  char rates[128];
+  int current;
+  unsigned int i;
+
+  current = _serial->getBaudrate();
+  if (!_serial->supportsBaudrate(current)) {
+    return true;
+  }
+
+  if (!_at.sendCommand("AT+IPR=?", "+IPR: ", rates, sizeof(rates), MODEM_BOOTSTRAP_TIMEOUT)) {
+    // No way to know what the modem supports, stay where we are
+    return true;
+  }
+
+  for (i = 0; i < sizeof(negotiatedBaudrates) / sizeof(negotiatedBaudrates[0]); i++) {
+    if (negotiatedBaudrates[i] <= current) {
+      break;
+    }
+
+    if (!_serial->supportsBaudrate(negotiatedBaudrates[i]) || !iprListContains(rates, negotiatedBaudrates[i])) {
+      continue;
+    }
+
+    if (switchBaudrate(negotiatedBaudrates[i], false)) {
+      return true;
+    }
+
+    // Either the modem refused the rate or the link does not work at it, go back
+    if ((_serial->getBaudrate() != current) && !switchBaudrate(current, true)) {
+      fprintf(stderr, "Modem lost while falling back to %d baud\n", current);
+      return false;
+    }
+  }
+
+  return true;
+}
+
+bool GenericModem::switchBaudrate(int baudrate, bool force) {
+  char cmd[24];
+  unsigned int i;
+
+  // The modem answers at the old rate and only then switches
+  snprintf(cmd, sizeof(cmd), "AT+IPR=%d", baudrate);
+  if (!_at.sendCommand(cmd, MODEM_BAUDRATE_CHECK_TIMEOUT) && !force) {
+    return false;
+  }
+
+  if (!_serial->setBaudrate(baudrate)) {
+    return false;
+  }
+
+  // Garbage received around the switch ends up in lines the parser skips, a few probes get past it
+  for (i = 0; i < MODEM_BAUDRATE_CHECKS; i++) {
+    if (_at.sendCommand("AT", MODEM_BAUDRATE_CHECK_TIMEOUT)) {
+      return true;
+    }
+  }
+
+  return false;
+}
+
+bool GenericModem::findBaudrate(void) {
+  unsigned int i;
+
+  for (i = 0; i < sizeof(negotiatedBaudrates) / sizeof(negotiatedBaudrates[0]); i++) {
+    if (!_serial->supportsBaudrate(negotiatedBaudrates[i]) || !_serial->setBaudrate(negotiatedBaudrates[i])) {
+      continue;
+    }
+
+    if (_at.sendCommand("AT", MODEM_BAUDRATE_CHECK_TIMEOUT) || _at.sendCommand("AT", MODEM_BAUDRATE_CHECK_TIMEOUT)) {
+      // Back to the expected rate, the negotiation then starts over from there. If the modem refuses the link
+      // simply stays at the rate it was found at.
+      if (!switchBaudrate(_initialBaudrate, false) && (_serial->getBaudrate() != negotiatedBaudrates[i])) {
+        return switchBaudrate(negotiatedBaudrates[i], true);
+      }
+      return true;
+    }
+  }
+
+  fprintf(stderr, "Modem is not answering at any baud rate\n");
+  return false;
+}
+
+bool GenericModem::bootstrap(void) {
+  static const char* const quietUrcs[] = {"AT+CREG=0", "AT+CGREG=0", "AT+CEREG=0"};
+  char cmd[16];
+  unsigned int i;
+
+  // Echo goes first, every later response then comes back without the command repeated in front of it
+  if (!_at.sendCommand(_profile.echo ? "ATE1" : "ATE0", MODEM_BOOTSTRAP_TIMEOUT)) {
+    fprintf(stderr, "Modem is not answering AT commands\n");
+    return false;
+  }
+
+  if (_profile.cmee >= 0) {
+    snprintf(cmd, sizeof(cmd), "AT+CMEE=%d", _profile.cmee);
+    if (!_at.sendCommand(cmd, MODEM_BOOTSTRAP_TIMEOUT)) {
+      fprintf(stderr, "Modem rejected %s\n", cmd);
+    }
+  }
+
+  // Not every module knows every registration command, a rejected one just stays as it was
+  if (!_profile.urcs) {
+    for (i = 0; i < sizeof(quietUrcs) / sizeof(quietUrcs[0]); i++) {
+      _at.sendCommand(quietUrcs[i], MODEM_BOOTSTRAP_TIMEOUT);
+    }
+  }
+
+  for (i = 0; (_profile.commands != nullptr) && (_profile.commands[i] != nullptr); i++) {
+    if (!_at.sendCommand(_profile.commands[i], MODEM_BOOTSTRAP_TIMEOUT)) {
+      fprintf(stderr, "Modem rejected %s\n", _profile.commands[i]);
+      return false;
+    }
+  }
+
+  return true;
+}
+
+bool GenericModem::openLogicalChannel(const uint8_t* aid, uint16_t aidLen, uint8_t* channel) {
+  unsigned long int session;
+
+  if (!_logicalChannels || !_at.sendATCCHO(aid, aidLen, &session)) {
+    return false;
+  }
+
+  // The session id is the channel number on every modem seen so far, past 19 it cannot be coded into CLA
+  if ((session == 0) || (session > MODEM_MAX_LOGICAL_CHANNEL)) {
+    _at.sendATCCHC(session);
+    return false;
+  }
+
+  _openChannels |= 1UL << session;
+  *channel = (uint8_t)session;
+
+  clearState(*channel);
+  memcpy(_channelState[*channel].aid, aid, aidLen);
+  _channelState[*channel].aidLen = aidLen;
+  return true;
+}
+
+bool GenericModem::closeLogicalChannel(uint8_t channel) {
+  if ((channel > MODEM_MAX_LOGICAL_CHANNEL) || !(_openChannels & (1UL << channel))) {
+    return false;
+  }
+
+  _openChannels &= ~(1UL << channel);
+  clearState(channel);
+  return _at.sendATCCHC(channel);
+}
+
+long int GenericModem::getSession(const uint8_t* apdu) {
+  uint8_t channel = claChannel(apdu[0]);
+
+  // Channels the modem opened are only reachable through AT+CGLA
+  return ((channel != 0) && (_openChannels & (1UL << channel))) ? (long int)channel : -1;
+}
+
+bool GenericModem::exchange(uint8_t* apdu, uint16_t apduLen, uint8_t* response, uint16_t* responseLen) {
+  long int session;
+
+  if ((session = getSession(apdu)) >= 0) {
+    return _at.sendATCGLA((unsigned long int)session, apdu, apduLen, response, responseLen);
+  }
+  return _at.sendATCSIM(apdu, apduLen, response, responseLen);
+}
+
+void GenericModem::recordState(const uint8_t* apdu, uint16_t apduLen, const uint8_t* response,
+                               uint16_t responseLen) {
+  ChannelState* state;
+  uint8_t channel;
+  uint8_t sw1;
+
+  if ((apduLen < 4) || (responseLen < 2)) {
+    return;
+  }
+
+  // Only what went through changed the state of the card
+  sw1 = response[responseLen - 2];
+  if ((sw1 != 0x90) && (sw1 != 0x61)) {
+    return;
+  }
+
+  channel = claChannel(apdu[0]);
+  state   = &_channelState[channel];
+
+  switch (apdu[1]) {
+    case 0x70:
+      // MANAGE CHANNEL open answers the channel number, close names it in P2
+      if ((apdu[2] == 0x00) && (responseLen == 3) && (response[0] != 0) && (response[0] <= MODEM_MAX_LOGICAL_CHANNEL)) {
+        _managedChannels |= 1UL << response[0];
+        clearState(response[0]);
+      } else if ((apdu[2] == 0x80) && (apdu[3] <= MODEM_MAX_LOGICAL_CHANNEL)) {
+        _managedChannels &= ~(1UL << apdu[3]);
+        clearState(apdu[3]);
+      }
+      break;
+
+    case 0xA4:
+      if (apdu[2] == 0x04) {
+        memcpy(state->select, apdu, apduLen);
+        state->selectLen = apduLen;
+        state->fileLen   = 0;
+      } else {
+        memcpy(state->file, apdu, apduLen);
+        state->fileLen = apduLen;
+      }
+      break;
+  }
+}
+
+void GenericModem::clearState(uint8_t channel) {
+  memset(&_channelState[channel], 0, sizeof(_channelState[channel]));
+}
+
+bool GenericModem::recover(void) {
+  uint32_t logicalChannels = _openChannels;
+  uint32_t managedChannels = _managedChannels;
+  struct timespec start;
+  struct timespec deadline;
+  struct timespec now;
+  uint32_t elapsed;
+  bool ok = false;
+
+  if (_profile.reconnectTimeout <= 0) {
+    return false;
+  }
+
+  fprintf(stderr, "Modem went away, waiting %d ms for it to come back\n", _profile.reconnectTimeout);
+  clock_gettime(CLOCK_MONOTONIC, &start);
+  deadline_after(_profile.reconnectTimeout, &deadline);
+  _at.close();
+
+  // The port may be back before the module answers AT commands
+  while (!ok && (deadline_remaining(&deadline) > 0)) {
+    if (_serial->waitForDevice(deadline_remaining(&deadline)) && !(ok = open()) &&
+        (deadline_remaining(&deadline) > 0)) {
+      usleep(MODEM_RECONNECT_RETRY * 1000);
+    }
+  }
+
+  if (!ok) {
+    fprintf(stderr, "Modem did not come back\n");
+    _recoveryStats.failures++;
+    return false;
+  }
+
+  restoreChannels(logicalChannels, managedChannels);
+
+  clock_gettime(CLOCK_MONOTONIC, &now);
+  elapsed = (uint32_t)((now.tv_sec - start.tv_sec) * 1000000L + (now.tv_nsec - start.tv_nsec) / 1000L);
+  _recoveryStats.recoveries++;
+  _recoveryStats.last_us = elapsed;
+  _recoveryStats.total_us += elapsed;
+  fprintf(stderr, "Modem back after %u ms\n", elapsed / 1000);
+  return true;
+}
+
+void GenericModem::restoreChannels(uint32_t logicalChannels, uint32_t managedChannels) {
+  static uint8_t manageChannel[] = {0x00, 0x70, 0x00, 0x00, 0x01};
+  uint8_t response[AT_MAX_RESPONSE_LEN];
+  uint16_t responseLen;
+  unsigned long int session;
+  ChannelState* state;
+  uint8_t channel;
+  uint8_t opened;
+
+  // Channels are handed out lowest first, opening them in order gives the numbers the applets coded into CLA
+  for (channel = 1; channel <= MODEM_MAX_LOGICAL_CHANNEL; channel++) {
+    state = &_channelState[channel];
+
+    if (logicalChannels & (1UL << channel)) {
+      if (!_logicalChannels || !_at.sendATCCHO(state->aid, state->aidLen, &session)) {
+        opened = 0;
+      } else if (session != channel) {
+        _at.sendATCCHC(session);
+        opened = 0;
+      } else {
+        _openChannels |= 1UL << channel;
+        opened = channel;
+      }
+    } else if (managedChannels & (1UL << channel)) {
+      opened = (exchange(manageChannel, sizeof(manageChannel), response, &responseLen) && (responseLen == 3) &&
+                (response[1] == 0x90))
+                   ? response[0]
+                   : 0;
+      if (opened == channel) {
+        _managedChannels |= 1UL << channel;
+      } else if (opened != 0) {
+        uint8_t close[] = {0x00, 0x70, 0x80, opened};
+        exchange(close, sizeof(close), response, &responseLen);
+        opened = 0;
+      }
+    } else {
+      continue;
+    }
+
+    if (opened == 0) {
+      fprintf(stderr, "Channel %u could not be restored\n", channel);
+      clearState(channel);
+    }
+  }
+
+  // The applet came back selected with AT+CCHO, everything else is replayed. VERIFY is not: the card may not be the
+  // same one and a wrong PIN burns an attempt, the retried command failing with 6982 for the caller to verify again.
+  for (channel = 0; channel <= MODEM_MAX_LOGICAL_CHANNEL; channel++) {
+    state = &_channelState[channel];
+
+    if ((state->selectLen != 0) && !(_openChannels & (1UL << channel))) {
+      exchange(state->select, state->selectLen, response, &responseLen);
+    }
+    if (state->fileLen != 0) {
+      exchange(state->file, state->fileLen, response, &responseLen);
+    }
+  }
 }
 
 bool GenericModem::transmitApdu(uint8_t* apdu, uint16_t apduLen, uint8_t* response, uint16_t* responseLen) {
@@ -39,7 +471,16 @@ bool GenericModem::transmitApdu(uint8_t* apdu, uint16_t apduLen, uint8_t* respon
   // -----
 #endif
 
-  ret = _at.sendATCSIM(apdu, apduLen, response, responseLen);
+  ret = exchange(apdu, apduLen, response, responseLen);
+
+  // A modem which dropped off the bus lost the exchange with everything else, it is retried once on the new session
+  if (!ret && _serial->isLost() && recover()) {
+    ret = exchange(apdu, apduLen, response, responseLen);
+  }
+
+  if (ret) {
+    recordState(apdu, apduLen, response, *responseLen);
+  }
 
 #ifdef MODEM_DEBUG
   // DEBBUG
@@ -61,6 +502,40 @@ bool GenericModem::transmitApdu(uint8_t* apdu, uint16_t apduLen, uint8_t* respon
   return ret;
 }
 
+bool GenericModem::startApdu(uint8_t* apdu, uint16_t apduLen, uint8_t* response) {
+  return _at.beginApdu(getSession(apdu), apdu, apduLen, response);
+}
+
+bool GenericModem::pollApdu(uint16_t* responseLen, bool* done) {
+  return _at.pollApdu(responseLen, done);
+}
+
+bool GenericModem::readBinary(uint8_t cla, uint16_t offset, uint16_t size, uint8_t chunk, uint8_t* data,
+                              uint16_t* readLen) {
+  uint16_t done = 0;
+  uint16_t rest;
+  bool ret;
+
+  // A single chunk has nothing to overlap with
+  if (_pipelining && (size > chunk) && (getPendingCount() == 0)) {
+    if (!_at.readBinaryPipelined(getSession(&cla), cla, offset, size, chunk, data, &done, _apduResponse,
+                                 &_apduResponseLen)) {
+      fprintf(stderr, "Modem lost a pipelined command, reading in lock-step from now on\n");
+      _pipelining = false;
+    }
+
+    if (done == size) {
+      *readLen = done;
+      return true;
+    }
+  }
+
+  // Whatever is left, 61xx and 6Cxx included, goes one command at a time
+  ret      = SEInterface::readBinary(cla, offset + done, size - done, chunk, &data[done], &rest);
+  *readLen = done + rest;
+  return ret;
+}
+
 extern "C" SEInterface* GenericModem_create(const char* device, int baudrate) {
   return new GenericModem(device, baudrate);
 }
@@ -72,3 +547,7 @@ extern "C" void GenericModem_destroy(SEInterface* iface) {
 extern "C" int GenericModem_open(SEInterface* iface) {
   return static_cast<GenericModem*>(iface)->open();
 }
+
+extern "C" void GenericModem_get_recovery_stats(SEInterface* iface, modem_recovery_stats_t* stats) {
+  *stats = static_cast<GenericModem*>(iface)->getRecoveryStats();
+}
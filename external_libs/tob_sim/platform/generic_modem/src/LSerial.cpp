@@ -8,206 +8,258 @@
  */
 
 #include "LSerial.h"
+#include "Deadline.h"
 #include <cstdio>
 #include <cstring>
 
 #include <termios.h>
 #include <unistd.h>
 #include <fcntl.h>
+#include <poll.h>
+#include <cerrno>
 #include <cstdlib>
+#include <climits>
+#include <sys/inotify.h>
 
 //#define SERIAL_DEBUG
 
-LSerial::LSerial(const char* const device, int baudrate) {
-  if (device) {
-    _device = strdup(device);
-  }
+// Milliseconds between two looks for a lost device when no inotify event comes
+#define SERIAL_DEVICE_POLL_INTERVAL 100
 
-  _baudrate = baudrate;
-  m_uart    = -1;
-}
+// Map a baud rate to its termios speed. Returns false in case the host does not support the rate.
+static bool baudrateToSpeed(int baudrate, speed_t* speed) {
+  switch (baudrate) {
+    case 50:
+      *speed = B50;
+      break;
 
-LSerial::~LSerial(void) {
-  if (_device) {
-    free(_device);
-  }
-}
+    case 75:
+      *speed = B75;
+      break;
 
+    case 110:
+      *speed = B110;
+      break;
 
-bool LSerial::start(void) {
-#ifdef SERIAL_DEBUG
-  printf("Opening serial port...");
-#endif
+    case 134:
+      *speed = B134;
+      break;
 
-  int port;
-  struct termios serial;
+    case 150:
+      *speed = B150;
+      break;
 
-  if ((m_uart = open(_device, O_RDWR | O_NOCTTY | O_NDELAY)) >= 0) {
-    tcgetattr(m_uart, &serial);
+    case 200:
+      *speed = B200;
+      break;
 
-    serial.c_iflag = 0;
-    serial.c_oflag = 0;
-    serial.c_lflag = 0;
-    serial.c_cflag = 0;
+    case 300:
+      *speed = B300;
+      break;
 
-    serial.c_cc[VMIN]  = 0;
-    serial.c_cc[VTIME] = 0;
+    case 600:
+      *speed = B600;
+      break;
 
-    serial.c_cflag = CS8 | CREAD;
+    case 1200:
+      *speed = B1200;
+      break;
 
-    switch (_baudrate) {
-      case 50:
-        serial.c_cflag |= B50;
-        break;
+    case 1800:
+      *speed = B1800;
+      break;
 
-      case 75:
-        serial.c_cflag |= B75;
-        break;
+    case 2400:
+      *speed = B2400;
+      break;
 
-      case 110:
-        serial.c_cflag |= B110;
-        break;
-
-      case 134:
-        serial.c_cflag |= B134;
-        break;
-
-      case 150:
-        serial.c_cflag |= B150;
-        break;
-
-      case 200:
-        serial.c_cflag |= B200;
-        break;
-
-      case 300:
-        serial.c_cflag |= B300;
-        break;
-
-      case 600:
-        serial.c_cflag |= B600;
-        break;
-
-      case 1200:
-        serial.c_cflag |= B1200;
-        break;
+    case 4800:
+      *speed = B4800;
+      break;
 
-      case 1800:
-        serial.c_cflag |= B1800;
-        break;
+    case 9600:
+      *speed = B9600;
+      break;
 
-      case 2400:
-        serial.c_cflag |= B2400;
-        break;
+    case 19200:
+      *speed = B19200;
+      break;
 
-      case 4800:
-        serial.c_cflag |= B4800;
-        break;
+    case 38400:
+      *speed = B38400;
+      break;
 
-      case 9600:
-        serial.c_cflag |= B9600;
-        break;
+    case 57600:
+      *speed = B57600;
+      break;
 
-      case 19200:
-        serial.c_cflag |= B19200;
-        break;
+    case 115200:
+      *speed = B115200;
+      break;
 
-      case 38400:
-        serial.c_cflag |= B38400;
-        break;
-
-      case 57600:
-        serial.c_cflag |= B57600;
-        break;
-
-      case 115200:
-        serial.c_cflag |= B115200;
-        break;
-
-      case 230400:
-        serial.c_cflag |= B230400;
-        break;
+    case 230400:
+      *speed = B230400;
+      break;
 
 #ifdef B460800
-      case 460800:
-        serial.c_cflag |= B460800;
-        break;
+    case 460800:
+      *speed = B460800;
+      break;
 #endif
 
 #ifdef B500000
-      case 500000:
-        serial.c_cflag |= B500000;
-        break;
+    case 500000:
+      *speed = B500000;
+      break;
 #endif
 
 #ifdef B576000
-      case 576000:
-        serial.c_cflag |= B576000;
-        break;
+    case 576000:
+      *speed = B576000;
+      break;
 #endif
 
 #ifdef B921600
-      case 921600:
-        serial.c_cflag |= B921600;
-        break;
+    case 921600:
+      *speed = B921600;
+      break;
 #endif
 
 #ifdef B1000000
-      case 1000000:
-        serial.c_cflag |= B1000000;
-        break;
+    case 1000000:
+      *speed = B1000000;
+      break;
 #endif
 
 #ifdef B1152000
-      case 11520000:
-        serial.c_cflag |= B1152000;
-        break;
+    case 1152000:
+      *speed = B1152000;
+      break;
 #endif
 
 #ifdef B1500000
-      case 1500000:
-        serial.c_cflag |= B1500000;
-        break;
+    case 1500000:
+      *speed = B1500000;
+      break;
 #endif
 
 #ifdef B2000000
-      case 2000000:
-        serial.c_cflag |= B2000000;
-        break;
+    case 2000000:
+      *speed = B2000000;
+      break;
 #endif
 
 #ifdef B2500000
-      case 2500000:
-        serial.c_cflag |= B2500000;
-        break;
+    case 2500000:
+      *speed = B2500000;
+      break;
 #endif
 
 #ifdef B3000000
-      case 3000000:
-        serial.c_cflag |= B3000000;
-        break;
+    case 3000000:
+      *speed = B3000000;
+      break;
 #endif
 
 #ifdef B3500000
-      case 3500000:
-        serial.c_cflag |= B3500000;
-        break;
+    case 3500000:
+      *speed = B3500000;
+      break;
 #endif
 
 #ifdef B4000000
-      case 4000000:
-        serial.c_cflag |= B4000000;
-        break;
+    case 4000000:
+      *speed = B4000000;
+      break;
 #endif
 
-      default:
-        close(m_uart);
-        m_uart = -1;
-        return false;
+    default:
+      return false;
+  }
+
+  return true;
+}
+
+// USB CDC ACM ports have no physical line, the driver ignores whatever speed is configured
+static bool isUsbCdcAcm(const char* device) {
+  char path[PATH_MAX];
+  char driver[PATH_MAX];
+  const char* name;
+  const char* base;
+  char* real;
+  ssize_t n;
+  bool ret;
+
+  if ((real = realpath(device, nullptr)) == nullptr) {
+    return false;
+  }
+
+  name = strrchr(real, '/');
+  name = (name != nullptr) ? name + 1 : real;
+
+  snprintf(path, sizeof(path), "/sys/class/tty/%s/device/driver", name);
+  if ((n = readlink(path, driver, sizeof(driver) - 1)) >= 0) {
+    driver[n] = '\0';
+    base      = strrchr(driver, '/');
+    ret       = (strcmp((base != nullptr) ? base + 1 : driver, "cdc_acm") == 0);
+  } else {
+    ret = (strncmp(name, "ttyACM", 6) == 0);
+  }
+
+  free(real);
+  return ret;
+}
+
+LSerial::LSerial(const char* const device, int baudrate) {
+  if (device) {
+    _device = strdup(device);
+  }
+
+  _baudrate = baudrate;
+  m_uart    = -1;
+  _usbCdc   = (_device != nullptr) && isUsbCdcAcm(_device);
+}
+
+LSerial::~LSerial(void) {
+  if (_device) {
+    free(_device);
+  }
+}
+
+
+bool LSerial::start(void) {
+#ifdef SERIAL_DEBUG
+  printf("Opening serial port...");
+#endif
+
+  struct termios serial;
+  speed_t speed;
+
+  // The descriptor stays non-blocking, waiting for data is done in poll() so that an idle port costs no CPU
+  _lost = false;
+  if ((m_uart = open(_device, O_RDWR | O_NOCTTY | O_NONBLOCK)) >= 0) {
+    tcgetattr(m_uart, &serial);
+
+    serial.c_iflag = 0;
+    serial.c_oflag = 0;
+    serial.c_lflag = 0;
+    serial.c_cflag = 0;
+
+    serial.c_cc[VMIN]  = 0;
+    serial.c_cc[VTIME] = 0;
+
+    serial.c_cflag = CS8 | CREAD;
+
+    if (!baudrateToSpeed(_baudrate, &speed)) {
+      close(m_uart);
+      m_uart = -1;
+      return false;
     }
+    cfsetispeed(&serial, speed);
+    cfsetospeed(&serial, speed);
 
     tcsetattr(m_uart, TCSANOW, &serial);  // Apply configuration
-    fcntl(m_uart, F_SETFL, 0);
+    tcflush(m_uart, TCIFLUSH);            // Drop whatever a previous session left unread
 
 #ifdef SERIAL_DEBUG
     printf("Found serial %s %d\r\n", _device, m_uart);
@@ -218,20 +270,56 @@ bool LSerial::start(void) {
   return false;
 }
 
+bool LSerial::setBaudrate(int baudrate) {
+  struct termios serial;
+  speed_t speed;
+
+  if ((m_uart < 0) || !baudrateToSpeed(baudrate, &speed)) {
+    return false;
+  }
+
+  if (tcgetattr(m_uart, &serial) != 0) {
+    return false;
+  }
+  cfsetispeed(&serial, speed);
+  cfsetospeed(&serial, speed);
+
+  // Let the last command leave at the old speed before switching
+  if (tcsetattr(m_uart, TCSADRAIN, &serial) != 0) {
+    return false;
+  }
+
+  _baudrate = baudrate;
+  return true;
+}
+
+bool LSerial::supportsBaudrate(int baudrate) {
+  speed_t speed;
+
+  return !_usbCdc && baudrateToSpeed(baudrate, &speed);
+}
+
 bool LSerial::send(char* data, unsigned long int toWrite, unsigned long int* size) {
+  struct timespec deadline;
   unsigned long int i;
-  int w;
+  ssize_t w;
 
   if (m_uart < 0) {
     return false;
   }
 
+  deadline_after(_timeout, &deadline);
   for (i = 0; i < toWrite;) {
     w = write(m_uart, &data[i], (toWrite - i));
-    if (w == -1) {
-      return false;
-    } else if (w) {
+    if (w > 0) {
       i += w;
+    } else if ((w == 0) || (errno == EAGAIN) || (errno == EWOULDBLOCK)) {
+      if (!waitFor(POLLOUT, (_timeout < 0) ? nullptr : &deadline)) {
+        return false;
+      }
+    } else if (errno != EINTR) {
+      checkLost();
+      return false;
     }
   }
 
@@ -254,24 +342,42 @@ bool LSerial::send(char* data, unsigned long int toWrite, unsigned long int* siz
   return true;
 }
 
+bool LSerial::drain(void) {
+  // Returns once the UART shifted the last byte out, the kernel buffer hides that from write()
+  return (m_uart >= 0) && (tcdrain(m_uart) == 0);
+}
+
 bool LSerial::recv(char* data, unsigned long int toRead, unsigned long int* size) {
+  return recv(data, toRead, size, _timeout);
+}
+
+bool LSerial::recv(char* data, unsigned long int toRead, unsigned long int* size, int timeout) {
+  struct timespec deadline;
   unsigned long int i;
-  int r;
+  ssize_t r;
+
+  *size = 0;
 
   if (m_uart < 0) {
     return false;
   }
 
+  deadline_after(timeout, &deadline);
   for (i = 0; i < toRead;) {
     r = read(m_uart, &data[i], (toRead - i));
-    if (r == -1) {
-      return false;
-    } else if (r) {
+    if (r > 0) {
       i += r;
+    } else if ((r == 0) || (errno == EAGAIN) || (errno == EWOULDBLOCK)) {
+      if (!waitFor(POLLIN, (timeout < 0) ? nullptr : &deadline)) {
+        break;
+      }
+    } else if (errno != EINTR) {
+      checkLost();
+      break;
     }
   }
 
-  *size = toRead;
+  *size = i;
 
 
 #ifdef SERIAL_DEBUG
@@ -287,15 +393,156 @@ bool LSerial::recv(char* data, unsigned long int toRead, unsigned long int* size
   }
 #endif
 
+  return (i == toRead);
+}
+
+bool LSerial::recvAvailable(char* data, unsigned long int toRead, unsigned long int* size, int timeout) {
+  struct timespec deadline;
+  ssize_t r;
+
+  *size = 0;
+
+  if (m_uart < 0) {
+    return false;
+  }
+
+  deadline_after(timeout, &deadline);
+  for (;;) {
+    r = read(m_uart, data, toRead);
+    if (r > 0) {
+      break;
+    } else if ((r == 0) || (errno == EAGAIN) || (errno == EWOULDBLOCK)) {
+      if (!waitFor(POLLIN, (timeout < 0) ? nullptr : &deadline)) {
+        return false;
+      }
+    } else if (errno != EINTR) {
+      checkLost();
+      return false;
+    }
+  }
+
+  *size = r;
+
+
+#ifdef SERIAL_DEBUG
+  {
+    unsigned long int i;
+    printf("< ");
+    for (i = 0; i < *size; i++) {
+      if ((data[i] != '\r') && (data[i] != '\n')) {
+        printf("%c", data[i]);
+      }
+    }
+    printf("\n");
+  }
+#endif
+
   return true;
 }
 
+bool LSerial::waitFor(short events, const struct timespec* deadline) {
+  struct pollfd pfd;
+  int ret;
+
+  pfd.fd     = m_uart;
+  pfd.events = events;
+
+  do {
+    pfd.revents = 0;
+    ret         = poll(&pfd, 1, deadline_remaining(deadline));
+  } while ((ret < 0) && (errno == EINTR));
+
+  if (ret <= 0) {
+    return false;
+  }
+
+  // Data still buffered before a hangup is delivered, a hangup alone is an error
+  if ((pfd.revents & events) != 0) {
+    return true;
+  }
+
+  if ((pfd.revents & (POLLHUP | POLLERR | POLLNVAL)) != 0) {
+    _lost = true;
+  }
+  return false;
+}
+
+void LSerial::checkLost(void) {
+  if ((errno == EIO) || (errno == ENODEV) || (errno == ENXIO)) {
+    _lost = true;
+  }
+}
+
+bool LSerial::waitForDevice(int timeout) {
+  char events[sizeof(struct inotify_event) + NAME_MAX + 1];
+  char dir[PATH_MAX];
+  struct timespec deadline;
+  struct pollfd pfd;
+  char* slash;
+  int fd;
+  int wait;
+
+  if (_device == nullptr) {
+    return false;
+  }
+
+  snprintf(dir, sizeof(dir), "%s", _device);
+  slash = strrchr(dir, '/');
+  if (slash == dir) {
+    slash[1] = '\0';
+  } else if (slash != nullptr) {
+    *slash = '\0';
+  } else {
+    strcpy(dir, ".");
+  }
+
+  // Without inotify the node is looked for every poll interval only
+  pfd.fd     = inotify_init1(IN_NONBLOCK | IN_CLOEXEC);
+  pfd.events = POLLIN;
+  if ((pfd.fd >= 0) && (inotify_add_watch(pfd.fd, dir, IN_CREATE | IN_ATTRIB | IN_MOVED_TO) < 0)) {
+    close(pfd.fd);
+    pfd.fd = -1;
+  }
+
+  deadline_after(timeout, &deadline);
+  for (;;) {
+    // The node may be there before udev gave it its permissions, only a successful open counts
+    if ((fd = open(_device, O_RDWR | O_NOCTTY | O_NONBLOCK)) >= 0) {
+      close(fd);
+      break;
+    }
+
+    wait = deadline_remaining((timeout < 0) ? nullptr : &deadline);
+    if (wait == 0) {
+      break;
+    }
+    if ((wait < 0) || (wait > SERIAL_DEVICE_POLL_INTERVAL)) {
+      wait = SERIAL_DEVICE_POLL_INTERVAL;
+    }
+
+    if (pfd.fd >= 0) {
+      if (poll(&pfd, 1, wait) > 0) {
+        while (read(pfd.fd, events, sizeof(events)) > 0) {
+        }
+      }
+    } else {
+      usleep(wait * 1000);
+    }
+  }
+
+  if (pfd.fd >= 0) {
+    close(pfd.fd);
+  }
+  return fd >= 0;
+}
+
 bool LSerial::stop(void) {
 #ifdef SERIAL_DEBUG
   printf("Closing serial port...");
 #endif
   if (m_uart >= 0) {
     close(m_uart);
+    m_uart = -1;
   }
 #ifdef SERIAL_DEBUG
   printf("OK\n");
@@ -0,0 +1,134 @@
+/*
+ *
+ * Twilio Breakout Trust Onboard SDK
+ *
+ * Copyright (c) 2019 Twilio, Inc.
+ *
+ * SPDX-License-Identifier:  Apache-2.0
+ */
+
+#include "ModemDriver.h"
+#include <cstring>
+
+#include <strings.h>
+
+/** Built-in drivers **********************************************************/
+
+QuectelModem::QuectelModem(Serial* serial) : GenericModem(serial) {
+  _profile.probeLogicalChannels = false;
+}
+
+UbloxModem::UbloxModem(Serial* serial) : GenericModem(serial) {
+  _profile.probeLogicalChannels = false;
+  _profile.commandDelay         = UBLOX_COMMAND_DELAY;
+}
+
+SimcomModem::SimcomModem(Serial* serial) : GenericModem(serial) {
+  _profile.probeLogicalChannels = false;
+}
+
+static GenericModem* createGenericModem(Serial* serial) {
+  return new GenericModem(serial);
+}
+
+static GenericModem* createQuectelModem(Serial* serial) {
+  return new QuectelModem(serial);
+}
+
+static GenericModem* createUbloxModem(Serial* serial) {
+  return new UbloxModem(serial);
+}
+
+static GenericModem* createSimcomModem(Serial* serial) {
+  return new SimcomModem(serial);
+}
+
+static const ModemDriver builtinDrivers[] = {
+    {"quectel", "Quectel", nullptr, createQuectelModem},
+    {"u-blox", "u-blox", nullptr, createUbloxModem},
+    {"simcom", "SIMCOM", nullptr, createSimcomModem},
+};
+
+static const ModemDriver genericDriver = {"generic", nullptr, nullptr, createGenericModem};
+
+/** Registry ******************************************************************/
+
+static const ModemDriver* drivers[MODEM_MAX_DRIVERS];
+static unsigned int driverCount = 0;
+
+static bool matches(const char* pattern, const char* value) {
+  return (pattern == nullptr) || (strncasecmp(value, pattern, strlen(pattern)) == 0);
+}
+
+// Store the answer of command, without its optional "+CGMx:" prefix, into identity
+static void identify(ATInterface& at, const char* command, char* identity) {
+  char response[MODEM_IDENTITY_LEN + 8];
+  const char* value;
+
+  identity[0] = '\0';
+  if (!at.sendCommand(command, "", response, sizeof(response), MODEM_BOOTSTRAP_TIMEOUT)) {
+    return;
+  }
+
+  value = response;
+  if ((strncmp(value, command + 2, 5) == 0) && (value[5] == ':')) {
+    value += 6;
+  }
+  while (*value == ' ') {
+    value++;
+  }
+
+  strncpy(identity, value, MODEM_IDENTITY_LEN - 1);
+  identity[MODEM_IDENTITY_LEN - 1] = '\0';
+}
+
+bool ModemRegistry::add(const ModemDriver* driver) {
+  if (driverCount == MODEM_MAX_DRIVERS) {
+    return false;
+  }
+
+  drivers[driverCount++] = driver;
+  return true;
+}
+
+const ModemDriver* ModemRegistry::probe(Serial* serial, char* manufacturer, char* model) {
+  ATInterface at(serial);
+  unsigned int i;
+
+  manufacturer[0] = '\0';
+  model[0]        = '\0';
+
+  // Echo is turned off first, the identification responses have no prefix to tell them from it
+  if (at.open()) {
+    if (at.sendCommand("ATE0", MODEM_BOOTSTRAP_TIMEOUT)) {
+      identify(at, "AT+CGMI", manufacturer);
+      identify(at, "AT+CGMM", model);
+    }
+    at.close();
+  }
+
+  if (manufacturer[0] == '\0') {
+    return &genericDriver;
+  }
+
+  for (i = driverCount; i > 0; i--) {
+    if (matches(drivers[i - 1]->manufacturer, manufacturer) && matches(drivers[i - 1]->model, model)) {
+      return drivers[i - 1];
+    }
+  }
+
+  for (i = 0; i < sizeof(builtinDrivers) / sizeof(builtinDrivers[0]); i++) {
+    if (matches(builtinDrivers[i].manufacturer, manufacturer) && matches(builtinDrivers[i].model, model)) {
+      return &builtinDrivers[i];
+    }
+  }
+
+  return &genericDriver;
+}
+
+GenericModem* ModemRegistry::create(Serial* serial) {
+  char manufacturer[MODEM_IDENTITY_LEN];
+  char model[MODEM_IDENTITY_LEN];
+
+  return probe(serial, manufacturer, model)->create(serial);
+}
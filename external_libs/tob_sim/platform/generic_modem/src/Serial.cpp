@@ -10,6 +10,7 @@
 #include "Serial.h"
 
 Serial::Serial(void) {
+  _timeout = SERIAL_DEFAULT_TIMEOUT;
 }
 
 Serial::~Serial(void) {
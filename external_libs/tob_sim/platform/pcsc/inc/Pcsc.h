@@ -12,6 +12,8 @@
 
 #include <PCSC/winscard.h>
 
+#include <string>
+
 #include "SEInterface.h"
 
 #ifdef __cplusplus
@@ -20,21 +22,38 @@ class PcscSEInterface : public SEInterface {
  public:
   // Create an instance of Generic Modem.
   PcscSEInterface(int reader_idx);
+  // Reader found by name rather than by its place in the list, which changes as readers come and go
+  PcscSEInterface(const char* reader_name);
   ~PcscSEInterface(void);
 
+  // Connect with T=1 when the card offers it, T=0 otherwise
   bool open(void) override;
 
   void close(void) override;
 
+  // The card talks T=1 and its ATR announces extended Lc and Le
+  bool supportsExtendedLength(void) override {
+    return _extendedLength;
+  }
+
+  // Copy the names of the readers pcscd knows, one after the other and each NUL terminated, into names.
+  // Returns the number of readers, -1 in case they could not be listed.
+  static int listReaders(char* names, unsigned long int size);
+
  protected:
   bool transmitApdu(uint8_t* apdu, uint16_t apduLen, uint8_t* response, uint16_t* responseLen) override;
+  // SCardBeginTransaction and SCardEndTransaction, pcscd then keeping the reader for this handle in between
+  bool lockTransport(void) override;
+  void unlockTransport(void) override;
 
  private:
   SCARDHANDLE _card_handle;
   SCARDCONTEXT _card_context;
   int _idx{0};
+  std::string _name;
   DWORD _protocol{SCARD_PROTOCOL_T0};
   bool _initialized{false};
+  bool _extendedLength{false};
 };
 
 #else /* __cplusplus */
@@ -8,12 +8,15 @@
  */
 
 #include "Pcsc.h"
+#include "Atr.h"
 
 #include <memory>
 #include <cstdio>
 
 PcscSEInterface::PcscSEInterface(int reader_idx) : _idx{reader_idx} {
 }
+PcscSEInterface::PcscSEInterface(const char* reader_name) : _name{reader_name} {
+}
 PcscSEInterface::~PcscSEInterface() {
   if (_initialized) {
     close();
@@ -48,7 +51,10 @@ bool PcscSEInterface::open() {
   int pos = 0;
   char* p = nullptr;
   for (p = reader_names.get(); p != nullptr; p += strlen(p) + 1) {
-    if (pos == _idx) {
+    if (*p == '\0') {
+      p = nullptr;
+      break;
+    } else if (_name.empty() ? (pos == _idx) : (_name == p)) {
       break;
     } else {
       ++pos;
@@ -56,16 +62,35 @@ bool PcscSEInterface::open() {
   }
 
   if (p == nullptr) {
-    fprintf(stderr, "PCSC: card reader #%d is not found\n", _idx);
+    if (_name.empty()) {
+      fprintf(stderr, "PCSC: card reader #%d is not found\n", _idx);
+    } else {
+      fprintf(stderr, "PCSC: card reader %s is not found\n", _name.c_str());
+    }
     return false;
   }
 
-  if ((ret = SCardConnect(_card_context, p, SCARD_SHARE_SHARED, SCARD_PROTOCOL_T0, &_card_handle, &_protocol)) !=
-      SCARD_S_SUCCESS) {
+  // T=1 carries whole APDUs without 61xx and GET RESPONSE and allows extended lengths, T=0 is the fallback
+  if ((ret = SCardConnect(_card_context, p, SCARD_SHARE_SHARED, SCARD_PROTOCOL_T1, &_card_handle, &_protocol)) ==
+      SCARD_E_PROTO_MISMATCH) {
+    ret = SCardConnect(_card_context, p, SCARD_SHARE_SHARED, SCARD_PROTOCOL_T0, &_card_handle, &_protocol);
+  }
+  if (ret != SCARD_S_SUCCESS) {
     fprintf(stderr, "PCSC: could not connect to card reader: %s\n", pcsc_stringify_error(ret));
     return false;
   }
 
+  BYTE atr[MAX_ATR_SIZE];
+  DWORD atr_len    = sizeof(atr);
+  DWORD reader_len = 0;
+  DWORD state;
+  DWORD protocol;
+
+  _extendedLength = (_protocol == SCARD_PROTOCOL_T1) &&
+                    (SCardStatus(_card_handle, nullptr, &reader_len, &state, &protocol, atr, &atr_len) ==
+                     SCARD_S_SUCCESS) &&
+                    tob_atr_extended_length(atr, atr_len);
+
   _initialized = true;
   return true;
 }
@@ -77,14 +102,18 @@ void PcscSEInterface::close() {
 }
 
 bool PcscSEInterface::transmitApdu(uint8_t* apdu, uint16_t apduLen, uint8_t* response, uint16_t* responseLen) {
-  DWORD resp_len_long = 256 + 2;
+  DWORD resp_len_long = SE_RESPONSE_MAX_LEN;
 
   LONG ret;
+
+  // pcscd hands the whole exchange to the reader driver, the answer is only seen once it is complete
+  _timer.sent(apduLen);
   if ((ret = SCardTransmit(_card_handle, (_protocol == SCARD_PROTOCOL_T0) ? SCARD_PCI_T0 : SCARD_PCI_T1, apdu, apduLen,
                            nullptr, response, &resp_len_long)) != SCARD_S_SUCCESS) {
     fprintf(stderr, "PCSC: transmit failed: %s\n", pcsc_stringify_error(ret));
     return false;
   }
+  _timer.received(resp_len_long);
 
   if (resp_len_long > UINT16_MAX) {
     return false;
@@ -94,6 +123,65 @@ bool PcscSEInterface::transmitApdu(uint8_t* apdu, uint16_t apduLen, uint8_t* res
   return true;
 }
 
+bool PcscSEInterface::lockTransport() {
+  LONG ret;
+
+  if (!_initialized) {
+    return false;
+  }
+
+  // Another client reset the card since the last transaction, whatever was selected is gone either way
+  if ((ret = SCardBeginTransaction(_card_handle)) == SCARD_W_RESET_CARD) {
+    if ((ret = SCardReconnect(_card_handle, SCARD_SHARE_SHARED, _protocol, SCARD_LEAVE_CARD, &_protocol)) ==
+        SCARD_S_SUCCESS) {
+      ret = SCardBeginTransaction(_card_handle);
+    }
+  }
+
+  if (ret != SCARD_S_SUCCESS) {
+    fprintf(stderr, "PCSC: could not begin transaction: %s\n", pcsc_stringify_error(ret));
+    return false;
+  }
+
+  return true;
+}
+
+void PcscSEInterface::unlockTransport() {
+  LONG ret;
+
+  if ((ret = SCardEndTransaction(_card_handle, SCARD_LEAVE_CARD)) != SCARD_S_SUCCESS) {
+    fprintf(stderr, "PCSC: could not end transaction: %s\n", pcsc_stringify_error(ret));
+  }
+}
+
+int PcscSEInterface::listReaders(char* names, unsigned long int size) {
+  SCARDCONTEXT context;
+  DWORD len = size;
+  int count = 0;
+  LONG ret;
+
+  if ((ret = SCardEstablishContext(SCARD_SCOPE_SYSTEM, nullptr, nullptr, &context)) != SCARD_S_SUCCESS) {
+    fprintf(stderr, "PCSC: Failed to initialize context: %s\n", pcsc_stringify_error(ret));
+    return -1;
+  }
+
+  ret = SCardListReaders(context, nullptr, names, &len);
+  SCardReleaseContext(context);
+  if (ret == SCARD_E_NO_READERS_AVAILABLE) {
+    return 0;
+  }
+  if (ret != SCARD_S_SUCCESS) {
+    fprintf(stderr, "PCSC: Failed to get reader names: %s\n", pcsc_stringify_error(ret));
+    return -1;
+  }
+
+  // The list ends with an empty name
+  for (const char* p = names; *p != '\0'; p += strlen(p) + 1) {
+    count++;
+  }
+  return count;
+}
+
 extern "C" SEInterface* PcscSEInterface_create(int reader_idx) {
   return new PcscSEInterface(reader_idx);
 }
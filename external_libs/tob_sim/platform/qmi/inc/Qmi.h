@@ -0,0 +1,130 @@
+/*
+ *
+ * Twilio Breakout Trust Onboard SDK
+ *
+ * Copyright (c) 2019 Twilio, Inc.
+ *
+ * SPDX-License-Identifier:  Apache-2.0
+ */
+
+#ifndef __QMI_SEINTERFACE_H__
+#define __QMI_SEINTERFACE_H__
+
+#include "SEInterface.h"
+
+// Longest QMUX message sent or accepted, an APDU and its response fit with plenty of room
+#define QMI_MAX_MESSAGE_LEN 2048
+
+// Deadline in milliseconds for the modem to answer a request
+#define QMI_TIMEOUT 5000
+
+// QMUX header: interface type, length, control flags, service, client
+#define QMI_QMUX_HEADER_LEN 6
+#define QMI_QMUX_IF_TYPE 0x01
+#define QMI_QMUX_FLAG_SERVICE 0x80
+
+// Services and their messages
+#define QMI_SERVICE_CTL 0x00
+#define QMI_SERVICE_UIM 0x0B
+
+#define QMI_CTL_GET_CLIENT_ID 0x0022
+#define QMI_CTL_RELEASE_CLIENT_ID 0x0023
+
+#define QMI_UIM_SEND_APDU 0x003B
+#define QMI_UIM_LOGICAL_CHANNEL 0x003F
+#define QMI_UIM_OPEN_LOGICAL_CHANNEL 0x0042
+
+// Message types in the SDU control flags. CTL uses 1 for responses and 2 for indications, other services 2 and 4.
+#define QMI_CTL_FLAG_RESPONSE 0x01
+#define QMI_CTL_FLAG_INDICATION 0x02
+#define QMI_FLAG_RESPONSE 0x02
+#define QMI_FLAG_INDICATION 0x04
+
+// TLV carrying the result and error code of every response
+#define QMI_TLV_RESULT 0x02
+
+#ifdef __cplusplus
+
+struct QmiMessage {
+  uint8_t service;
+  uint8_t client;
+  uint8_t flags;  // SDU control flags
+  uint16_t transaction;
+  uint16_t message;
+  const uint8_t* tlvs;
+  uint16_t tlvsLen;
+};
+
+// SIM access through the UIM service of a Qualcomm modem's QMI control device, e.g. /dev/cdc-wdm0. APDUs travel in
+// binary and logical channels are opened by the modem.
+class QmiSEInterface : public SEInterface {
+ public:
+  // Create an instance for the card in slot (1 for the first one) behind the QMI device
+  QmiSEInterface(const char* device, uint8_t slot = 1);
+  // Create an instance on an already open QMI endpoint, which is then owned by the interface
+  QmiSEInterface(int fd, uint8_t slot = 1);
+  ~QmiSEInterface(void);
+
+  bool open(void) override;
+  void close(void) override;
+
+  bool openLogicalChannel(const uint8_t* aid, uint16_t aidLen, uint8_t* channel) override;
+  bool closeLogicalChannel(uint8_t channel) override;
+
+  // QMI error code of the last failed request, 0 if it failed before reaching the modem
+  uint16_t getLastError(void) {
+    return _lastError;
+  }
+
+  // Encode a QMUX message into out, which must have room for QMI_MAX_MESSAGE_LEN bytes.
+  // Returns the message length, 0 in case it does not fit.
+  static unsigned long int encodeMessage(const QmiMessage* msg, uint8_t* out);
+
+  // Decode the QMUX message at the start of data.
+  // Returns its length in case it is complete, 0 in case more data is needed, -1 in case it is malformed.
+  static long int decodeMessage(const uint8_t* data, unsigned long int len, QmiMessage* msg);
+
+  // Append a TLV to out, returns its length
+  static unsigned long int putTlv(uint8_t* out, uint8_t type, const void* value, uint16_t len);
+
+  // Find the TLV of the given type, returns false in case there is none
+  static bool findTlv(const QmiMessage* msg, uint8_t type, const uint8_t** value, uint16_t* len);
+
+ protected:
+  bool transmitApdu(uint8_t* apdu, uint16_t apduLen, uint8_t* response, uint16_t* responseLen) override;
+
+  // Send a request and wait for the response carrying its transaction ID, which is left in _response. Indications
+  // and responses to requests given up on are dropped.
+  // Returns true in case the modem reported success, false otherwise.
+  bool request(uint8_t service, uint16_t message, const uint8_t* tlvs, uint16_t tlvsLen);
+
+  // Wait at most timeout milliseconds for the next complete message, stored in _response
+  bool receive(int timeout);
+
+ private:
+  // Copy of the path, the caller's string need not outlive the interface
+  char* _device;
+  int _fd;
+  uint8_t _slot;
+  uint8_t _client;
+  uint16_t _transaction;
+  uint16_t _lastError;
+  // Channels opened by the modem, bit n set for channel n
+  uint32_t _openChannels;
+
+  uint8_t _tx[QMI_MAX_MESSAGE_LEN];
+  uint8_t _rx[2 * QMI_MAX_MESSAGE_LEN];
+  unsigned long int _rxLen;
+  unsigned long int _rxUsed;
+  QmiMessage _response;
+};
+
+#else /* __cplusplus */
+
+SEInterface* QmiSEInterface_create(const char* device);
+void QmiSEInterface_destroy(SEInterface* iface);
+int QmiSEInterface_open(SEInterface* iface);
+
+#endif /* __cplusplus */
+
+#endif /* __QMI_SEINTERFACE_H__ */
@@ -0,0 +1,431 @@
+/*
+ *
+ * Twilio Breakout Trust Onboard SDK
+ *
+ * Copyright (c) 2019 Twilio, Inc.
+ *
+ * SPDX-License-Identifier:  Apache-2.0
+ */
+
+#include "Qmi.h"
+#include "Deadline.h"
+#include <cstdio>
+#include <cstdlib>
+#include <cstring>
+
+#include <fcntl.h>
+#include <poll.h>
+#include <unistd.h>
+
+//#define QMI_DEBUG
+
+// TLVs of the UIM requests and responses
+#define QMI_TLV_CTL_SERVICE 0x01
+#define QMI_TLV_CTL_CLIENT 0x01
+#define QMI_TLV_UIM_SLOT 0x01
+#define QMI_TLV_UIM_APDU 0x02
+#define QMI_TLV_UIM_CHANNEL 0x10
+#define QMI_TLV_UIM_APDU_RESPONSE 0x10
+#define QMI_TLV_UIM_AID 0x10
+#define QMI_TLV_UIM_OPENED_CHANNEL 0x10
+#define QMI_TLV_UIM_CLOSED_CHANNEL 0x11
+
+// Logical channels 1 to QMI_MAX_LOGICAL_CHANNEL can be coded into CLA, as per ISO/IEC 7816-4 (claWithChannel)
+#define QMI_MAX_LOGICAL_CHANNEL 19
+
+static inline void put16(uint8_t* out, uint16_t value) {
+  out[0] = (uint8_t)(value & 0xFF);
+  out[1] = (uint8_t)(value >> 8);
+}
+
+static inline uint16_t get16(const uint8_t* data) {
+  return (uint16_t)(data[0] | (data[1] << 8));
+}
+
+QmiSEInterface::QmiSEInterface(const char* device, uint8_t slot) {
+  _device       = (device != nullptr) ? strdup(device) : nullptr;
+  _fd           = -1;
+  _slot         = slot;
+  _client       = 0;
+  _transaction  = 0;
+  _lastError    = 0;
+  _openChannels = 0;
+  _rxLen        = 0;
+  _rxUsed       = 0;
+}
+
+QmiSEInterface::QmiSEInterface(int fd, uint8_t slot) : QmiSEInterface((const char*)nullptr, slot) {
+  _fd = fd;
+}
+
+QmiSEInterface::~QmiSEInterface(void) {
+  if (_fd >= 0) {
+    close();
+  }
+  free(_device);
+}
+
+/** Message codec *************************************************************/
+
+unsigned long int QmiSEInterface::encodeMessage(const QmiMessage* msg, uint8_t* out) {
+  unsigned long int off;
+  unsigned long int total;
+
+  total = QMI_QMUX_HEADER_LEN + ((msg->service == QMI_SERVICE_CTL) ? 6 : 7) + msg->tlvsLen;
+  if (total > QMI_MAX_MESSAGE_LEN) {
+    return 0;
+  }
+
+  // The length covers everything but the interface type
+  out[0] = QMI_QMUX_IF_TYPE;
+  put16(&out[1], (uint16_t)(total - 1));
+  out[3] = (msg->flags != 0) ? QMI_QMUX_FLAG_SERVICE : 0x00;
+  out[4] = msg->service;
+  out[5] = msg->client;
+  off    = QMI_QMUX_HEADER_LEN;
+
+  out[off++] = msg->flags;
+  if (msg->service == QMI_SERVICE_CTL) {
+    out[off++] = (uint8_t)msg->transaction;
+  } else {
+    put16(&out[off], msg->transaction);
+    off += 2;
+  }
+  put16(&out[off], msg->message);
+  put16(&out[off + 2], msg->tlvsLen);
+  off += 4;
+
+  if (msg->tlvsLen > 0) {
+    memcpy(&out[off], msg->tlvs, msg->tlvsLen);
+  }
+
+  return total;
+}
+
+long int QmiSEInterface::decodeMessage(const uint8_t* data, unsigned long int len, QmiMessage* msg) {
+  unsigned long int total;
+  unsigned long int off;
+
+  if (len < 1) {
+    return 0;
+  }
+  if (data[0] != QMI_QMUX_IF_TYPE) {
+    return -1;
+  }
+  if (len < 3) {
+    return 0;
+  }
+
+  total = get16(&data[1]) + 1UL;
+  if ((total < QMI_QMUX_HEADER_LEN + 6) || (total > QMI_MAX_MESSAGE_LEN)) {
+    return -1;
+  }
+  if (len < total) {
+    return 0;
+  }
+
+  msg->service = data[4];
+  msg->client  = data[5];
+  off          = QMI_QMUX_HEADER_LEN;
+
+  msg->flags = data[off++];
+  if (msg->service == QMI_SERVICE_CTL) {
+    msg->transaction = data[off++];
+  } else {
+    if (total < QMI_QMUX_HEADER_LEN + 7) {
+      return -1;
+    }
+    msg->transaction = get16(&data[off]);
+    off += 2;
+  }
+  msg->message = get16(&data[off]);
+  msg->tlvsLen = get16(&data[off + 2]);
+  off += 4;
+
+  if (off + msg->tlvsLen != total) {
+    return -1;
+  }
+  msg->tlvs = &data[off];
+
+  return (long int)total;
+}
+
+unsigned long int QmiSEInterface::putTlv(uint8_t* out, uint8_t type, const void* value, uint16_t len) {
+  out[0] = type;
+  put16(&out[1], len);
+  if (len > 0) {
+    memcpy(&out[3], value, len);
+  }
+  return 3 + len;
+}
+
+bool QmiSEInterface::findTlv(const QmiMessage* msg, uint8_t type, const uint8_t** value, uint16_t* len) {
+  unsigned long int off;
+  uint16_t tlvLen;
+
+  for (off = 0; off + 3 <= msg->tlvsLen; off += 3 + tlvLen) {
+    tlvLen = get16(&msg->tlvs[off + 1]);
+    if (off + 3 + tlvLen > msg->tlvsLen) {
+      return false;
+    }
+    if (msg->tlvs[off] == type) {
+      *value = &msg->tlvs[off + 3];
+      *len   = tlvLen;
+      return true;
+    }
+  }
+
+  return false;
+}
+
+/** Transport *****************************************************************/
+
+bool QmiSEInterface::receive(int timeout) {
+  struct timespec deadline;
+  struct pollfd pfd;
+  long int n;
+  ssize_t r;
+
+  deadline_after(timeout, &deadline);
+
+  // The previous message goes, whatever came with it stays
+  if (_rxUsed > 0) {
+    memmove(_rx, &_rx[_rxUsed], _rxLen - _rxUsed);
+    _rxLen -= _rxUsed;
+    _rxUsed = 0;
+  }
+
+  for (;;) {
+    n = decodeMessage(_rx, _rxLen, &_response);
+    if (n > 0) {
+      _rxUsed = n;
+      return true;
+    }
+    if (n < 0) {
+      // The device hands over whole messages, anything malformed is dropped as a whole
+      _rxLen = 0;
+    }
+
+    pfd.fd     = _fd;
+    pfd.events = POLLIN;
+    if (poll(&pfd, 1, deadline_remaining(&deadline)) <= 0) {
+      return false;
+    }
+
+    r = read(_fd, &_rx[_rxLen], sizeof(_rx) - _rxLen);
+    if (r <= 0) {
+      return false;
+    }
+    _rxLen += r;
+  }
+}
+
+bool QmiSEInterface::request(uint8_t service, uint16_t message, const uint8_t* tlvs, uint16_t tlvsLen) {
+  struct timespec deadline;
+  const uint8_t* result;
+  uint16_t resultLen;
+  unsigned long int len;
+  QmiMessage msg;
+  uint8_t responseFlag;
+
+  _lastError = 0;
+
+  // CTL transaction IDs are 8 bits wide, 0 is never used
+  do {
+    _transaction++;
+  } while (((service == QMI_SERVICE_CTL) && ((_transaction & 0xFF) == 0)) || (_transaction == 0));
+
+  msg.service     = service;
+  msg.client      = (service == QMI_SERVICE_CTL) ? 0 : _client;
+  msg.flags       = 0;
+  msg.transaction = (service == QMI_SERVICE_CTL) ? (_transaction & 0xFF) : _transaction;
+  msg.message     = message;
+  msg.tlvs        = tlvs;
+  msg.tlvsLen     = tlvsLen;
+
+  len = encodeMessage(&msg, _tx);
+  if ((len == 0) || (write(_fd, _tx, len) != (ssize_t)len)) {
+    fprintf(stderr, "QMI: could not send message 0x%04X\n", message);
+    return false;
+  }
+
+#ifdef QMI_DEBUG
+  printf("QMI: > service %u message 0x%04X transaction %u\r\n", service, message, msg.transaction);
+#endif
+
+  // Indications and late responses to requests given up on share the device, only our transaction ID counts
+  responseFlag = (service == QMI_SERVICE_CTL) ? QMI_CTL_FLAG_RESPONSE : QMI_FLAG_RESPONSE;
+  deadline_after(QMI_TIMEOUT, &deadline);
+  for (;;) {
+    if (!receive(deadline_remaining(&deadline))) {
+      fprintf(stderr, "QMI: no response to message 0x%04X\n", message);
+      return false;
+    }
+
+    if ((_response.service == service) && (_response.client == msg.client) && (_response.flags == responseFlag) &&
+        (_response.transaction == msg.transaction) && (_response.message == message)) {
+      break;
+    }
+  }
+
+  if (!findTlv(&_response, QMI_TLV_RESULT, &result, &resultLen) || (resultLen < 4)) {
+    return false;
+  }
+
+  if (get16(result) != 0) {
+    _lastError = get16(&result[2]);
+    return false;
+  }
+
+  return true;
+}
+
+bool QmiSEInterface::open(void) {
+  const uint8_t* value;
+  uint16_t len;
+  uint8_t tlvs[4];
+  uint8_t service = QMI_SERVICE_UIM;
+
+  if (_fd < 0) {
+    if (_device == nullptr) {
+      return false;
+    }
+    if ((_fd = ::open(_device, O_RDWR | O_NOCTTY)) < 0) {
+      fprintf(stderr, "QMI: could not open %s\n", _device);
+      return false;
+    }
+  }
+
+  _rxLen        = 0;
+  _rxUsed       = 0;
+  _openChannels = 0;
+
+  if (!request(QMI_SERVICE_CTL, QMI_CTL_GET_CLIENT_ID, tlvs, putTlv(tlvs, QMI_TLV_CTL_SERVICE, &service, 1)) ||
+      !findTlv(&_response, QMI_TLV_CTL_CLIENT, &value, &len) || (len < 2) || (value[0] != QMI_SERVICE_UIM)) {
+    fprintf(stderr, "QMI: could not allocate a UIM client (error %u)\n", _lastError);
+    ::close(_fd);
+    _fd = -1;
+    return false;
+  }
+
+  _client = value[1];
+  return true;
+}
+
+void QmiSEInterface::close(void) {
+  uint8_t tlvs[8];
+  uint8_t value[2];
+  uint8_t channel;
+
+  if (_fd < 0) {
+    return;
+  }
+
+  for (channel = 1; channel <= QMI_MAX_LOGICAL_CHANNEL; channel++) {
+    if (_openChannels & (1UL << channel)) {
+      closeLogicalChannel(channel);
+    }
+  }
+
+  value[0] = QMI_SERVICE_UIM;
+  value[1] = _client;
+  request(QMI_SERVICE_CTL, QMI_CTL_RELEASE_CLIENT_ID, tlvs, putTlv(tlvs, QMI_TLV_CTL_SERVICE, value, 2));
+
+  ::close(_fd);
+  _fd = -1;
+}
+
+bool QmiSEInterface::openLogicalChannel(const uint8_t* aid, uint16_t aidLen, uint8_t* channel) {
+  uint8_t tlvs[4 + 3 + 1 + 255];
+  uint8_t value[1 + 255];
+  const uint8_t* opened;
+  uint16_t len;
+  unsigned long int off;
+
+  if (aidLen > 255) {
+    return false;
+  }
+
+  value[0] = (uint8_t)aidLen;
+  memcpy(&value[1], aid, aidLen);
+
+  off = putTlv(tlvs, QMI_TLV_UIM_SLOT, &_slot, 1);
+  off += putTlv(&tlvs[off], QMI_TLV_UIM_AID, value, 1 + aidLen);
+
+  // The modem selects the applet itself and keeps track of the channel
+  if (!request(QMI_SERVICE_UIM, QMI_UIM_OPEN_LOGICAL_CHANNEL, tlvs, off) ||
+      !findTlv(&_response, QMI_TLV_UIM_OPENED_CHANNEL, &opened, &len) || (len < 1)) {
+    return false;
+  }
+
+  if ((opened[0] == 0) || (opened[0] > QMI_MAX_LOGICAL_CHANNEL)) {
+    closeLogicalChannel(opened[0]);
+    return false;
+  }
+
+  _openChannels |= 1UL << opened[0];
+  *channel = opened[0];
+  return true;
+}
+
+bool QmiSEInterface::closeLogicalChannel(uint8_t channel) {
+  uint8_t tlvs[8];
+  unsigned long int off;
+
+  _openChannels &= ~(1UL << channel);
+
+  off = putTlv(tlvs, QMI_TLV_UIM_SLOT, &_slot, 1);
+  off += putTlv(&tlvs[off], QMI_TLV_UIM_CLOSED_CHANNEL, &channel, 1);
+  return request(QMI_SERVICE_UIM, QMI_UIM_LOGICAL_CHANNEL, tlvs, off);
+}
+
+bool QmiSEInterface::transmitApdu(uint8_t* apdu, uint16_t apduLen, uint8_t* response, uint16_t* responseLen) {
+  uint8_t tlvs[4 + 3 + 2 + (5 + 256 + 1) + 4];
+  const uint8_t* value;
+  unsigned long int off;
+  uint16_t len;
+  uint8_t channel;
+
+  if ((apduLen == 0) || (apduLen > 5 + 256 + 1)) {
+    return false;
+  }
+
+  off = putTlv(tlvs, QMI_TLV_UIM_SLOT, &_slot, 1);
+
+  // The APDU goes as is, preceded by its length
+  tlvs[off] = QMI_TLV_UIM_APDU;
+  put16(&tlvs[off + 1], 2 + apduLen);
+  put16(&tlvs[off + 3], apduLen);
+  memcpy(&tlvs[off + 5], apdu, apduLen);
+  off += 5 + apduLen;
+
+  // Channels the modem opened are named explicitly
+  channel = claChannel(apdu[0]);
+  if ((channel != 0) && (_openChannels & (1UL << channel))) {
+    off += putTlv(&tlvs[off], QMI_TLV_UIM_CHANNEL, &channel, 1);
+  }
+
+  if (!request(QMI_SERVICE_UIM, QMI_UIM_SEND_APDU, tlvs, off) ||
+      !findTlv(&_response, QMI_TLV_UIM_APDU_RESPONSE, &value, &len) || (len < 2) || (get16(value) + 2 > len) ||
+      (get16(value) > 256 + 2)) {
+    return false;
+  }
+
+  *responseLen = get16(value);
+  memcpy(response, &value[2], *responseLen);
+  return true;
+}
+
+/** C Accessors	***************************************************************/
+
+extern "C" SEInterface* QmiSEInterface_create(const char* device) {
+  return new QmiSEInterface(device);
+}
+
+extern "C" void QmiSEInterface_destroy(SEInterface* iface) {
+  delete static_cast<QmiSEInterface*>(iface);
+}
+
+extern "C" int QmiSEInterface_open(SEInterface* iface) {
+  return static_cast<QmiSEInterface*>(iface)->open();
+}
@@ -29,6 +29,8 @@
 #define PEM_BUFFER_SIZE 10 * 1024
 #define DER_BUFFER_SIZE 2 * 1024
 
+#define TOB_BAUDRATE_AUTO 0 /**< Negotiate the fastest baud rate supported by both the modem and the host. */
+
 #define TOB_MD_SHA1 0x10
 #define TOB_MD_SHA224 0x30
 #define TOB_MD_SHA256 0x40
@@ -53,6 +55,14 @@ typedef enum {
   TOB_ALGO_SHA384_RSA_RFC_2409  = TOB_ALGO_RSA_RFC_2409 | TOB_MD_SHA384,
 } tob_algorithm_t;
 
+/** What tobCalibrate measured on the link and the chunk sizes it tuned */
+typedef struct {
+  double command_us; /**< Fitted cost of one command, in microseconds */
+  double byte_us;    /**< Fitted cost of one byte of response, in microseconds */
+  int read_chunk;    /**< Bytes per READ BINARY */
+  int hash_chunk;    /**< Bytes per PSO HASH, 0 if the SIM takes one hash block at a time only */
+} tob_calibration_t;
+
 #ifdef __cplusplus
 extern "C" {
 #endif
@@ -61,12 +71,42 @@ extern "C" {
  * Initialize Trust Onboard connection to cellular module with specified device.
  * Device must not be in use by another application in the system and must be
  * accessible as the current user.
- * @param device - full path to cellular module UART or "pcsc:N" for PC/SC device
- * @param baudrate - baud rate for a serial UART, ignored for PC/SC
+ * @param device - full path to cellular module UART, "cmux:" followed by that path to share the UART with data
+ *                 through a 3GPP TS 27.010 multiplexer, "qmi:" followed by the QMI control device of a Qualcomm
+ *                 modem (e.g. qmi:/dev/cdc-wdm0), "ccid:VID:PID[:serial]" for a USB smart card reader driven
+ *                 directly (e.g. ccid:076b:3021), "pcsc:N" for PC/SC device, or "auto" to probe every USB modem
+ *                 port and PC/SC reader at once and take the first one with a Trust Onboard SIM. The winner is
+ *                 remembered in /var/cache/trust_onboard/device for the next call.
+ * @param baudrate - baud rate for a serial UART or TOB_BAUDRATE_AUTO, ignored for PC/SC and "auto"
  * @return 0 if successful, -1 if initialization fails
  */
 extern int tobInitialize(const char *device, int baudrate);
 
+/**
+ * Baud rate the link to the cellular module runs at, for instance the one chosen by TOB_BAUDRATE_AUTO.
+ * @return the baud rate, 0 if not initialized through tobInitialize with a serial device
+ */
+extern int tobGetBaudrate(void);
+
+/**
+ * Pseudo-terminal carrying the data channel of the multiplexer started by tobInitialize with a "cmux:" device,
+ * for instance to run pppd on while Trust Onboard keeps using the same UART.
+ * @param name - buffer receiving the pseudo-terminal path
+ * @param size - size of name
+ * @return 0 if successful, -1 if no multiplexer is running or name is too small
+ */
+extern int tobGetCmuxDataPort(char *name, int size);
+
+/**
+ * Time READ BINARY of several sizes on the link opened by tobInitialize, fit the cost of a command and of a byte,
+ * and tune the chunk sizes certificate and key reads and hashing use. They are applied right away and remembered in
+ * /var/cache/trust_onboard/chunking for the next tobInitialize with the same device.
+ * @param pin - PIN1 for access to the certificate read while probing
+ * @param result - receives the costs and chunk sizes, may be null
+ * @return 0 if successful, -1 if not initialized or probing failed
+ */
+extern int tobCalibrate(const char *pin, tob_calibration_t *result);
+
 /**
  * Initialize Trust Onboard connection to cellular module with SEInterface instance.
  * It is a lower-level initialization procedure, also suitable for bare-metal and RTOS
@@ -0,0 +1,83 @@
+/*
+ *
+ * Twilio Breakout Trust Onboard SDK
+ *
+ * Copyright (c) 2019 Twilio, Inc.
+ *
+ * SPDX-License-Identifier:  Apache-2.0
+ */
+
+#ifndef __TOB_CALIBRATION_H__
+#define __TOB_CALIBRATION_H__
+
+#include "SEInterface.h"
+
+// Chunk size tuning behind tobCalibrate. READ BINARY of the MF certificate is timed at several sizes to fit what a
+// command and a byte cost on the link, the fastest size per byte becoming the READ BINARY chunk. MIAS is then asked
+// to hash the same data in one block and in several blocks per PSO HASH, the largest size giving the same digest
+// becoming the PSO HASH chunk. Results are remembered per device for tobInitialize to apply.
+
+#define TOB_CALIBRATION_PROBES 7
+#define TOB_CALIBRATION_DEVICE_LEN 64
+
+// Where the tuned chunk sizes are remembered between runs
+#define TOB_CALIBRATION_CACHE "/var/cache/trust_onboard/chunking"
+
+#ifdef __cplusplus
+
+class MF;
+class MIAS;
+
+class TobCalibration {
+ public:
+  // cachePath nullptr disables load() and save()
+  TobCalibration(const char* cachePath = TOB_CALIBRATION_CACHE);
+
+  // Probe seiface, which must be open, with the MF and MIAS PIN, keeping the fastest of rounds times for each size.
+  // The tuned chunking is set on seiface.
+  // Returns true in case enough sizes went through for a fit, false otherwise, seiface keeping its chunking.
+  bool run(SEInterface* seiface, const char* pin, int rounds = 3);
+
+  // Fitted cost of one command and of one byte of response, in microseconds
+  double getCommandCost(void) {
+    return _commandUs;
+  }
+
+  double getByteCost(void) {
+    return _byteUs;
+  }
+
+  const se_chunking_t& getChunking(void) {
+    return _chunking;
+  }
+
+  // READ BINARY sizes probed and the fastest time of each in microseconds, 0 for those which failed
+  static const uint8_t probeSizes[TOB_CALIBRATION_PROBES];
+
+  uint32_t getProbeTime(int probe) {
+    return _probeUs[probe];
+  }
+
+  // Chunking remembered for device
+  // Returns false in case there is none.
+  bool load(const char* device, se_chunking_t* chunking);
+
+  // Remember the chunking of the last run() for device, replacing what was there for it
+  // Returns true in case the cache was written, false otherwise.
+  bool save(const char* device);
+
+ private:
+  bool probeReads(MF* mf, int rounds);
+  // Largest PSO HASH size, in whole SHA-256 blocks, the card hashes as it does one block at a time
+  uint8_t probeHash(SEInterface* seiface, MIAS* mias);
+
+  const char* _cachePath;
+  uint32_t _probeUs[TOB_CALIBRATION_PROBES];
+  double _commandUs;
+  double _byteUs;
+  se_chunking_t _chunking;
+};
+
+#endif /* __cplusplus */
+
+#endif /* __TOB_CALIBRATION_H__ */
@@ -0,0 +1,96 @@
+/*
+ *
+ * Twilio Breakout Trust Onboard SDK
+ *
+ * Copyright (c) 2019 Twilio, Inc.
+ *
+ * SPDX-License-Identifier:  Apache-2.0
+ */
+
+#ifndef __TOB_DISCOVERY_H__
+#define __TOB_DISCOVERY_H__
+
+#include "SEInterface.h"
+
+#ifdef __cplusplus
+#include <atomic>
+#endif
+
+// Device discovery behind tobInitialize("auto"). Every serial port a USB modem may provide and every PC/SC reader is
+// probed at the same time, the first one whose SIM answers a MIAS SELECT wins. The winner is remembered by where it
+// sits on the USB bus and by the ICCID of its SIM, so the next run goes straight to it even when the ports were
+// enumerated in a different order.
+
+#define TOB_DISCOVERY_MAX_CANDIDATES 16
+#define TOB_DISCOVERY_DEVICE_LEN 64
+#define TOB_DISCOVERY_KEY_LEN 128
+// 19 or 20 digits
+#define TOB_ICCID_LEN 20
+
+// Where the winner is remembered between runs
+#define TOB_DISCOVERY_CACHE "/var/cache/trust_onboard/device"
+
+#ifdef __cplusplus
+
+// Create the interface probed for device, nullptr in case device is not supported
+typedef SEInterface* (*TobProbeFactory)(const char* device);
+
+class TobDiscovery {
+ public:
+  // cachePath nullptr disables the cache, factory nullptr creates modems and PC/SC readers as tobInitialize does
+  TobDiscovery(const char* cachePath = TOB_DISCOVERY_CACHE, TobProbeFactory factory = nullptr);
+
+  // Add a device to probe. key identifies it across reboots, nullptr uses the device itself.
+  // Returns false in case there is no room left.
+  bool addCandidate(const char* device, const char* key = nullptr);
+
+  // Add every /dev/ttyACM* and /dev/ttyUSB* port keyed by its USB interface, and every PC/SC reader keyed by its name
+  void addSystemCandidates(void);
+
+  // Go to the remembered device if it is still there with the same SIM, probe every candidate at once otherwise.
+  // Returns the winning interface, open and owned by the caller, nullptr in case no SIM answered.
+  SEInterface* discover(void);
+
+  // Winner of the last discover()
+  const char* getDevice(void) {
+    return _device;
+  }
+
+  const char* getIccid(void) {
+    return _iccid;
+  }
+
+  // Returns true in case the last discover() took the remembered device
+  bool isCached(void) {
+    return _cached;
+  }
+
+  // Read EF ICCID through the basic channel and decode it into iccid, of at least TOB_ICCID_LEN + 1 bytes
+  // Returns true in case reading was successful, false otherwise.
+  static bool readIccid(SEInterface* seiface, char* iccid);
+
+ private:
+  struct Candidate {
+    char device[TOB_DISCOVERY_DEVICE_LEN];
+    char key[TOB_DISCOVERY_KEY_LEN];
+  };
+
+  // Open the candidate and check for MIAS, giving up early once abort is set by another probe's success
+  SEInterface* probe(const Candidate* candidate, char* iccid, const std::atomic<bool>* abort);
+
+  bool loadCache(char* key, char* iccid);
+  void saveCache(const Candidate* candidate);
+
+  const char* _cachePath;
+  TobProbeFactory _factory;
+  Candidate _candidates[TOB_DISCOVERY_MAX_CANDIDATES];
+  int _count;
+
+  char _device[TOB_DISCOVERY_DEVICE_LEN];
+  char _iccid[TOB_ICCID_LEN + 1];
+  bool _cached;
+};
+
+#endif /* __cplusplus */
+
+#endif /* __TOB_DISCOVERY_H__ */
@@ -0,0 +1,118 @@
+/*
+ *
+ * Twilio Breakout Trust Onboard SDK
+ *
+ * Copyright (c) 2019 Twilio, Inc.
+ *
+ * SPDX-License-Identifier:  Apache-2.0
+ */
+
+#ifndef __TOB_READER_POOL_H__
+#define __TOB_READER_POOL_H__
+
+#include "TobDiscovery.h"
+
+#ifdef __cplusplus
+#include <atomic>
+#include <condition_variable>
+#include <map>
+#include <memory>
+#include <mutex>
+#include <string>
+#include <thread>
+#endif
+
+// Card after card on many readers at once, for provisioning stations. Every PC/SC reader is watched for cards being
+// inserted, each card getting a worker thread with an interface, MF and MIAS of its own which runs the job on it.
+// Outcomes are kept by ICCID, a card taken out and put back in being run again.
+
+#define TOB_POOL_MAX_READERS 64
+#define TOB_POOL_READER_LEN 128
+
+#ifdef __cplusplus
+
+class MF;
+class MIAS;
+
+// Work done on each card inserted, seiface being open and mf and mias initialized on it. Runs on the worker thread of
+// the reader, concurrently with the jobs of the other readers.
+// Returns 0 in case of success, an error code otherwise.
+typedef int (*TobPoolJob)(SEInterface* seiface, MF* mf, MIAS* mias, const char* iccid, void* arg);
+
+// Called once the job of a card is done, from the worker thread. iccid is empty in case it could not be read, result
+// is the job's or -1 in case the card could not be opened.
+typedef void (*TobPoolCompletion)(const char* reader, const char* iccid, int result, void* arg);
+
+struct TobPoolResult {
+  std::string reader;
+  int result;
+  // Time from the insertion being seen to the end of the job
+  uint32_t elapsedMs;
+};
+
+class TobReaderPool {
+ public:
+  // factory nullptr opens the PC/SC readers by name
+  TobReaderPool(TobPoolJob job, void* arg, TobProbeFactory factory = nullptr);
+  ~TobReaderPool(void);
+
+  void setCompletion(TobPoolCompletion completion, void* arg);
+
+  // List the PC/SC readers and watch them, and readers plugged in later, for cards in a thread of its own. Cards
+  // already in are run right away.
+  // Returns false in case PC/SC is not available.
+  bool start(void);
+
+  // Stop watching and wait for the jobs running to finish
+  void stop(void);
+
+  // Run the job on the card in reader, unless a job is running there already. The PC/SC watcher calls this on every
+  // insertion, it can be called for other devices the factory knows.
+  // Returns false in case a job is running on reader or too many readers are known.
+  bool cardInserted(const char* reader);
+
+  // Wait until no job is running, timeout in milliseconds, -1 waits forever
+  // Returns true in case the pool is idle, false in case of timeout.
+  bool waitIdle(int timeout);
+
+  // Outcome of the last job of every card seen, by ICCID
+  std::map<std::string, TobPoolResult> getResults(void);
+
+  // Readers which had a card so far and jobs running
+  int getReaderCount(void);
+  int getBusyCount(void);
+
+ private:
+  struct Worker {
+    char reader[TOB_POOL_READER_LEN];
+    std::thread thread;
+    bool busy;
+  };
+
+  Worker* findWorker(const char* reader, bool add);
+  void run(Worker* worker);
+  void watch(void);
+
+  TobPoolJob _job;
+  void* _jobArg;
+  TobProbeFactory _factory;
+  TobPoolCompletion _completion;
+  void* _completionArg;
+
+  std::mutex _lock;
+  std::condition_variable _idle;
+  Worker _workers[TOB_POOL_MAX_READERS];
+  int _workerCount;
+  int _busy;
+  std::map<std::string, TobPoolResult> _results;
+
+  std::thread _watcher;
+  std::atomic<bool> _stopping;
+  // PC/SC context of the watcher, for stop() to cancel its wait
+  long _context;
+  bool _watching;
+};
+
+#endif /* __cplusplus */
+
+#endif /* __TOB_READER_POOL_H__ */
@@ -19,17 +19,34 @@
 #include "MIAS.h"
 
 #include "BreakoutTrustOnboardSDK.h"
+#include "Ccid.h"
 #include "GenericModem.h"
+#include "Cmux.h"
+#include "LSerial.h"
+#include "ModemDriver.h"
+#include "Qmi.h"
+#include "TobCalibration.h"
+#include "TobDiscovery.h"
 
 #ifdef PCSC_SUPPORT
 #include "Pcsc.h"
 #endif
 
 #include "base64.h"
+#include "HexCodec.h"
 
 static MF _mf;
 static MIAS _mias;
 static SEInterface* _modem = nullptr;
+// Interface the applets were initialized with, for the operations to hold it from their first APDU to their last
+static SEInterface* _seiface = nullptr;
+static int _baudrate        = 0;
+#ifndef NO_OS
+static Cmux* _cmux = nullptr;
+static char _cmuxDataPort[64];
+// Key of the tuned chunk sizes, as given to tobInitialize or found by "auto"
+static char _device[TOB_CALIBRATION_DEVICE_LEN];
+#endif
 
 #define USE_BASIC_CHANNEL false
 
@@ -131,28 +148,6 @@ static void crop_pem_chain(const char* inPem, int inPemLen, int* outPemLen) {
   *outPemLen = inPemLen;
 }
 
-static void hex_string_2_bytes_array(uint8_t* hexstr, uint16_t hexstrLen, uint8_t* bytes, uint16_t* bytesLen) {
-  uint8_t d;
-  uint16_t i, j;
-
-  *bytesLen = 0;
-  for (i = 0; i < hexstrLen; *bytesLen += 1) {
-    d = 0;
-    for (j = i + 2; i < j; i++) {
-      d <<= 4;
-      if ((hexstr[i] >= '0') && (hexstr[i] <= '9')) {
-        d |= hexstr[i] - '0';
-      } else if ((hexstr[i] >= 'a') && (hexstr[i] <= 'f')) {
-        d |= hexstr[i] - 'a' + 10;
-      } else if ((hexstr[i] >= 'A') && (hexstr[i] <= 'F')) {
-        d |= hexstr[i] - 'A' + 10;
-      }
-    }
-    *bytes = d;
-    bytes++;
-  }
-}
-
 static int se_read_ef(uint8_t* efname, uint16_t efnamelen, uint8_t* data, int* data_size, const char* pin) {
   int ret;
   uint16_t size;
@@ -212,7 +207,9 @@ static int se_read_object(const char* path, uint8_t* obj, int* size, const char*
   }
 
   efname_len = (pathlen / 2);
-  hex_string_2_bytes_array((uint8_t*)path, pathlen, efname, (uint16_t*)&efname_len);
+  if (!tob_hex_decode(path, pathlen, efname)) {
+    return ERR_SE_EF_INVALID_NAME_ERROR;
+  }
   ret = se_read_ef(efname, efname_len, obj, size, pin);
 
   return ret;
@@ -265,6 +262,7 @@ static int se_p11_read_object(const char* label, uint8_t* obj, int* size, const
 }
 
 int tobInitializeWithInterface(SEInterface* seiface) {
+  _seiface = seiface;
 #ifdef __cplusplus
   Applet::closeAllChannels(seiface);
 
@@ -283,7 +281,20 @@ int tobInitializeWithInterface(SEInterface* seiface) {
 }
 
 #ifndef NO_OS
+// Apply what tobCalibrate found for device on a previous run
+static void loadChunking(const char* device) {
+  TobCalibration calibration;
+  se_chunking_t chunking;
+
+  snprintf(_device, sizeof(_device), "%s", device);
+  if (calibration.load(_device, &chunking)) {
+    _modem->setChunking(&chunking);
+  }
+}
+
 int tobInitialize(const char* device, int baudrate) {
+  GenericModem* serialModem = nullptr;
+
   if (_modem != nullptr) {
     return 0;
   }
@@ -293,7 +304,19 @@ int tobInitialize(const char* device, int baudrate) {
     return -1;
   }
 
-  if (strncmp(device, "pcsc:", 5) == 0) {
+  if (strcmp(device, "auto") == 0) {
+    TobDiscovery discovery;
+    discovery.addSystemCandidates();
+    if ((_modem = discovery.discover()) == nullptr) {
+      fprintf(stderr, "Error no Trust Onboard SIM found!\n");
+      return -1;
+    }
+    if (strncmp(discovery.getDevice(), "pcsc:", 5) != 0) {
+      _baudrate = MODEM_BAUDRATE_DEFAULT;
+    }
+    loadChunking(discovery.getDevice());
+    return tobInitializeWithInterface(_modem);
+  } else if (strncmp(device, "pcsc:", 5) == 0) {
 #ifdef PCSC_SUPPORT
     long idx = strtol(device + 5, 0, 10);  // device is al least 5 characters long, indexing is safe
     _modem   = new PcscSEInterface((int)idx);
@@ -301,22 +324,96 @@ int tobInitialize(const char* device, int baudrate) {
     fprintf(stderr, "No pcsc support, please rebuild with -DPCSC_SUPPORT=ON\n");
     return -1;
 #endif
+  } else if (strncmp(device, "qmi:", 4) == 0) {
+    _modem = new QmiSEInterface(device + 4);
+  } else if (strncmp(device, "ccid:", 5) == 0) {
+    uint16_t vendor;
+    uint16_t product;
+    const char* serial;
+    if (!CcidSEInterface::parseDevice(device + 5, &vendor, &product, &serial)) {
+      fprintf(stderr, "Error invalid CCID reader %s, expected ccid:VID:PID[:serial]\n", device + 5);
+      return -1;
+    }
+    _modem = new CcidSEInterface(vendor, product, serial);
+  } else if (strncmp(device, "cmux:", 5) == 0) {
+    // Trust Onboard runs on DLC 1, DLC 2 is left to PPP or whatever else needs the data port
+    _cmux = new Cmux(new LSerial(device + 5, (baudrate == TOB_BAUDRATE_AUTO) ? MODEM_BAUDRATE_DEFAULT : baudrate));
+    if (!_cmux->start() || !_cmux->exposeChannel(2, _cmuxDataPort, sizeof(_cmuxDataPort))) {
+      fprintf(stderr, "Error starting the multiplexer on %s!\n", device + 5);
+      delete _cmux;
+      _cmux = nullptr;
+      return -1;
+    }
+    _modem = ModemRegistry::create(new CmuxChannel(_cmux, 1));
   } else {
-    _modem = new GenericModem(device, baudrate);
+    // The driver is picked by what the modem reports in AT+CGMI and AT+CGMM
+    serialModem =
+        ModemRegistry::create(new LSerial(device, (baudrate == TOB_BAUDRATE_AUTO) ? MODEM_BAUDRATE_DEFAULT : baudrate));
+    if (baudrate == TOB_BAUDRATE_AUTO) {
+      ModemProfile profile = serialModem->getProfile();
+      profile.autoBaudrate = true;
+      serialModem->setProfile(profile);
+    }
+    _modem = serialModem;
   }
 
   if (!_modem->open()) {
     fprintf(stderr, "Error modem not found!\n");
     delete _modem;
     _modem = nullptr;
+    delete _cmux;
+    _cmux = nullptr;
     return -1;
   }
+
+  if (serialModem != nullptr) {
+    _baudrate = serialModem->getBaudrate();
+  }
+
+  loadChunking(device);
   return tobInitializeWithInterface(_modem);
 }
+
+int tobGetBaudrate(void) {
+  return _baudrate;
+}
+
+int tobCalibrate(const char* pin, tob_calibration_t* result) {
+  TobCalibration calibration;
+
+  if ((_modem == nullptr) || (pin == NULL)) {
+    return -1;
+  }
+
+  if (!calibration.run(_modem, pin)) {
+    return -1;
+  }
+  if ((_device[0] != '\0') && !calibration.save(_device)) {
+    fprintf(stderr, "Error saving the chunk sizes to %s\n", TOB_CALIBRATION_CACHE);
+  }
+
+  if (result != NULL) {
+    result->command_us = calibration.getCommandCost();
+    result->byte_us    = calibration.getByteCost();
+    result->read_chunk = calibration.getChunking().read_chunk;
+    result->hash_chunk = calibration.getChunking().hash_chunk;
+  }
+  return 0;
+}
+
+int tobGetCmuxDataPort(char* name, int size) {
+  if ((_cmux == nullptr) || (name == nullptr) || (size <= (int)strlen(_cmuxDataPort))) {
+    return -1;
+  }
+
+  strcpy(name, _cmuxDataPort);
+  return 0;
+}
 #endif  // NO_OS
 
 int tob_x509_crt_extract_se(uint8_t* cert, int* cert_size, const char* path, const char* pin) {
   int ret = ERR_SE_BAD_KEY_NAME_ERROR;
+  SETransaction transaction(_seiface);
 
   // Read Certificate from EF
   if (memcmp(path, SE_EF_KEY_NAME_PREFIX, strlen(SE_EF_KEY_NAME_PREFIX)) == 0) {
@@ -374,6 +471,7 @@ int tob_x509_crt_extract_se(uint8_t* cert, int* cert_size, const char* path, con
 
 int tob_pk_extract_se(uint8_t* pk, int* pk_size, const char* path, const char* pin) {
   int ret = ERR_SE_BAD_KEY_NAME_ERROR;
+  SETransaction transaction(_seiface);
 
   // Read PKey from EF
   if (memcmp(path, SE_EF_KEY_NAME_PREFIX, strlen(SE_EF_KEY_NAME_PREFIX)) == 0) {
@@ -474,6 +572,8 @@ int tobSigningSign(tob_algorithm_t algorithm, const uint8_t* hash, int hash_len,
     path++;
   }
 
+  // Released after the deselection
+  SETransaction transaction(_seiface);
   auto sg = SelectionGuard(_mias, USE_BASIC_CHANNEL);
   if (!sg.selected()) {
     return ERR_SE_BAD_KEY_NAME_ERROR;
@@ -521,6 +621,7 @@ int tobSigningDecrypt(const uint8_t* cipher, int cipher_len, uint8_t* plain, int
     path++;
   }
 
+  SETransaction transaction(_seiface);
   auto sg = SelectionGuard(_mias, USE_BASIC_CHANNEL);
   if (!sg.selected()) {
     return ERR_SE_BAD_KEY_NAME_ERROR;
@@ -568,6 +669,7 @@ int tobSigningLen(const char* pin) {
     path++;
   }
 
+  SETransaction transaction(_seiface);
   auto sg = SelectionGuard(_mias, USE_BASIC_CHANNEL);
   if (!sg.selected()) {
     return ERR_SE_BAD_KEY_NAME_ERROR;
@@ -0,0 +1,230 @@
+/*
+ *
+ * Twilio Breakout Trust Onboard SDK
+ *
+ * Copyright (c) 2019 Twilio, Inc.
+ *
+ * SPDX-License-Identifier:  Apache-2.0
+ */
+
+#include "TobCalibration.h"
+#include "MF.h"
+#include "MIAS.h"
+
+#include <chrono>
+#include <cstdio>
+#include <cstdlib>
+#include <cstring>
+#include <string>
+
+#include <limits.h>
+#include <sys/stat.h>
+
+// Sizes within 2% of the best throughput count as fast; the largest of them wins, fewer commands meaning fewer
+// responses to lose
+#define CALIBRATION_TOLERANCE 0.98
+
+// SHA-256 block, the unit MIAS hashes in by default
+#define HASH_BLOCK 64
+
+const uint8_t TobCalibration::probeSizes[TOB_CALIBRATION_PROBES] = {16, 32, 64, 128, 192, 0xEE, 0xFF};
+
+TobCalibration::TobCalibration(const char* cachePath) {
+  _cachePath = cachePath;
+  _commandUs = 0;
+  _byteUs    = 0;
+  _chunking  = se_chunking_t();
+  memset(_probeUs, 0, sizeof(_probeUs));
+}
+
+bool TobCalibration::probeReads(MF* mf, int rounds) {
+  uint16_t size;
+
+  // Selects the EF, only its size is read
+  if (!mf->readCertificate(NULL, &size)) {
+    return false;
+  }
+
+  for (int p = 0; (p < TOB_CALIBRATION_PROBES) && (probeSizes[p] <= size); p++) {
+    for (int r = 0; r < rounds; r++) {
+      auto start = std::chrono::steady_clock::now();
+      if (!mf->transmit(0x00, SCIns::ReadBinary, 0x00, 0x00, probeSizes[p]) ||
+          (mf->getStatusWord() != (SCSW1::OKNoQualification | SCSW2::OKNoQualification)) ||
+          (mf->getResponseLength() != probeSizes[p])) {
+        // The link or the card does not take this size, larger ones are not worth trying
+        _probeUs[p] = 0;
+        return true;
+      }
+
+      auto elapsed = std::chrono::steady_clock::now() - start;
+      uint32_t us  = std::chrono::duration_cast<std::chrono::microseconds>(elapsed).count() + 1;
+      if ((_probeUs[p] == 0) || (us < _probeUs[p])) {
+        _probeUs[p] = us;
+      }
+    }
+  }
+
+  return true;
+}
+
+uint8_t TobCalibration::probeHash(SEInterface* seiface, MIAS* mias) {
+  static const uint8_t candidates[] = {3 * HASH_BLOCK, 2 * HASH_BLOCK};
+  se_chunking_t chunking = _chunking;
+  uint8_t data[3 * HASH_BLOCK];
+  uint8_t reference[64];
+  uint8_t hash[64];
+  uint16_t referenceLen;
+  uint16_t hashLen;
+  uint8_t chunk = 0;
+
+  for (size_t i = 0; i < sizeof(data); i++) {
+    data[i] = (uint8_t)(i * 7);
+  }
+
+  // One block per command as a reference, then the candidates largest first
+  chunking.hash_chunk = HASH_BLOCK;
+  seiface->setChunking(&chunking);
+  if (mias->hashInit(ALGO_SHA256) && mias->hashUpdate(data, sizeof(data)) &&
+      mias->hashFinal(reference, &referenceLen)) {
+    for (uint8_t candidate : candidates) {
+      if ((_chunking.read_chunk != 0) && (candidate > _chunking.read_chunk)) {
+        continue;
+      }
+
+      chunking.hash_chunk = candidate;
+      seiface->setChunking(&chunking);
+      if (mias->hashInit(ALGO_SHA256) && mias->hashUpdate(data, sizeof(data)) && mias->hashFinal(hash, &hashLen) &&
+          (hashLen == referenceLen) && (memcmp(hash, reference, hashLen) == 0)) {
+        chunk = candidate;
+        break;
+      }
+    }
+  }
+
+  return chunk;
+}
+
+bool TobCalibration::run(SEInterface* seiface, const char* pin, int rounds) {
+  double sx = 0, sy = 0, sxx = 0, sxy = 0, best = 0;
+  int points = 0;
+  bool ok;
+  MF mf;
+  MIAS mias;
+
+  memset(_probeUs, 0, sizeof(_probeUs));
+  _chunking = se_chunking_t();
+
+  mf.init(seiface);
+  ok = mf.select(false) && mf.verifyPin((uint8_t*)pin, strlen(pin)) && probeReads(&mf, rounds);
+  mf.deselect();
+  if (!ok) {
+    return false;
+  }
+
+  // Least squares fit of time = command + size * byte
+  for (int p = 0; p < TOB_CALIBRATION_PROBES; p++) {
+    if (_probeUs[p] != 0) {
+      sx += probeSizes[p];
+      sy += _probeUs[p];
+      sxx += (double)probeSizes[p] * probeSizes[p];
+      sxy += (double)probeSizes[p] * _probeUs[p];
+      points++;
+
+      if ((double)probeSizes[p] / _probeUs[p] > best) {
+        best = (double)probeSizes[p] / _probeUs[p];
+      }
+    }
+  }
+  if (points < 2) {
+    return false;
+  }
+
+  _byteUs    = (points * sxy - sx * sy) / (points * sxx - sx * sx);
+  _commandUs = (sy - _byteUs * sx) / points;
+  _byteUs    = (_byteUs > 0) ? _byteUs : 0;
+  _commandUs = (_commandUs > 0) ? _commandUs : 0;
+
+  for (int p = 0; p < TOB_CALIBRATION_PROBES; p++) {
+    if ((_probeUs[p] != 0) && ((double)probeSizes[p] / _probeUs[p] >= best * CALIBRATION_TOLERANCE)) {
+      _chunking.read_chunk = probeSizes[p];
+    }
+  }
+
+  mias.init(seiface);
+  if (mias.select(false) && mias.verifyPin((uint8_t*)pin, strlen(pin))) {
+    _chunking.hash_chunk = probeHash(seiface, &mias);
+  }
+  mias.deselect();
+
+  seiface->setChunking(&_chunking);
+  return true;
+}
+
+bool TobCalibration::load(const char* device, se_chunking_t* chunking) {
+  char line[TOB_CALIBRATION_DEVICE_LEN + 16];
+  size_t deviceLen = strlen(device);
+  unsigned int readChunk;
+  unsigned int hashChunk;
+  FILE* file;
+
+  if ((_cachePath == nullptr) || ((file = fopen(_cachePath, "r")) == nullptr)) {
+    return false;
+  }
+
+  // device<TAB>read_chunk<TAB>hash_chunk, one line per device
+  while (fgets(line, sizeof(line), file) != nullptr) {
+    if ((strncmp(line, device, deviceLen) == 0) && (line[deviceLen] == '\t') &&
+        (sscanf(line + deviceLen + 1, "%u\t%u", &readChunk, &hashChunk) == 2) && (readChunk <= 0xFF) &&
+        (hashChunk <= 0xFF)) {
+      fclose(file);
+      chunking->read_chunk = (uint8_t)readChunk;
+      chunking->hash_chunk = (uint8_t)hashChunk;
+      return true;
+    }
+  }
+
+  fclose(file);
+  return false;
+}
+
+bool TobCalibration::save(const char* device) {
+  char line[TOB_CALIBRATION_DEVICE_LEN + 16];
+  char tmp[PATH_MAX];
+  char dir[PATH_MAX];
+  size_t deviceLen = strlen(device);
+  std::string others;
+  char* slash;
+  FILE* file;
+
+  if ((_cachePath == nullptr) || (deviceLen >= TOB_CALIBRATION_DEVICE_LEN) || (strchr(device, '\t') != nullptr)) {
+    return false;
+  }
+
+  if ((file = fopen(_cachePath, "r")) != nullptr) {
+    while (fgets(line, sizeof(line), file) != nullptr) {
+      if ((strncmp(line, device, deviceLen) != 0) || (line[deviceLen] != '\t')) {
+        others += line;
+      }
+    }
+    fclose(file);
+  }
+
+  snprintf(dir, sizeof(dir), "%s", _cachePath);
+  if ((slash = strrchr(dir, '/')) != nullptr) {
+    *slash = '\0';
+    mkdir(dir, 0755);
+  }
+
+  // Written aside and renamed over, as the discovery cache
+  snprintf(tmp, sizeof(tmp), "%s.tmp", _cachePath);
+  if ((file = fopen(tmp, "w")) == nullptr) {
+    return false;
+  }
+  fprintf(file, "%s%s\t%u\t%u\n", others.c_str(), device, _chunking.read_chunk, _chunking.hash_chunk);
+  if ((fclose(file) != 0) || (rename(tmp, _cachePath) != 0)) {
+    remove(tmp);
+    return false;
+  }
+
+  return true;
+}
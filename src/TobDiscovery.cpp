@@ -0,0 +1,307 @@
+/*
+ *
+ * Twilio Breakout Trust Onboard SDK
+ *
+ * Copyright (c) 2019 Twilio, Inc.
+ *
+ * SPDX-License-Identifier:  Apache-2.0
+ */
+
+#include "TobDiscovery.h"
+#include "LSerial.h"
+#include "MIAS.h"
+#include "ModemDriver.h"
+
+#ifdef PCSC_SUPPORT
+#include "Pcsc.h"
+#endif
+
+#include <cstdio>
+#include <cstdlib>
+#include <cstring>
+#include <mutex>
+#include <thread>
+
+#include <dirent.h>
+#include <limits.h>
+#include <sys/stat.h>
+
+// EF ICCID under the MF, 10 bytes of swapped BCD digits
+static uint8_t ICCID_PATH[] = {0x2F, 0xE2};
+#define ICCID_FILE_LEN 10
+
+static SEInterface* createInterface(const char* device) {
+  if (strncmp(device, "pcsc:", 5) == 0) {
+#ifdef PCSC_SUPPORT
+    return new PcscSEInterface((int)strtol(device + 5, nullptr, 10));
+#else
+    return nullptr;
+#endif
+  }
+
+  return ModemRegistry::create(new LSerial(device, MODEM_BAUDRATE_DEFAULT));
+}
+
+static void copyString(char* out, const char* in, size_t size) {
+  strncpy(out, in, size - 1);
+  out[size - 1] = '\0';
+}
+
+TobDiscovery::TobDiscovery(const char* cachePath, TobProbeFactory factory) {
+  _cachePath = cachePath;
+  _factory   = (factory != nullptr) ? factory : createInterface;
+  _count     = 0;
+  _device[0] = '\0';
+  _iccid[0]  = '\0';
+  _cached    = false;
+}
+
+bool TobDiscovery::addCandidate(const char* device, const char* key) {
+  if (_count >= TOB_DISCOVERY_MAX_CANDIDATES) {
+    return false;
+  }
+
+  copyString(_candidates[_count].device, device, TOB_DISCOVERY_DEVICE_LEN);
+  copyString(_candidates[_count].key, (key != nullptr) ? key : device, TOB_DISCOVERY_KEY_LEN);
+  _count++;
+  return true;
+}
+
+static int isModemPort(const struct dirent* entry) {
+  return (strncmp(entry->d_name, "ttyACM", 6) == 0) || (strncmp(entry->d_name, "ttyUSB", 6) == 0);
+}
+
+void TobDiscovery::addSystemCandidates(void) {
+  struct dirent** entries;
+  char device[TOB_DISCOVERY_DEVICE_LEN];
+  char key[TOB_DISCOVERY_KEY_LEN];
+  char link[PATH_MAX];
+  char target[PATH_MAX];
+  const char* interface;
+  int n;
+  int i;
+
+  // A port is known by the USB interface it belongs to (e.g. 1-1.3:1.2), which stays put across enumerations
+  n = scandir("/dev", &entries, isModemPort, alphasort);
+  for (i = 0; i < n; i++) {
+    // A path cut short would name another device
+    if (snprintf(device, sizeof(device), "/dev/%s", entries[i]->d_name) >= (int)sizeof(device)) {
+      free(entries[i]);
+      continue;
+    }
+    snprintf(link, sizeof(link), "/sys/class/tty/%s/device", entries[i]->d_name);
+    interface = (realpath(link, target) != nullptr) ? strrchr(target, '/') : nullptr;
+    if ((interface != nullptr) && (strchr(interface, ':') != nullptr)) {
+      snprintf(key, sizeof(key), "usb:%s", interface + 1);
+      addCandidate(device, key);
+    } else {
+      addCandidate(device);
+    }
+    free(entries[i]);
+  }
+  if (n >= 0) {
+    free(entries);
+  }
+
+#ifdef PCSC_SUPPORT
+  {
+    char names[1024];
+    const char* name = names;
+    int readers      = PcscSEInterface::listReaders(names, sizeof(names));
+
+    for (i = 0; i < readers; i++, name += strlen(name) + 1) {
+      snprintf(device, sizeof(device), "pcsc:%d", i);
+      snprintf(key, sizeof(key), "pcsc:%s", name);
+      addCandidate(device, key);
+    }
+  }
+#endif
+}
+
+bool TobDiscovery::readIccid(SEInterface* seiface, char* iccid) {
+  uint8_t data[ICCID_FILE_LEN];
+  uint16_t len;
+  uint16_t i;
+  int digits = 0;
+
+  if (!seiface->transmit(0x00, SCIns::Select, SCP1::SELECTByPathFromMF,
+                         SCP2::SELECTFCPTemplate | SCP2::SELECTFirstOrOnly, ICCID_PATH, sizeof(ICCID_PATH), 0x00) ||
+      (seiface->getStatusWord() != 0x9000)) {
+    return false;
+  }
+
+  if (!seiface->transmit(0x00, SCIns::ReadBinary, static_cast<SCP1>(0x00), static_cast<SCP2>(0x00), ICCID_FILE_LEN) ||
+      (seiface->getStatusWord() != 0x9000) || ((len = seiface->getResponse(data)) != ICCID_FILE_LEN)) {
+    return false;
+  }
+
+  // Digits come low nibble first, padded with F
+  for (i = 0; i < len; i++) {
+    if ((data[i] & 0x0F) > 9) {
+      break;
+    }
+    iccid[digits++] = '0' + (data[i] & 0x0F);
+    if ((data[i] >> 4) > 9) {
+      break;
+    }
+    iccid[digits++] = '0' + (data[i] >> 4);
+  }
+  iccid[digits] = '\0';
+
+  return digits > 0;
+}
+
+SEInterface* TobDiscovery::probe(const Candidate* candidate, char* iccid, const std::atomic<bool>* abort) {
+  SEInterface* seiface;
+  bool found = false;
+
+  iccid[0] = '\0';
+  if ((seiface = _factory(candidate->device)) == nullptr) {
+    return nullptr;
+  }
+
+  if (seiface->open()) {
+    if ((abort == nullptr) || !*abort) {
+      MIAS mias;
+      mias.init(seiface);
+      if (mias.select(false)) {
+        mias.deselect();
+        found = (abort == nullptr) || !*abort;
+      }
+    }
+
+    if (found) {
+      readIccid(seiface, iccid);
+      return seiface;
+    }
+    seiface->close();
+  }
+
+  delete seiface;
+  return nullptr;
+}
+
+bool TobDiscovery::loadCache(char* key, char* iccid) {
+  char line[TOB_DISCOVERY_KEY_LEN + TOB_ICCID_LEN + TOB_DISCOVERY_DEVICE_LEN + 4];
+  char* iccidField;
+  char* end;
+  FILE* file;
+
+  if ((_cachePath == nullptr) || ((file = fopen(_cachePath, "r")) == nullptr)) {
+    return false;
+  }
+  if (fgets(line, sizeof(line), file) == nullptr) {
+    fclose(file);
+    return false;
+  }
+  fclose(file);
+
+  // key<TAB>iccid<TAB>device, the device being informational only
+  if (((iccidField = strchr(line, '\t')) == nullptr) || ((end = strchr(iccidField + 1, '\t')) == nullptr)) {
+    return false;
+  }
+  *iccidField = '\0';
+  *end        = '\0';
+
+  copyString(key, line, TOB_DISCOVERY_KEY_LEN);
+  copyString(iccid, iccidField + 1, TOB_ICCID_LEN + 1);
+  return true;
+}
+
+void TobDiscovery::saveCache(const Candidate* candidate) {
+  char tmp[PATH_MAX];
+  char dir[PATH_MAX];
+  char* slash;
+  FILE* file;
+
+  if (_cachePath == nullptr) {
+    return;
+  }
+
+  copyString(dir, _cachePath, sizeof(dir));
+  if ((slash = strrchr(dir, '/')) != nullptr) {
+    *slash = '\0';
+    mkdir(dir, 0755);
+  }
+
+  // Written aside and renamed over, a power cut never leaves half a line behind
+  snprintf(tmp, sizeof(tmp), "%s.tmp", _cachePath);
+  if ((file = fopen(tmp, "w")) == nullptr) {
+    return;
+  }
+  fprintf(file, "%s\t%s\t%s\n", candidate->key, _iccid, candidate->device);
+  if (fclose(file) == 0) {
+    rename(tmp, _cachePath);
+  } else {
+    remove(tmp);
+  }
+}
+
+SEInterface* TobDiscovery::discover(void) {
+  char key[TOB_DISCOVERY_KEY_LEN];
+  char iccid[TOB_ICCID_LEN + 1];
+  char iccids[TOB_DISCOVERY_MAX_CANDIDATES][TOB_ICCID_LEN + 1];
+  std::thread probes[TOB_DISCOVERY_MAX_CANDIDATES];
+  std::atomic<bool> abort(false);
+  std::mutex lock;
+  SEInterface* seiface = nullptr;
+  int winner           = -1;
+  int i;
+
+  _device[0] = '\0';
+  _iccid[0]  = '\0';
+  _cached    = false;
+
+  // The remembered device only counts with the same SIM in it, anything else changed is worth a full probe
+  if (loadCache(key, iccid)) {
+    for (i = 0; i < _count; i++) {
+      if (strcmp(_candidates[i].key, key) == 0) {
+        if ((seiface = probe(&_candidates[i], iccids[i], nullptr)) != nullptr) {
+          if (strcmp(iccids[i], iccid) == 0) {
+            copyString(_device, _candidates[i].device, sizeof(_device));
+            copyString(_iccid, iccid, sizeof(_iccid));
+            _cached = true;
+            return seiface;
+          }
+          seiface->close();
+          delete seiface;
+          seiface = nullptr;
+        }
+        break;
+      }
+    }
+  }
+
+  // Each probe runs on its own deadlines, a silent port only holds up its own thread. The first SIM found stops the
+  // others at their next step.
+  for (i = 0; i < _count; i++) {
+    probes[i] = std::thread([&, i] {
+      SEInterface* found = probe(&_candidates[i], iccids[i], &abort);
+      if (found == nullptr) {
+        return;
+      }
+
+      std::lock_guard<std::mutex> guard(lock);
+      if (winner < 0) {
+        winner  = i;
+        seiface = found;
+        abort   = true;
+      } else {
+        found->close();
+        delete found;
+      }
+    });
+  }
+  for (i = 0; i < _count; i++) {
+    probes[i].join();
+  }
+
+  if (winner < 0) {
+    return nullptr;
+  }
+
+  copyString(_device, _candidates[winner].device, sizeof(_device));
+  copyString(_iccid, iccids[winner], sizeof(_iccid));
+  saveCache(&_candidates[winner]);
+  return seiface;
+}
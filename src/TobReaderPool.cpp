@@ -0,0 +1,284 @@
+/*
+ *
+ * Twilio Breakout Trust Onboard SDK
+ *
+ * Copyright (c) 2019 Twilio, Inc.
+ *
+ * SPDX-License-Identifier:  Apache-2.0
+ */
+
+#include "TobReaderPool.h"
+#include "MF.h"
+#include "MIAS.h"
+
+#ifdef PCSC_SUPPORT
+#include "Pcsc.h"
+#endif
+
+#include <chrono>
+#include <cstdio>
+#include <cstring>
+#include <vector>
+
+// Pseudo reader through which pcscd reports readers being plugged in and out
+#define POOL_PNP_READER "\\\\?PnP?\\Notification"
+
+static SEInterface* createReader(const char* reader) {
+#ifdef PCSC_SUPPORT
+  return new PcscSEInterface(reader);
+#else
+  return nullptr;
+#endif
+}
+
+TobReaderPool::TobReaderPool(TobPoolJob job, void* arg, TobProbeFactory factory) {
+  _job           = job;
+  _jobArg        = arg;
+  _factory       = (factory != nullptr) ? factory : createReader;
+  _completion    = nullptr;
+  _completionArg = nullptr;
+  _workerCount   = 0;
+  _busy          = 0;
+  _stopping      = false;
+  _context       = 0;
+  _watching      = false;
+}
+
+TobReaderPool::~TobReaderPool(void) {
+  stop();
+}
+
+void TobReaderPool::setCompletion(TobPoolCompletion completion, void* arg) {
+  std::lock_guard<std::mutex> guard(_lock);
+
+  _completion    = completion;
+  _completionArg = arg;
+}
+
+TobReaderPool::Worker* TobReaderPool::findWorker(const char* reader, bool add) {
+  for (int i = 0; i < _workerCount; i++) {
+    if (strcmp(_workers[i].reader, reader) == 0) {
+      return &_workers[i];
+    }
+  }
+
+  if (!add || (_workerCount >= TOB_POOL_MAX_READERS) || (strlen(reader) >= TOB_POOL_READER_LEN)) {
+    return nullptr;
+  }
+
+  Worker* worker = &_workers[_workerCount++];
+  strcpy(worker->reader, reader);
+  worker->busy = false;
+  return worker;
+}
+
+bool TobReaderPool::cardInserted(const char* reader) {
+  std::lock_guard<std::mutex> guard(_lock);
+  Worker* worker;
+
+  if (_stopping || ((worker = findWorker(reader, true)) == nullptr) || worker->busy) {
+    return false;
+  }
+
+  // The previous job of this reader is over, its thread only has to return
+  if (worker->thread.joinable()) {
+    worker->thread.join();
+  }
+
+  worker->busy = true;
+  _busy++;
+  worker->thread = std::thread(&TobReaderPool::run, this, worker);
+  return true;
+}
+
+void TobReaderPool::run(Worker* worker) {
+  auto start = std::chrono::steady_clock::now();
+  char iccid[TOB_ICCID_LEN + 1];
+  TobPoolCompletion completion;
+  void* completionArg;
+  SEInterface* seiface;
+  int result = -1;
+
+  iccid[0] = '\0';
+  if ((seiface = _factory(worker->reader)) != nullptr) {
+    if (seiface->open()) {
+      // Nobody else gets to the card in between, the MF and MIAS of this reader only ever see their own state
+      {
+        SETransaction transaction(seiface);
+        MF mf;
+        MIAS mias;
+
+        Applet::closeAllChannels(seiface);
+        TobDiscovery::readIccid(seiface, iccid);
+        mf.init(seiface);
+        mias.init(seiface);
+        result = _job(seiface, &mf, &mias, iccid, _jobArg);
+      }
+      seiface->close();
+    }
+    delete seiface;
+  }
+
+  {
+    std::lock_guard<std::mutex> guard(_lock);
+
+    if (iccid[0] != '\0') {
+      TobPoolResult& outcome = _results[iccid];
+      outcome.reader         = worker->reader;
+      outcome.result         = result;
+      outcome.elapsedMs =
+          std::chrono::duration_cast<std::chrono::milliseconds>(std::chrono::steady_clock::now() - start).count();
+    }
+    completion    = _completion;
+    completionArg = _completionArg;
+  }
+
+  if (completion != nullptr) {
+    completion(worker->reader, iccid, result, completionArg);
+  }
+
+  std::lock_guard<std::mutex> guard(_lock);
+  worker->busy = false;
+  _busy--;
+  _idle.notify_all();
+}
+
+bool TobReaderPool::start(void) {
+#ifdef PCSC_SUPPORT
+  SCARDCONTEXT context;
+  LONG ret;
+
+  if (_watching) {
+    return true;
+  }
+
+  if ((ret = SCardEstablishContext(SCARD_SCOPE_SYSTEM, nullptr, nullptr, &context)) != SCARD_S_SUCCESS) {
+    fprintf(stderr, "PCSC: Failed to initialize context: %s\n", pcsc_stringify_error(ret));
+    return false;
+  }
+
+  _context  = (long)context;
+  _stopping = false;
+  _watching = true;
+  _watcher  = std::thread(&TobReaderPool::watch, this);
+  return true;
+#else
+  fprintf(stderr, "No pcsc support, please rebuild with -DPCSC_SUPPORT=ON\n");
+  return false;
+#endif
+}
+
+void TobReaderPool::watch(void) {
+#ifdef PCSC_SUPPORT
+  SCARDCONTEXT context = (SCARDCONTEXT)_context;
+  std::map<std::string, DWORD> known;
+  std::vector<std::string> names;
+  std::vector<SCARD_READERSTATE> states;
+  char list[4096];
+  DWORD len;
+  LONG ret;
+
+  while (!_stopping) {
+    // Readers are listed again every time one comes or goes, cards already known to be in are not run again
+    len = sizeof(list);
+    if ((ret = SCardListReaders(context, nullptr, list, &len)) == SCARD_E_NO_READERS_AVAILABLE) {
+      list[0] = '\0';
+    } else if (ret != SCARD_S_SUCCESS) {
+      fprintf(stderr, "PCSC: Failed to get reader names: %s\n", pcsc_stringify_error(ret));
+      return;
+    }
+
+    names.clear();
+    for (const char* p = list; *p != '\0'; p += strlen(p) + 1) {
+      names.push_back(p);
+    }
+    names.push_back(POOL_PNP_READER);
+
+    states.assign(names.size(), SCARD_READERSTATE());
+    for (size_t i = 0; i < names.size(); i++) {
+      states[i].szReader       = names[i].c_str();
+      states[i].dwCurrentState = (known.count(names[i]) != 0) ? known[names[i]] : SCARD_STATE_UNAWARE;
+    }
+
+    bool changed = false;
+    while (!_stopping && !changed) {
+      ret = SCardGetStatusChange(context, INFINITE, states.data(), states.size());
+      if ((ret == SCARD_E_CANCELLED) || _stopping) {
+        return;
+      }
+      if (ret == SCARD_E_TIMEOUT) {
+        continue;
+      }
+      if (ret != SCARD_S_SUCCESS) {
+        fprintf(stderr, "PCSC: Failed to watch readers: %s\n", pcsc_stringify_error(ret));
+        return;
+      }
+
+      for (size_t i = 0; i < states.size(); i++) {
+        DWORD state = states[i].dwEventState;
+
+        if ((state & SCARD_STATE_CHANGED) == 0) {
+          continue;
+        }
+        if (i == states.size() - 1) {
+          changed = true;
+        } else if ((state & SCARD_STATE_PRESENT) && !(state & SCARD_STATE_MUTE) &&
+                   !(states[i].dwCurrentState & SCARD_STATE_PRESENT)) {
+          cardInserted(names[i].c_str());
+        }
+        states[i].dwCurrentState = state & ~SCARD_STATE_CHANGED;
+        known[names[i]]          = states[i].dwCurrentState;
+      }
+    }
+  }
+#endif
+}
+
+void TobReaderPool::stop(void) {
+  _stopping = true;
+
+#ifdef PCSC_SUPPORT
+  if (_watching) {
+    SCardCancel((SCARDCONTEXT)_context);
+    _watcher.join();
+    SCardReleaseContext((SCARDCONTEXT)_context);
+    _watching = false;
+  }
+#endif
+
+  // Nothing starts a job anymore, the threads can be joined without the lock which they take to finish
+  for (int i = 0; i < _workerCount; i++) {
+    if (_workers[i].thread.joinable()) {
+      _workers[i].thread.join();
+    }
+  }
+}
+
+bool TobReaderPool::waitIdle(int timeout) {
+  std::unique_lock<std::mutex> guard(_lock);
+
+  if (timeout < 0) {
+    _idle.wait(guard, [this] { return _busy == 0; });
+    return true;
+  }
+
+  return _idle.wait_for(guard, std::chrono::milliseconds(timeout), [this] { return _busy == 0; });
+}
+
+std::map<std::string, TobPoolResult> TobReaderPool::getResults(void) {
+  std::lock_guard<std::mutex> guard(_lock);
+
+  return _results;
+}
+
+int TobReaderPool::getReaderCount(void) {
+  std::lock_guard<std::mutex> guard(_lock);
+
+  return _workerCount;
+}
+
+int TobReaderPool::getBusyCount(void) {
+  std::lock_guard<std::mutex> guard(_lock);
+
+  return _busy;
+}
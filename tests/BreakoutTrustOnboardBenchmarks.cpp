@@ -0,0 +1,443 @@
+/*
+ *
+ * Twilio Breakout Trust Onboard SDK
+ *
+ * Copyright (c) 2019 Twilio, Inc.
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *     http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+// Host-side microbenchmarks for the transport layer. They need neither a modem nor a SIM, pcsc aside which needs a
+// PC/SC reader.
+//
+//   trust_onboard_benchmarks [name]
+//
+// runs every benchmark, or only the one given by name.
+
+#include "Applet.h"
+#include "GenericModem.h"
+#include "HexCodec.h"
+#include "MF.h"
+#include "ModemEmulator.h"
+
+#ifdef PCSC_SUPPORT
+#include "Pcsc.h"
+#endif
+
+#include <algorithm>
+#include <chrono>
+#include <cstdio>
+#include <cstdlib>
+#include <cstring>
+#include <functional>
+#include <string>
+#include <vector>
+
+// Keeps the optimizer from dropping the benchmarked work
+static volatile uint8_t sink;
+
+// Run fn until at least 200ms have passed, returns nanoseconds per call
+static double measure(const std::function<void(void)>& fn) {
+  using clock      = std::chrono::steady_clock;
+  unsigned long n  = 0;
+  auto start       = clock::now();
+  auto elapsed     = clock::duration::zero();
+  unsigned long batch = 16;
+
+  do {
+    for (unsigned long i = 0; i < batch; i++) {
+      fn();
+    }
+    n += batch;
+    batch *= 2;
+    elapsed = clock::now() - start;
+  } while (elapsed < std::chrono::milliseconds(200));
+
+  return std::chrono::duration<double, std::nano>(elapsed).count() / n;
+}
+
+/** Hex codec *****************************************************************/
+
+// The routines ATInterface and the SDK used before the shared codec, kept here as the baseline
+static bool legacyBytesArray2HexString(uint8_t* bytes, uint16_t bytesLen, uint8_t* hexstr, uint16_t* hexstrLen) {
+  const uint8_t* hex = (const uint8_t*)"0123456789ABCDEF";
+  uint16_t i;
+
+  *hexstrLen = 0;
+  for (i = 0; i < bytesLen; i++, *hexstrLen += 2) {
+    *hexstr = hex[(bytes[i] >> 4) & 0xF];
+    hexstr++;
+    *hexstr = hex[bytes[i] & 0xF];
+    hexstr++;
+  }
+
+  return true;
+}
+
+static bool legacyHexString2BytesArray(uint8_t* hexstr, uint16_t hexstrLen, uint8_t* bytes, uint16_t* bytesLen) {
+  uint8_t d;
+  uint16_t i, j;
+
+  *bytesLen = 0;
+  for (i = 0; i < hexstrLen; *bytesLen += 1) {
+    d = 0;
+    for (j = i + 2; i < j; i++) {
+      d <<= 4;
+      if ((hexstr[i] >= '0') && (hexstr[i] <= '9')) {
+        d |= hexstr[i] - '0';
+      } else if ((hexstr[i] >= 'a') && (hexstr[i] <= 'f')) {
+        d |= hexstr[i] - 'a' + 10;
+      } else if ((hexstr[i] >= 'A') && (hexstr[i] <= 'F')) {
+        d |= hexstr[i] - 'A' + 10;
+      }
+    }
+    *bytes = d;
+    bytes++;
+  }
+
+  return true;
+}
+
+static void benchmarkHexCodec(void) {
+  static const size_t sizes[] = {4, 16, 64, 258, 2048};
+
+  printf("hex codec, ns per call (lower is better)\n");
+  printf("%8s %10s %10s %10s | %10s %10s %10s\n", "bytes", "enc-old", "enc-scal", "enc-new", "dec-old", "dec-scal",
+         "dec-new");
+
+  for (size_t len : sizes) {
+    std::vector<uint8_t> bytes(len), out(len);
+    std::vector<char> hex(2 * len);
+    uint16_t outLen;
+
+    for (size_t i = 0; i < len; i++) {
+      bytes[i] = (uint8_t)(i * 37 + 11);
+    }
+    tob_hex_encode(bytes.data(), len, hex.data());
+
+    double encOld = measure([&]() {
+      legacyBytesArray2HexString(bytes.data(), len, (uint8_t*)hex.data(), &outLen);
+      sink = hex[0];
+    });
+    double encScalar = measure([&]() {
+      tob_hex_encode_scalar(bytes.data(), len, hex.data());
+      sink = hex[0];
+    });
+    double encNew = measure([&]() {
+      tob_hex_encode(bytes.data(), len, hex.data());
+      sink = hex[0];
+    });
+    double decOld = measure([&]() {
+      legacyHexString2BytesArray((uint8_t*)hex.data(), 2 * len, out.data(), &outLen);
+      sink = out[0];
+    });
+    double decScalar = measure([&]() {
+      sink = tob_hex_decode_scalar(hex.data(), 2 * len, out.data());
+    });
+    double decNew = measure([&]() {
+      sink = tob_hex_decode(hex.data(), 2 * len, out.data());
+    });
+
+    printf("%8zu %10.1f %10.1f %10.1f | %10.1f %10.1f %10.1f\n", len, encOld, encScalar, encNew, decOld, decScalar,
+           decNew);
+  }
+}
+
+/** AT session profile *******************************************************/
+
+// Answers AT commands the way a module with factory settings would, counting the bytes on the wire
+class ScriptedModem : public Serial {
+ public:
+  bool start(void) override {
+    return true;
+  }
+
+  bool stop(void) override {
+    return true;
+  }
+
+  bool send(char* data, unsigned long int toWrite, unsigned long int* written) override {
+    _sent += toWrite;
+    _line.append(data, toWrite);
+
+    size_t cr;
+    while ((cr = _line.find('\r')) != std::string::npos) {
+      answer(_line.substr(0, cr));
+      _line.erase(0, (cr + 1 < _line.size() && _line[cr + 1] == '\n') ? cr + 2 : cr + 1);
+    }
+
+    *written = toWrite;
+    return true;
+  }
+
+  bool recv(char* data, unsigned long int toRead, unsigned long int* read) override {
+    return recv(data, toRead, read, _timeout);
+  }
+
+  bool recv(char* data, unsigned long int toRead, unsigned long int* read, int timeout) override {
+    recvAvailable(data, toRead, read, timeout);
+    return *read == toRead;
+  }
+
+  bool recvAvailable(char* data, unsigned long int toRead, unsigned long int* read, int timeout) override {
+    *read = std::min<unsigned long int>(toRead, _pending.size());
+    memcpy(data, _pending.data(), *read);
+    _pending.erase(0, *read);
+    _received += *read;
+    return *read > 0;
+  }
+
+  void resetCounters(void) {
+    _sent     = 0;
+    _received = 0;
+    _commands = 0;
+  }
+
+  unsigned long int _sent     = 0;
+  unsigned long int _received = 0;
+  unsigned long int _commands = 0;
+  // Support AT+CCHO, AT+CGLA and AT+CCHC
+  bool _logicalChannels = false;
+
+ private:
+  void answer(const std::string& cmd) {
+    if (_echo) {
+      _pending += cmd + "\r";
+    }
+
+    _commands++;
+    if (cmd == "ATE0" || cmd == "ATE1") {
+      _echo = (cmd == "ATE1");
+    } else if (!_logicalChannels && (cmd.compare(0, 7, "AT+CCHO") == 0 || cmd.compare(0, 7, "AT+CGLA") == 0)) {
+      _pending += "\r\nERROR\r\n";
+      return;
+    } else if (cmd.compare(0, 8, "AT+CCHO=") == 0 && cmd != "AT+CCHO=?") {
+      _pending += "\r\n1\r\n";
+    } else if ((cmd.compare(0, 8, "AT+CSIM=") == 0 || cmd.compare(0, 8, "AT+CGLA=") == 0) && cmd.back() == '"') {
+      // READ BINARY and GET RESPONSE return Le bytes, SELECT has its FCI waiting, MANAGE CHANNEL opens channel 1,
+      // anything else just returns a status word
+      size_t quote = cmd.find('"');
+      std::string ins = cmd.substr(quote + 3, 2);
+      std::string response;
+      if (ins == "B0" || ins == "C0") {
+        unsigned long int le = strtoul(cmd.substr(quote + 9, 2).c_str(), nullptr, 16);
+        response.assign(2 * le, 'A');
+        response += "9000";
+      } else if (ins == "A4") {
+        response = "611C";
+      } else if (ins == "70" && cmd.compare(quote + 5, 2, "00") == 0) {
+        response = "019000";
+      } else {
+        response = "9000";
+      }
+      _pending += "\r\n" + cmd.substr(2, 5) + ": " + std::to_string(response.size()) + ",\"" + response + "\"\r\n";
+    }
+
+    _pending += "\r\nOK\r\n";
+  }
+
+  bool _echo = true;
+  std::string _line;
+  std::string _pending;
+};
+
+static void benchmarkSessionProfile(void) {
+  static const struct {
+    const char* name;
+    bool echo;
+  } profiles[] = {{"echo on (factory)", true}, {"echo off (default)", false}};
+
+  printf("bytes on the wire per APDU, time at 115200 baud 8N1\n");
+  printf("%-20s %-14s %6s %6s %9s\n", "profile", "apdu", "tx", "rx", "ms");
+
+  for (const auto& profile : profiles) {
+    ScriptedModem* serial = new ScriptedModem();
+    GenericModem modem(serial);
+    ModemProfile settings;
+
+    settings.echo = profile.echo;
+    modem.setProfile(settings);
+    modem.open();
+
+    serial->resetCounters();
+    modem.transmit(0x00, 0xA4, 0x04, 0x00, (const uint8_t*)"\xA0\x00\x00\x00\x77\x01\x00\x00\x06\x00\x01\x00\x01", 13);
+    printf("%-20s %-14s %6lu %6lu %9.2f\n", profile.name, "SELECT", serial->_sent, serial->_received,
+           (serial->_sent + serial->_received) * 10 * 1000.0 / 115200);
+
+    serial->resetCounters();
+    modem.transmit(0x00, 0xB0, 0x00, 0x00, 0xEE);
+    printf("%-20s %-14s %6lu %6lu %9.2f\n", profile.name, "READ BINARY", serial->_sent, serial->_received,
+           (serial->_sent + serial->_received) * 10 * 1000.0 / 115200);
+
+    modem.close();
+  }
+}
+
+/** Logical channels **********************************************************/
+
+static void benchmarkLogicalChannels(void) {
+  static uint8_t aid[] = {0xA0, 0x00, 0x00, 0x00, 0x77, 0x01, 0x00, 0x00, 0x06, 0x00, 0x01, 0x00, 0x01};
+  static const uint8_t hash[32] = {0};
+
+  printf("AT round trips per signature (select, PSO, deselect), time at 115200 baud 8N1\n");
+  printf("%-22s %6s %6s %6s %9s\n", "channels", "cmds", "tx", "rx", "ms");
+
+  for (bool logicalChannels : {false, true}) {
+    ScriptedModem* serial = new ScriptedModem();
+    GenericModem modem(serial);
+    Applet applet(aid, sizeof(aid));
+
+    serial->_logicalChannels = logicalChannels;
+    modem.open();
+    applet.init(&modem);
+
+    serial->resetCounters();
+    applet.select(false);
+    applet.transmit(0x00, static_cast<SCIns>(0x2A), static_cast<SCP1>(0x9E), static_cast<SCP2>(0x9A), hash,
+                    sizeof(hash), 0x00);
+    applet.deselect();
+    printf("%-22s %6lu %6lu %6lu %9.2f\n", logicalChannels ? "AT+CCHO/CGLA/CCHC" : "MANAGE CHANNEL (CSIM)",
+           serial->_commands, serial->_sent, serial->_received,
+           (serial->_sent + serial->_received) * 10 * 1000.0 / 115200);
+
+    modem.close();
+  }
+}
+
+/** Emulated modem ************************************************************/
+
+static void benchmarkEmulator(void) {
+  static uint8_t mfAid[] = {0xA0, 0x00, 0x00, 0x00, 0x87, 0x10, 0x01, 0xFF,
+                            0x33, 0xFF, 0xFF, 0x89, 0x01, 0x01, 0x01, 0x00};
+  std::vector<uint8_t> certificate(2048, 0x5A);
+
+  printf("reading a %lu byte EF through the pseudo-terminal modem emulator\n", certificate.size());
+  printf("%-10s %-12s %-12s %6s %9s\n", "baudrate", "sim latency", "pipelining", "cmds", "ms");
+
+  for (int baudrate : {115200, 921600}) {
+    for (int latency : {0, 5}) {
+      for (bool pipelining : {false, true}) {
+        MemoryCard card;
+        card.addApplet(std::vector<uint8_t>(mfAid, mfAid + sizeof(mfAid)));
+        card.addFile({0x7F, 0xAA, 0x6F, 0x01}, certificate);
+
+        ModemEmulatorConfig config;
+        config.baudrate   = baudrate;
+        config.simLatency = latency;
+        ModemEmulator emulator(&card, config);
+        if (!emulator.start()) {
+          printf("cannot create a pseudo-terminal\n");
+          return;
+        }
+
+        GenericModem modem(emulator.getDevice().c_str());
+        ModemProfile profile = modem.getProfile();
+        profile.pipelining   = pipelining;
+        modem.setProfile(profile);
+        MF mf;
+        std::vector<uint8_t> data(certificate.size());
+        uint16_t len = 0;
+
+        if (!modem.open()) {
+          printf("cannot open %s\n", emulator.getDevice().c_str());
+          return;
+        }
+        mf.init(&modem);
+        mf.select(false);
+
+        unsigned long int commands = emulator.getCommands();
+        auto start                 = std::chrono::steady_clock::now();
+        bool ok                    = mf.readCertificate(data.data(), &len);
+        std::chrono::duration<double, std::milli> elapsed = std::chrono::steady_clock::now() - start;
+
+        printf("%-10d %-12d %-12s %6lu %9.2f%s\n", baudrate, latency, modem.hasPipelining() ? "on" : "off",
+               emulator.getCommands() - commands, elapsed.count(), ok ? "" : " (failed)");
+
+        mf.deselect();
+        modem.close();
+        emulator.stop();
+      }
+    }
+  }
+}
+
+#ifdef PCSC_SUPPORT
+/** PC/SC transactions ********************************************************/
+
+// Against the reader given by TOB_PCSC_READER (index, 0 by default), e.g. vpcd from vsmartcard with a virtual card.
+// Each operation is six APDUs, as many as tobSigningSign sends, each SELECT of the MF going to pcscd on its own or
+// all of them inside one SCardBeginTransaction/SCardEndTransaction.
+static void benchmarkPcscTransactions(void) {
+  static const uint8_t mf[] = {0x3F, 0x00};
+  const char* reader        = getenv("TOB_PCSC_READER");
+  PcscSEInterface pcsc((reader != nullptr) ? atoi(reader) : 0);
+  double ns[2];
+
+  if (!pcsc.open()) {
+    printf("cannot open PC/SC reader %s\n", (reader != nullptr) ? reader : "0");
+    return;
+  }
+
+  printf("6 APDU operation through pcscd\n");
+  printf("%-22s %9s\n", "locking", "ms/op");
+
+  for (bool transaction : {false, true}) {
+    ns[transaction] = measure([&]() {
+      SETransaction hold(transaction ? &pcsc : nullptr);
+      for (int i = 0; i < 6; i++) {
+        pcsc.transmit(0x00, 0xA4, 0x00, 0x0C, mf, sizeof(mf));
+      }
+    });
+    printf("%-22s %9.3f\n", transaction ? "one transaction" : "one per APDU", ns[transaction] / 1e6);
+  }
+
+  printf("%-22s %9.3f\n", "saved per operation", (ns[false] - ns[true]) / 1e6);
+  pcsc.close();
+}
+#endif
+
+/** Driver ********************************************************************/
+
+struct Benchmark {
+  const char* name;
+  void (*run)(void);
+};
+
+static const Benchmark benchmarks[] = {
+    {"hex", benchmarkHexCodec},
+    {"profile", benchmarkSessionProfile},
+    {"channels", benchmarkLogicalChannels},
+    {"emulator", benchmarkEmulator},
+#ifdef PCSC_SUPPORT
+    {"pcsc", benchmarkPcscTransactions},
+#endif
+};
+
+int main(int argc, char** argv) {
+  bool found = false;
+
+  for (const Benchmark& b : benchmarks) {
+    if (argc < 2 || strcmp(argv[1], b.name) == 0) {
+      b.run();
+      printf("\n");
+      found = true;
+    }
+  }
+
+  if (!found) {
+    fprintf(stderr, "Unknown benchmark: %s\n", argv[1]);
+    return 1;
+  }
+
+  return 0;
+}
@@ -0,0 +1,2509 @@
+/*
+ *
+ * Twilio Breakout Trust Onboard SDK
+ *
+ * Copyright (c) 2019 Twilio, Inc.
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *     http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+// Transport tests which don't need a modem or a SIM: the serial side is played by a pseudo-terminal.
+
+#define CATCH_CONFIG_MAIN
+#include "catch.hpp"
+
+#include "ATInterface.h"
+#include "Applet.h"
+#include "Atr.h"
+#include "Ccid.h"
+#include "Cmux.h"
+#include "GenericModem.h"
+#include "HexCodec.h"
+#include "LSerial.h"
+#include "MF.h"
+#include "MIAS.h"
+#include "ModemDriver.h"
+#include "ModemEmulator.h"
+#include "Qmi.h"
+#include "TobCalibration.h"
+#include "TobDiscovery.h"
+#include "TobReaderPool.h"
+
+#include <algorithm>
+#include <atomic>
+#include <chrono>
+#include <map>
+#include <memory>
+#include <mutex>
+#include <random>
+#include <string>
+#include <thread>
+#include <vector>
+
+#include <fcntl.h>
+#include <poll.h>
+#include <stdlib.h>
+#include <sys/stat.h>
+#include <sys/epoll.h>
+#include <sys/socket.h>
+#include <unistd.h>
+
+// AID of the MF applet the emulated cards carry
+static const std::vector<uint8_t> mfAid = {0xA0, 0x00, 0x00, 0x00, 0x87, 0x10, 0x01, 0xFF,
+                                           0x33, 0xFF, 0xFF, 0x89, 0x01, 0x01, 0x01, 0x00};
+
+class PtyPair {
+ public:
+  PtyPair() {
+    master = posix_openpt(O_RDWR | O_NOCTTY);
+    if (master >= 0 && grantpt(master) == 0 && unlockpt(master) == 0) {
+      slave = ptsname(master);
+    }
+  }
+
+  ~PtyPair() {
+    if (master >= 0) {
+      close(master);
+    }
+  }
+
+  void write(const std::string& data) {
+    ::write(master, data.data(), data.size());
+  }
+
+  // Collect what the code under test wrote to the port, waiting at most timeout milliseconds for each chunk
+  std::string read(int timeout = 200) {
+    std::string data;
+    struct pollfd pfd = {master, POLLIN, 0};
+    char buf[256];
+
+    while (poll(&pfd, 1, timeout) > 0) {
+      ssize_t r = ::read(master, buf, sizeof(buf));
+      if (r <= 0) {
+        break;
+      }
+      data.append(buf, r);
+    }
+
+    return data;
+  }
+
+  int master{-1};
+  std::string slave;
+};
+
+TEST_CASE("LSerial receive honours its deadline", "[serial]") {
+  PtyPair pty;
+  REQUIRE(!pty.slave.empty());
+
+  LSerial serial(pty.slave.c_str(), 115200);
+  REQUIRE(serial.start());
+
+  char buf[16];
+  unsigned long int read = 0;
+
+  SECTION("dead peer times out instead of hanging") {
+    auto start = std::chrono::steady_clock::now();
+    REQUIRE_FALSE(serial.recv(buf, 4, &read, 200));
+    auto elapsed = std::chrono::duration_cast<std::chrono::milliseconds>(std::chrono::steady_clock::now() - start);
+    REQUIRE(read == 0);
+    REQUIRE(elapsed.count() >= 150);
+    REQUIRE(elapsed.count() < 2000);
+  }
+
+  SECTION("partial data is reported on timeout") {
+    pty.write("OK");
+    REQUIRE_FALSE(serial.recv(buf, 4, &read, 200));
+    REQUIRE(read == 2);
+  }
+
+  SECTION("available data is returned") {
+    pty.write("OK\r\n");
+    REQUIRE(serial.recv(buf, 4, &read, 1000));
+    REQUIRE(read == 4);
+    REQUIRE(std::string(buf, 4) == "OK\r\n");
+  }
+
+  serial.stop();
+}
+
+TEST_CASE("ATInterface keeps bytes received past the end of a response", "[at]") {
+  PtyPair pty;
+  REQUIRE(!pty.slave.empty());
+
+  LSerial serial(pty.slave.c_str(), 115200);
+  ATInterface at(&serial);
+  REQUIRE(at.open());
+
+  // Both responses arrive in one burst, the second one must survive the first command
+  pty.write("+CSIM: 4,\"9000\"\r\nOK\r\n+CSIM: 4,\"6A82\"\r\nOK\r\n");
+
+  uint8_t apdu[] = {0x00, 0xA4, 0x00, 0x0C};
+  uint8_t response[258];
+  uint16_t response_len = 0;
+
+  REQUIRE(at.sendATCSIM(apdu, sizeof(apdu), response, &response_len));
+  REQUIRE(response_len == 2);
+  REQUIRE(response[0] == 0x90);
+  REQUIRE(response[1] == 0x00);
+  REQUIRE(pty.read() == "AT+CSIM=8,\"00A4000C\"\r\n");
+
+  REQUIRE(at.sendATCSIM(apdu, sizeof(apdu), response, &response_len));
+  REQUIRE(response_len == 2);
+  REQUIRE(response[0] == 0x6A);
+  REQUIRE(response[1] == 0x82);
+
+  at.close();
+}
+
+TEST_CASE("ATInterface parses +CSIM responses while they arrive", "[at]") {
+  PtyPair pty;
+  REQUIRE(!pty.slave.empty());
+
+  LSerial serial(pty.slave.c_str(), 115200);
+  ATInterface at(&serial);
+  REQUIRE(at.open());
+
+  uint8_t apdu[] = {0x00, 0xB0, 0x00, 0x00, 0x00};
+  uint8_t response[258];
+  uint16_t response_len = 0;
+
+  SECTION("response split at odd offsets, with echo and URCs around it") {
+    std::vector<uint8_t> expected(258);
+    for (size_t i = 0; i < expected.size(); i++) {
+      expected[i] = (uint8_t)(i * 7 + 3);
+    }
+    std::string hex(2 * expected.size(), '\0');
+    tob_hex_encode(expected.data(), expected.size(), &hex[0]);
+
+    std::string reply = "AT+CSIM=10,\"00B0000000\"\r\r\n\r\n+CREG: 1\r\n+CSIM: 516,\"" + hex + "\"\r\n\r\nRING\r\n\r\nOK\r\n";
+    std::thread peer([&]() {
+      for (size_t off = 0; off < reply.size(); off += 37) {
+        pty.write(reply.substr(off, 37));
+        std::this_thread::sleep_for(std::chrono::milliseconds(1));
+      }
+    });
+
+    REQUIRE(at.sendATCSIM(apdu, sizeof(apdu), response, &response_len));
+    peer.join();
+    REQUIRE(response_len == expected.size());
+    REQUIRE(std::vector<uint8_t>(response, response + response_len) == expected);
+  }
+
+  SECTION("+CME ERROR ends the command") {
+    pty.write("+CME ERROR: 13\r\n");
+    REQUIRE_FALSE(at.sendATCSIM(apdu, sizeof(apdu), response, &response_len));
+    REQUIRE(at.getLastResult() == AT_RESULT_CME_ERROR);
+    REQUIRE(at.getLastErrorCode() == 13);
+  }
+
+  SECTION("ERROR ends the command") {
+    pty.write("\r\nERROR\r\n");
+    REQUIRE_FALSE(at.sendATCSIM(apdu, sizeof(apdu), response, &response_len));
+  }
+
+  SECTION("malformed payload is rejected but the stream stays in sync") {
+    pty.write("+CSIM: 4,\"90ZZ\"\r\nOK\r\n+CSIM: 4,\"9000\"\r\nOK\r\n");
+    REQUIRE_FALSE(at.sendATCSIM(apdu, sizeof(apdu), response, &response_len));
+    REQUIRE(at.sendATCSIM(apdu, sizeof(apdu), response, &response_len));
+    REQUIRE(response_len == 2);
+    REQUIRE(response[0] == 0x90);
+  }
+
+  at.close();
+}
+
+static void collectUrc(const char* line, void* arg) {
+  static_cast<std::vector<std::string>*>(arg)->push_back(line);
+}
+
+TEST_CASE("ATInterface hands URCs over to their handlers", "[at]") {
+  PtyPair pty;
+  REQUIRE(!pty.slave.empty());
+
+  LSerial serial(pty.slave.c_str(), 115200);
+  ATInterface at(&serial);
+  REQUIRE(at.open());
+
+  std::vector<std::string> registration, ring;
+  REQUIRE(at.addUrcHandler("+CREG: ", collectUrc, &registration));
+  REQUIRE(at.addUrcHandler("RING", collectUrc, &ring));
+
+  uint8_t apdu[] = {0x00, 0xA4, 0x00, 0x0C};
+  uint8_t response[258];
+  uint16_t response_len = 0;
+
+  SECTION("URCs interleaved with a command are delivered once it completes") {
+    pty.write("\r\n+CREG: 5\r\n\r\n+CMTI: \"SM\",1\r\n\r\n+CSIM: 4,\"9000\"\r\n\r\nRING\r\n\r\nOK\r\n");
+    REQUIRE(at.sendATCSIM(apdu, sizeof(apdu), response, &response_len));
+    REQUIRE(response_len == 2);
+    REQUIRE(registration == std::vector<std::string>{"+CREG: 5"});
+    REQUIRE(ring == std::vector<std::string>{"RING"});
+  }
+
+  SECTION("URCs are polled while idle, a partial one is finished by the next command") {
+    pty.write("\r\n+CREG: 1\r\n\r\nOK\r\n\r\n+CREG: ");
+    REQUIRE(at.pollUrcs(200) == 1);
+    REQUIRE(registration == std::vector<std::string>{"+CREG: 1"});
+
+    // The stray OK above must not complete this command
+    pty.write("2\r\n\r\n+CMS ERROR: 500\r\n");
+    REQUIRE_FALSE(at.sendATCSIM(apdu, sizeof(apdu), response, &response_len));
+    REQUIRE(at.getLastResult() == AT_RESULT_CMS_ERROR);
+    REQUIRE(at.getLastErrorCode() == 500);
+    REQUIRE(registration == std::vector<std::string>{"+CREG: 1", "+CREG: 2"});
+  }
+
+  SECTION("a full queue drops URCs instead of stalling") {
+    std::string burst;
+    for (int i = 0; i < AT_URC_QUEUE_LEN + 3; i++) {
+      burst += "\r\nRING\r\n";
+    }
+    pty.write(burst + "\r\nOK\r\n");
+    REQUIRE(at.sendCommand("AT", 1000));
+    REQUIRE(ring.size() == AT_URC_QUEUE_LEN);
+    REQUIRE(at.getDroppedUrcs() == 3);
+  }
+
+  at.close();
+}
+
+TEST_CASE("GenericModem applies its session profile on open", "[modem]") {
+  PtyPair pty;
+  REQUIRE(!pty.slave.empty());
+
+  std::vector<std::string> commands;
+  std::thread peer([&]() {
+    std::string pending;
+    auto deadline = std::chrono::steady_clock::now() + std::chrono::seconds(5);
+    while (commands.size() < 5 && std::chrono::steady_clock::now() < deadline) {
+      pending += pty.read(10);
+
+      size_t end;
+      while ((end = pending.find("\r\n")) != std::string::npos) {
+        commands.push_back(pending.substr(0, end));
+        pending.erase(0, end + 2);
+        // A module without LTE rejects +CEREG, which must not fail the bootstrap
+        pty.write(commands.back() == "AT+CEREG=0" ? "\r\nERROR\r\n" : "\r\nOK\r\n");
+      }
+    }
+  });
+
+  GenericModem modem(pty.slave.c_str());
+  REQUIRE(modem.open());
+  peer.join();
+  modem.close();
+
+  REQUIRE(commands == std::vector<std::string>{"ATE0", "AT+CMEE=1", "AT+CREG=0", "AT+CGREG=0", "AT+CEREG=0"});
+}
+
+TEST_CASE("GenericModem negotiates the fastest working baud rate", "[modem]") {
+  PtyPair pty;
+  REQUIRE(!pty.slave.empty());
+
+  // The link is broken at brokenRate: the modem switches to it but nothing gets through until it is asked to go back.
+  // Each of the sessions is left at 115200, where the next one starts.
+  auto negotiate = [&](int brokenRate, int sessions) {
+    std::vector<std::string> commands;
+    std::mutex lock;
+    std::atomic<bool> done(false);
+    std::thread peer([&]() {
+      std::string pending;
+      bool broken = false;
+      while (!done) {
+        pending += pty.read(10);
+
+        size_t end;
+        while ((end = pending.find("\r\n")) != std::string::npos) {
+          std::string cmd = pending.substr(0, end);
+          pending.erase(0, end + 2);
+          {
+            std::lock_guard<std::mutex> guard(lock);
+            commands.push_back(cmd);
+          }
+
+          if (cmd == "AT+IPR=?") {
+            pty.write("\r\n+IPR: (9600,115200,230400,921600),(0)\r\n\r\nOK\r\n");
+          } else if (cmd == "AT+IPR=" + std::to_string(brokenRate)) {
+            pty.write("\r\nOK\r\n");
+            broken = true;
+          } else if (cmd.compare(0, 7, "AT+IPR=") == 0) {
+            broken = false;
+            pty.write("\r\nOK\r\n");
+          } else if (!broken) {
+            pty.write("\r\nOK\r\n");
+          }
+        }
+      }
+    });
+
+    GenericModem modem(pty.slave.c_str(), MODEM_BAUDRATE_AUTO);
+    std::vector<bool> opened;
+    std::vector<std::string> last;
+    int baudrate = 0;
+    for (int i = 0; i < sessions; i++) {
+      opened.push_back(modem.open());
+      baudrate = modem.getBaudrate();
+      modem.close();
+
+      // The peer answered the last command before close() returned
+      std::lock_guard<std::mutex> guard(lock);
+      last.push_back(commands.back());
+    }
+    done = true;
+    peer.join();
+
+    REQUIRE(opened == std::vector<bool>(sessions, true));
+    REQUIRE(last == std::vector<std::string>(sessions, "AT+IPR=115200"));
+    return baudrate;
+  };
+
+  SECTION("highest advertised rate") {
+    REQUIRE(negotiate(0, 1) == 921600);
+  }
+
+  SECTION("falls back when the link does not work") {
+    REQUIRE(negotiate(921600, 1) == 230400);
+  }
+
+  SECTION("every session starts from the rate of the first one") {
+    REQUIRE(negotiate(0, 3) == 921600);
+  }
+}
+
+TEST_CASE("Applet lets the modem manage logical channels when it can", "[modem]") {
+  PtyPair pty;
+  REQUIRE(!pty.slave.empty());
+
+  auto session = [&](bool advertised) {
+    std::vector<std::string> commands;
+    std::atomic<bool> done(false);
+    std::thread peer([&]() {
+      std::string pending;
+      while (!done) {
+        pending += pty.read(10);
+
+        size_t end;
+        while ((end = pending.find("\r\n")) != std::string::npos) {
+          std::string cmd = pending.substr(0, end);
+          pending.erase(0, end + 2);
+          commands.push_back(cmd);
+
+          if (cmd.compare(0, 7, "AT+CCHO") == 0 || cmd.compare(0, 7, "AT+CGLA") == 0) {
+            if (!advertised) {
+              pty.write("\r\nERROR\r\n");
+            } else if (cmd.compare(0, 8, "AT+CCHO=") == 0 && cmd != "AT+CCHO=?") {
+              // Bare <sessionid> as in TS 27.007
+              pty.write("\r\n2\r\n\r\nOK\r\n");
+            } else if (cmd.compare(0, 10, "AT+CGLA=2,") == 0) {
+              pty.write("\r\n+CGLA: 6,\"AB9000\"\r\n\r\nOK\r\n");
+            } else {
+              pty.write("\r\nOK\r\n");
+            }
+          } else if (cmd.compare(0, 16, "AT+CSIM=10,\"0070") == 0) {
+            pty.write("\r\n+CSIM: 6,\"019000\"\r\n\r\nOK\r\n");
+          } else if (cmd.compare(0, 8, "AT+CSIM=") == 0) {
+            pty.write("\r\n+CSIM: 6,\"AB9000\"\r\n\r\nOK\r\n");
+          } else {
+            pty.write("\r\nOK\r\n");
+          }
+        }
+      }
+    });
+
+    uint8_t aid[] = {0xA0, 0x00, 0x00, 0x00, 0x77, 0x01};
+    GenericModem modem(pty.slave.c_str());
+    REQUIRE(modem.open());
+    REQUIRE(modem.hasLogicalChannels() == advertised);
+
+    Applet applet(aid, sizeof(aid));
+    applet.init(&modem);
+    REQUIRE(applet.select(false));
+    REQUIRE(applet.transmit(0x80, static_cast<SCIns>(0xCA), static_cast<SCP1>(0x00), static_cast<SCP2>(0x00), 0x01));
+    REQUIRE(applet.getStatusWord() == 0x9000);
+    REQUIRE(applet.deselect());
+
+    modem.close();
+    done = true;
+    peer.join();
+
+    // Only what follows the bootstrap and the capability probe
+    auto probe = std::find_if(commands.rbegin(), commands.rend(),
+                              [](const std::string& cmd) { return cmd.compare(cmd.size() - 2, 2, "=?") == 0; });
+    return std::vector<std::string>(probe.base(), commands.end());
+  };
+
+  SECTION("advertised") {
+    REQUIRE(session(true) ==
+            std::vector<std::string>{"AT+CCHO=\"A00000007701\"", "AT+CGLA=2,10,\"82CA000001\"", "AT+CCHC=2"});
+  }
+
+  SECTION("falls back to MANAGE CHANNEL") {
+    REQUIRE(session(false) == std::vector<std::string>{"AT+CSIM=10,\"0070000001\"",
+                                                       "AT+CSIM=22,\"01A4040006A00000007701\"",
+                                                       "AT+CSIM=10,\"81CA000001\"", "AT+CSIM=10,\"0070800101\""});
+  }
+}
+
+static GenericModem* createCustomModem(Serial* serial) {
+  GenericModem* modem  = new GenericModem(serial);
+  ModemProfile profile = modem->getProfile();
+  profile.cmee         = 2;
+  modem->setProfile(profile);
+  return modem;
+}
+
+TEST_CASE("ModemRegistry picks the driver from the modem identification", "[modem]") {
+  PtyPair pty;
+  REQUIRE(!pty.slave.empty());
+
+  struct Command {
+    std::string line;
+    std::chrono::steady_clock::time_point at;
+  };
+
+  // Identify as manufacturer and model, then open the modem with the driver picked for it
+  auto identifyAs = [&](const std::string& manufacturer, const std::string& model, std::string* driver) {
+    std::vector<Command> commands;
+    std::atomic<bool> done(false);
+    std::thread peer([&]() {
+      std::string pending;
+      while (!done) {
+        pending += pty.read(2);
+
+        size_t end;
+        while ((end = pending.find("\r\n")) != std::string::npos) {
+          commands.push_back({pending.substr(0, end), std::chrono::steady_clock::now()});
+          pending.erase(0, end + 2);
+
+          if (commands.back().line == "AT+CGMI") {
+            pty.write("\r\n" + manufacturer + "\r\n\r\nOK\r\n");
+          } else if (commands.back().line == "AT+CGMM") {
+            pty.write("\r\n+CGMM: " + model + "\r\n\r\nOK\r\n");
+          } else {
+            pty.write("\r\nOK\r\n");
+          }
+        }
+      }
+    });
+
+    char manufacturerId[MODEM_IDENTITY_LEN];
+    char modelId[MODEM_IDENTITY_LEN];
+    LSerial* serial = new LSerial(pty.slave.c_str());
+    *driver         = ModemRegistry::probe(serial, manufacturerId, modelId)->name;
+    REQUIRE(manufacturerId == manufacturer);
+    REQUIRE(modelId == model);
+
+    GenericModem* modem = ModemRegistry::create(serial);
+    REQUIRE(modem->open());
+    modem->close();
+    delete modem;
+    done = true;
+    peer.join();
+    return commands;
+  };
+
+  auto contains = [](const std::vector<Command>& commands, const std::string& line) {
+    return std::any_of(commands.begin(), commands.end(), [&](const Command& cmd) { return cmd.line == line; });
+  };
+
+  std::string driver;
+
+  SECTION("unknown modules get GenericModem") {
+    auto commands = identifyAs("Acme", "X1", &driver);
+    REQUIRE(driver == "generic");
+    REQUIRE(contains(commands, "AT+CCHO=?"));
+  }
+
+  SECTION("Quectel skips the logical channel probe") {
+    auto commands = identifyAs("Quectel", "EG25", &driver);
+    REQUIRE(driver == "quectel");
+    REQUIRE_FALSE(contains(commands, "AT+CCHO=?"));
+  }
+
+  SECTION("u-blox gets its guard time between commands") {
+    auto commands = identifyAs("u-blox", "SARA-R410M-02B", &driver);
+    REQUIRE(driver == "u-blox");
+
+    // From ATE0 of the session on, the probe runs without it
+    auto start =
+        std::find_if(commands.rbegin(), commands.rend(), [](const Command& cmd) { return cmd.line == "ATE0"; });
+    for (auto it = start.base(); it != commands.end(); ++it) {
+      REQUIRE(it->at - (it - 1)->at >= std::chrono::milliseconds(UBLOX_COMMAND_DELAY));
+    }
+  }
+
+  SECTION("added drivers take precedence") {
+    static const ModemDriver custom = {"custom", "quectel", "EG25", createCustomModem};
+    REQUIRE(ModemRegistry::add(&custom));
+
+    auto commands = identifyAs("Quectel", "EG25-G", &driver);
+    REQUIRE(driver == "custom");
+    REQUIRE(contains(commands, "AT+CMEE=2"));
+
+    identifyAs("Quectel", "BG96", &driver);
+    REQUIRE(driver == "quectel");
+  }
+}
+
+TEST_CASE("CMUX frames match TS 27.010 and decode back", "[cmux]") {
+  uint8_t frame[CMUX_MAX_FRAME_SIZE + CMUX_FRAME_OVERHEAD];
+
+  // SABM and UA on the control channel as found in the specification examples
+  REQUIRE(Cmux::encodeFrame(0, CMUX_SABM | CMUX_PF, true, nullptr, 0, frame) == 6);
+  REQUIRE(std::vector<uint8_t>(frame, frame + 6) == std::vector<uint8_t>{0xF9, 0x03, 0x3F, 0x01, 0x1C, 0xF9});
+  REQUIRE(Cmux::encodeFrame(0, CMUX_UA | CMUX_PF, true, nullptr, 0, frame) == 6);
+  REQUIRE(frame[4] == 0xD7);
+
+  std::string payload(300, 'x');
+  unsigned long int len = Cmux::encodeFrame(3, CMUX_UIH, true, (const uint8_t*)payload.data(), payload.size(), frame);
+  REQUIRE(len == payload.size() + CMUX_FRAME_OVERHEAD);
+
+  CmuxDecoder decoder;
+  CmuxFrame decoded;
+  int frames = 0;
+
+  // Garbage and a corrupted copy first, the decoder must resynchronise on the intact one
+  std::vector<uint8_t> stream = {0x00, 0x41, 0xF9, 0x12};
+  stream.insert(stream.end(), frame, frame + len);
+  stream[stream.size() - 10] ^= 0xFF;
+  stream[stream.size() - 2] ^= 0xFF;
+  stream.insert(stream.end(), frame, frame + len);
+
+  for (uint8_t byte : stream) {
+    if (decoder.feed(byte, &decoded)) {
+      frames++;
+      REQUIRE(decoded.dlci == 3);
+      REQUIRE(decoded.control == CMUX_UIH);
+      REQUIRE(std::string((const char*)decoded.data, decoded.len) == payload);
+    }
+  }
+  REQUIRE(frames == 1);
+}
+
+// Modem side of a multiplexed link: answers AT+CMUX, opens whatever DLC is asked for, runs AT commands on DLC 1 and
+// echoes anything received on DLC 2
+class CmuxPeer {
+ public:
+  CmuxPeer(PtyPair& pty) : _pty(pty), _thread([this] { run(); }) {
+  }
+
+  ~CmuxPeer() {
+    _done = true;
+    _thread.join();
+  }
+
+  std::vector<std::string> commands;
+  std::atomic<bool> closed{false};
+
+ private:
+  void send(uint8_t dlci, uint8_t control, const std::string& data) {
+    uint8_t frame[CMUX_MAX_FRAME_SIZE + CMUX_FRAME_OVERHEAD];
+    unsigned long int len =
+        Cmux::encodeFrame(dlci, control, false, (const uint8_t*)data.data(), data.size(), frame);
+    _pty.write(std::string((const char*)frame, len));
+  }
+
+  void run() {
+    std::string pending;
+    while (!_done && pending.find("AT+CMUX=0,0,,127\r") == std::string::npos) {
+      pending += _pty.read(10);
+    }
+    _pty.write("\r\nOK\r\n");
+
+    CmuxDecoder decoder;
+    CmuxFrame frame;
+    std::string line;
+    while (!_done) {
+      for (char c : _pty.read(10)) {
+        if (!decoder.feed((uint8_t)c, &frame)) {
+          continue;
+        }
+
+        std::string data((const char*)frame.data, frame.len);
+        switch (frame.control & ~CMUX_PF) {
+          case CMUX_SABM:
+          case CMUX_DISC:
+            send(frame.dlci, CMUX_UA | CMUX_PF, "");
+            break;
+          case CMUX_UIH:
+            if (frame.dlci == 0) {
+              // Acknowledge MSC and CLD with their responses
+              data[0] &= ~CMUX_MSG_CR;
+              send(0, CMUX_UIH, data);
+              closed = closed || ((uint8_t)data[0] == CMUX_MSG_CLD);
+            } else if (frame.dlci == 1) {
+              for (char c : data) {
+                if (c != '\n') {
+                  line += c;
+                }
+              }
+              size_t end;
+              while ((end = line.find('\r')) != std::string::npos) {
+                commands.push_back(line.substr(0, end));
+                line.erase(0, end + 1);
+                send(1, CMUX_UIH,
+                     commands.back().compare(0, 8, "AT+CSIM=") == 0 ? "\r\n+CSIM: 4,\"9000\"\r\n\r\nOK\r\n"
+                                                                     : "\r\nOK\r\n");
+              }
+            } else {
+              send(frame.dlci, CMUX_UIH, data);
+            }
+            break;
+        }
+      }
+    }
+  }
+
+  PtyPair& _pty;
+  std::atomic<bool> _done{false};
+  std::thread _thread;
+};
+
+TEST_CASE("CMUX carries AT+CSIM on one DLC and data on another", "[cmux]") {
+  PtyPair pty;
+  REQUIRE(!pty.slave.empty());
+
+  CmuxPeer peer(pty);
+  Cmux mux(new LSerial(pty.slave.c_str()));
+  REQUIRE(mux.start());
+
+  char name[64];
+  REQUIRE(mux.exposeChannel(2, name, sizeof(name)));
+
+  GenericModem modem(new CmuxChannel(&mux, 1));
+  REQUIRE(modem.open());
+
+  REQUIRE(modem.transmit(0x00, 0x70, 0x00, 0x00, 0x01));
+  REQUIRE(modem.getStatusWord() == 0x9000);
+
+  // The data port is a plain pseudo-terminal, whatever goes in comes back through the peer
+  int data = open(name, O_RDWR | O_NOCTTY);
+  REQUIRE(data >= 0);
+  std::string sent(1000, 'p');
+  REQUIRE(write(data, sent.data(), sent.size()) == (ssize_t)sent.size());
+
+  std::string echoed;
+  struct pollfd pfd = {data, POLLIN, 0};
+  char buf[256];
+  while (echoed.size() < sent.size() && poll(&pfd, 1, 2000) > 0) {
+    ssize_t r = read(data, buf, sizeof(buf));
+    if (r <= 0) {
+      break;
+    }
+    echoed.append(buf, r);
+  }
+  close(data);
+  REQUIRE(echoed == sent);
+
+  modem.close();
+  mux.stop();
+  REQUIRE(peer.closed);
+  REQUIRE(peer.commands.front() == "ATE0");
+  REQUIRE(peer.commands.back() == "AT+CSIM=10,\"0070000001\"");
+}
+
+// QMI modem stand-in on the other end of a socket pair: hands out a UIM client, opens channel 2 for the known AID only
+// and answers every APDU with AB 90 00. Indications and stale responses are thrown in to check the demultiplexing.
+class FakeQmiModem {
+ public:
+  FakeQmiModem(int fd) : _fd(fd), _thread([this] { run(); }) {
+  }
+
+  ~FakeQmiModem() {
+    _thread.join();
+    close(_fd);
+  }
+
+  struct Apdu {
+    std::vector<uint8_t> bytes;
+    int channel;
+  };
+
+  std::vector<Apdu> apdus;
+  std::vector<int> closedChannels;
+  bool released = false;
+  // Handed out to OPEN LOGICAL CHANNEL
+  uint8_t channel = 2;
+
+ private:
+  void send(uint8_t service, uint8_t client, uint8_t flags, uint16_t transaction, uint16_t message,
+            const std::vector<uint8_t>& tlvs, bool split = false) {
+    QmiMessage msg = {service, client, flags, transaction, message, tlvs.data(), (uint16_t)tlvs.size()};
+    uint8_t out[QMI_MAX_MESSAGE_LEN];
+    unsigned long int len = QmiSEInterface::encodeMessage(&msg, out);
+
+    if (split) {
+      ::write(_fd, out, 5);
+      std::this_thread::sleep_for(std::chrono::milliseconds(5));
+      ::write(_fd, out + 5, len - 5);
+    } else {
+      ::write(_fd, out, len);
+    }
+  }
+
+  static std::vector<uint8_t> tlv(uint8_t type, const std::vector<uint8_t>& value) {
+    std::vector<uint8_t> out(3 + value.size());
+    QmiSEInterface::putTlv(out.data(), type, value.data(), (uint16_t)value.size());
+    return out;
+  }
+
+  static std::vector<uint8_t> result(uint16_t error = 0) {
+    return tlv(QMI_TLV_RESULT, {(uint8_t)(error ? 1 : 0), 0, (uint8_t)(error & 0xFF), (uint8_t)(error >> 8)});
+  }
+
+  void run() {
+    uint8_t buf[QMI_MAX_MESSAGE_LEN];
+    std::vector<uint8_t> pending;
+    QmiMessage req;
+    const uint8_t* value;
+    uint16_t len;
+    long int n;
+    ssize_t r;
+
+    while ((r = read(_fd, buf, sizeof(buf))) > 0) {
+      pending.insert(pending.end(), buf, buf + r);
+
+      while ((n = QmiSEInterface::decodeMessage(pending.data(), pending.size(), &req)) > 0) {
+        std::vector<uint8_t> tlvs = result();
+
+        if (req.service == QMI_SERVICE_CTL && req.message == QMI_CTL_GET_CLIENT_ID) {
+          send(QMI_SERVICE_CTL, 0, QMI_CTL_FLAG_INDICATION, 0, 0x0024, {});
+          auto client = tlv(0x01, {QMI_SERVICE_UIM, 7});
+          tlvs.insert(tlvs.end(), client.begin(), client.end());
+          send(QMI_SERVICE_CTL, 0, QMI_CTL_FLAG_RESPONSE, req.transaction, req.message, tlvs);
+        } else if (req.service == QMI_SERVICE_CTL && req.message == QMI_CTL_RELEASE_CLIENT_ID) {
+          released = true;
+          send(QMI_SERVICE_CTL, 0, QMI_CTL_FLAG_RESPONSE, req.transaction, req.message, tlvs);
+        } else if (req.message == QMI_UIM_OPEN_LOGICAL_CHANNEL) {
+          if (QmiSEInterface::findTlv(&req, 0x10, &value, &len) &&
+              std::vector<uint8_t>(value, value + len) == std::vector<uint8_t>{3, 0xA0, 0x00, 0x01}) {
+            auto opened = tlv(0x10, {channel});
+            tlvs.insert(tlvs.end(), opened.begin(), opened.end());
+          } else {
+            tlvs = result(0x0010);
+          }
+          // A late answer to some earlier request comes first
+          send(QMI_SERVICE_UIM, 7, QMI_FLAG_RESPONSE, req.transaction - 1, req.message, result());
+          send(QMI_SERVICE_UIM, 7, QMI_FLAG_RESPONSE, req.transaction, req.message, tlvs);
+        } else if (req.message == QMI_UIM_LOGICAL_CHANNEL) {
+          closedChannels.push_back(QmiSEInterface::findTlv(&req, 0x11, &value, &len) ? value[0] : -1);
+          send(QMI_SERVICE_UIM, 7, QMI_FLAG_RESPONSE, req.transaction, req.message, tlvs);
+        } else if (req.message == QMI_UIM_SEND_APDU) {
+          Apdu apdu = {{}, -1};
+          if (req.client == 7 && QmiSEInterface::findTlv(&req, 0x02, &value, &len)) {
+            apdu.bytes.assign(value + 2, value + len);
+          }
+          if (QmiSEInterface::findTlv(&req, 0x10, &value, &len)) {
+            apdu.channel = value[0];
+          }
+          apdus.push_back(apdu);
+
+          auto response = tlv(0x10, {3, 0, 0xAB, 0x90, 0x00});
+          tlvs.insert(tlvs.end(), response.begin(), response.end());
+          send(QMI_SERVICE_UIM, 7, QMI_FLAG_INDICATION, 0, 0x0032, {});
+          send(QMI_SERVICE_UIM, 7, QMI_FLAG_RESPONSE, req.transaction, req.message, tlvs, true);
+        }
+
+        pending.erase(pending.begin(), pending.begin() + n);
+      }
+    }
+  }
+
+  int _fd;
+  std::thread _thread;
+};
+
+TEST_CASE("QmiSEInterface talks UIM over QMUX", "[qmi]") {
+  int fds[2];
+  REQUIRE(socketpair(AF_UNIX, SOCK_STREAM, 0, fds) == 0);
+
+  FakeQmiModem modem(fds[1]);
+  {
+    QmiSEInterface qmi(fds[0]);
+    REQUIRE(qmi.open());
+
+    SECTION("basic channel") {
+      REQUIRE(qmi.transmit(0x00, 0xCA, 0x00, 0x00, 0x01));
+      REQUIRE(qmi.getStatusWord() == 0x9000);
+      REQUIRE(modem.apdus.back().bytes == std::vector<uint8_t>{0x00, 0xCA, 0x00, 0x00, 0x01});
+      REQUIRE(modem.apdus.back().channel == -1);
+    }
+
+    SECTION("logical channel opened by the modem") {
+      uint8_t aid[] = {0xA0, 0x00, 0x01};
+      Applet applet(aid, sizeof(aid));
+      applet.init(&qmi);
+      REQUIRE(applet.select(false));
+      REQUIRE(applet.transmit(0x80, static_cast<SCIns>(0xCA), static_cast<SCP1>(0x00), static_cast<SCP2>(0x00), 0x01));
+      REQUIRE(applet.getResponseLength() == 1);
+      REQUIRE(applet.deselect());
+
+      REQUIRE(modem.apdus.size() == 1);
+      REQUIRE(modem.apdus.back().bytes == std::vector<uint8_t>{0x82, 0xCA, 0x00, 0x00, 0x01});
+      REQUIRE(modem.apdus.back().channel == 2);
+      REQUIRE(modem.closedChannels == std::vector<int>{2});
+    }
+
+    SECTION("logical channel past 3") {
+      uint8_t aid[] = {0xA0, 0x00, 0x01};
+      Applet applet(aid, sizeof(aid));
+      applet.init(&qmi);
+      modem.channel = 9;
+      REQUIRE(applet.select(false));
+      REQUIRE(applet.transmit(0x80, static_cast<SCIns>(0xCA), static_cast<SCP1>(0x00), static_cast<SCP2>(0x00), 0x01));
+      REQUIRE(applet.deselect());
+
+      // Further interindustry class, 9 - 4 in its low bits
+      REQUIRE(modem.apdus.back().bytes == std::vector<uint8_t>{0xC5, 0xCA, 0x00, 0x00, 0x01});
+      REQUIRE(modem.apdus.back().channel == 9);
+      REQUIRE(modem.closedChannels == std::vector<int>{9});
+    }
+
+    SECTION("unknown applet") {
+      uint8_t channel;
+      uint8_t aid[] = {0xA0, 0x00, 0x02};
+      REQUIRE_FALSE(qmi.openLogicalChannel(aid, sizeof(aid), &channel));
+      REQUIRE(qmi.getLastError() == 0x0010);
+    }
+
+    qmi.close();
+  }
+  REQUIRE(modem.released);
+}
+
+TEST_CASE("CcidSEInterface parses reader device strings", "[ccid]") {
+  uint16_t vendor;
+  uint16_t product;
+  const char* serial;
+
+  REQUIRE(CcidSEInterface::parseDevice("076b:3021", &vendor, &product, &serial));
+  REQUIRE(vendor == 0x076B);
+  REQUIRE(product == 0x3021);
+  REQUIRE(serial == nullptr);
+
+  REQUIRE(CcidSEInterface::parseDevice("08E6:3437:ABC123", &vendor, &product, &serial));
+  REQUIRE(product == 0x3437);
+  REQUIRE(std::string(serial) == "ABC123");
+
+  REQUIRE_FALSE(CcidSEInterface::parseDevice("076b", &vendor, &product, &serial));
+  REQUIRE_FALSE(CcidSEInterface::parseDevice("076b:", &vendor, &product, &serial));
+  REQUIRE_FALSE(CcidSEInterface::parseDevice("10000:3021", &vendor, &product, &serial));
+  REQUIRE_FALSE(CcidSEInterface::parseDevice("076b:30x1", &vendor, &product, &serial));
+}
+
+// CCID reader with a card behind it, answering in software. The card echoes the data of INS DA and returns P2 bytes
+// for INS CA. Depending on the exchange level, the reader expects T=0 TPDUs, T=1 blocks or whole APDUs.
+class SoftCcidReader : public CcidTransport {
+ public:
+  SoftCcidReader(uint32_t features, const std::vector<uint8_t>& atr) : _features(features), _atr(atr) {
+  }
+
+  bool open() override {
+    opened = true;
+    return true;
+  }
+
+  void close() override {
+    opened = false;
+  }
+
+  uint32_t getFeatures() override {
+    return _features;
+  }
+
+  bool write(const uint8_t* data, unsigned long int len) override {
+    std::vector<uint8_t> payload(data + CCID_HEADER_LEN, data + len);
+    uint8_t sequence = data[6];
+
+    if ((len < CCID_HEADER_LEN) || (len - CCID_HEADER_LEN != (unsigned long int)(data[1] | (data[2] << 8)))) {
+      return false;
+    }
+
+    switch (data[0]) {
+      case CCID_PC_TO_RDR_ICC_POWER_ON:
+        powered = true;
+        reply(CCID_RDR_TO_PC_DATA_BLOCK, sequence, _atr);
+        break;
+      case CCID_PC_TO_RDR_ICC_POWER_OFF:
+        powered = false;
+        reply(CCID_RDR_TO_PC_SLOT_STATUS, sequence, {});
+        break;
+      case CCID_PC_TO_RDR_SET_PARAMETERS:
+        protocol   = data[7];
+        parameters = payload;
+        reply(CCID_RDR_TO_PC_PARAMETERS, sequence, payload);
+        break;
+      case CCID_PC_TO_RDR_XFR_BLOCK:
+        waitingTimes.push_back(data[7]);
+        if (timeExtension) {
+          timeExtension = false;
+          reply(CCID_RDR_TO_PC_DATA_BLOCK, sequence, {}, CCID_STATUS_TIME_EXTENSION);
+        }
+        if (stale) {
+          stale = false;
+          reply(CCID_RDR_TO_PC_DATA_BLOCK, sequence - 1, {0x90, 0x00});
+        }
+        if ((_features & CCID_FEATURE_LEVEL_MASK) != CCID_FEATURE_LEVEL_TPDU) {
+          commands.push_back(payload);
+          reply(CCID_RDR_TO_PC_DATA_BLOCK, sequence, card(payload));
+        } else if (_atr[1] & 0x80) {
+          reply(CCID_RDR_TO_PC_DATA_BLOCK, sequence, t1(payload));
+        } else {
+          reply(CCID_RDR_TO_PC_DATA_BLOCK, sequence, t0(payload));
+        }
+        break;
+      default:
+        return false;
+    }
+    return true;
+  }
+
+  bool read(uint8_t* data, unsigned long int size, unsigned long int* len, int timeout) override {
+    if (_out.empty() || (_out.front().size() > size)) {
+      return false;
+    }
+    std::copy(_out.front().begin(), _out.front().end(), data);
+    *len = _out.front().size();
+    _out.erase(_out.begin());
+    return true;
+  }
+
+  bool opened  = false;
+  bool powered = false;
+  int protocol = -1;
+  std::vector<uint8_t> parameters;
+  std::vector<uint8_t> waitingTimes;
+  // APDUs, TPDUs or the information fields of the I-blocks the card received
+  std::vector<std::vector<uint8_t>> commands;
+  std::vector<uint8_t> rBlocks;
+  int ifsd = T1_DEFAULT_IFS;
+
+  // Faults to inject on the next exchange
+  bool timeExtension = false;
+  bool stale         = false;
+  bool wtx           = false;
+  bool corrupt       = false;
+  // Largest information field the card sends
+  unsigned long int cardChunk = T1_MAX_IFS;
+
+ private:
+  void reply(uint8_t type, uint8_t sequence, const std::vector<uint8_t>& data, uint8_t status = 0) {
+    std::vector<uint8_t> msg = {type, (uint8_t)data.size(), 0, 0, 0, 0, sequence, status, 0, 0};
+    msg.insert(msg.end(), data.begin(), data.end());
+    _out.push_back(msg);
+  }
+
+  static std::vector<uint8_t> card(const std::vector<uint8_t>& apdu) {
+    std::vector<uint8_t> response;
+
+    if ((apdu[1] == 0xCA) && (apdu.size() >= 4)) {
+      for (uint8_t i = 0; i < apdu[3]; i++) {
+        response.push_back(i);
+      }
+    } else if ((apdu[1] == 0xDA) && (apdu.size() > 5)) {
+      response.assign(apdu.begin() + 5, apdu.begin() + 5 + apdu[4]);
+    }
+    response.push_back(0x90);
+    response.push_back(0x00);
+    return response;
+  }
+
+  std::vector<uint8_t> t0(const std::vector<uint8_t>& tpdu) {
+    std::vector<uint8_t> response;
+
+    commands.push_back(tpdu);
+    if (tpdu.size() < 5) {
+      return {0x67, 0x00};
+    }
+
+    // Outgoing data of a case 4 command waits for GET RESPONSE
+    if (tpdu[1] == 0xC0) {
+      response = _pending;
+      response.resize(std::min<size_t>(response.size(), tpdu[4]));
+      response.push_back(0x90);
+      response.push_back(0x00);
+      return response;
+    }
+    if (tpdu[1] == 0xDA) {
+      _pending = card(tpdu);
+      _pending.resize(_pending.size() - 2);
+      return {0x61, (uint8_t)_pending.size()};
+    }
+    return card(tpdu);
+  }
+
+  static std::vector<uint8_t> block(uint8_t pcb, const std::vector<uint8_t>& inf) {
+    std::vector<uint8_t> out = {0x00, pcb, (uint8_t)inf.size()};
+    uint8_t lrc              = 0;
+
+    out.insert(out.end(), inf.begin(), inf.end());
+    for (uint8_t b : out) {
+      lrc ^= b;
+    }
+    out.push_back(lrc);
+    return out;
+  }
+
+  std::vector<uint8_t> nextBlock() {
+    unsigned long int n = std::min<unsigned long int>({_response.size() - _sent, (unsigned long int)ifsd, cardChunk});
+    bool more           = _sent + n < _response.size();
+    std::vector<uint8_t> out;
+
+    out = block((_ns ? T1_PCB_I_NS : 0) | (more ? T1_PCB_I_MORE : 0),
+                std::vector<uint8_t>(_response.begin() + _sent, _response.begin() + _sent + n));
+    _ns ^= 1;
+    _sent += n;
+    _last = out;
+
+    if (corrupt) {
+      corrupt = false;
+      out.back() ^= 0xFF;
+    }
+    return out;
+  }
+
+  std::vector<uint8_t> t1(const std::vector<uint8_t>& in) {
+    std::vector<uint8_t> inf(in.begin() + T1_PROLOGUE_LEN, in.end() - 1);
+    uint8_t pcb = in[1];
+
+    if ((pcb & T1_PCB_R) == 0) {
+      commands.push_back(inf);
+      _command.insert(_command.end(), inf.begin(), inf.end());
+      _nr ^= 1;
+      if (pcb & T1_PCB_I_MORE) {
+        return block(T1_PCB_R | (_nr ? T1_PCB_R_NR : 0), {});
+      }
+
+      _response = card(_command);
+      _command.clear();
+      _sent = 0;
+      if (wtx) {
+        wtx = false;
+        return block(T1_PCB_S | T1_S_WTX, {2});
+      }
+      return nextBlock();
+    }
+
+    if ((pcb & T1_PCB_S) == T1_PCB_R) {
+      rBlocks.push_back(pcb);
+      return (pcb & 0x0F) ? _last : nextBlock();
+    }
+
+    if (pcb == (T1_PCB_S | T1_S_IFS)) {
+      ifsd = inf[0];
+      return block(T1_PCB_S | T1_PCB_S_RESPONSE | T1_S_IFS, inf);
+    }
+    if (pcb == (T1_PCB_S | T1_PCB_S_RESPONSE | T1_S_WTX)) {
+      return nextBlock();
+    }
+    return block(T1_PCB_S | T1_S_ABORT, {});
+  }
+
+  uint32_t _features;
+  std::vector<uint8_t> _atr;
+  std::vector<std::vector<uint8_t>> _out;
+  std::vector<uint8_t> _pending;
+
+  // T=1 card state
+  std::vector<uint8_t> _command;
+  std::vector<uint8_t> _response;
+  std::vector<uint8_t> _last;
+  unsigned long int _sent = 0;
+  uint8_t _ns             = 0;
+  uint8_t _nr             = 0;
+};
+
+TEST_CASE("CcidSEInterface drives a T=0 card through a TPDU reader", "[ccid]") {
+  SoftCcidReader* reader = new SoftCcidReader(CCID_FEATURE_LEVEL_TPDU, {0x3B, 0x02, 0x14, 0x50});
+  CcidSEInterface ccid(reader);
+  uint8_t data[] = {0x01, 0x02, 0x03};
+  uint8_t response[sizeof(data)];
+
+  REQUIRE(ccid.open());
+  REQUIRE(ccid.getProtocol() == 0);
+  REQUIRE(reader->powered);
+  REQUIRE(reader->protocol == 0);
+  REQUIRE(reader->parameters.size() == 5);
+
+  // Case 1 gets P3, case 4 loses Le and its data comes with GET RESPONSE
+  reader->timeExtension = true;
+  reader->stale         = true;
+  REQUIRE(ccid.transmit(0x00, 0x70, 0x00, 0x00));
+  REQUIRE(ccid.getStatusWord() == 0x9000);
+  REQUIRE(reader->commands.back() == std::vector<uint8_t>{0x00, 0x70, 0x00, 0x00, 0x00});
+
+  REQUIRE(ccid.transmit(0x00, 0xDA, 0x00, 0x00, data, sizeof(data), 0x00));
+  REQUIRE(ccid.getStatusWord() == 0x9000);
+  REQUIRE(ccid.getResponse(response) == sizeof(data));
+  REQUIRE(std::equal(data, data + sizeof(data), response));
+  REQUIRE(reader->commands.size() == 3);
+  REQUIRE(reader->commands[1] == std::vector<uint8_t>{0x00, 0xDA, 0x00, 0x00, 0x03, 0x01, 0x02, 0x03});
+  REQUIRE(reader->commands[2] == std::vector<uint8_t>{0x00, 0xC0, 0x00, 0x00, 0x03});
+
+  ccid.close();
+  REQUIRE_FALSE(reader->powered);
+  REQUIRE_FALSE(reader->opened);
+}
+
+TEST_CASE("CcidSEInterface runs T=1 blocks for a TPDU reader", "[ccid]") {
+  // T=1 only, IFSC 16, BWI 4, CWI 5
+  SoftCcidReader* reader =
+      new SoftCcidReader(CCID_FEATURE_LEVEL_TPDU, {0x3B, 0x80, 0x81, 0x31, 0x10, 0x45, 0x00});
+  CcidSEInterface ccid(reader);
+  std::vector<uint8_t> data(40);
+  std::vector<uint8_t> response(data.size());
+
+  for (size_t i = 0; i < data.size(); i++) {
+    data[i] = (uint8_t)(0x80 + i);
+  }
+
+  REQUIRE(ccid.open());
+  REQUIRE(ccid.getProtocol() == 1);
+  REQUIRE(reader->protocol == 1);
+  REQUIRE(reader->parameters == std::vector<uint8_t>{0x11, 0x10, 0x00, 0x45, 0x00, 0x10, 0x00});
+  REQUIRE(reader->ifsd == T1_MAX_IFS);
+
+  SECTION("chaining both ways") {
+    reader->cardChunk = 20;
+    REQUIRE(ccid.transmit(0x00, 0xDA, 0x00, 0x00, data.data(), (uint16_t)data.size(), 0x00));
+    REQUIRE(ccid.getStatusWord() == 0x9000);
+    REQUIRE(ccid.getResponse(response.data()) == data.size());
+    REQUIRE(response == data);
+
+    // 46 bytes of APDU in blocks of at most IFSC, 42 bytes of response acknowledged twice
+    REQUIRE(reader->commands.size() == 3);
+    REQUIRE(reader->commands[0].size() == 16);
+    REQUIRE(reader->commands[2].size() == 14);
+    REQUIRE(reader->rBlocks == std::vector<uint8_t>{T1_PCB_R | T1_PCB_R_NR, T1_PCB_R});
+  }
+
+  SECTION("waiting time extension and a corrupted block") {
+    reader->wtx     = true;
+    reader->corrupt = true;
+    REQUIRE(ccid.transmit(0x00, 0xCA, 0x00, 0x08, 0x08));
+    REQUIRE(ccid.getStatusWord() == 0x9000);
+    REQUIRE(ccid.getResponseLength() == 8);
+    REQUIRE(std::find(reader->waitingTimes.begin(), reader->waitingTimes.end(), 2) != reader->waitingTimes.end());
+    REQUIRE(reader->rBlocks.size() == 1);
+    REQUIRE((reader->rBlocks[0] & 0x0F) != 0);
+
+    // Sequence numbers keep in step for the next command
+    REQUIRE(ccid.transmit(0x00, 0xCA, 0x00, 0x02, 0x02));
+    REQUIRE(ccid.getResponseLength() == 2);
+  }
+
+  ccid.close();
+}
+
+TEST_CASE("CcidSEInterface hands whole APDUs to an APDU reader", "[ccid]") {
+  SoftCcidReader* reader =
+      new SoftCcidReader(CCID_FEATURE_LEVEL_SHORT_APDU, {0x3B, 0x80, 0x81, 0x31, 0x10, 0x45, 0x00});
+  CcidSEInterface ccid(reader);
+  uint8_t data[] = {0x01, 0x02};
+
+  REQUIRE(ccid.open());
+  REQUIRE(reader->protocol == -1);
+
+  REQUIRE(ccid.transmit(0x00, 0xDA, 0x00, 0x00, data, sizeof(data), 0x00));
+  REQUIRE(ccid.getResponseLength() == sizeof(data));
+  REQUIRE(reader->commands.back() == std::vector<uint8_t>{0x00, 0xDA, 0x00, 0x00, 0x02, 0x01, 0x02, 0x00});
+
+  ccid.close();
+}
+
+// SIM behind a fake transport for the discovery tests. Devices read fake:<open delay ms>:<mias>:<last ICCID digit>,
+// a negative delay fails to open.
+class FakeSim : public SEInterface {
+ public:
+  FakeSim(const char* device) {
+    sscanf(device, "fake:%d:%d:%d", &_delay, &_mias, &_digit);
+  }
+
+  bool open() override {
+    opened++;
+    std::this_thread::sleep_for(std::chrono::milliseconds(std::abs(_delay)));
+    return _delay >= 0;
+  }
+
+  void close() override {
+  }
+
+  static std::atomic<int> opened;
+
+ protected:
+  bool transmitApdu(uint8_t* apdu, uint16_t apduLen, uint8_t* response, uint16_t* responseLen) override {
+    std::vector<uint8_t> r = {0x6D, 0x00};
+
+    if ((apdu[1] == 0x70) && (apdu[2] == 0x00)) {
+      r = {0x01, 0x90, 0x00};
+    } else if ((apdu[1] == 0x70) || ((apdu[1] == 0xA4) && (apdu[2] == 0x08))) {
+      r = {0x90, 0x00};
+    } else if ((apdu[1] == 0xA4) && (apdu[2] == 0x04)) {
+      r = _mias ? std::vector<uint8_t>{0x90, 0x00} : std::vector<uint8_t>{0x6A, 0x82};
+    } else if (apdu[1] == 0xB0) {
+      r = {0x98, 0x10, 0x32, 0x54, 0x76, 0x98, 0x10, 0x32, 0x54, (uint8_t)(0xF0 | _digit), 0x90, 0x00};
+    }
+
+    std::copy(r.begin(), r.end(), response);
+    *responseLen = (uint16_t)r.size();
+    return true;
+  }
+
+ private:
+  int _delay = 0;
+  int _mias  = 0;
+  int _digit = 0;
+};
+
+std::atomic<int> FakeSim::opened(0);
+
+static SEInterface* createFakeSim(const char* device) {
+  return new FakeSim(device);
+}
+
+TEST_CASE("TobDiscovery probes every candidate at once and remembers the winner", "[discovery]") {
+  char cache[] = "/tmp/tob-discovery-XXXXXX";
+  REQUIRE(mkdtemp(cache) != nullptr);
+  std::string path = std::string(cache) + "/trust_onboard/device";
+
+  {
+    TobDiscovery discovery(path.c_str(), createFakeSim);
+    discovery.addCandidate("fake:-300:0:0", "usb:1-1:1.0");
+    discovery.addCandidate("fake:100:0:0", "usb:1-1:1.1");
+    discovery.addCandidate("fake:300:1:5", "usb:1-1:1.2");
+    discovery.addCandidate("fake:300:1:6", "usb:1-1:1.3");
+
+    FakeSim::opened = 0;
+    auto start      = std::chrono::steady_clock::now();
+    SEInterface* se = discovery.discover();
+    auto elapsed    = std::chrono::steady_clock::now() - start;
+    REQUIRE(se != nullptr);
+    delete se;
+
+    // All of them in parallel, one of the two SIMs wins
+    REQUIRE(FakeSim::opened == 4);
+    REQUIRE(elapsed < std::chrono::milliseconds(1000));
+    REQUIRE_FALSE(discovery.isCached());
+    REQUIRE(std::string(discovery.getIccid()).substr(0, 18) == "890123456789012345");
+  }
+
+  SECTION("the next run goes straight to the remembered device") {
+    std::string winner;
+    {
+      TobDiscovery discovery(path.c_str(), createFakeSim);
+      FILE* file = fopen(path.c_str(), "r");
+      char line[256];
+      REQUIRE(file != nullptr);
+      REQUIRE(fgets(line, sizeof(line), file) != nullptr);
+      fclose(file);
+      winner = line;
+    }
+
+    // Ports enumerated in another order, the key still finds the SIM
+    bool first = winner.find("1.2\t") != std::string::npos;
+    TobDiscovery discovery(path.c_str(), createFakeSim);
+    discovery.addCandidate("fake:-300:0:0", "usb:1-1:1.0");
+    discovery.addCandidate("fake:0:1:6:ttyACM0", "usb:1-1:1.3");
+    discovery.addCandidate("fake:0:1:5:ttyACM1", "usb:1-1:1.2");
+
+    FakeSim::opened = 0;
+    SEInterface* se = discovery.discover();
+    REQUIRE(se != nullptr);
+    delete se;
+    REQUIRE(discovery.isCached());
+    REQUIRE(FakeSim::opened == 1);
+    REQUIRE(std::string(discovery.getDevice()) == (first ? "fake:0:1:5:ttyACM1" : "fake:0:1:6:ttyACM0"));
+  }
+
+  SECTION("another SIM behind the remembered port means a full probe") {
+    TobDiscovery discovery(path.c_str(), createFakeSim);
+    discovery.addCandidate("fake:0:1:7", "usb:1-1:1.2");
+    discovery.addCandidate("fake:0:1:7", "usb:1-1:1.3");
+
+    FakeSim::opened = 0;
+    SEInterface* se = discovery.discover();
+    REQUIRE(se != nullptr);
+    delete se;
+    REQUIRE_FALSE(discovery.isCached());
+    REQUIRE(FakeSim::opened >= 2);
+    REQUIRE(std::string(discovery.getIccid()) == "8901234567890123457");
+  }
+
+  SECTION("no SIM anywhere") {
+    TobDiscovery discovery(path.c_str(), createFakeSim);
+    discovery.addCandidate("fake:-10:0:0");
+    discovery.addCandidate("fake:10:0:0");
+    REQUIRE(discovery.discover() == nullptr);
+  }
+
+  remove(path.c_str());
+  rmdir((std::string(cache) + "/trust_onboard").c_str());
+  rmdir(cache);
+}
+
+// Card on a link costing a millisecond per command and 10 us per byte, which refuses READ BINARY above 200 bytes
+// and PSO HASH above two blocks
+class CalibrationSim : public SEInterface {
+ public:
+  bool open() override {
+    return true;
+  }
+
+  void close() override {
+  }
+
+  uint8_t largestRead = 0;
+
+ protected:
+  bool transmitApdu(uint8_t* apdu, uint16_t apduLen, uint8_t* response, uint16_t* responseLen) override {
+    std::vector<uint8_t> r = {0x90, 0x00};
+
+    if ((apdu[1] == 0x70) && (apdu[2] == 0x00)) {
+      r = {0x01, 0x90, 0x00};
+    } else if ((apdu[1] == 0xA4) && (apdu[2] == 0x08)) {
+      r = {0x62, 0x04, 0x80, 0x02, 0x04, 0x00, 0x90, 0x00};
+    } else if (apdu[1] == 0xB0) {
+      if (apdu[4] > 200) {
+        r = {0x67, 0x00};
+      } else {
+        largestRead = std::max(largestRead, apdu[4]);
+        std::this_thread::sleep_for(std::chrono::microseconds(1000 + 10 * apdu[4]));
+        r.assign(apdu[4], 0x5A);
+        r.insert(r.end(), {0x90, 0x00});
+      }
+    } else if (apdu[1] == 0x22) {
+      _hashed.clear();
+    } else if ((apdu[1] == 0x2A) && (apdu[3] == 0x80)) {
+      if (apdu[4] > 128) {
+        r = {0x67, 0x00};
+      } else {
+        _hashed.insert(_hashed.end(), apdu + 5, apdu + 5 + apdu[4]);
+      }
+    } else if (apdu[1] == 0x2A) {
+      // Any digest of everything received will do
+      uint32_t h = 2166136261u;
+      for (uint8_t b : _hashed) {
+        h = (h ^ b) * 16777619u;
+      }
+      r = {(uint8_t)(h >> 24), (uint8_t)(h >> 16), (uint8_t)(h >> 8), (uint8_t)h, 0x90, 0x00};
+    }
+
+    std::copy(r.begin(), r.end(), response);
+    *responseLen = (uint16_t)r.size();
+    return true;
+  }
+
+ private:
+  std::vector<uint8_t> _hashed;
+};
+
+struct PoolLog {
+  std::mutex lock;
+  std::atomic<int> running{0};
+  int peak = 0;
+  std::vector<std::string> completed;
+};
+
+static int poolJob(SEInterface* seiface, MF* mf, MIAS* mias, const char* iccid, void* arg) {
+  PoolLog* log = (PoolLog*)arg;
+  int now      = ++log->running;
+
+  {
+    std::lock_guard<std::mutex> guard(log->lock);
+    log->peak = std::max(log->peak, now);
+  }
+  std::this_thread::sleep_for(std::chrono::milliseconds(150));
+  log->running--;
+
+  // Each card gets applets of its own, on its own interface
+  return (mias->select(false) && mias->deselect()) ? 0 : 1;
+}
+
+static void poolCompletion(const char* reader, const char* iccid, int result, void* arg) {
+  PoolLog* log = (PoolLog*)arg;
+  std::lock_guard<std::mutex> guard(log->lock);
+
+  log->completed.push_back(std::string(reader) + "=" + std::to_string(result));
+}
+
+TEST_CASE("TobReaderPool runs a job on every card at once and keeps the outcome by ICCID", "[pool]") {
+  PoolLog log;
+  TobReaderPool pool(poolJob, &log, createFakeSim);
+  pool.setCompletion(poolCompletion, &log);
+
+  auto start = std::chrono::steady_clock::now();
+  REQUIRE(pool.cardInserted("fake:50:1:1"));
+  REQUIRE(pool.cardInserted("fake:50:1:2"));
+  REQUIRE(pool.cardInserted("fake:50:0:3"));
+  REQUIRE(pool.cardInserted("fake:-50:1:4"));
+  REQUIRE(pool.cardInserted("fake:50:1:5"));
+
+  // A reader runs one card at a time
+  REQUIRE_FALSE(pool.cardInserted("fake:50:1:1"));
+  REQUIRE(pool.getBusyCount() == 5);
+
+  REQUIRE(pool.waitIdle(5000));
+  auto elapsed = std::chrono::steady_clock::now() - start;
+  REQUIRE(elapsed < std::chrono::milliseconds(4 * 200));
+  REQUIRE(log.peak >= 2);
+  REQUIRE(pool.getReaderCount() == 5);
+  REQUIRE(pool.getBusyCount() == 0);
+
+  std::map<std::string, TobPoolResult> results = pool.getResults();
+  REQUIRE(results.size() == 4);
+  REQUIRE(results["8901234567890123451"].reader == "fake:50:1:1");
+  REQUIRE(results["8901234567890123451"].result == 0);
+  REQUIRE(results["8901234567890123451"].elapsedMs >= 50);
+  REQUIRE(results["8901234567890123452"].result == 0);
+  REQUIRE(results["8901234567890123453"].result == 1);
+  REQUIRE(results["8901234567890123455"].result == 0);
+
+  // The card which could not be opened has no ICCID, its completion still runs
+  std::sort(log.completed.begin(), log.completed.end());
+  REQUIRE(log.completed == std::vector<std::string>{"fake:-50:1:4=-1", "fake:50:0:3=1", "fake:50:1:1=0",
+                                                    "fake:50:1:2=0", "fake:50:1:5=0"});
+
+  // Moved to another reader, the card runs again and its outcome replaces the first one
+  REQUIRE(pool.cardInserted("fake:0:1:1"));
+  REQUIRE(pool.waitIdle(5000));
+  REQUIRE(pool.getResults()["8901234567890123451"].reader == "fake:0:1:1");
+
+  pool.stop();
+  REQUIRE_FALSE(pool.cardInserted("fake:0:1:2"));
+}
+
+TEST_CASE("TobCalibration fits the link costs and tunes the chunk sizes", "[calibration]") {
+  char cache[] = "/tmp/tob-calibration-XXXXXX";
+  REQUIRE(mkdtemp(cache) != nullptr);
+  std::string path = std::string(cache) + "/trust_onboard/chunking";
+  CalibrationSim sim;
+
+  TobCalibration calibration(path.c_str());
+  REQUIRE(calibration.run(&sim, "0000"));
+
+  // Everything up to 192 bytes went through, 238 did not
+  REQUIRE(calibration.getProbeTime(4) >= 1000 + 10 * 192);
+  REQUIRE(calibration.getProbeTime(5) == 0);
+  REQUIRE(calibration.getCommandCost() > 500);
+  REQUIRE(calibration.getCommandCost() < 5000);
+  REQUIRE(calibration.getByteCost() > 5);
+  REQUIRE(calibration.getByteCost() < 20);
+  REQUIRE(calibration.getChunking().read_chunk == 192);
+  REQUIRE(calibration.getChunking().hash_chunk == 128);
+
+  // Readers take the tuned sizes from the interface
+  MF mf;
+  std::vector<uint8_t> data(1024);
+  uint16_t len;
+  mf.init(&sim);
+  sim.largestRead = 0;
+  REQUIRE(mf.select(false));
+  REQUIRE(mf.readCertificate(data.data(), &len));
+  REQUIRE(mf.deselect());
+  REQUIRE(len == 1024);
+  REQUIRE(sim.largestRead == 192);
+
+  SECTION("chunk sizes are remembered per device") {
+    se_chunking_t chunking;
+
+    REQUIRE(calibration.save("/dev/ttyACM0"));
+    REQUIRE(calibration.save("pcsc:0"));
+    REQUIRE(calibration.save("/dev/ttyACM0"));
+    REQUIRE(calibration.load("/dev/ttyACM0", &chunking));
+    REQUIRE(chunking.read_chunk == 192);
+    REQUIRE(chunking.hash_chunk == 128);
+    REQUIRE(calibration.load("pcsc:0", &chunking));
+    REQUIRE_FALSE(calibration.load("/dev/ttyACM", &chunking));
+
+    FILE* file = fopen(path.c_str(), "r");
+    char line[256];
+    int lines = 0;
+    REQUIRE(file != nullptr);
+    while (fgets(line, sizeof(line), file) != nullptr) {
+      lines++;
+    }
+    fclose(file);
+    REQUIRE(lines == 2);
+  }
+
+  remove(path.c_str());
+  rmdir((std::string(cache) + "/trust_onboard").c_str());
+  rmdir(cache);
+}
+
+struct AsyncResult {
+  int calls = 0;
+  bool ok   = false;
+  std::vector<uint8_t> response;
+};
+
+static void collectResponse(SEInterface* seiface, bool ok, const uint8_t* response, uint16_t responseLen, void* arg) {
+  AsyncResult* result = static_cast<AsyncResult*>(arg);
+  result->calls++;
+  result->ok = ok;
+  result->response.assign(response, response + responseLen);
+}
+
+TEST_CASE("GenericModem completes asynchronous APDUs from an epoll loop", "[async]") {
+  PtyPair pty;
+  REQUIRE(!pty.slave.empty());
+
+  // Slow SIM: READ BINARY answers 6104 after 100 ms, the data comes with GET RESPONSE in two writes
+  std::vector<std::string> commands;
+  std::atomic<bool> stop(false);
+  std::thread peer([&]() {
+    std::string pending;
+    while (!stop) {
+      pending += pty.read(10);
+
+      size_t end;
+      while ((end = pending.find("\r\n")) != std::string::npos) {
+        std::string line = pending.substr(0, end);
+        pending.erase(0, end + 2);
+        commands.push_back(line);
+        if (line.compare(0, 8, "AT+CSIM=") != 0) {
+          pty.write("\r\nOK\r\n");
+        } else if (line.find("\"00B0") != std::string::npos) {
+          std::this_thread::sleep_for(std::chrono::milliseconds(100));
+          pty.write("\r\n+CREG: 1\r\n\r\n+CSIM: 4,\"6104\"\r\n\r\nOK\r\n");
+        } else if (line.find("\"00C0") != std::string::npos) {
+          pty.write("\r\n+CSIM: 12,\"0102");
+          std::this_thread::sleep_for(std::chrono::milliseconds(20));
+          pty.write("03049000\"\r\n\r\nOK\r\n");
+        } else {
+          pty.write("\r\n+CME ERROR: 3\r\n");
+        }
+      }
+    }
+  });
+
+  GenericModem modem(pty.slave.c_str());
+  ModemProfile profile    = modem.getProfile();
+  profile.logicalChannels = false;
+  profile.urcs            = true;
+  modem.setProfile(profile);
+  REQUIRE(modem.open());
+  REQUIRE(modem.getPollFd() >= 0);
+  REQUIRE(modem.getPollTimeout() == -1);
+
+  int ep = epoll_create1(0);
+  REQUIRE(ep >= 0);
+  struct epoll_event ev = {};
+  ev.events             = EPOLLIN;
+  ev.data.fd            = modem.getPollFd();
+  REQUIRE(epoll_ctl(ep, EPOLL_CTL_ADD, modem.getPollFd(), &ev) == 0);
+
+  uint8_t readBinary[] = {0x00, 0xB0, 0x00, 0x00, 0x04};
+  uint8_t unknown[]    = {0x00, 0xEE, 0x00, 0x00};
+  AsyncResult first;
+  AsyncResult second;
+
+  auto start = std::chrono::steady_clock::now();
+  REQUIRE(modem.transmitAsync(readBinary, sizeof(readBinary), collectResponse, &first));
+  REQUIRE(modem.transmitAsync(unknown, sizeof(unknown), collectResponse, &second));
+  REQUIRE(std::chrono::steady_clock::now() - start < std::chrono::milliseconds(50));
+  REQUIRE(modem.getPendingCount() == 2);
+
+  // Blocking calls are refused while the port is busy
+  REQUIRE_FALSE(modem.transmit(0x00, 0xCA, 0x00, 0x00, 0x01));
+
+  // The loop keeps turning while the SIM works
+  int wakeups = 0;
+  while ((modem.getPendingCount() > 0) && (std::chrono::steady_clock::now() - start < std::chrono::seconds(5))) {
+    struct epoll_event events[1];
+    int timeout = modem.getPollTimeout();
+    epoll_wait(ep, events, 1, ((timeout < 0) || (timeout > 10)) ? 10 : timeout);
+    modem.processEvents();
+    wakeups++;
+  }
+  close(ep);
+
+  REQUIRE(wakeups > 5);
+  REQUIRE(first.calls == 1);
+  REQUIRE(first.ok);
+  REQUIRE(first.response == std::vector<uint8_t>{0x01, 0x02, 0x03, 0x04, 0x90, 0x00});
+  REQUIRE(second.calls == 1);
+  REQUIRE_FALSE(second.ok);
+
+  // Back to blocking use
+  REQUIRE(modem.transmit(0x00, 0xCA, 0x00, 0x00, 0x01) == false);
+  REQUIRE(modem.getATInterface().getLastErrorCode() == 3);
+
+  stop = true;
+  peer.join();
+  modem.close();
+
+  std::vector<std::string> apdus;
+  for (const std::string& c : commands) {
+    if (c.compare(0, 8, "AT+CSIM=") == 0) {
+      apdus.push_back(c);
+    }
+  }
+  REQUIRE(apdus == std::vector<std::string>{"AT+CSIM=10,\"00B0000004\"", "AT+CSIM=10,\"00C0000004\"",
+                                            "AT+CSIM=8,\"00EE0000\"", "AT+CSIM=10,\"00CA000001\""});
+}
+
+TEST_CASE("Transports without poll descriptor complete asynchronous APDUs right away", "[async]") {
+  uint8_t select[] = {0x00, 0xA4, 0x04, 0x00, 0x02, 0xA0, 0x00};
+  AsyncResult result;
+
+  FakeSim sim("fake:0:1:0");
+  REQUIRE(sim.getPollFd() == -1);
+
+  // Nothing to hand the response to, or too long for a short APDU
+  std::vector<uint8_t> tooLong(SE_SHORT_APDU_MAX_LEN + 1, 0x00);
+  REQUIRE_FALSE(sim.transmitAsync(select, sizeof(select), nullptr, nullptr));
+  REQUIRE_FALSE(sim.transmitAsync(tooLong.data(), (uint16_t)tooLong.size(), collectResponse, &result));
+  REQUIRE(sim.getPendingCount() == 0);
+
+  REQUIRE(sim.transmitAsync(select, sizeof(select), collectResponse, &result));
+  REQUIRE(result.calls == 0);
+  REQUIRE(sim.processEvents() == 1);
+  REQUIRE(result.ok);
+  REQUIRE(result.response == std::vector<uint8_t>{0x90, 0x00});
+  REQUIRE(sim.getPendingCount() == 0);
+}
+
+// Modem working through its input one command at a time, like a module queueing commands received while busy. Each
+// READ BINARY of its 600 byte file takes 20 ms.
+class PipelineModem {
+ public:
+  explicit PipelineModem(PtyPair& pty) : _pty(pty) {
+    for (int i = 0; i < 600; i++) {
+      file.push_back((uint8_t)(i * 7));
+    }
+    _peer = std::thread([this]() { run(); });
+  }
+
+  ~PipelineModem() {
+    _stop = true;
+    _peer.join();
+  }
+
+  std::vector<uint8_t> file;
+  std::vector<std::string> reads;
+  // Commands already waiting behind the one being answered, at most
+  int maxQueued = 0;
+  // Offset whose first READ BINARY fails at the AT level, -1 for none
+  int failAt = -1;
+
+ private:
+  void run() {
+    std::string pending;
+    while (!_stop) {
+      pending += _pty.read(10);
+
+      size_t end;
+      while ((end = pending.find("\r\n")) != std::string::npos) {
+        std::string line = pending.substr(0, end);
+        pending.erase(0, end + 2);
+        if (line.find("\"00B0") == std::string::npos) {
+          _pty.write("\r\nOK\r\n");
+          continue;
+        }
+
+        std::this_thread::sleep_for(std::chrono::milliseconds(20));
+        pending += _pty.read(0);
+        int queued = 0;
+        for (size_t pos = 0; (pos = pending.find("\r\n", pos)) != std::string::npos; pos += 2) {
+          queued++;
+        }
+        maxQueued = std::max(maxQueued, queued);
+        reads.push_back(line);
+        _pty.write(answer(line));
+      }
+    }
+  }
+
+  std::string answer(const std::string& line) {
+    std::string apdu = line.substr(line.find('"') + 1, 10);
+    int offset       = (int)strtoul(apdu.substr(4, 4).c_str(), nullptr, 16);
+    int le           = (int)strtoul(apdu.substr(8, 2).c_str(), nullptr, 16);
+    char hex[3];
+
+    if (offset == failAt) {
+      failAt = -1;
+      return "\r\n+CME ERROR: 13\r\n";
+    }
+
+    std::string response = "6B00";
+    if (offset + le <= (int)file.size()) {
+      response.clear();
+      for (int i = 0; i < le; i++) {
+        snprintf(hex, sizeof(hex), "%02X", file[offset + i]);
+        response += hex;
+      }
+      response += "9000";
+    }
+    return "\r\n+CSIM: " + std::to_string(response.size()) + ",\"" + response + "\"\r\n\r\nOK\r\n";
+  }
+
+  PtyPair& _pty;
+  std::atomic<bool> _stop{false};
+  std::thread _peer;
+};
+
+TEST_CASE("GenericModem pipelines file reads on modems which queue commands", "[pipelining]") {
+  PtyPair pty;
+  REQUIRE(!pty.slave.empty());
+  PipelineModem sim(pty);
+
+  GenericModem modem(pty.slave.c_str());
+  ModemProfile profile    = modem.getProfile();
+  profile.logicalChannels = false;
+  profile.pipelining      = true;
+
+  std::vector<uint8_t> data(700);
+  uint16_t len;
+
+  SECTION("Lock-step unless asked for") {
+    profile.pipelining = false;
+    modem.setProfile(profile);
+    REQUIRE(modem.open());
+    REQUIRE_FALSE(modem.hasPipelining());
+
+    REQUIRE(modem.readBinary(0x00, 0, 600, 0xEE, data.data(), &len));
+    REQUIRE(len == 600);
+    REQUIRE(std::vector<uint8_t>(data.begin(), data.begin() + 600) == sim.file);
+    REQUIRE(sim.maxQueued == 0);
+  }
+
+  SECTION("The next command waits in the modem") {
+    modem.setProfile(profile);
+    REQUIRE(modem.open());
+    REQUIRE(modem.hasPipelining());
+
+    REQUIRE(modem.readBinary(0x00, 0, 600, 0xEE, data.data(), &len));
+    REQUIRE(len == 600);
+    REQUIRE(std::vector<uint8_t>(data.begin(), data.begin() + 600) == sim.file);
+    REQUIRE(sim.maxQueued == 1);
+    REQUIRE(sim.reads == std::vector<std::string>{"AT+CSIM=10,\"00B00000EE\"", "AT+CSIM=10,\"00B000EEEE\"",
+                                                  "AT+CSIM=10,\"00B001DC7C\""});
+    REQUIRE(modem.getStatusWord() == 0x9000);
+  }
+
+  SECTION("A status word error ends the read") {
+    modem.setProfile(profile);
+    REQUIRE(modem.open());
+
+    REQUIRE_FALSE(modem.readBinary(0x00, 0, 700, 0xEE, data.data(), &len));
+    REQUIRE(len == 476);
+    REQUIRE(modem.getStatusWord() == 0x6B00);
+    REQUIRE(modem.hasPipelining());
+  }
+
+  SECTION("An AT error falls back to lock-step") {
+    sim.failAt = 0xEE;
+    modem.setProfile(profile);
+    REQUIRE(modem.open());
+
+    REQUIRE(modem.readBinary(0x00, 0, 600, 0xEE, data.data(), &len));
+    REQUIRE(len == 600);
+    REQUIRE(std::vector<uint8_t>(data.begin(), data.begin() + 600) == sim.file);
+    REQUIRE_FALSE(modem.hasPipelining());
+  }
+
+  modem.close();
+}
+
+static void collectTiming(SEInterface* seiface, const uint8_t* apdu, uint16_t apduLen, const se_apdu_timing_t* timing,
+                          void* arg) {
+  static_cast<std::vector<se_apdu_timing_t>*>(arg)->push_back(*timing);
+}
+
+TEST_CASE("GenericModem times each exchange on the link", "[timing]") {
+  PtyPair pty;
+  REQUIRE(!pty.slave.empty());
+
+  // The SIM takes 30 ms, then the response comes in two pieces 20 ms apart
+  const std::string status = "\r\n+CSIM: 4,\"6104\"\r\n\r\nOK\r\n";
+  const std::string head   = "\r\n+CSIM: 12,\"0102";
+  const std::string tail   = "03049000\"\r\n\r\nOK\r\n";
+  std::atomic<bool> stop(false);
+  std::thread peer([&]() {
+    std::string pending;
+    while (!stop) {
+      pending += pty.read(10);
+
+      size_t end;
+      while ((end = pending.find("\r\n")) != std::string::npos) {
+        std::string line = pending.substr(0, end);
+        pending.erase(0, end + 2);
+        if (line.find("\"00B0") != std::string::npos) {
+          std::this_thread::sleep_for(std::chrono::milliseconds(30));
+          pty.write(status);
+        } else if (line.find("\"00C0") != std::string::npos) {
+          std::this_thread::sleep_for(std::chrono::milliseconds(30));
+          pty.write(head);
+          std::this_thread::sleep_for(std::chrono::milliseconds(20));
+          pty.write(tail);
+        } else {
+          pty.write("\r\nOK\r\n");
+        }
+      }
+    }
+  });
+
+  GenericModem modem(pty.slave.c_str());
+  ModemProfile profile    = modem.getProfile();
+  profile.logicalChannels = false;
+  modem.setProfile(profile);
+  REQUIRE(modem.open());
+
+  se_apdu_timing_t timing;
+  std::vector<se_apdu_timing_t> records;
+
+  // Off by default
+  REQUIRE(modem.transmit(0x00, SCIns::ReadBinary, static_cast<SCP1>(0x00), static_cast<SCP2>(0x00), 0x04));
+  REQUIRE_FALSE(modem.getLastTiming(&timing));
+
+  modem.setTiming(true, collectTiming, &records);
+  REQUIRE(modem.transmit(0x00, SCIns::ReadBinary, static_cast<SCP1>(0x00), static_cast<SCP2>(0x00), 0x04));
+  REQUIRE(modem.getStatusWord() == 0x9000);
+
+  // READ BINARY and its GET RESPONSE
+  REQUIRE(records.size() == 2);
+  REQUIRE(modem.getLastTiming(&timing));
+  REQUIRE(memcmp(&timing, &records[1], sizeof(timing)) == 0);
+
+  REQUIRE(records[0].bytes_out == strlen("AT+CSIM=10,\"00B0000004\"\r\n"));
+  REQUIRE(records[0].bytes_in == status.size());
+  REQUIRE(records[1].bytes_out == strlen("AT+CSIM=10,\"00C0000004\"\r\n"));
+  REQUIRE(records[1].bytes_in == head.size() + tail.size());
+
+  for (const se_apdu_timing_t& record : records) {
+    REQUIRE(record.write_us <= record.first_byte_us);
+    REQUIRE(record.first_byte_us >= 30000);
+    REQUIRE(record.first_byte_us <= record.last_byte_us);
+    REQUIRE(record.last_byte_us <= record.total_us);
+  }
+  REQUIRE(records[1].last_byte_us - records[1].first_byte_us >= 15000);
+
+  modem.setTiming(false);
+  REQUIRE_FALSE(modem.getLastTiming(&timing));
+
+  stop = true;
+  peer.join();
+  modem.close();
+}
+
+TEST_CASE("GenericModem reads files from the pseudo-terminal modem emulator", "[emulator]") {
+  std::vector<uint8_t> certificate(1000);
+  for (size_t i = 0; i < certificate.size(); i++) {
+    certificate[i] = (uint8_t)(i * 13 + 5);
+  }
+
+  MemoryCard card;
+  card.addApplet(mfAid);
+  card.addFile({0x7F, 0xAA, 0x6F, 0x01}, certificate);
+
+  ModemEmulatorConfig config;
+  config.baudrate = 115200;
+  ModemEmulator emulator(&card, config);
+  REQUIRE(emulator.start());
+
+  GenericModem modem(emulator.getDevice().c_str());
+  ModemProfile profile = modem.getProfile();
+  profile.urcs         = true;
+  modem.setProfile(profile);
+  REQUIRE(modem.open());
+  REQUIRE(modem.hasLogicalChannels());
+
+  MF mf;
+  mf.init(&modem);
+  REQUIRE(mf.select(false));
+
+  std::vector<uint8_t> data(certificate.size());
+  uint16_t len = 0;
+  auto start   = std::chrono::steady_clock::now();
+  REQUIRE(mf.readCertificate(data.data(), &len));
+  auto elapsed = std::chrono::steady_clock::now() - start;
+  REQUIRE(len == certificate.size());
+  REQUIRE(data == certificate);
+
+  // Each byte crosses the link as two hex digits, 10 bits each at 115200 baud
+  REQUIRE(elapsed >= std::chrono::microseconds(certificate.size() * 2 * 10 * 1000000 / 115200));
+  REQUIRE(mf.deselect());
+
+  std::vector<std::string> registration;
+  modem.getATInterface().addUrcHandler("+CREG: ", collectUrc, &registration);
+  emulator.injectUrc("+CREG: 5");
+  for (int i = 0; (i < 10) && registration.empty(); i++) {
+    modem.getATInterface().pollUrcs(100);
+  }
+  REQUIRE(registration == std::vector<std::string>{"+CREG: 5"});
+
+  modem.close();
+  REQUIRE(emulator.getApdus() > 5);
+  REQUIRE(emulator.getBytesIn() > 0);
+  REQUIRE(emulator.getBytesOut() > 2 * certificate.size());
+}
+
+TEST_CASE("GenericModem codes channels the modem opens past 3 into CLA", "[emulator]") {
+  static uint8_t open[]  = {0x00, 0x70, 0x00, 0x00, 0x01};
+  std::vector<uint8_t> certificate(300, 0x6B);
+  uint8_t response[8];
+  uint16_t responseLen;
+
+  MemoryCard card;
+  card.addApplet(mfAid);
+  card.addFile({0x7F, 0xAA, 0x6F, 0x01}, certificate);
+
+  // Channels 1 to 4 busy, AT+CCHO gets 5: CLA 0x41, which 0x05 would send to channel 1
+  for (int i = 0; i < 4; i++) {
+    REQUIRE(card.transmit(open, sizeof(open), response, &responseLen));
+  }
+
+  ModemEmulator emulator(&card);
+  REQUIRE(emulator.start());
+
+  GenericModem modem(emulator.getDevice().c_str());
+  REQUIRE(modem.open());
+  REQUIRE(modem.hasLogicalChannels());
+
+  MF mf;
+  mf.init(&modem);
+  REQUIRE(mf.select(false));
+
+  std::vector<uint8_t> data(certificate.size());
+  uint16_t len = 0;
+  REQUIRE(mf.readCertificate(data.data(), &len));
+  REQUIRE(len == certificate.size());
+  REQUIRE(data == certificate);
+  REQUIRE(mf.deselect());
+  modem.close();
+
+  REQUIRE(claWithChannel(0x00, 5) == 0x41);
+  REQUIRE(claWithChannel(0x10, 19) == 0x5F);
+  REQUIRE(claWithChannel(0x80, 3) == 0x83);
+  for (uint8_t channel = 0; channel < 20; channel++) {
+    REQUIRE(claChannel(claWithChannel(0x10, channel)) == channel);
+  }
+}
+
+TEST_CASE("GenericModem opens logical channels with echo on and URCs around", "[emulator]") {
+  std::vector<uint8_t> certificate(100, 0x2C);
+  std::vector<std::string> registration;
+
+  MemoryCard card;
+  card.addApplet(mfAid);
+  card.addFile({0x7F, 0xAA, 0x6F, 0x01}, certificate);
+  ModemEmulator emulator(&card);
+  REQUIRE(emulator.start());
+
+  GenericModem modem(emulator.getDevice().c_str());
+  ModemProfile profile = modem.getProfile();
+  profile.echo         = true;
+  modem.setProfile(profile);
+  REQUIRE(modem.open());
+  REQUIRE(modem.hasLogicalChannels());
+  modem.getATInterface().addUrcHandler("+CREG: ", collectUrc, &registration);
+
+  // A channel taken for the echo or the URC would be left open on the card, which runs out of them before the end
+  for (int i = 0; i < 25; i++) {
+    emulator.injectUrc("+CREG: " + std::to_string(i % 6));
+    std::this_thread::sleep_for(std::chrono::milliseconds(2));
+
+    MF mf;
+    mf.init(&modem);
+    REQUIRE(mf.select(false));
+
+    std::vector<uint8_t> data(certificate.size());
+    uint16_t len = 0;
+    REQUIRE(mf.readCertificate(data.data(), &len));
+    REQUIRE(data == certificate);
+    REQUIRE(mf.deselect());
+  }
+
+  REQUIRE(registration.size() == 25);
+  modem.close();
+}
+
+// Card taking any PIN, counting the VERIFY it got
+class PinCard : public MemoryCard {
+ public:
+  bool transmit(const uint8_t* apdu, uint16_t apduLen, uint8_t* response, uint16_t* responseLen) override {
+    if (apdu[1] != 0x20) {
+      return MemoryCard::transmit(apdu, apduLen, response, responseLen);
+    }
+    verifies++;
+    response[0]  = 0x90;
+    response[1]  = 0x00;
+    *responseLen = 2;
+    return true;
+  }
+
+  int verifies = 0;
+};
+
+TEST_CASE("GenericModem reopens a USB modem which re-enumerated and retries the exchange", "[hotplug]") {
+  std::vector<uint8_t> certificate(300, 0xC3);
+  char dir[] = "/tmp/tob-hotplug-XXXXXX";
+  REQUIRE(mkdtemp(dir) != nullptr);
+  std::string port = std::string(dir) + "/ttyACM0";
+
+  // A fresh card and modem each time, as after a module reset
+  std::unique_ptr<PinCard> card;
+  std::unique_ptr<ModemEmulator> emulator;
+  auto plug = [&]() {
+    card.reset(new PinCard());
+    card->addApplet(mfAid);
+    card->addFile({0x7F, 0xAA, 0x6F, 0x01}, certificate);
+    emulator.reset(new ModemEmulator(card.get()));
+    return emulator->start() && (symlink(emulator->getDevice().c_str(), port.c_str()) == 0);
+  };
+  REQUIRE(plug());
+
+  GenericModem modem(port.c_str());
+  ModemProfile profile     = modem.getProfile();
+  profile.reconnectTimeout = 3000;
+  modem.setProfile(profile);
+  REQUIRE(modem.open());
+
+  MF mf;
+  std::vector<uint8_t> data(certificate.size());
+  uint16_t len;
+  mf.init(&modem);
+  REQUIRE(mf.select(false));
+  REQUIRE(mf.verifyPin((uint8_t*)"0000", 4));
+  REQUIRE(card->verifies == 1);
+  REQUIRE(mf.readCertificate(nullptr, &len));
+
+  // The port disappears with the modem
+  unlink(port.c_str());
+  emulator.reset();
+
+  SECTION("the modem comes back") {
+    std::thread replug([&]() {
+      std::this_thread::sleep_for(std::chrono::milliseconds(300));
+      plug();
+    });
+
+    // The channel is opened again, the EF selected again, and the READ BINARY which failed sent again
+    bool ok = mf.readBinary(0, len, 0xEE, data.data());
+    replug.join();
+    REQUIRE(ok);
+    REQUIRE(data == certificate);
+    REQUIRE(modem.getRecoveryStats().recoveries == 1);
+    REQUIRE(modem.getRecoveryStats().last_us >= 300000);
+    REQUIRE(modem.getRecoveryStats().last_us < 3000000);
+    // The card which came back may not be the same, the PIN is left to the caller
+    REQUIRE(card->verifies == 0);
+    REQUIRE(mf.deselect());
+  }
+
+  SECTION("the modem stays away") {
+    profile.reconnectTimeout = 200;
+    modem.setProfile(profile);
+
+    REQUIRE_FALSE(mf.readBinary(0, len, 0xEE, data.data()));
+    REQUIRE(modem.getRecoveryStats().recoveries == 0);
+    REQUIRE(modem.getRecoveryStats().failures == 1);
+  }
+
+  modem.close();
+  unlink(port.c_str());
+  rmdir(dir);
+}
+
+// Card reached directly, recording every APDU and logging when it is held and released, as a shared reader would
+// see them. extended tells whether the transport takes extended Lc and Le.
+class RecordingCard : public SEInterface {
+ public:
+  explicit RecordingCard(CardBackend* card, bool extended = false) : _card(card), _extended(extended) {
+  }
+
+  bool open() override {
+    return true;
+  }
+
+  void close() override {
+  }
+
+  bool supportsExtendedLength() override {
+    return _extended;
+  }
+
+  std::vector<std::vector<uint8_t>> commands;
+  std::vector<std::string> events;
+  bool refuse = false;
+
+ protected:
+  bool transmitApdu(uint8_t* apdu, uint16_t apduLen, uint8_t* response, uint16_t* responseLen) override {
+    commands.push_back(std::vector<uint8_t>(apdu, apdu + apduLen));
+    events.push_back("apdu");
+    return _card->transmit(apdu, apduLen, response, responseLen);
+  }
+
+  bool lockTransport() override {
+    events.push_back(refuse ? "refused" : "lock");
+    return !refuse;
+  }
+
+  void unlockTransport() override {
+    events.push_back("unlock");
+  }
+
+ private:
+  CardBackend* _card;
+  bool _extended;
+};
+
+TEST_CASE("SEInterface holds the card for a whole operation", "[transaction]") {
+  std::vector<uint8_t> certificate(600, 0x5A);
+
+  MemoryCard card;
+  card.addApplet(mfAid);
+  card.addFile({0x7F, 0xAA, 0x6F, 0x01}, certificate);
+  RecordingCard shared(&card);
+
+  SECTION("nested transactions only reach the transport once") {
+    REQUIRE(shared.beginTransaction());
+    REQUIRE(shared.beginTransaction());
+    shared.endTransaction();
+    REQUIRE(shared.events == std::vector<std::string>{"lock"});
+    shared.endTransaction();
+    REQUIRE(shared.events == std::vector<std::string>{"lock", "unlock"});
+
+    // Unbalanced ends are ignored
+    shared.endTransaction();
+    REQUIRE(shared.events.size() == 2);
+  }
+
+  SECTION("a refused lock is not released") {
+    shared.refuse = true;
+    {
+      SETransaction transaction(&shared);
+      REQUIRE_FALSE(transaction.locked());
+    }
+    REQUIRE(shared.events == std::vector<std::string>{"refused"});
+
+    shared.refuse = false;
+    {
+      SETransaction transaction(&shared);
+      REQUIRE(transaction.locked());
+    }
+    REQUIRE(shared.events == std::vector<std::string>{"refused", "lock", "unlock"});
+  }
+
+  SECTION("every APDU of a file read falls inside the transaction") {
+    std::vector<uint8_t> data(certificate.size());
+    uint16_t len = 0;
+    MF mf;
+    mf.init(&shared);
+    {
+      SETransaction transaction(&shared);
+      REQUIRE(mf.select(false));
+      REQUIRE(mf.readCertificate(data.data(), &len));
+      REQUIRE(mf.deselect());
+    }
+    REQUIRE(len == certificate.size());
+    REQUIRE(data == certificate);
+
+    REQUIRE(shared.events.size() > 5);
+    REQUIRE(shared.events.front() == "lock");
+    REQUIRE(shared.events.back() == "unlock");
+    REQUIRE(std::count(shared.events.begin(), shared.events.end(), "apdu") == (long)shared.events.size() - 2);
+  }
+}
+
+static size_t countReads(const std::vector<std::vector<uint8_t>>& commands) {
+  return std::count_if(commands.begin(), commands.end(),
+                       [](const std::vector<uint8_t>& c) { return c[1] == 0xB0; });
+}
+
+TEST_CASE("SEInterface codes extended Lc and Le and reads whole EFs with them", "[extended]") {
+  std::vector<uint8_t> certificate(1500);
+  for (size_t i = 0; i < certificate.size(); i++) {
+    certificate[i] = (uint8_t)(i * 11 + 3);
+  }
+  std::vector<uint8_t> data(certificate.size());
+  uint16_t len = 0;
+
+  SECTION("encodings") {
+    MemoryCard card(false, true);
+    RecordingCard seiface(&card, true);
+    std::vector<uint8_t> body(300, 0xAB);
+
+    REQUIRE(seiface.transmitExtended(0x00, 0xB0, 0x01, 0x02, nullptr, 0, 0x0123));
+    REQUIRE(seiface.commands.back() == std::vector<uint8_t>{0x00, 0xB0, 0x01, 0x02, 0x00, 0x01, 0x23});
+
+    // Case 3 and 4 with more than 255 bytes of data go extended on their own
+    REQUIRE(seiface.transmit(0x00, 0xDA, 0x00, 0x00, body.data(), (uint16_t)body.size()));
+    REQUIRE(seiface.commands.back().size() == 4 + 3 + 300);
+    REQUIRE(std::vector<uint8_t>(seiface.commands.back().begin() + 4, seiface.commands.back().begin() + 7) ==
+            std::vector<uint8_t>{0x00, 0x01, 0x2C});
+
+    REQUIRE(seiface.transmit(0x00, 0x2A, 0x9E, 0x9A, body.data(), (uint16_t)body.size(), 0x00));
+    REQUIRE(seiface.commands.back().size() == 4 + 3 + 300 + 2);
+    REQUIRE(seiface.commands.back()[307] == 0x01);
+    REQUIRE(seiface.commands.back()[308] == 0x00);
+
+    REQUIRE_FALSE(seiface.transmitExtended(0x00, 0xB0, 0x00, 0x00, nullptr, 0, SE_MAX_DATA_LEN + 1));
+  }
+
+  SECTION("transports without extended lengths refuse long commands") {
+    MemoryCard card(false, true);
+    RecordingCard seiface(&card, false);
+    std::vector<uint8_t> body(300, 0xAB);
+
+    REQUIRE_FALSE(seiface.transmitExtended(0x00, 0xB0, 0x00, 0x00, nullptr, 0, 0x0100));
+    REQUIRE_FALSE(seiface.transmit(0x00, 0xDA, 0x00, 0x00, body.data(), (uint16_t)body.size()));
+    REQUIRE(seiface.commands.empty());
+  }
+
+  SECTION("one READ BINARY for the whole EF") {
+    MemoryCard card(false, true);
+    card.addApplet(mfAid);
+    card.addFile({0x7F, 0xAA, 0x6F, 0x01}, certificate);
+    RecordingCard seiface(&card, true);
+    MF mf;
+    mf.init(&seiface);
+
+    REQUIRE(mf.select(false));
+    REQUIRE(mf.readCertificate(data.data(), &len));
+    REQUIRE(len == certificate.size());
+    REQUIRE(data == certificate);
+    REQUIRE(countReads(seiface.commands) == 1);
+    REQUIRE(mf.deselect());
+  }
+
+  SECTION("cards turning extended lengths down are read chunk by chunk") {
+    MemoryCard card(false, false);
+    card.addApplet(mfAid);
+    card.addFile({0x7F, 0xAA, 0x6F, 0x01}, certificate);
+    RecordingCard seiface(&card, true);
+    MF mf;
+    mf.init(&seiface);
+
+    REQUIRE(mf.select(false));
+    REQUIRE(mf.readCertificate(data.data(), &len));
+    REQUIRE(len == certificate.size());
+    REQUIRE(data == certificate);
+    REQUIRE(countReads(seiface.commands) == 1 + (certificate.size() + 254) / 255);
+    REQUIRE(mf.deselect());
+  }
+}
+
+// MIAS applet answering signatures and plain texts in parts of at most 200 bytes, each but the last ending with 61xx.
+// Parts of a signature after the first are given to ENVELOPE, those of a plain text to GET RESPONSE.
+class ChainingSim : public SEInterface {
+ public:
+  bool open() override {
+    return true;
+  }
+
+  void close() override {
+  }
+
+  std::vector<uint8_t> signature;
+  std::vector<uint8_t> plain;
+  std::vector<uint8_t> cryptogram;
+  // Never runs out of signature parts
+  bool endless = false;
+
+  std::vector<std::vector<uint8_t>> commands;
+
+ protected:
+  bool transmitApdu(uint8_t* apdu, uint16_t apduLen, uint8_t* response, uint16_t* responseLen) override {
+    std::vector<uint8_t> r = {0x90, 0x00};
+
+    commands.push_back(std::vector<uint8_t>(apdu, apdu + apduLen));
+    if ((apdu[1] == 0x2A) && (apdu[2] == 0x9E)) {
+      r = next(signature, 0);
+    } else if (apdu[1] == 0xC2) {
+      r = next(signature, apdu[4]);
+    } else if ((apdu[1] == 0x2A) && (apdu[2] == 0x80)) {
+      cryptogram.insert(cryptogram.end(), apdu + 5, apdu + 5 + apdu[4]);
+      if ((apdu[0] & 0x10) == 0) {
+        r = next(plain, 0);
+      }
+    } else if (apdu[1] == 0xC0) {
+      r = next(plain, apdu[4]);
+    }
+
+    memcpy(response, r.data(), r.size());
+    *responseLen = r.size();
+    return true;
+  }
+
+ private:
+  std::vector<uint8_t> next(const std::vector<uint8_t>& data, uint8_t le) {
+    size_t len = std::min<size_t>(data.size() - _sent, 200);
+    std::vector<uint8_t> r(data.begin() + _sent, data.begin() + _sent + len);
+
+    // Asked for the length announced by the previous part
+    REQUIRE(((_sent == 0) || (le == (uint8_t)len)));
+    _sent = endless ? 0 : _sent + len;
+    if (_sent < data.size()) {
+      r.insert(r.end(), {0x61, (uint8_t)std::min<size_t>(data.size() - _sent, 200)});
+    } else {
+      r.insert(r.end(), {0x90, 0x00});
+      _sent = 0;
+    }
+    return r;
+  }
+
+  size_t _sent = 0;
+};
+
+TEST_CASE("SEInterface gathers responses which come in parts", "[chaining]") {
+  static uint8_t hash[32] = {0x01};
+  uint8_t out[MIAS_RSA_MAX_LEN];
+  uint16_t len = 0;
+  ChainingSim sim;
+  MIAS mias;
+  mias.init(&sim);
+  REQUIRE(mias.select());
+
+  SECTION("RSA-4096 signature") {
+    for (int i = 0; i < 512; i++) {
+      sim.signature.push_back((uint8_t)(i * 13 + 7));
+    }
+    sim.commands.clear();
+
+    REQUIRE(mias.signInit(ALGO_SHA256_WITH_RSA_PKCS1_PADDING, 0x01));
+    REQUIRE(mias.signFinal(hash, sizeof(hash), out, &len));
+    REQUIRE(len == 512);
+    REQUIRE(std::vector<uint8_t>(out, out + len) == sim.signature);
+
+    // MSE SET, PSO HASH, PSO CDS and two ENVELOPE for the 112 bytes left after 200 and 200
+    REQUIRE(sim.commands.size() == 5);
+    REQUIRE(sim.commands[3][1] == 0xC2);
+    REQUIRE(sim.commands[4] == std::vector<uint8_t>{0x00, 0xC2, 0x00, 0x00, 112});
+  }
+
+  SECTION("RSA-4096 decryption") {
+    for (int i = 0; i < 512; i++) {
+      sim.cryptogram.push_back((uint8_t)(i * 5 + 1));
+    }
+    for (int i = 0; i < 470; i++) {
+      sim.plain.push_back((uint8_t)(i * 3 + 2));
+    }
+    std::vector<uint8_t> cryptogram = sim.cryptogram;
+    sim.cryptogram.clear();
+    sim.commands.clear();
+
+    REQUIRE(mias.decryptInit(ALGO_RSA_PKCS1_PADDING, 0x02));
+    REQUIRE(mias.decryptFinal(cryptogram.data(), (uint16_t)cryptogram.size(), out, &len));
+    REQUIRE(len == 470);
+    REQUIRE(std::vector<uint8_t>(out, out + len) == sim.plain);
+
+    // Padding indicator and 512 bytes over two chained commands and a last one, then two GET RESPONSE
+    REQUIRE(sim.cryptogram.size() == 513);
+    REQUIRE(sim.cryptogram[0] == 0x81);
+    REQUIRE(std::vector<uint8_t>(sim.cryptogram.begin() + 1, sim.cryptogram.end()) == cryptogram);
+    REQUIRE(sim.commands.size() == 6);
+    REQUIRE(sim.commands[1][0] == 0x10);
+    REQUIRE(sim.commands[2][0] == 0x10);
+    REQUIRE(sim.commands[3][0] == 0x00);
+    REQUIRE(sim.commands[5] == std::vector<uint8_t>{0x00, 0xC0, 0x00, 0x00, 70});
+  }
+
+  SECTION("a response longer than the buffer fails") {
+    sim.signature.assign(600, 0x33);
+    uint8_t apdu[] = {0x00, 0x2A, 0x9E, 0x9A, 0x00};
+
+    REQUIRE_FALSE(sim.transmitChained(apdu, sizeof(apdu), out, sizeof(out), &len, 0xC2));
+    REQUIRE(sim.commands.size() == 1 + 3);
+  }
+
+  SECTION("a card which keeps asking for more is given up on") {
+    // Small parts, for the buffer not to fill up first
+    sim.signature.assign(10, 0x44);
+    sim.endless = true;
+    sim.commands.clear();
+
+    REQUIRE(mias.signInit(ALGO_SHA256_WITH_RSA_PKCS1_PADDING, 0x01));
+    REQUIRE_FALSE(mias.signFinal(hash, sizeof(hash), out, &len));
+    REQUIRE(sim.commands.size() == 2 + SE_CHAIN_MAX_COMMANDS);
+  }
+
+  SECTION("transmit leaves data followed by 61xx to the caller") {
+    sim.signature.assign(300, 0x55);
+
+    REQUIRE(sim.transmit(0x00, 0x2A, 0x9E, 0x9A, 0x00));
+    REQUIRE(sim.getStatusWord() == 0x6164);
+    REQUIRE(sim.getResponseLength() == 200);
+  }
+}
+
+TEST_CASE("ATR historical bytes tell whether the card takes extended lengths", "[atr]") {
+  const uint8_t* historical;
+  size_t historicalLen;
+
+  // TD1 offers T=0 and TD2 T=1, then come 80, 73 (card capabilities) 00 21 C0, empty objects and the TCK
+  static const uint8_t extended[] = {0x3B, 0x88, 0x80, 0x01, 0x80, 0x73, 0x00, 0x21, 0xC0,
+                                     0x00, 0x00, 0x00, 0x00, 0x00};
+  REQUIRE(tob_atr_historical_bytes(extended, sizeof(extended), &historical, &historicalLen));
+  REQUIRE(historicalLen == 8);
+  REQUIRE(historical == &extended[4]);
+  REQUIRE(tob_atr_extended_length(extended, sizeof(extended)));
+
+  // Same card capabilities without the extended Lc and Le bit
+  static const uint8_t shortOnly[] = {0x3B, 0x84, 0x80, 0x01, 0x80, 0x73, 0x00, 0x21, 0x80};
+  REQUIRE_FALSE(tob_atr_extended_length(shortOnly, sizeof(shortOnly)));
+
+  // Category 00 keeps three status bytes after the objects, which are not read as capabilities
+  static const uint8_t statusLast[] = {0x3B, 0x07, 0x00, 0x31, 0xC0, 0x73, 0x00, 0x21, 0xC0};
+  REQUIRE_FALSE(tob_atr_extended_length(statusLast, sizeof(statusLast)));
+  static const uint8_t status[] = {0x3B, 0x08, 0x00, 0x73, 0x00, 0x21, 0xC0, 0x00, 0x90, 0x00};
+  REQUIRE(tob_atr_extended_length(status, sizeof(status)));
+
+  // Cut short, or not an ATR at all
+  REQUIRE_FALSE(tob_atr_historical_bytes(extended, 8, &historical, &historicalLen));
+  REQUIRE_FALSE(tob_atr_extended_length(extended, 3));
+  static const uint8_t notAtr[] = {0x90, 0x00};
+  REQUIRE_FALSE(tob_atr_historical_bytes(notAtr, sizeof(notAtr), &historical, &historicalLen));
+}
+
+TEST_CASE("Hex codec round trips and matches the scalar implementation", "[hex]") {
+  std::mt19937 rng(7);
+
+  for (size_t len = 0; len < 100; len++) {
+    std::vector<uint8_t> bytes(len), decoded(len);
+    std::string hex(2 * len, '\0'), reference(2 * len, '\0');
+
+    for (auto& b : bytes) {
+      b = rng();
+    }
+
+    tob_hex_encode(bytes.data(), len, &hex[0]);
+    tob_hex_encode_scalar(bytes.data(), len, &reference[0]);
+    REQUIRE(hex == reference);
+
+    REQUIRE(tob_hex_decode(hex.data(), hex.size(), decoded.data()));
+    REQUIRE(decoded == bytes);
+  }
+}
+
+TEST_CASE("Hex codec accepts both cases and rejects anything else", "[hex]") {
+  const std::string mixed = "00aAbBcCdDeEfF0123456789abcdefABCDEF0123456789abcdef0123456789AB";
+  uint8_t bytes[32];
+
+  REQUIRE(tob_hex_decode(mixed.data(), mixed.size(), bytes));
+  REQUIRE(bytes[1] == 0xAA);
+  REQUIRE(bytes[6] == 0xFF);
+
+  REQUIRE_FALSE(tob_hex_decode(mixed.data(), mixed.size() - 1, bytes));
+
+  // Every position goes through either a vector block or the scalar tail
+  for (size_t i = 0; i < mixed.size(); i++) {
+    for (char bad : {'g', 'G', '/', ':', '@', '`', ' ', '"', '\x10', '\x80', '\xC1'}) {
+      std::string hex = mixed;
+      hex[i]          = bad;
+      REQUIRE_FALSE(tob_hex_decode(hex.data(), hex.size(), bytes));
+    }
+  }
+}
@@ -0,0 +1,574 @@
+/*
+ *
+ * Twilio Breakout Trust Onboard SDK
+ *
+ * Copyright (c) 2019 Twilio, Inc.
+ *
+ * SPDX-License-Identifier:  Apache-2.0
+ */
+
+#include "ModemEmulator.h"
+#include "HexCodec.h"
+
+#include <algorithm>
+#include <chrono>
+#include <cstdio>
+#include <cstdlib>
+#include <cstring>
+
+#include <fcntl.h>
+#include <poll.h>
+#include <stdlib.h>
+#include <termios.h>
+#include <unistd.h>
+
+// Rates offered to AT+IPR=?
+#define EMULATOR_IPR_LIST "(9600,19200,38400,57600,115200,230400,460800,921600,1000000,1500000,2000000,3000000,4000000)"
+
+// Bytes written at once to the terminal, small enough for the first ones to arrive before the last ones when throttled
+#define EMULATOR_WRITE_CHUNK 32
+
+// +CME ERROR codes of TS 27.007
+#define CME_OPERATION_NOT_ALLOWED 3
+#define CME_OPERATION_NOT_SUPPORTED 4
+#define CME_SIM_FAILURE 13
+#define CME_INVALID_INDEX 21
+
+static uint8_t channelOf(uint8_t cla) {
+  return (cla & 0x40) ? 4 + (cla & 0x0F) : (cla & 0x03);
+}
+
+/** MemoryCard ****************************************************************/
+
+// Extended Lc and Le start with a zero byte where a short APDU has its Lc or Le, and are at least 7 bytes long
+static bool isExtended(const uint8_t* apdu, uint16_t apduLen) {
+  return (apduLen >= 7) && (apdu[4] == 0x00);
+}
+
+MemoryCard::MemoryCard(bool t0, bool extendedLength) : _t0(t0), _extendedLength(extendedLength) {
+  for (Channel& channel : _channels) {
+    channel.open = false;
+    channel.file = nullptr;
+  }
+  _channels[0].open = true;
+}
+
+void MemoryCard::addFile(const std::vector<uint8_t>& path, const std::vector<uint8_t>& content) {
+  _files[path] = content;
+}
+
+void MemoryCard::addApplet(const std::vector<uint8_t>& aid) {
+  _applets.push_back(aid);
+}
+
+bool MemoryCard::transmit(const uint8_t* apdu, uint16_t apduLen, uint8_t* response, uint16_t* responseLen) {
+  std::vector<uint8_t> data;
+  uint8_t ch;
+  uint16_t sw;
+
+  if (apduLen < 4) {
+    return false;
+  }
+
+  ch = channelOf(apdu[0]);
+  if ((ch >= sizeof(_channels) / sizeof(_channels[0])) || !_channels[ch].open) {
+    sw = 0x6881;
+  } else {
+    sw = answer(apdu, apduLen, &_channels[ch], &data);
+  }
+
+  // A T=0 card keeps the data of commands with a body for GET RESPONSE
+  if (_t0 && (sw == 0x9000) && !data.empty() && (apduLen > 5) && !isExtended(apdu, apduLen) && (apdu[1] != 0xC0)) {
+    _channels[ch].pending = data;
+    data.clear();
+    sw = 0x6100 | ((_channels[ch].pending.size() > 0xFF) ? 0x00 : _channels[ch].pending.size());
+  }
+
+  memcpy(response, data.data(), data.size());
+  response[data.size()]     = sw >> 8;
+  response[data.size() + 1] = sw & 0xFF;
+  *responseLen              = data.size() + 2;
+  return true;
+}
+
+uint16_t MemoryCard::answer(const uint8_t* apdu, uint16_t apduLen, Channel* channel, std::vector<uint8_t>* data) {
+  const uint8_t* body = (apduLen > 5) ? &apdu[5] : nullptr;
+  unsigned int lc     = (apduLen > 5) ? apdu[4] : 0;
+  unsigned int le     = (apduLen == 5) ? (apdu[4] ? apdu[4] : 256) : 0;
+  unsigned int offset;
+  unsigned int i;
+
+  if (isExtended(apdu, apduLen)) {
+    if (!_extendedLength) {
+      return 0x6700;
+    }
+    if (apduLen == 7) {
+      body = nullptr;
+      lc   = 0;
+      le   = (apdu[5] << 8) | apdu[6];
+      le   = le ? le : 65536;
+    } else {
+      body = &apdu[7];
+      lc   = (apdu[5] << 8) | apdu[6];
+    }
+  }
+
+  if ((body != nullptr) && (apduLen < (size_t)(body - apdu) + lc)) {
+    return 0x6700;
+  }
+
+  switch (apdu[1]) {
+    case 0xA4:
+      // By path from the MF
+      if ((apdu[2] == 0x08) && (lc >= 2)) {
+        std::vector<uint8_t> path(body, body + lc);
+        auto file = _files.find(path);
+        // MF::readCertificate and readPrivateKey spell the path in ASCII hex
+        if ((file == _files.end()) && (lc % 2 == 0)) {
+          path.resize(lc / 2);
+          if (tob_hex_decode((const char*)body, lc, path.data())) {
+            file = _files.find(path);
+          }
+        }
+        if (file == _files.end()) {
+          return 0x6A82;
+        }
+
+        size_t size   = file->second.size();
+        channel->file = &file->second;
+        *data = {0x62, 0x0E, 0x80, 0x02, (uint8_t)(size >> 8), (uint8_t)size, 0x81, 0x02, (uint8_t)(size >> 8),
+                 (uint8_t)size, 0x82, 0x01, 0x01, 0x83, 0x02, path[path.size() - 2], path[path.size() - 1]};
+        return 0x9000;
+      }
+
+      // By AID, a prefix being enough
+      if (apdu[2] == 0x04) {
+        for (const std::vector<uint8_t>& aid : _applets) {
+          if ((lc <= aid.size()) && std::equal(body, body + lc, aid.begin())) {
+            channel->file = nullptr;
+            return 0x9000;
+          }
+        }
+        return 0x6A82;
+      }
+      return 0x6A86;
+
+    case 0xB0:
+      if (channel->file == nullptr) {
+        return 0x6986;
+      }
+      if (apdu[2] & 0x80) {
+        return 0x6A86;
+      }
+
+      offset = (apdu[2] << 8) | apdu[3];
+      if (offset > channel->file->size()) {
+        return 0x6B00;
+      }
+      data->assign(channel->file->begin() + offset,
+                   channel->file->begin() + std::min<size_t>(offset + le, channel->file->size()));
+      return (data->size() < le) ? 0x6282 : 0x9000;
+
+    case 0xC0:
+      if (channel->pending.empty()) {
+        return 0x6985;
+      }
+      if (le > channel->pending.size()) {
+        return 0x6C00 | (channel->pending.size() & 0xFF);
+      }
+      data->assign(channel->pending.begin(), channel->pending.begin() + le);
+      channel->pending.erase(channel->pending.begin(), channel->pending.begin() + le);
+      if (!channel->pending.empty()) {
+        return 0x6100 | ((channel->pending.size() > 0xFF) ? 0x00 : channel->pending.size());
+      }
+      return 0x9000;
+
+    case 0x70:
+      if (apdu[2] == 0x00) {
+        for (i = 1; i < sizeof(_channels) / sizeof(_channels[0]); i++) {
+          if (!_channels[i].open) {
+            _channels[i].open = true;
+            _channels[i].file = nullptr;
+            _channels[i].pending.clear();
+            data->push_back(i);
+            return 0x9000;
+          }
+        }
+        return 0x6A81;
+      }
+      if ((apdu[2] == 0x80) && (apdu[3] > 0) && (apdu[3] < sizeof(_channels) / sizeof(_channels[0]))) {
+        _channels[apdu[3]].open = false;
+        return 0x9000;
+      }
+      return 0x6A86;
+
+    default:
+      return 0x6D00;
+  }
+}
+
+/** SEInterfaceCard ***********************************************************/
+
+bool SEInterfaceCard::transmit(const uint8_t* apdu, uint16_t apduLen, uint8_t* response, uint16_t* responseLen) {
+  uint16_t sw;
+  bool ret;
+
+  // Split the APDU back into its case for the SEInterface calls
+  if (apduLen == 4) {
+    ret = _seiface->transmit(apdu[0], apdu[1], apdu[2], apdu[3]);
+  } else if (apduLen == 5) {
+    ret = _seiface->transmit(apdu[0], apdu[1], apdu[2], apdu[3], apdu[4]);
+  } else if ((apduLen > 5) && (apduLen == 5 + apdu[4])) {
+    ret = _seiface->transmit(apdu[0], apdu[1], apdu[2], apdu[3], &apdu[5], apdu[4]);
+  } else if ((apduLen > 5) && (apduLen == 6 + apdu[4])) {
+    ret = _seiface->transmit(apdu[0], apdu[1], apdu[2], apdu[3], &apdu[5], apdu[4], apdu[apduLen - 1]);
+  } else {
+    return false;
+  }
+
+  if (!ret) {
+    return false;
+  }
+
+  *responseLen               = _seiface->getResponse(response);
+  sw                         = _seiface->getStatusWord();
+  response[*responseLen]     = sw >> 8;
+  response[*responseLen + 1] = sw & 0xFF;
+  *responseLen += 2;
+  return true;
+}
+
+/** ModemEmulator *************************************************************/
+
+ModemEmulator::ModemEmulator(CardBackend* card, const ModemEmulatorConfig& config)
+    : _card(card), _config(config), _master(-1), _slave(-1), _running(false), _commands(0), _apdus(0), _bytesIn(0),
+      _bytesOut(0) {
+  _wake[0]  = -1;
+  _wake[1]  = -1;
+  _echo     = config.echo;
+  _cmee     = 0;
+  _baudrate = config.baudrate;
+}
+
+ModemEmulator::~ModemEmulator(void) {
+  stop();
+}
+
+bool ModemEmulator::start(void) {
+  struct termios tio;
+  const char* name;
+
+  if (_running) {
+    return true;
+  }
+
+  if ((_master = posix_openpt(O_RDWR | O_NOCTTY)) < 0) {
+    return false;
+  }
+  if ((grantpt(_master) != 0) || (unlockpt(_master) != 0) || ((name = ptsname(_master)) == nullptr) ||
+      ((_slave = open(name, O_RDWR | O_NOCTTY)) < 0) || (pipe(_wake) != 0)) {
+    stop();
+    return false;
+  }
+  _device = name;
+
+  // Raw until the host configures the port itself, nothing it sends may be echoed by the line discipline
+  if (tcgetattr(_slave, &tio) == 0) {
+    cfmakeraw(&tio);
+    tcsetattr(_slave, TCSANOW, &tio);
+  }
+
+  _echo     = _config.echo;
+  _cmee     = 0;
+  _baudrate = _config.baudrate;
+  _sessions.assign(20, false);
+  _running = true;
+  _thread  = std::thread([this]() { run(); });
+  return true;
+}
+
+void ModemEmulator::stop(void) {
+  char c = 0;
+
+  if (_running) {
+    _running = false;
+    if (::write(_wake[1], &c, 1) < 0) {
+      perror("emulator wake up");
+    }
+    _thread.join();
+  }
+
+  for (int* fd : {&_master, &_slave, &_wake[0], &_wake[1]}) {
+    if (*fd >= 0) {
+      close(*fd);
+      *fd = -1;
+    }
+  }
+  _device.clear();
+}
+
+void ModemEmulator::injectUrc(const std::string& line) {
+  char c = 0;
+
+  {
+    std::lock_guard<std::mutex> guard(_urcLock);
+    _urcs.push_back(line);
+  }
+  if ((_wake[1] >= 0) && (::write(_wake[1], &c, 1) < 0)) {
+    perror("emulator wake up");
+  }
+}
+
+void ModemEmulator::throttle(unsigned long int bytes) {
+  // 8N1 puts 10 bits on the line per byte
+  if (_baudrate > 0) {
+    std::this_thread::sleep_for(std::chrono::microseconds(bytes * 10 * 1000000ULL / _baudrate));
+  }
+}
+
+void ModemEmulator::write(const std::string& data) {
+  size_t off = 0;
+  size_t len;
+  ssize_t w;
+
+  while (off < data.size()) {
+    len = std::min<size_t>(data.size() - off, EMULATOR_WRITE_CHUNK);
+    throttle(len);
+    if ((w = ::write(_master, data.data() + off, len)) <= 0) {
+      return;
+    }
+    off += w;
+    _bytesOut += w;
+  }
+}
+
+void ModemEmulator::flushUrcs(void) {
+  std::vector<std::string> urcs;
+
+  {
+    std::lock_guard<std::mutex> guard(_urcLock);
+    urcs.swap(_urcs);
+  }
+  for (const std::string& urc : urcs) {
+    write("\r\n" + urc + "\r\n");
+  }
+}
+
+void ModemEmulator::run(void) {
+  struct pollfd fds[2];
+  std::string line;
+  char buf[256];
+  ssize_t r;
+  ssize_t i;
+
+  fds[0] = {_master, POLLIN, 0};
+  fds[1] = {_wake[0], POLLIN, 0};
+
+  while (_running) {
+    if (poll(fds, 2, -1) < 0) {
+      continue;
+    }
+
+    if (fds[1].revents & POLLIN) {
+      if (read(_wake[0], buf, sizeof(buf)) < 0) {
+        perror("emulator wake up");
+      }
+    }
+
+    if (fds[0].revents & POLLIN) {
+      if ((r = read(_master, buf, sizeof(buf))) <= 0) {
+        continue;
+      }
+      _bytesIn += r;
+      throttle(r);
+
+      for (i = 0; i < r; i++) {
+        if (buf[i] == '\n') {
+          continue;
+        }
+        if (buf[i] != '\r') {
+          line += buf[i];
+          continue;
+        }
+
+        if (_echo) {
+          write(line + "\r");
+        }
+        if (!line.empty()) {
+          _commands++;
+          answer(line);
+        }
+        line.clear();
+      }
+    }
+
+    // URCs never cut through a command being typed
+    if (line.empty()) {
+      flushUrcs();
+    }
+  }
+}
+
+static bool startsWith(const std::string& s, const char* prefix) {
+  return s.compare(0, strlen(prefix), prefix) == 0;
+}
+
+void ModemEmulator::answer(const std::string& command) {
+  std::string response;
+  int error = 0;
+  int rate  = 0;
+
+  if ((command == "AT") || startsWith(command, "AT+CREG=") || startsWith(command, "AT+CGREG=") ||
+      startsWith(command, "AT+CEREG=")) {
+  } else if ((command == "ATE0") || (command == "ATE1")) {
+    _echo = (command == "ATE1");
+  } else if (startsWith(command, "AT+CMEE=")) {
+    _cmee = atoi(command.c_str() + 8);
+  } else if (command == "AT+CGMI") {
+    response = _config.manufacturer;
+  } else if (command == "AT+CGMM") {
+    response = _config.model;
+  } else if (command == "ATI") {
+    response = _config.manufacturer + " " + _config.model;
+  } else if (command == "AT+IPR=?") {
+    response = "+IPR: " EMULATOR_IPR_LIST;
+  } else if (command == "AT+IPR?") {
+    response = "+IPR: " + std::to_string(_baudrate);
+  } else if (startsWith(command, "AT+IPR=")) {
+    rate = atoi(command.c_str() + 7);
+  } else if ((command == "AT+CCHO=?") || (command == "AT+CGLA=?") || (command == "AT+CCHC=?")) {
+    error = _config.logicalChannels ? 0 : CME_OPERATION_NOT_SUPPORTED;
+  } else if (startsWith(command, "AT+CSIM=")) {
+    response = answerApdu("CSIM", command.substr(8));
+    error    = response.empty() ? CME_SIM_FAILURE : 0;
+  } else if (_config.logicalChannels && startsWith(command, "AT+CGLA=")) {
+    response = answerApdu("CGLA", command.substr(8));
+    error    = response.empty() ? CME_INVALID_INDEX : 0;
+  } else if (_config.logicalChannels && startsWith(command, "AT+CCHO=")) {
+    response = openChannel(command.substr(8));
+    error    = response.empty() ? CME_SIM_FAILURE : 0;
+  } else if (_config.logicalChannels && startsWith(command, "AT+CCHC=")) {
+    error = closeChannel(command.substr(8)) ? 0 : CME_INVALID_INDEX;
+  } else {
+    error = CME_OPERATION_NOT_ALLOWED;
+  }
+
+  if (error != 0) {
+    if (_cmee == 0) {
+      write("\r\nERROR\r\n");
+    } else {
+      write("\r\n+CME ERROR: " + std::to_string(error) + "\r\n");
+    }
+    return;
+  }
+
+  if (!response.empty()) {
+    write("\r\n" + response + "\r\n");
+  }
+  write("\r\nOK\r\n");
+
+  // The modem answers at the old rate and only then switches
+  if ((rate > 0) && (_baudrate > 0)) {
+    _baudrate = rate;
+  }
+}
+
+std::string ModemEmulator::openChannel(const std::string& args) {
+  uint8_t apdu[5 + 16];
+  uint8_t response[256 + 2];
+  uint16_t responseLen;
+  uint8_t session;
+  std::string hex;
+
+  // "<dfname>", opened with MANAGE CHANNEL and selected on it, the session id being the channel number
+  if ((args.size() < 2) || (args.front() != '"') || (args.back() != '"') || (args.size() - 2 > 32)) {
+    return "";
+  }
+  hex = args.substr(1, args.size() - 2);
+  if (!tob_hex_decode(hex.data(), hex.size(), &apdu[5])) {
+    return "";
+  }
+
+  uint8_t open[] = {0x00, 0x70, 0x00, 0x00, 0x01};
+  if (!_card->transmit(open, sizeof(open), response, &responseLen) || (responseLen != 3) || (response[1] != 0x90) ||
+      (response[0] == 0) || (response[0] >= _sessions.size())) {
+    return "";
+  }
+  session = response[0];
+
+  apdu[0] = (session < 4) ? session : (0x40 | (session - 4));
+  apdu[1] = 0xA4;
+  apdu[2] = 0x04;
+  apdu[3] = 0x00;
+  apdu[4] = hex.size() / 2;
+  _apdus++;
+  if (!_card->transmit(apdu, 5 + apdu[4], response, &responseLen) ||
+      ((response[responseLen - 2] != 0x90) && (response[responseLen - 2] != 0x61))) {
+    uint8_t close[] = {0x00, 0x70, 0x80, session};
+    _card->transmit(close, sizeof(close), response, &responseLen);
+    return "";
+  }
+
+  _sessions[session] = true;
+  return std::to_string(session);
+}
+
+bool ModemEmulator::closeChannel(const std::string& args) {
+  uint8_t response[256 + 2];
+  uint16_t responseLen;
+  unsigned long int session;
+  char* end;
+
+  session = strtoul(args.c_str(), &end, 10);
+  if ((*end != '\0') || (session == 0) || (session >= _sessions.size()) || !_sessions[session]) {
+    return false;
+  }
+
+  uint8_t close[]    = {0x00, 0x70, 0x80, (uint8_t)session};
+  _sessions[session] = false;
+  return _card->transmit(close, sizeof(close), response, &responseLen);
+}
+
+std::string ModemEmulator::answerApdu(const std::string& name, const std::string& args) {
+  uint8_t apdu[5 + 256 + 1];
+  uint8_t response[256 + 2];
+  uint16_t responseLen;
+  std::string hex;
+  unsigned long int session = 0;
+  unsigned long int len;
+  size_t quote;
+  char* end;
+
+  // [<sessionid>,]<length>,"<command>"
+  if (name == "CGLA") {
+    session = strtoul(args.c_str(), &end, 10);
+    if ((*end != ',') || (session >= _sessions.size()) || !_sessions[session]) {
+      return "";
+    }
+    len = strtoul(end + 1, &end, 10);
+  } else {
+    len = strtoul(args.c_str(), &end, 10);
+  }
+
+  quote = end - args.c_str();
+  if ((*end != ',') || (args.size() < quote + 3) || (args[quote + 1] != '"') || (args.back() != '"')) {
+    return "";
+  }
+  hex = args.substr(quote + 2, args.size() - quote - 3);
+  if ((hex.size() != len) || (len < 8) || (len > 2 * sizeof(apdu)) || !tob_hex_decode(hex.data(), len, apdu)) {
+    return "";
+  }
+
+  if (_config.simLatency > 0) {
+    std::this_thread::sleep_for(std::chrono::milliseconds(_config.simLatency));
+  }
+
+  _apdus++;
+  if (!_card->transmit(apdu, len / 2, response, &responseLen)) {
+    return "";
+  }
+
+  hex.resize(2 * responseLen);
+  tob_hex_encode(response, responseLen, &hex[0]);
+  return "+" + name + ": " + std::to_string(hex.size()) + ",\"" + hex + "\"";
+}
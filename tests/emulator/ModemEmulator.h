@@ -0,0 +1,166 @@
+/*
+ *
+ * Twilio Breakout Trust Onboard SDK
+ *
+ * Copyright (c) 2019 Twilio, Inc.
+ *
+ * SPDX-License-Identifier:  Apache-2.0
+ */
+
+#ifndef __MODEM_EMULATOR_H__
+#define __MODEM_EMULATOR_H__
+
+#include "SEInterface.h"
+
+#include <atomic>
+#include <map>
+#include <mutex>
+#include <string>
+#include <thread>
+#include <vector>
+
+// A modem on a pseudo-terminal, speaking the AT subset the SDK uses, for tests and benchmarks without hardware.
+// GenericModem, or anything else taking a serial device, opens getDevice() as it would /dev/ttyACM0.
+
+// Card the emulated modem forwards AT+CSIM and AT+CGLA to
+class CardBackend {
+ public:
+  virtual ~CardBackend(void) {
+  }
+
+  // Answer a command APDU, the response being data followed by the status word.
+  // Returns false in case the card could not be reached, the modem then answers +CME ERROR.
+  virtual bool transmit(const uint8_t* apdu, uint16_t apduLen, uint8_t* response, uint16_t* responseLen) = 0;
+};
+
+// Card holding transparent EFs in memory. Files are selected by path from the MF (SELECT P1=08), applets by AID, on
+// the basic channel and on channels opened by MANAGE CHANNEL.
+class MemoryCard : public CardBackend {
+ public:
+  // With t0, responses with data to case 4 commands go through 61xx and GET RESPONSE as on a T=0 UICC. Extended Lc
+  // and Le are turned down with 6700 unless extendedLength.
+  explicit MemoryCard(bool t0 = true, bool extendedLength = false);
+
+  // path is the file identifiers from the MF, e.g. {0x7F, 0xAA, 0x6F, 0x01}; SELECT finds it spelled in ASCII hex too
+  void addFile(const std::vector<uint8_t>& path, const std::vector<uint8_t>& content);
+  void addApplet(const std::vector<uint8_t>& aid);
+
+  bool transmit(const uint8_t* apdu, uint16_t apduLen, uint8_t* response, uint16_t* responseLen) override;
+
+ private:
+  struct Channel {
+    bool open;
+    const std::vector<uint8_t>* file;
+    std::vector<uint8_t> pending;
+  };
+
+  uint16_t answer(const uint8_t* apdu, uint16_t apduLen, Channel* channel, std::vector<uint8_t>* data);
+
+  bool _t0;
+  bool _extendedLength;
+  std::map<std::vector<uint8_t>, std::vector<uint8_t>> _files;
+  std::vector<std::vector<uint8_t>> _applets;
+  Channel _channels[20];
+};
+
+// Card reached through any SEInterface, e.g. a PC/SC or CCID reader with a real SIM in it. The interface must be
+// open, it stays owned by the caller.
+class SEInterfaceCard : public CardBackend {
+ public:
+  explicit SEInterfaceCard(SEInterface* seiface) : _seiface(seiface) {
+  }
+
+  bool transmit(const uint8_t* apdu, uint16_t apduLen, uint8_t* response, uint16_t* responseLen) override;
+
+ private:
+  SEInterface* _seiface;
+};
+
+struct ModemEmulatorConfig {
+  // Echo at power on, as modules leave the factory; ATE0 and ATE1 change it
+  bool echo = true;
+  // Throttle both directions to what a UART at this rate (8N1) carries, 0 for as fast as the pty goes. AT+IPR
+  // changes it, like a real link.
+  int baudrate = 0;
+  // Milliseconds the card takes for each APDU
+  int simLatency = 0;
+  // Answer AT+CCHO, AT+CGLA and AT+CCHC, ERROR otherwise
+  bool logicalChannels = true;
+  // Answers to AT+CGMI and AT+CGMM
+  std::string manufacturer = "Twilio";
+  std::string model        = "PTY Emulator";
+};
+
+class ModemEmulator {
+ public:
+  ModemEmulator(CardBackend* card, const ModemEmulatorConfig& config = ModemEmulatorConfig());
+  ~ModemEmulator(void);
+
+  // Create the pseudo-terminal and start answering on it.
+  // Returns true in case the modem is running, false otherwise.
+  bool start(void);
+  void stop(void);
+
+  // Path of the terminal to open, empty until started
+  const std::string& getDevice(void) {
+    return _device;
+  }
+
+  // Send line as an unsolicited result code, between two commands as a real modem does
+  void injectUrc(const std::string& line);
+
+  // Commands and APDUs answered, bytes from and to the host
+  unsigned long int getCommands(void) {
+    return _commands;
+  }
+
+  unsigned long int getApdus(void) {
+    return _apdus;
+  }
+
+  unsigned long int getBytesIn(void) {
+    return _bytesIn;
+  }
+
+  unsigned long int getBytesOut(void) {
+    return _bytesOut;
+  }
+
+ private:
+  void run(void);
+  void answer(const std::string& command);
+  // Answer the arguments of AT+CSIM or AT+CGLA, empty in case the command fails
+  std::string answerApdu(const std::string& name, const std::string& args);
+  // AT+CCHO and AT+CCHC
+  std::string openChannel(const std::string& args);
+  bool closeChannel(const std::string& args);
+  void write(const std::string& data);
+  void throttle(unsigned long int bytes);
+  void flushUrcs(void);
+
+  CardBackend* _card;
+  ModemEmulatorConfig _config;
+  int _master;
+  // Kept open so that the master does not see a hang up between two sessions of the host
+  int _slave;
+  // Wakes the thread up for injected URCs and stop()
+  int _wake[2];
+  std::string _device;
+  std::thread _thread;
+  std::atomic<bool> _running;
+
+  std::mutex _urcLock;
+  std::vector<std::string> _urcs;
+
+  bool _echo;
+  int _cmee;
+  int _baudrate;
+  std::vector<bool> _sessions;
+
+  std::atomic<unsigned long int> _commands;
+  std::atomic<unsigned long int> _apdus;
+  std::atomic<unsigned long int> _bytesIn;
+  std::atomic<unsigned long int> _bytesOut;
+};
+
+#endif /* __MODEM_EMULATOR_H__ */
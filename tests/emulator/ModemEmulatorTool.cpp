@@ -0,0 +1,218 @@
+/*
+ *
+ * Twilio Breakout Trust Onboard SDK
+ *
+ * Copyright (c) 2019 Twilio, Inc.
+ *
+ * SPDX-License-Identifier:  Apache-2.0
+ */
+
+// Standalone pseudo-terminal modem, for running the SDK tools and benchmarks without hardware:
+//
+//   tob_modem_emulator -b 115200 -l 20 -f 7FAA6F01=cert.der &
+//   trust_onboard_tool -d /dev/pts/N ...
+
+#include "Ccid.h"
+#include "HexCodec.h"
+#include "ModemEmulator.h"
+
+#ifdef PCSC_SUPPORT
+#include "Pcsc.h"
+#endif
+
+#include <cerrno>
+#include <csignal>
+#include <cstdio>
+#include <cstdlib>
+#include <cstring>
+#include <fstream>
+#include <iterator>
+#include <memory>
+
+#include <getopt.h>
+#include <unistd.h>
+
+static volatile sig_atomic_t stopRequested = 0;
+
+static void requestStop(int sig) {
+  stopRequested = 1;
+}
+
+static void print_usage(const char* program_name) {
+  fprintf(stderr, "%s [arguments]\n", program_name);
+  fprintf(stderr,
+          "\nPrints the pseudo-terminal to open, then answers AT commands on it until interrupted.\n\
+\n\
+Optional arguments:\n\
+  -b,--baudrate=<baudrate>      - throttle the link to a UART at this rate,\n\
+                                  unthrottled by default\n\
+  -l,--latency=<ms>             - time the card takes for each APDU\n\
+  -e,--no-echo                  - start with echo off (ATE0)\n\
+  -n,--no-logical-channels      - answer ERROR to AT+CCHO, AT+CGLA, AT+CCHC\n\
+  -c,--card=<device>            - forward APDUs to a real card, ccid:VID:PID\n\
+                                  or pcsc:N if built with PC/SC support;\n\
+                                  an in-memory card is used otherwise\n\
+  -f,--file=<path>=<file>       - add an EF to the in-memory card, path being\n\
+                                  the hex file identifiers from the MF\n\
+  -a,--applet=<aid>             - add an applet to the in-memory card\n\
+  -u,--urc=<line>               - send line as a URC every --urc-interval\n\
+  -i,--urc-interval=<ms>        - defaults to 1000\n\
+  -s,--symlink=<path>           - also make the terminal available as path\n\
+\n\
+Example:\n");
+  fprintf(stderr, "\n%s -b 115200 -l 20 -f 7FAA6F01=cert.der -u \"+CREG: 1\"\n", program_name);
+}
+
+static bool hexArgument(const char* hex, std::vector<uint8_t>* bytes) {
+  size_t len = strlen(hex);
+
+  bytes->resize(len / 2);
+  return (len > 0) && tob_hex_decode(hex, len, bytes->data());
+}
+
+int main(int argc, char** argv) {
+  ModemEmulatorConfig config;
+  std::unique_ptr<MemoryCard> memory(new MemoryCard());
+  std::unique_ptr<SEInterface> reader;
+  std::unique_ptr<SEInterfaceCard> forward;
+  CardBackend* card       = memory.get();
+  const char* cardDevice  = nullptr;
+  const char* urc         = nullptr;
+  const char* symlinkPath = nullptr;
+  int urcInterval         = 1000;
+  std::vector<uint8_t> bytes;
+  const char* sep;
+
+  static struct option options[] = {{"baudrate", required_argument, NULL, 'b'},
+                                    {"latency", required_argument, NULL, 'l'},
+                                    {"no-echo", no_argument, NULL, 'e'},
+                                    {"no-logical-channels", no_argument, NULL, 'n'},
+                                    {"card", required_argument, NULL, 'c'},
+                                    {"file", required_argument, NULL, 'f'},
+                                    {"applet", required_argument, NULL, 'a'},
+                                    {"urc", required_argument, NULL, 'u'},
+                                    {"urc-interval", required_argument, NULL, 'i'},
+                                    {"symlink", required_argument, NULL, 's'},
+                                    {NULL, 0, NULL, 0}};
+
+  int opt;
+  while ((opt = getopt_long(argc, argv, "b:l:enc:f:a:u:i:s:", options, NULL)) != -1) {
+    switch (opt) {
+      case 'b':
+        config.baudrate = atoi(optarg);
+        break;
+      case 'l':
+        config.simLatency = atoi(optarg);
+        break;
+      case 'e':
+        config.echo = false;
+        break;
+      case 'n':
+        config.logicalChannels = false;
+        break;
+      case 'c':
+        cardDevice = optarg;
+        break;
+      case 'f': {
+        if (((sep = strchr(optarg, '=')) == nullptr) ||
+            !hexArgument(std::string(optarg, sep - optarg).c_str(), &bytes)) {
+          fprintf(stderr, "Invalid file: %s\n", optarg);
+          print_usage(argv[0]);
+          return 1;
+        }
+        std::ifstream file(sep + 1, std::ios::binary);
+        if (!file) {
+          fprintf(stderr, "Cannot read %s\n", sep + 1);
+          return 1;
+        }
+        memory->addFile(bytes, std::vector<uint8_t>(std::istreambuf_iterator<char>(file), {}));
+        break;
+      }
+      case 'a':
+        if (!hexArgument(optarg, &bytes)) {
+          fprintf(stderr, "Invalid AID: %s\n", optarg);
+          print_usage(argv[0]);
+          return 1;
+        }
+        memory->addApplet(bytes);
+        break;
+      case 'u':
+        urc = optarg;
+        break;
+      case 'i':
+        urcInterval = atoi(optarg);
+        break;
+      case 's':
+        symlinkPath = optarg;
+        break;
+      default:
+        print_usage(argv[0]);
+        return 1;
+    }
+  }
+
+  if (cardDevice != nullptr) {
+    uint16_t vendor;
+    uint16_t product;
+    const char* serial;
+
+    if ((strncmp(cardDevice, "ccid:", 5) == 0) &&
+        CcidSEInterface::parseDevice(cardDevice + 5, &vendor, &product, &serial)) {
+      reader.reset(new CcidSEInterface(vendor, product, serial));
+#ifdef PCSC_SUPPORT
+    } else if (strncmp(cardDevice, "pcsc:", 5) == 0) {
+      reader.reset(new PcscSEInterface((int)strtol(cardDevice + 5, nullptr, 10)));
+#endif
+    } else {
+      fprintf(stderr, "Invalid card: %s\n", cardDevice);
+      print_usage(argv[0]);
+      return 1;
+    }
+
+    if (!reader->open()) {
+      fprintf(stderr, "Cannot open card %s\n", cardDevice);
+      return 1;
+    }
+    forward.reset(new SEInterfaceCard(reader.get()));
+    card = forward.get();
+  }
+
+  ModemEmulator modem(card, config);
+  if (!modem.start()) {
+    fprintf(stderr, "Cannot create a pseudo-terminal\n");
+    return 1;
+  }
+
+  if ((symlinkPath != nullptr) && ((unlink(symlinkPath) != 0) && (errno != ENOENT))) {
+    perror(symlinkPath);
+  }
+  if ((symlinkPath != nullptr) && (symlink(modem.getDevice().c_str(), symlinkPath) != 0)) {
+    perror(symlinkPath);
+  }
+
+  printf("%s\n", modem.getDevice().c_str());
+  fflush(stdout);
+
+  signal(SIGINT, requestStop);
+  signal(SIGTERM, requestStop);
+
+  // Signals cut the sleep short
+  while (!stopRequested) {
+    usleep(((urc != nullptr) ? urcInterval : 1000) * 1000);
+    if ((urc != nullptr) && !stopRequested) {
+      modem.injectUrc(urc);
+    }
+  }
+
+  modem.stop();
+  if (symlinkPath != nullptr) {
+    unlink(symlinkPath);
+  }
+  if (reader) {
+    reader->close();
+  }
+
+  fprintf(stderr, "%lu commands, %lu APDUs, %lu bytes in, %lu bytes out\n", modem.getCommands(), modem.getApdus(),
+          modem.getBytesIn(), modem.getBytesOut());
+  return 0;
+}
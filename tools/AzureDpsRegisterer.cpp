@@ -1,5 +1,6 @@
 #include <stdlib.h>
 #include <stdio.h>
+#include <string.h>
 
 #include <getopt.h>
 
@@ -97,8 +98,8 @@ void print_usage(const char* program_name) {
   -a,--azure-scope=<scope>          - Azure ID scope\n\
 \n\
 Optional arguments:\n\
-  -b,--baudrate=<baudrate>          - baud rate for a serial device. Defaults to\n\
-                                      115200\n\
+  -b,--baudrate=<baudrate>          - baud rate for a serial device or \"auto\" to\n\
+                                      negotiate the fastest one. Defaults to 115200\n\
   -v,--verbose                      - enable verbose (tracing) output\n\
 \n\
 Examples:\n");
@@ -134,6 +135,10 @@ int main(int argc, char **argv) {
         device = optarg;
         break;
       case 'b': {
+        if (strcmp(optarg, "auto") == 0) {
+          baudrate = TOB_BAUDRATE_AUTO;
+          break;
+        }
         long long_baudrate = strtol(optarg, NULL, 10);
         if (long_baudrate < 0 || long_baudrate >= MAX_BAUDRATE) {
           fprintf(stderr, "Invalid baudrate: %s\n", optarg);
@@ -19,7 +19,7 @@ static const ENGINE_CMD_DEFN engine_cmd_defns[] = {
     {CMD_PIN, "PIN", "Card's PIN code", ENGINE_CMD_FLAG_STRING},
     {CMD_MODEM_DEVICE, "MODEM_DEVICE",
      "Device, used to connect to Trust Onboard SIM. Either '/dev/<serial_device>' or 'pcsc:N'", ENGINE_CMD_FLAG_STRING},
-    {CMD_MODEM_BAUDRATE, "MODEM_BAUDRATE", "Baudrate for a serial interface", ENGINE_CMD_FLAG_NUMERIC},
+    {CMD_MODEM_BAUDRATE, "MODEM_BAUDRATE", "Baudrate for a serial interface, 0 to negotiate", ENGINE_CMD_FLAG_NUMERIC},
     {CMD_LOAD_CERT_CTRL, "LOAD_CERT_CTRL", "Load public certificate from engine", ENGINE_CMD_FLAG_STRING},
     {0, NULL, NULL, 0}};
 
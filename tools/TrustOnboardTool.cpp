@@ -8,7 +8,9 @@
  */
 
 #include <stdio.h>
+#include <string.h>
 #include <unistd.h>
+#include <iostream>
 #include <getopt.h>
 
 // nlohmann's single-header implementation
@@ -67,21 +69,28 @@ void print_usage(const char* program_name) {
   fprintf(stderr,
           "\nRequired arguments:\n\
   -d,--device=<device>          - device to connect to a SIM, can be either a\n\
-                                  char device under /dev or of form pcsc:N if\n\
-				  built with PC/SC interface support\n\
+                                  char device under /dev, the same prefixed\n\
+                                  with cmux: to multiplex it, a QMI device as\n\
+                                  qmi:/dev/cdc-wdmN, a USB reader as\n\
+                                  ccid:VID:PID[:serial], of form pcsc:N if\n\
+				  built with PC/SC interface support, or auto\n\
+                                  to find the SIM on any port or reader\n\
   -p,--pin=<pin>                - PIN code for the mIAS applet on your SIM card\n\
 \n\
 Optional arguments:\n\
-  -b,--baudrate=<baudrate>      - baud rate for a serial device. Defaults to\n\
-                                  115200\n\
+  -b,--baudrate=<baudrate>      - baud rate for a serial device or \"auto\" to\n\
+                                  negotiate the fastest one. Defaults to 115200\n\
   -a,--available-cert=<cert>    - path to store the available certificate\n\
   -k,--available-key=<key>      - path to store the available private key\n\
   -s,--signing-cert=<cert>      - path to store the signing certifiate\n\
   -j,--json                     - print everything as a json object\n\
+  -c,--calibrate                - time the link, tune the chunk sizes used\n\
+                                  for this device from now on and exit\n\
 \n\
 Examples:\n");
   fprintf(stderr, "\n%s -d /dev/ttyACM1 -p 0000 -a certificate.pem -k key.pem\n", program_name);
   fprintf(stderr, "\n%s -d /dev/ttyUSB0 -b 9600 -p 0000 -s signing-certificate.pem\n", program_name);
+  fprintf(stderr, "\n%s -d /dev/ttyACM1 -p 0000 --calibrate\n", program_name);
 #ifdef PCSC_SUPPORT
   fprintf(stderr, "\n%s --device=pcsc:0 --pin=0000 --available-cert=certificate.pem --available-key=key.pem\n",
           program_name);
@@ -110,6 +119,7 @@ int main(int argc, char** argv) {
   char* pk_path           = nullptr;
   char* signing_cert_path = nullptr;
   bool print_json         = false;
+  bool calibrate          = false;
 
   static struct option options[] = {{"device", required_argument, NULL, 'd'},
                                     {"baudrate", required_argument, NULL, 'b'},
@@ -118,15 +128,20 @@ int main(int argc, char** argv) {
                                     {"available-key", required_argument, NULL, 'k'},
                                     {"signing-cert", required_argument, NULL, 's'},
                                     {"json", no_argument, NULL, 'j'},
+                                    {"calibrate", no_argument, NULL, 'c'},
                                     {NULL, 0, NULL, 0}};
 
   int opt;
-  while ((opt = getopt_long(argc, argv, "d:b:p:a:k:s:j", options, NULL)) != -1) {
+  while ((opt = getopt_long(argc, argv, "d:b:p:a:k:s:jc", options, NULL)) != -1) {
     switch (opt) {
       case 'd':
         device = optarg;
         break;
       case 'b': {
+        if (strcmp(optarg, "auto") == 0) {
+          baudrate = TOB_BAUDRATE_AUTO;
+          break;
+        }
         long long_baudrate = strtol(optarg, nullptr, 10);
         if (long_baudrate < 0 || long_baudrate >= MAX_BAUDRATE) {
           fprintf(stderr, "Invalid baudrate: %s\n", optarg);
@@ -151,6 +166,9 @@ int main(int argc, char** argv) {
       case 'j':
         print_json = true;
         break;
+      case 'c':
+        calibrate = true;
+        break;
       default:
         fprintf(stderr, "Invalid option: %c\n", opt);
         print_usage(argv[0]);
@@ -172,6 +190,36 @@ int main(int argc, char** argv) {
   }
 
   tobInitialize(device, baudrate);
+  if (baudrate == TOB_BAUDRATE_AUTO) {
+    fprintf(stderr, "Link running at %d baud\n", tobGetBaudrate());
+  }
+
+  if (calibrate) {
+    tob_calibration_t calibration;
+
+    if (tobCalibrate(pin, &calibration) != 0) {
+      fprintf(stderr, "Error calibrating the link\n");
+      return 1;
+    }
+
+    if (print_json) {
+      nlohmann::json j;
+      j["command_us"] = calibration.command_us;
+      j["byte_us"]    = calibration.byte_us;
+      j["read_chunk"] = calibration.read_chunk;
+      j["hash_chunk"] = calibration.hash_chunk;
+      std::cout << j.dump() << std::endl;
+    } else {
+      printf("Per command: %.0f us, per byte: %.1f us\n", calibration.command_us, calibration.byte_us);
+      printf("READ BINARY chunk: %d bytes\n", calibration.read_chunk);
+      if (calibration.hash_chunk != 0) {
+        printf("PSO HASH chunk: %d bytes\n", calibration.hash_chunk);
+      } else {
+        printf("PSO HASH chunk: one hash block\n");
+      }
+    }
+    return 0;
+  }
 
   ret = tobExtractAvailableCertificate(NULL, &cert_size, pin);
   if (ret != 0) {